@@ -0,0 +1,205 @@
+/******************************************************************************
+Meridian prototype distribution
+Copyright (C) 2005 Bernard Wong
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+The copyright owner can be contacted by e-mail at bwong@cs.cornell.edu
+*******************************************************************************/
+
+//	Measures closest node query throughput of a local Meridian node run
+//	with 1 to N workers. Client threads keep a window of v2 encoded
+//	REQ_CLOSEST_N_MERID_PING queries outstanding, each naming the node
+//	itself as the target, so every query is answered from the ping cache
+//	after the first and the run measures packet handling, not the network.
+//	The client threads need cores of their own, on a machine with fewer
+//	cores than workers plus clients the numbers do not scale
+
+using namespace std;
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include "Marshal.h"
+#include "MeridianProcess.h"
+#include "meridian.h"
+
+#define BENCH_PORT				3990
+#define DEFAULT_RUN_S			3
+#define DEFAULT_CLIENTS			2
+#define WARMUP_MS				500
+//	Queries each client keeps outstanding
+#define CLIENT_WINDOW			64
+//	A window with no answer for this long is considered lost
+#define CLIENT_LOSS_MS			100
+
+typedef struct {
+	uint16_t		port;			// Of the Meridian node
+	struct timeval	start;			// Counting starts here
+	struct timeval	end;
+	uint64_t		numDone;
+	uint64_t		numLost;
+} ClientArg;
+
+static double elapsedMS(const struct timeval& from, const struct timeval& to) {
+	return (to.tv_sec - from.tv_sec) * 1000.0 +
+		(to.tv_usec - from.tv_usec) / 1000.0;
+}
+
+static int sendQuery(int sock, uint16_t port, unsigned int* seed) {
+	uint64_t qid = ((uint64_t)rand_r(seed) << 32) | rand_r(seed);
+	ReqClosestMeridPing req(qid, 1, 2, 0, 0);
+	NodeIdent self = {INADDR_LOOPBACK, port};
+	req.addTarget(self);
+	RealPacket outPacket(self);
+	outPacket.setWireVersion(WIRE_VERSION_2);
+	if (req.createRealPacket(outPacket) == -1) {
+		return -1;
+	}
+	return MeridianProcess::performSend(sock, &outPacket);
+}
+
+static void* clientMain(void* in_arg) {
+	ClientArg* arg = (ClientArg*)in_arg;
+	int sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock == -1) {
+		perror("socket");
+		return NULL;
+	}
+	unsigned int seed = time(NULL) ^ (uintptr_t)in_arg;
+	char buf[MAX_UDP_PACKET_SIZE];
+	u_int outstanding = 0;
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	while (elapsedMS(now, arg->end) > 0) {
+		while (outstanding < CLIENT_WINDOW) {
+			if (sendQuery(sock, arg->port, &seed) == -1) {
+				break;
+			}
+			outstanding++;
+		}
+		struct pollfd pfd = {sock, POLLIN, 0};
+		int pollRet = poll(&pfd, 1, CLIENT_LOSS_MS);
+		gettimeofday(&now, NULL);
+		bool counting = elapsedMS(arg->start, now) >= 0;
+		if (pollRet == 0) {
+			if (counting) {
+				arg->numLost += outstanding;
+			}
+			outstanding = 0;
+			continue;
+		}
+		int numBytes;
+		while ((numBytes = recv(sock, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+			BufferWrapper rb(buf, numBytes);
+			char queryType;	uint64_t queryID;
+			if (Packet::parseHeader(rb, &queryType, &queryID) == -1) {
+				continue;
+			}
+			//	RET_INFO only reports progress
+			if (queryType == RET_RESPONSE || queryType == RET_ERROR) {
+				if (outstanding > 0) {
+					outstanding--;
+				}
+				if (counting && elapsedMS(now, arg->end) > 0) {
+					arg->numDone++;
+				}
+			}
+		}
+	}
+	close(sock);
+	return NULL;
+}
+
+//	Returns queries per second, or -1 on error
+static double runBench(u_int numWorkers, u_int numClients, u_int runS,
+		uint64_t* numLost) {
+	uint16_t port = BENCH_PORT + numWorkers;
+	meridian node(port, 0, 4, 4, 2);
+	node.setNumWorkers(numWorkers);
+	node.setGossipInterval(3600, 1, 3600);	// No seeds, keep it quiet
+	fflush(stdout);		// Or the node prints it again when it exits
+	if (node.start() == -1) {
+		return -1;
+	}
+	usleep(200000);	// Let the workers bind
+	vector<ClientArg> args(numClients);
+	vector<pthread_t> threads(numClients);
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	for (u_int i = 0; i < numClients; i++) {
+		memset(&(args[i]), 0, sizeof(ClientArg));
+		args[i].port = port;
+		args[i].start = now;
+		args[i].start.tv_usec += WARMUP_MS * MICRO_IN_MILLI;
+		args[i].start.tv_sec += args[i].start.tv_usec / MICRO_IN_SECOND;
+		args[i].start.tv_usec %= MICRO_IN_SECOND;
+		args[i].end = args[i].start;
+		args[i].end.tv_sec += runS;
+		pthread_create(&(threads[i]), NULL, clientMain, &(args[i]));
+	}
+	uint64_t numDone = 0;
+	*numLost = 0;
+	for (u_int i = 0; i < numClients; i++) {
+		pthread_join(threads[i], NULL);
+		numDone += args[i].numDone;
+		*numLost += args[i].numLost;
+	}
+	node.stop();
+	return (double)numDone / runS;
+}
+
+int main(int argc, char* argv[]) {
+	long numCPU = sysconf(_SC_NPROCESSORS_ONLN);
+	u_int maxWorkers = (numCPU > 0) ? numCPU : 1;
+	u_int numClients = DEFAULT_CLIENTS;
+	u_int runS = DEFAULT_RUN_S;
+	if (argc > 1) maxWorkers = atoi(argv[1]);
+	if (argc > 2) numClients = atoi(argv[2]);
+	if (argc > 3) runS = atoi(argv[3]);
+	if (argc > 4 || maxWorkers == 0 || numClients == 0 || runS == 0) {
+		fprintf(stderr, "Usage: %s [max_workers] [clients] [seconds]\n",
+			argv[0]);
+		return -1;
+	}
+	printf("%ld CPUs, %u client threads, %u queries outstanding each, "
+		"%u s per run\n", numCPU, numClients, CLIENT_WINDOW, runS);
+	printf("workers    queries/s  speedup    lost\n");
+	double base = 0;
+	for (u_int n = 1; n <= maxWorkers; n = (n < maxWorkers && n * 2 >
+			maxWorkers) ? maxWorkers : n * 2) {
+		uint64_t numLost = 0;
+		double qps = runBench(n, numClients, runS, &numLost);
+		if (qps < 0) {
+			printf("%7u  cannot start node\n", n);
+			continue;
+		}
+		if (n == 1) {
+			base = qps;
+		}
+		printf("%7u %12.0f %7.2fx %7llu\n", n, qps,
+			(base > 0) ? qps / base : 0.0, (unsigned long long)numLost);
+	}
+	return 0;
+}
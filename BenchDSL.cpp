@@ -0,0 +1,559 @@
+/******************************************************************************
+Meridian prototype distribution
+Copyright (C) 2005 Bernard Wong
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+The copyright owner can be contacted by e-mail at bwong@cs.cornell.edu
+*******************************************************************************/
+
+//	Runs DSL programs under the tree walker and as compiled functions on the
+//	register VM, with the same fiber scheduling as demoMQL. Besides a few
+//	local programs it runs one hop of closestNode.b repeatedly, with the
+//	ring and measurement natives answered from a synthetic latency space.
+//	Measurements block the fiber once, as they do in a Meridian node.
+//	Last, it compares the setup of a request sent with the program text to
+//	one sent by hash and found in the program cache, and the cost of a
+//	thread switch.
+//
+//	Usage: benchDSL [closestNode.b]
+
+using namespace std;
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <ucontext.h>
+#include <sys/time.h>
+#include <string>
+#include "Marshal.h"
+#include "MQLState.h"
+#include "MeridianDSL.h"
+#include "ProgramCache.h"
+
+#define EVAL_SLICE		10000	// Same budget as the schedulers
+#define RING_MEMBERS	32
+#define RING_BASE_ADDR	100
+
+static const char* loopProgram =
+	"int work(int n) {\n"
+	"	int s = 0;\n"
+	"	for (int i = 0; i < n; i = i + 1) {\n"
+	"		if (i % 3 == 0) {\n"
+	"			continue;\n"
+	"		}\n"
+	"		s = (s + i * 7) % 10007;\n"
+	"	}\n"
+	"	return s;\n"
+	"}\n"
+	"int main() {\n"
+	"	int t = 0;\n"
+	"	for (int r = 0; r < 500; r = r + 1) {\n"
+	"		t = (t + work(2000)) % 10007;\n"
+	"	}\n"
+	"	return t;\n"
+	"}\n";
+
+static const char* fibProgram =
+	"int fib(int n) {\n"
+	"	if (n < 2) {\n"
+	"		return n;\n"
+	"	}\n"
+	"	return fib(n - 1) + fib(n - 2);\n"
+	"}\n"
+	"int main() {\n"
+	"	return fib(20);\n"
+	"}\n";
+
+static const char* arrayProgram =
+	"int[] fill(int n, int seed) {\n"
+	"	int a[0];\n"
+	"	int x = seed;\n"
+	"	for (int i = 0; i < n; i = i + 1) {\n"
+	"		x = (x * 1103 + 12345) % 65536;\n"
+	"		push_back(a, x);\n"
+	"	}\n"
+	"	return a;\n"
+	"}\n"
+	"int sorted(int n, int seed) {\n"
+	"	int a[] = fill(n, seed);\n"
+	"	for (int i = 0; i < n; i = i + 1) {\n"
+	"		for (int j = 0; j < n - 1 - i; j = j + 1) {\n"
+	"			if (a[j] > a[j + 1]) {\n"
+	"				int t = a[j];\n"
+	"				a[j] = a[j + 1];\n"
+	"				a[j + 1] = t;\n"
+	"			}\n"
+	"		}\n"
+	"	}\n"
+	"	return a[n / 2];\n"
+	"}\n"
+	"int main() {\n"
+	"	int t = 0;\n"
+	"	for (int r = 0; r < 100; r = r + 1) {\n"
+	"		t = (t + sorted(60, r)) % 65536;\n"
+	"	}\n"
+	"	return t;\n"
+	"}\n";
+
+static const char* structProgram =
+	"struct Pt {\n"
+	"	double x;\n"
+	"	double y;\n"
+	"};\n"
+	"double dist(Pt a, Pt b) {\n"
+	"	double dx = a.x - b.x;\n"
+	"	double dy = a.y - b.y;\n"
+	"	return pow(dx * dx + dy * dy, 0.5);\n"
+	"}\n"
+	"double nearest(int n) {\n"
+	"	Pt pts[n];\n"
+	"	for (int i = 0; i < n; i = i + 1) {\n"
+	"		pts[i].x = dbl(i % 17);\n"
+	"		pts[i].y = dbl(i % 13);\n"
+	"	}\n"
+	"	Pt q = {3.5, 4.5};\n"
+	"	double best = 1000000.0;\n"
+	"	for (int i = 0; i < n; i = i + 1) {\n"
+	"		double d = dist(pts[i], q);\n"
+	"		if (d < best) {\n"
+	"			best = d;\n"
+	"		}\n"
+	"	}\n"
+	"	return best;\n"
+	"}\n"
+	"int main() {\n"
+	"	double t = 0.0;\n"
+	"	for (int r = 0; r < 300; r = r + 1) {\n"
+	"		t = t + nearest(50);\n"
+	"	}\n"
+	"	return round(t * 100.0);\n"
+	"}\n";
+
+//	Appended to closestNode.b, runs closest() as the first hop would
+static const char* closestDriver =
+	"\n"
+	"int benchHop() {\n"
+	"	Node t1 = {1, 80, 0, 0};\n"
+	"	Node t2 = {2, 80, 0, 0};\n"
+	"	Node ts[] = {t1, t2};\n"
+	"	int found = 0;\n"
+	"	for (int r = 0; r < 200; r = r + 1) {\n"
+	"		Measurement m = closest(0.5, ts);\n"
+	"		found = (found + m.addr) % 65536;\n"
+	"	}\n"
+	"	return found;\n"
+	"}\n";
+
+//	Synthetic one way latency in us between two addresses, 0 is this node
+static uint32_t latencyUS(uint32_t src, uint32_t dst) {
+	uint32_t h = (src * 2654435761U) ^ (dst * 40503U);
+	h ^= h >> 13;
+	return h % 150000 + 5000;
+}
+
+static double elapsedUS(const struct timeval& start) {
+	struct timeval end;
+	gettimeofday(&end, NULL);
+	return (end.tv_sec - start.tv_sec) * 1000000.0 +
+		(end.tv_usec - start.tv_usec);
+}
+
+//	Gives the scheduler a turn, as a measurement in progress would
+static void blockOnce(ParserState* ps) {
+	ps->set_parser_state(PS_BLOCKED);
+	fiber_switch(ps->get_context(), &global_env_thread);
+}
+
+ASTNode* handleDNSLookup(
+		ParserState* cur_parser, ASTNode* cur_node, int recurse_count) {
+	DSL_ERROR("dns_lookup not available in benchmark\n");
+	return cur_parser->empty_token();
+}
+
+ASTNode* handleGetSelf(ParserState* cur_parser) {
+	NodeIdentRendv self = {0, 0, 0, 0};
+	return createNodeIdent(cur_parser, self);
+}
+
+//	Ring members whose latency is at least (or at most) the bound in ms
+static ASTNode* ringRange(ParserState* cur_parser, ASTNode* cur_node,
+		int recurse_count, bool lower, bool equal) {
+	ASTNode* nextNode = eval(cur_parser,
+		cur_node->val.n_val.n_param_1, recurse_count + 1);
+	if (nextNode->type != DOUBLE_TYPE) {
+		DSL_ERROR("Double type expected\n");
+		return cur_parser->empty_token();
+	}
+	double boundUS = nextNode->val.d_val * 1000.0;
+	string adtName = "Node";
+	ASTNode* newArray
+		= ASTCreate(cur_parser, ARRAY_TYPE, &adtName, ADT_TYPE, 0);
+	if (newArray->type == EMPTY_TYPE) {
+		return cur_parser->empty_token();
+	}
+	for (uint32_t addr = RING_BASE_ADDR;
+			addr < RING_BASE_ADDR + RING_MEMBERS; addr++) {
+		double lat = latencyUS(0, addr);
+		bool inRange = lower ? (equal ? lat >= boundUS : lat > boundUS) :
+			(equal ? lat <= boundUS : lat < boundUS);
+		if (!inRange) {
+			continue;
+		}
+		NodeIdentRendv member = {addr, MERIDIAN_DSL_PORT, 0, 0};
+		ASTNode* newNodeIdent = createNodeIdent(cur_parser, member);
+		if (newNodeIdent->type == EMPTY_TYPE) {
+			return cur_parser->empty_token();
+		}
+		newArray->val.a_val.a_vector->push_back(newNodeIdent);
+	}
+	return newArray;
+}
+
+ASTNode* handleRingGT(
+		ParserState* cur_parser, ASTNode* cur_node, int recurse_count) {
+	return ringRange(cur_parser, cur_node, recurse_count, true, false);
+}
+
+ASTNode* handleRingGE(
+		ParserState* cur_parser, ASTNode* cur_node, int recurse_count) {
+	return ringRange(cur_parser, cur_node, recurse_count, true, true);
+}
+
+ASTNode* handleRingLT(
+		ParserState* cur_parser, ASTNode* cur_node, int recurse_count) {
+	return ringRange(cur_parser, cur_node, recurse_count, false, false);
+}
+
+ASTNode* handleRingLE(
+		ParserState* cur_parser, ASTNode* cur_node, int recurse_count) {
+	return ringRange(cur_parser, cur_node, recurse_count, false, true);
+}
+
+//	Fills a Measurement of src to every target
+static ASTNode* measure(ParserState* cur_parser,
+		const NodeIdentRendv& src, const vector<NodeIdentRendv>& targets) {
+	vector<uint32_t> lat_us;
+	for (u_int i = 0; i < targets.size(); i++) {
+		lat_us.push_back(latencyUS(src.addr, targets[i].addr));
+	}
+	return createNodeIdentLat(cur_parser, src,
+		lat_us.empty() ? NULL : &(lat_us[0]), lat_us.size());
+}
+
+ASTNode* handleGetDistTCP(
+		ParserState* cur_parser, ASTNode* cur_node, int recurse_count) {
+	ASTNode* nextNode_1 = cur_parser->empty_token();
+	if (cur_node->val.n_val.n_param_1->type != EMPTY_TYPE) {
+		nextNode_1 = eval(cur_parser,
+			cur_node->val.n_val.n_param_1, recurse_count + 1);
+		if (nextNode_1->type != ARRAY_TYPE) {
+			DSL_ERROR("Unexpected type encountered\n");
+			return cur_parser->empty_token();
+		}
+	}
+	ASTNode* nextNode_2 = eval(cur_parser,
+		cur_node->val.n_val.n_param_2, recurse_count + 1);
+	if (nextNode_2->type != ARRAY_TYPE) {
+		DSL_ERROR("Unexpected type encountered\n");
+		return cur_parser->empty_token();
+	}
+	vector<NodeIdentRendv> targets;
+	for (u_int i = 0; i < nextNode_2->val.a_val.a_vector->size(); i++) {
+		NodeIdentRendv tmpIdentRendv;
+		if (createNodeIdent((*(nextNode_2->val.a_val.a_vector))[i],
+				&tmpIdentRendv) == -1) {
+			return cur_parser->empty_token();
+		}
+		targets.push_back(tmpIdentRendv);
+	}
+	blockOnce(cur_parser);
+	if (nextNode_1->type == EMPTY_TYPE) {
+		NodeIdentRendv self = {0, 0, 0, 0};
+		return measure(cur_parser, self, targets);
+	}
+	string adtName = "Measurement";
+	ASTNode* newArray
+		= ASTCreate(cur_parser, ARRAY_TYPE, &adtName, ADT_TYPE, 0);
+	if (newArray->type == EMPTY_TYPE) {
+		return cur_parser->empty_token();
+	}
+	for (u_int i = 0; i < nextNode_1->val.a_val.a_vector->size(); i++) {
+		NodeIdentRendv src;
+		if (createNodeIdent((*(nextNode_1->val.a_val.a_vector))[i],
+				&src) == -1) {
+			return cur_parser->empty_token();
+		}
+		ASTNode* m = measure(cur_parser, src, targets);
+		if (m->type == EMPTY_TYPE) {
+			return cur_parser->empty_token();
+		}
+		newArray->val.a_val.a_vector->push_back(m);
+	}
+	return newArray;
+}
+
+ASTNode* handleGetDistDNS(
+		ParserState* cur_parser, ASTNode* cur_node, int recurse_count) {
+	return handleGetDistTCP(cur_parser, cur_node, recurse_count);
+}
+
+ASTNode* handleGetDistPing(
+		ParserState* cur_parser, ASTNode* cur_node, int recurse_count) {
+	return handleGetDistTCP(cur_parser, cur_node, recurse_count);
+}
+
+#ifdef PLANET_LAB_SUPPORT
+ASTNode* handleGetDistICMP(
+		ParserState* cur_parser, ASTNode* cur_node, int recurse_count) {
+	return handleGetDistTCP(cur_parser, cur_node, recurse_count);
+}
+#endif
+
+//	The next hop answers with itself, at the latency to the first target
+ASTNode* handleRPC(ParserState* ps,
+		const NodeIdentRendv& dest, string* func_name, ASTNode* paramAST) {
+	blockOnce(ps);
+	uint32_t lat_us = latencyUS(dest.addr, 1);
+	return createNodeIdentLat(ps, dest, &lat_us, 1);
+}
+
+void FloatingPointError(int sig_num) {
+	if (sig_num == SIGFPE) {
+		DSL_ERROR("Floating point error\n");
+		signal(SIGFPE, FloatingPointError);
+		fiber_escape(SIGFPE, &global_env_thread);
+	}
+}
+
+typedef struct {
+	double		parseUS;
+	double		runUS;
+	int			result;
+	u_int		numCompiled;
+	u_int		numFailed;
+	u_int		numInstrs;
+} RunStats;
+
+//	Parses, or looks up in cache if not NULL, and runs func of the program
+//	to completion. Returns -1 if the program could not be parsed or did not
+//	finish
+static int runProgram(const string& source, const char* func,
+		bool bytecode, ProgramCache* cache, RunStats* stats) {
+	ParserState* ps = new ParserState();
+	ps->set_bytecode(bytecode);
+	if (ps->input_buffer.create_buffer(source.size()) == -1) {
+		delete ps;
+		return -1;
+	}
+	memcpy(ps->input_buffer.get_raw_buf(), source.data(), source.size());
+	ps->set_func_string(func);
+	g_parser_line = 1;
+	struct timeval start;
+	gettimeofday(&start, NULL);
+	int parsed = (cache != NULL) ? cache->attach(ps) : yyparse((void*)ps);
+	if (parsed == -1 || ps->save_context(&jmp_eval) == -1) {
+		delete ps;
+		return -1;
+	}
+	stats->parseUS = elapsedUS(start);
+	int ret = 0;
+	gettimeofday(&start, NULL);
+	while (true) {
+		ps->allocateEvalCount(EVAL_SLICE);
+		fiber_switch(&global_env_thread, ps->get_context());
+		if (ps->parser_state() == PS_DONE) {
+			break;
+		}
+		if (ps->parser_state() == PS_RUNNING) {
+			DSL_ERROR("Exception occurred, exiting thread\n");
+			ret = -1;
+			break;
+		}
+		//	Ready or blocked on a measurement, which completes right away
+	}
+	stats->runUS = elapsedUS(start);
+	ASTNode* retNode = ps->getQueryReturn();
+	stats->result = (retNode != NULL && retNode->type == INT_TYPE) ?
+		retNode->val.i_val : -1;
+	stats->numCompiled = ps->get_program()->getNumCompiled();
+	stats->numFailed = ps->get_program()->getNumFailed();
+	stats->numInstrs = ps->get_program()->getNumInstrs();
+	delete ps;
+	return ret;
+}
+
+static void benchProgram(const char* name, const string& source,
+		const char* func) {
+	RunStats walker, compiled;
+	if (runProgram(source, func, false, NULL, &walker) == -1 ||
+			runProgram(source, func, true, NULL, &compiled) == -1) {
+		printf("%-10s failed\n", name);
+		return;
+	}
+	printf("%-10s %10.0f us %10.0f us %7.2fx %8.0f us %4u %4u %6u %6d %s\n",
+		name, walker.runUS, compiled.runUS, walker.runUS / compiled.runUS,
+		compiled.parseUS, compiled.numCompiled, compiled.numFailed,
+		compiled.numInstrs, compiled.result,
+		(walker.result == compiled.result) ? "ok" : "MISMATCH");
+}
+
+//	Request setup cost on the receiving node, from the DSL_REQUEST payload
+//	to a runnable ParserState: decompressing and parsing the text, against
+//	reading the hash and looking the program up in the program cache. The
+//	cached program is then run to check it gives the same result
+static void benchRequest(const char* name, const string& source,
+		const char* func) {
+#define REQUEST_ROUNDS	1000
+	NodeIdent dummy = {0, 0};
+	string funcName = func;
+	ProgramCache cache(DEFAULT_PROGRAM_CACHE_SIZE);
+	ParserState* sender = new ParserState();
+	if (sender->input_buffer.create_buffer(source.size()) == -1) {
+		delete sender;
+		return;
+	}
+	memcpy(sender->input_buffer.get_raw_buf(), source.data(), source.size());
+	RealPacket fullPacket(dummy);
+	if (marshal_packet(sender, fullPacket, &funcName, 
+			sender->get_param()) == -1 || cache.attach(sender) == -1) {
+		printf("%-10s failed\n", name);
+		delete sender;
+		return;
+	}
+	RealPacket hashPacket(dummy);
+	marshal_packet(sender, hashPacket, &funcName, sender->get_param(), true);
+	double requestUS[2];
+	RealPacket* packets[2] = {&fullPacket, &hashPacket};
+	for (int i = 0; i < 2; i++) {
+		struct timeval start;
+		gettimeofday(&start, NULL);
+		for (int j = 0; j < REQUEST_ROUNDS; j++) {
+			ParserState* ps = new ParserState();
+			BufferWrapper bw(packets[i]->getPayLoad(), 
+				packets[i]->getPayLoadSize());
+			if (unmarshal_packet(*ps, bw) == -1) {
+				delete ps;
+				break;
+			}
+			if (i == 0) {
+				g_parser_line = 1;
+				yyparse((void*)ps);
+			} else {
+				cache.attach(ps);
+			}
+			delete ps;
+		}
+		requestUS[i] = elapsedUS(start) / REQUEST_ROUNDS;
+	}
+	RunStats parsed, cached;
+	bool same = (runProgram(source, func, true, NULL, &parsed) != -1 &&
+		runProgram(source, func, true, &cache, &cached) != -1 &&
+		parsed.result == cached.result);
+	printf("%-10s %8.1f us %8.1f us %7.2fx %6d B %6d B %s\n", name, 
+		requestUS[0], requestUS[1], requestUS[0] / requestUS[1],
+		fullPacket.getPayLoadSize(), hashPacket.getPayLoadSize(),
+		same ? "ok" : "MISMATCH");
+	delete sender;
+}
+
+//	Cost of a DSL thread yielding to the scheduler and being resumed, with
+//	fiber_switch and with the ucontext calls it replaces
+static FiberContext schedContext, yieldContext;
+static ucontext_t schedUContext, yieldUContext;
+
+static void yieldLoop(void* arg) {
+	while (true) {
+		fiber_switch(&yieldContext, &schedContext);
+	}
+}
+
+static void yieldLoopUContext() {
+	while (true) {
+		swapcontext(&yieldUContext, &schedUContext);
+	}
+}
+
+static void benchSwitch() {
+#define SWITCH_ROUNDS	1000000
+	void* stack = FiberStackPool::pool()->alloc();
+	void* ucStack = FiberStackPool::pool()->alloc();
+	if (stack == NULL || ucStack == NULL) {
+		printf("Cannot allocate fiber stacks\n");
+		return;
+	}
+	fiber_make(&yieldContext, stack, FIBER_STACK, &yieldLoop, NULL);
+	struct timeval start;
+	gettimeofday(&start, NULL);
+	for (int i = 0; i < SWITCH_ROUNDS; i++) {
+		fiber_switch(&schedContext, &yieldContext);
+	}
+	double fiberNS = elapsedUS(start) * 1000.0 / SWITCH_ROUNDS;
+	getcontext(&yieldUContext);
+	yieldUContext.uc_link = 0;
+	yieldUContext.uc_stack.ss_sp = ucStack;
+	yieldUContext.uc_stack.ss_size = FIBER_STACK;
+	yieldUContext.uc_stack.ss_flags = 0;
+	makecontext(&yieldUContext, &yieldLoopUContext, 0);
+	gettimeofday(&start, NULL);
+	for (int i = 0; i < SWITCH_ROUNDS; i++) {
+		swapcontext(&schedUContext, &yieldUContext);
+	}
+	double ucontextNS = elapsedUS(start) * 1000.0 / SWITCH_ROUNDS;
+	printf("\nyield and resume: %0.1f ns, %0.1f ns with swapcontext\n",
+		fiberNS, ucontextNS);
+	//	Both loops are abandoned, their stacks are not reused
+}
+
+int main(int argc, char* argv[]) {
+	signal(SIGFPE, FloatingPointError);
+	const char* closestPath = (argc > 1) ? argv[1] : "closestNode.b";
+	printf("%-10s %13s %13s %8s %11s %4s %4s %6s %6s\n", "program",
+		"tree walker", "compiled", "speedup", "parse", "fns", "fail",
+		"instrs", "result");
+	benchProgram("loop", loopProgram, "main");
+	benchProgram("fib", fibProgram, "main");
+	benchProgram("array", arrayProgram, "main");
+	benchProgram("struct", structProgram, "main");
+
+	FILE* in_file = fopen(closestPath, "r");
+	if (in_file == NULL) {
+		printf("Cannot open %s, skipping closest\n", closestPath);
+		return 0;
+	}
+	string source;
+	char buf[4096];
+	size_t numRead;
+	while ((numRead = fread(buf, 1, sizeof(buf), in_file)) > 0) {
+		source.append(buf, numRead);
+	}
+	fclose(in_file);
+	source += closestDriver;
+	benchProgram("closest", source, "benchHop");
+
+	printf("\n%-10s %11s %11s %8s %8s %8s\n", "request", "parse", 
+		"cached", "speedup", "text", "hash");
+	benchRequest("struct", structProgram, "main");
+	benchRequest("closest", source, "benchHop");
+
+	benchSwitch();
+	FiberStackPool* stackPool = FiberStackPool::pool();
+	printf("fiber stacks: %llu mapped, %llu reused, deepest use %u of %u KB\n",
+		(unsigned long long)stackPool->getNumMisses(),
+		(unsigned long long)stackPool->getNumHits(),
+		(u_int)(stackPool->getHighWater() / 1024), FIBER_STACK / 1024);
+	return 0;
+}
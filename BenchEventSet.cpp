@@ -0,0 +1,145 @@
+/******************************************************************************
+Meridian prototype distribution
+Copyright (C) 2005 Bernard Wong
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+The copyright owner can be contacted by e-mail at bwong@cs.cornell.edu
+*******************************************************************************/
+
+//	Measures the cost of a single wakeup of the main event loop while a
+//	large number of probe sockets are outstanding. Each iteration makes one
+//	random socket readable, waits for it and dispatches it, just like the
+//	main loop would. Build with and without MERIDIAN_SELECT to compare the
+//	epoll and select backends.
+
+using namespace std;
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "Common.h"
+#include "EventSet.h"
+
+#define DEFAULT_ITERATIONS	10000
+#define BENCH_OWNER			1
+
+static int setNonBlock(int fd) {
+	int sockflags;
+	if ((sockflags = fcntl(fd, F_GETFL, 0)) != -1){
+		sockflags |= O_NONBLOCK;
+		return fcntl(fd, F_SETFL, sockflags);
+	}
+	return -1;
+}
+
+//	Returns the average wakeup cost in microseconds, or -1 if the backend
+//	cannot watch numProbes sockets
+static double runBench(int numProbes, int iterations) {
+	EventSet events;
+	if (events.init() == -1) {
+		return -1;
+	}
+	vector<int> sendFDs, recvFDs;
+	double retVal = -1;
+	for (int i = 0; i < numProbes; i++) {
+		int sv[2];
+		if (socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) == -1) {
+			perror("socketpair");
+			goto cleanup;
+		}
+		sendFDs.push_back(sv[0]);
+		recvFDs.push_back(sv[1]);
+		if (setNonBlock(sv[1]) == -1 ||
+				events.addFD(sv[1], BENCH_OWNER, EVENT_READ) == -1) {
+			goto cleanup;
+		}
+	}
+	{
+		struct timeval start, end;
+		gettimeofday(&start, NULL);
+		for (int i = 0; i < iterations; i++) {
+			int target = rand() % numProbes;
+			char byte = 0;
+			if (send(sendFDs[target], &byte, 1, 0) != 1) {
+				perror("send");
+				goto cleanup;
+			}
+			struct timeval timeOutTV = {1, 0};
+			if (events.wait(&timeOutTV) <= 0) {
+				ERROR_LOG("Wakeup lost\n");
+				goto cleanup;
+			}
+			int readyFD;
+			u_int readyOwner, readyEvents;
+			while (events.nextReady(
+					&readyFD, &readyOwner, &readyEvents) != -1) {
+				//	Drain, as the owner in the main loop would
+				while (recv(readyFD, &byte, 1, 0) == 1);
+			}
+		}
+		gettimeofday(&end, NULL);
+		retVal = ((end.tv_sec - start.tv_sec) * 1000000.0 +
+			(end.tv_usec - start.tv_usec)) / iterations;
+	}
+cleanup:
+	for (u_int i = 0; i < recvFDs.size(); i++) {
+		events.removeFD(recvFDs[i]);
+		close(recvFDs[i]);
+	}
+	for (u_int i = 0; i < sendFDs.size(); i++) {
+		close(sendFDs[i]);
+	}
+	return retVal;
+}
+
+int main(int argc, char* argv[]) {
+	int iterations = DEFAULT_ITERATIONS;
+	if (argc > 1) {
+		iterations = atoi(argv[1]);
+		if (iterations <= 0) {
+			fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+			return -1;
+		}
+	}
+	//	Two fds per probe, raise the limit as far as we are allowed to
+	struct rlimit fdLimit;
+	if (getrlimit(RLIMIT_NOFILE, &fdLimit) == 0) {
+		fdLimit.rlim_cur = fdLimit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &fdLimit);
+	}
+	srand(time(NULL));
+	int probeCounts[] = {100, 1000, 10000};
+	printf("Backend: %s, %d wakeups per run\n", 
+		EventSet::backendName(), iterations);
+	for (u_int i = 0; i < sizeof(probeCounts) / sizeof(int); i++) {
+		double costUS = runBench(probeCounts[i], iterations);
+		if (costUS < 0) {
+			printf("%6d probes: not supported\n", probeCounts[i]);
+		} else {
+			printf("%6d probes: %8.3f us per wakeup\n", 
+				probeCounts[i], costUS);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,132 @@
+/******************************************************************************
+Meridian prototype distribution
+Copyright (C) 2005 Bernard Wong
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+The copyright owner can be contacted by e-mail at bwong@cs.cornell.edu
+*******************************************************************************/
+
+
+//	Measures Gram-Schmidt and the hypervolume kernel on the matrix sizes
+//	seen in ring management: the row by row interface against the blocked
+//	batch interface, and evaluating every removal candidate of a reduction
+//	step from scratch against the downdated Gram matrix.
+
+using namespace std;
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <vector>
+#include "Common.h"
+#include "GramSchmidtOpt.h"
+#include "HyperVolume.h"
+
+#define MIN_SIZE		8
+#define MAX_SIZE		64
+#define SIZE_STEP		8
+#define WORK_PER_SIZE	20000000.0	// Iterations are scaled down by n^3
+
+static double elapsedUS(const struct timeval& start) {
+	struct timeval end;
+	gettimeofday(&end, NULL);
+	return (end.tv_sec - start.tv_sec) * 1000000.0 +
+		(end.tv_usec - start.tv_usec);
+}
+
+//	Symmetric latency matrix in ms, as built by createLatencyMatrix
+static void randomLatencies(vector<double>& matrix, int n) {
+	matrix.resize(n * n);
+	for (int i = 0; i < n; i++) {
+		matrix[i * n + i] = 0.0;
+		for (int j = 0; j < i; j++) {
+			matrix[i * n + j] = matrix[j * n + i] = 1.0 + rand() % 300000 / 1000.0;
+		}
+	}
+}
+
+int main(int argc, char* argv[]) {
+	srand(1);
+	printf("Kernel: %s\n", GramSchmidtOpt::kernelName());
+	printf("%4s %12s %12s %14s %14s\n", "n", "addVector", "batch",
+		"from scratch", "downdate");
+	double checksum = 0.0;
+	for (int n = MIN_SIZE; n <= MAX_SIZE; n += SIZE_STEP) {
+		int iterations = (int)(WORK_PER_SIZE / ((double)n * n * n)) + 1;
+		vector<double> latencies, edges, work, norms(n), logVolumes(n);
+		randomLatencies(latencies, n);
+		edges.resize((n - 1) * n);
+		for (int i = 0; i < n - 1; i++) {
+			for (int j = 0; j < n; j++) {
+				edges[i * n + j] = latencies[i * n + j] - 
+					latencies[(n - 1) * n + j];
+			}
+		}
+		work.resize(edges.size());
+
+		struct timeval start;
+		gettimeofday(&start, NULL);
+		for (int it = 0; it < iterations; it++) {
+			GramSchmidtOpt gs(n);
+			for (int i = 0; i < n - 1; i++) {
+				gs.addVector(&(edges[i * n]));
+			}
+			int orthSize;
+			checksum += gs.returnOrth(&orthSize)[0];
+		}
+		double addVectorUS = elapsedUS(start) / iterations;
+
+		gettimeofday(&start, NULL);
+		for (int it = 0; it < iterations; it++) {
+			memcpy(&(work[0]), &(edges[0]), sizeof(double) * work.size());
+			checksum += GramSchmidtOpt::orthogonalizeRows(
+				&(work[0]), n - 1, n, &(norms[0]), 1e-12);
+		}
+		double batchUS = elapsedUS(start) / iterations;
+
+		//	All candidates of one reduction step
+		HyperVolume hv;
+		int stepIterations = iterations / n + 1;
+		gettimeofday(&start, NULL);
+		for (int it = 0; it < stepIterations; it++) {
+			for (int c = 0; c < n; c++) {
+				//	Candidate moved last, as reduceSetByN used to do
+				vector<double> swapped(latencies);
+				for (int i = 0; i < n; i++) {
+					swap(swapped[i * n + c], swapped[i * n + n - 1]);
+				}
+				for (int j = 0; j < n; j++) {
+					swap(swapped[c * n + j], swapped[(n - 1) * n + j]);
+				}
+				checksum += hv.logVolume(&(swapped[0]), n, n - 1);
+			}
+		}
+		double scratchUS = elapsedUS(start) / stepIterations;
+
+		gettimeofday(&start, NULL);
+		for (int it = 0; it < stepIterations; it++) {
+			hv.logVolumesWithout(&(latencies[0]), n, n, &(logVolumes[0]));
+			checksum += logVolumes[0];
+		}
+		double downdateUS = elapsedUS(start) / stepIterations;
+
+		printf("%4d %9.2f us %9.2f us %11.2f us %11.2f us\n", n, 
+			addVectorUS, batchUS, scratchUS, downdateUS);
+	}
+	printf("(checksum %g)\n", checksum);
+	return 0;
+}
@@ -0,0 +1,156 @@
+/******************************************************************************
+Meridian prototype distribution
+Copyright (C) 2005 Bernard Wong
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+The copyright owner can be contacted by e-mail at bwong@cs.cornell.edu
+*******************************************************************************/
+
+//	Measures the query table with a large number of outstanding queries:
+//	inserting, looking up IDs, re-arming the timeout on every packet (as notifyQPacket
+//	does), computing the next timeout of the main loop and sweeping the
+//	queries out as they time out.
+
+using namespace std;
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <time.h>
+#include "Common.h"
+#include "QueryTable.h"
+
+#define DEFAULT_NUM_QUERIES		100000
+#define REARM_ITERATIONS		1000000
+#define LOOKUP_ITERATIONS		1000000
+#define NEXT_TIMEOUT_ITERATIONS	1000000
+#define TIMEOUT_SPREAD_MS		2000
+
+//	Minimal query that finishes on its first timeout
+class BenchQuery : public Query {
+private:
+	uint64_t		qid;
+	struct timeval	timeoutTV;
+	bool			finished;
+public:
+	BenchQuery(uint64_t id, u_int timeoutMS) : qid(id), finished(false) {
+		computeTimeout(timeoutMS * MICRO_IN_MILLI, &timeoutTV);
+	}
+	virtual ~BenchQuery() {}
+	virtual uint64_t getQueryID() const				{ return qid;		}
+	virtual struct timeval timeOut() const			{ return timeoutTV;	}
+	virtual int init()								{ return 0;			}
+	virtual int handleEvent(
+			const NodeIdent& in_remote, const char* inPacket, int packetSize) {
+		computeTimeout(
+			(rand() % TIMEOUT_SPREAD_MS + 1) * MICRO_IN_MILLI, &timeoutTV);
+		return 0;
+	}
+	virtual int handleLatency(
+			const vector<NodeIdentLat>& in_remoteNodes) { return 0;		}
+	virtual int handleTimeout()		{ finished = true; return 0; 		}
+	virtual bool isFinished() const	{ return finished;					}
+};
+
+static double elapsedUS(const struct timeval& start) {
+	struct timeval end;
+	gettimeofday(&end, NULL);
+	return (end.tv_sec - start.tv_sec) * 1000000.0 +
+		(end.tv_usec - start.tv_usec);
+}
+
+int main(int argc, char* argv[]) {
+	int numQueries = DEFAULT_NUM_QUERIES;
+	if (argc > 1) {
+		numQueries = atoi(argv[1]);
+		if (numQueries <= 0) {
+			fprintf(stderr, "Usage: %s [num_queries]\n", argv[0]);
+			return -1;
+		}
+	}
+	srand(time(NULL));
+	QueryTable* table = new QueryTable();
+	struct timeval start;
+	printf("%d live queries\n", numQueries);
+
+	gettimeofday(&start, NULL);
+	for (int i = 0; i < numQueries; i++) {
+		BenchQuery* newQuery = 
+			new BenchQuery(i, rand() % TIMEOUT_SPREAD_MS + 1);
+		if (table->insertNewQuery(newQuery) == -1) {
+			ERROR_LOG("Cannot insert query\n");
+			delete newQuery;
+			return -1;
+		}
+	}
+	printf("insert:       %8.3f us per query\n", 
+		elapsedUS(start) / numQueries);
+
+	//	Half hits, half misses, as in getNewQueryID
+	u_int numFound = 0;
+	gettimeofday(&start, NULL);
+	for (int i = 0; i < LOOKUP_ITERATIONS; i++) {
+		if (table->isQueryInTable(rand() % (2 * numQueries))) {
+			numFound++;
+		}
+	}
+	printf("lookup:       %8.3f us per ID (%u found)\n", 
+		elapsedUS(start) / LOOKUP_ITERATIONS, numFound);
+
+	NodeIdent dummyNode = {0, 0};
+	gettimeofday(&start, NULL);
+	for (int i = 0; i < REARM_ITERATIONS; i++) {
+		table->notifyQPacket(rand() % numQueries, dummyNode, NULL, 0);
+	}
+	printf("re-arm:       %8.3f us per packet\n", 
+		elapsedUS(start) / REARM_ITERATIONS);
+
+	struct timeval nextEventTime;
+	gettimeofday(&start, NULL);
+	for (int i = 0; i < NEXT_TIMEOUT_ITERATIONS; i++) {
+		table->nextTimeout(&nextEventTime);
+	}
+	printf("nextTimeout:  %8.3f us per call\n", 
+		elapsedUS(start) / NEXT_TIMEOUT_ITERATIONS);
+
+	//	Sweep as the main loop would, sleeping until the next timeout
+	u_int numSweeps = 0;
+	double sweepUS = 0;
+	while (true) {
+		struct timeval curTime, timeOutTV;
+		Query::getCurrentTime(&curTime);
+		table->nextTimeout(&nextEventTime);
+		if (timercmp(&nextEventTime, &curTime, >)) {
+			timersub(&nextEventTime, &curTime, &timeOutTV);
+			if (timeOutTV.tv_sec >= DEFAULT_TIME_OUT_S) {
+				break;	// Empty
+			}
+			select(0, NULL, NULL, NULL, &timeOutTV);
+		}
+		gettimeofday(&start, NULL);
+		table->handleTimeout();
+		sweepUS += elapsedUS(start);
+		numSweeps++;
+	}
+	printf("timeout:      %8.3f us per query, %u sweeps\n", 
+		sweepUS / numQueries, numSweeps);
+	printf("query pool:   %llu hits, %llu misses\n",
+		(unsigned long long)Query::pool()->getNumHits(),
+		(unsigned long long)Query::pool()->getNumMisses());
+	delete table;
+	return 0;
+}
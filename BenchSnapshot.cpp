@@ -0,0 +1,198 @@
+/******************************************************************************
+Meridian prototype distribution
+Copyright (C) 2005 Bernard Wong
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+The copyright owner can be contacted by e-mail at bwong@cs.cornell.edu
+*******************************************************************************/
+
+//	Measures the time a Meridian node takes to get back to useful rings
+//	when started cold, knowing a single seed and learning the others
+//	through gossip, and when restarted from its snapshot. A few seed nodes
+//	are run locally, and the node is counted as ready once its info port
+//	reports all of them as ring members. The cold time is mostly the
+//	gossip interval, set here to its shortest of 1 s
+
+using namespace std;
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include "Marshal.h"
+#include "MeridianProcess.h"
+#include "meridian.h"
+
+#define SEED_PORT				3960
+#define TEST_PORT				3980
+#define INFO_PORT_OFFSET		100
+#define DEFAULT_SEEDS			8
+#define DEFAULT_RUNS			5
+#define POLL_MS					5
+#define READY_TIMEOUT_MS		30000
+
+static double elapsedMS(const struct timeval& from, const struct timeval& to) {
+	return (to.tv_sec - from.tv_sec) * 1000.0 +
+		(to.tv_usec - from.tv_usec) / 1000.0;
+}
+
+//	Number of ring members reported by the info port, -1 if it cannot be
+//	reached yet
+static int countRingMembers(uint16_t infoPort) {
+	int sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock == -1) {
+		return -1;
+	}
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(infoPort);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1 ||
+			send(sock, "M2", 2, 0) != 2) {
+		close(sock);
+		return -1;
+	}
+	vector<char> buf(MAX_INFO_PACKET_SIZE);
+	int numBytes = 0;
+	int recvRet;
+	while (numBytes < (int)buf.size() && (recvRet = 
+			recv(sock, &(buf[numBytes]), buf.size() - numBytes, 0)) > 0) {
+		numBytes += recvRet;
+	}
+	close(sock);
+	map<u_int, vector<NodeIdentLat>*> ringMap;
+	if (InfoPacket::parse(&(buf[0]), numBytes, ringMap) == -1) {
+		return -1;
+	}
+	int numMembers = 0;
+	map<u_int, vector<NodeIdentLat>*>::iterator it = ringMap.begin();
+	for (; it != ringMap.end(); it++) {
+		numMembers += it->second->size();
+		delete it->second;
+	}
+	return numMembers;
+}
+
+//	Start the test node and return the ms until it has numSeeds ring
+//	members, or -1. The node is stopped again, which saves its snapshot
+static double timeToUsefulRing(const char* snapshotPath, u_int numSeeds) {
+	meridian node(TEST_PORT, TEST_PORT + INFO_PORT_OFFSET, 
+		numSeeds, numSeeds, 2);
+	node.setGossipInterval(1, 1000, 1);
+	node.setSnapshotFile(snapshotPath);
+	node.addSeedNode(INADDR_LOOPBACK, SEED_PORT);
+	struct timeval startTV, now;
+	fflush(stdout);		// Or the node prints it again when it exits
+	gettimeofday(&startTV, NULL);
+	if (node.start() == -1) {
+		return -1;
+	}
+	double readyMS = -1;
+	do {
+		usleep(POLL_MS * MICRO_IN_MILLI);
+		gettimeofday(&now, NULL);
+		if (countRingMembers(TEST_PORT + INFO_PORT_OFFSET) >= (int)numSeeds) {
+			readyMS = elapsedMS(startTV, now);
+			break;
+		}
+	} while (elapsedMS(startTV, now) < READY_TIMEOUT_MS);
+	node.stop();
+	return readyMS;
+}
+
+static void printStats(const char* name, vector<double>& times) {
+	sort(times.begin(), times.end());
+	double total = 0;
+	for (u_int i = 0; i < times.size(); i++) {
+		total += times[i];
+	}
+	printf("%-9s %9.1f %9.1f %9.1f %9.1f\n", name, times.front(),
+		times[times.size() / 2], total / times.size(), times.back());
+}
+
+int main(int argc, char* argv[]) {
+	u_int numSeeds = DEFAULT_SEEDS;
+	u_int numRuns = DEFAULT_RUNS;
+	if (argc > 1) numSeeds = atoi(argv[1]);
+	if (argc > 2) numRuns = atoi(argv[2]);
+	if (argc > 3 || numSeeds == 0 || numRuns == 0) {
+		fprintf(stderr, "Usage: %s [seeds] [runs]\n", argv[0]);
+		return -1;
+	}
+	char snapshotPath[] = "/tmp/benchSnapshotXXXXXX";
+	int fd = mkstemp(snapshotPath);
+	if (fd == -1) {
+		perror("mkstemp");
+		return -1;
+	}
+	close(fd);
+	//	Every seed knows the first one, which learns the rest as they
+	//	join, so gossip from it covers all of them
+	vector<meridian*> seeds;
+	for (u_int i = 0; i < numSeeds; i++) {
+		meridian* seed = new meridian(SEED_PORT + i, 
+			SEED_PORT + i + INFO_PORT_OFFSET, numSeeds, numSeeds, 2);
+		seed->setGossipInterval(1, 1000, 1);
+		if (i > 0) {
+			seed->addSeedNode(INADDR_LOOPBACK, SEED_PORT);
+		}
+		fflush(stdout);
+		if (seed->start() == -1) {
+			fprintf(stderr, "Cannot start seed %u\n", i);
+			return -1;
+		}
+		seeds.push_back(seed);
+	}
+	struct timeval startTV, now;
+	gettimeofday(&startTV, NULL);
+	do {
+		usleep(POLL_MS * MICRO_IN_MILLI);
+		gettimeofday(&now, NULL);
+	} while (countRingMembers(SEED_PORT + INFO_PORT_OFFSET) < 
+		(int)numSeeds - 1 && elapsedMS(startTV, now) < READY_TIMEOUT_MS);
+	printf("%u seeds, %u runs, ms until all seeds are ring members\n", 
+		numSeeds, numRuns);
+	printf("start          min    median      mean       max\n");
+	vector<double> coldTimes;
+	vector<double> warmTimes;
+	for (u_int i = 0; i < numRuns; i++) {
+		unlink(snapshotPath);
+		double coldMS = timeToUsefulRing(snapshotPath, numSeeds);
+		double warmMS = timeToUsefulRing(snapshotPath, numSeeds);
+		if (coldMS < 0 || warmMS < 0) {
+			fprintf(stderr, "Node not ready after %d ms\n", READY_TIMEOUT_MS);
+			continue;
+		}
+		coldTimes.push_back(coldMS);
+		warmTimes.push_back(warmMS);
+	}
+	if (!coldTimes.empty()) {
+		printStats("cold", coldTimes);
+		printStats("snapshot", warmTimes);
+	}
+	unlink(snapshotPath);
+	for (u_int i = 0; i < seeds.size(); i++) {
+		delete seeds[i];
+	}
+	return 0;
+}
@@ -89,38 +89,33 @@ int createMeasurement(ASTNode* in_ast, Measurement* in_Measure) {
 	if (in_ast->type != VAR_ADT_TYPE) {
 		return -1;	
 	}
-	if (*(in_ast->val.adt_val.adt_type_name) != "Measurement") {
+	if (in_ast->val.adt_val.adt_layout != &adt_measurement_layout) {
 		return -1;
 	}
 	int32_t tmpVal;
-	if (fillNodeIdentField("addr", in_ast->val.adt_val.adt_map, 
-			&tmpVal) == -1) {				
+	if (fillNodeIdentField(in_ast, ADT_FIELD_ADDR, &tmpVal) == -1) {				
 		return -1;
 	}
 	in_Measure->addr = (uint32_t)tmpVal;	
-	if (fillNodeIdentField("port", in_ast->val.adt_val.adt_map,
-			&tmpVal) == -1) {
+	if (fillNodeIdentField(in_ast, ADT_FIELD_PORT, &tmpVal) == -1) {
 		return -1;
 	}
 	in_Measure->port = (uint16_t)tmpVal;
-	if (fillNodeIdentField("rendvAddr", in_ast->val.adt_val.adt_map,
-			&tmpVal) == -1) {
+	if (fillNodeIdentField(in_ast, ADT_FIELD_RENDV_ADDR, &tmpVal) == -1) {
 		return -1;
 	}
 	in_Measure->rendvAddr = (uint32_t)tmpVal;
-	if (fillNodeIdentField("rendvPort", in_ast->val.adt_val.adt_map,
-			&tmpVal) == -1) {		
+	if (fillNodeIdentField(in_ast, ADT_FIELD_RENDV_PORT, &tmpVal) == -1) {		
 		return -1;
 	}
 	in_Measure->rendvPort = (uint16_t)tmpVal;	
 	// Now load array
-	map<string, ASTNode*>::const_iterator findIt 
-		= in_ast->val.adt_val.adt_map->find("distance");
-	if (findIt == in_ast->val.adt_val.adt_map->end() || 
-		findIt->second->type != ARRAY_TYPE) {
+	const ASTNode* distNode = 
+		in_ast->val.adt_val.adt_fields[ADT_FIELD_DISTANCE];
+	if (distNode->type != ARRAY_TYPE) {
 		return -1;	
 	}
-	vector<ASTNode*>* a_val = findIt->second->val.a_val.a_vector;	
+	vector<ASTNode*>* a_val = distNode->val.a_val.a_vector;	
 	for (u_int i = 0; i < a_val->size(); i++) {
 		if ((*a_val)[i]->type != DOUBLE_TYPE) {
 			return -1;	
@@ -84,13 +84,14 @@ ASTNode* bruteCreateNodeIdent(ParserState* ps, NodeIdentRendv* in_node) {
 	string* tmpStr = ps->get_var_table()->new_stack_string();
 	*tmpStr = "Node";	
 	retVar->val.adt_val.adt_type_name = tmpStr;
-	retVar->val.adt_val.adt_map = ps->get_var_table()->new_stack_map();
-	(*(retVar->val.adt_val.adt_map))["addr"] = mk_int(ps, in_node->addr);
-	(*(retVar->val.adt_val.adt_map))["port"] = mk_int(ps, in_node->port);
-	(*(retVar->val.adt_val.adt_map))["rendvAddr"] 
-		= mk_int(ps, in_node->addrRendv);
-	(*(retVar->val.adt_val.adt_map))["rendvPort"] 
-		= mk_int(ps, in_node->portRendv);
+	retVar->val.adt_val.adt_layout = &adt_node_layout;
+	ASTNode** fields = ps->get_var_table()->new_stack_fields(
+		adt_node_layout.numFields);
+	retVar->val.adt_val.adt_fields = fields;
+	fields[ADT_FIELD_ADDR] = mk_int(ps, in_node->addr);
+	fields[ADT_FIELD_PORT] = mk_int(ps, in_node->port);
+	fields[ADT_FIELD_RENDV_ADDR] = mk_int(ps, in_node->addrRendv);
+	fields[ADT_FIELD_RENDV_PORT] = mk_int(ps, in_node->portRendv);
 	return retVar;
 }
 
@@ -10,8 +10,8 @@ typedef struct Measurement_t {
 } Measurement;
 
 // This is in MeridianDSL
-extern int fillNodeIdentField(const char* in_string, 
-	const map<string, ASTNode*>* inMap, int32_t* val);
+extern int fillNodeIdentField(
+	const ASTNode* in_ast, u_int in_field, int32_t* val);
 
 extern int createMeasurement(ASTNode* in_ast, Measurement* in_Measure); 
 
@@ -0,0 +1,128 @@
+/******************************************************************************
+Meridian prototype distribution
+Copyright (C) 2005 Bernard Wong
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+The copyright owner can be contacted by e-mail at bwong@cs.cornell.edu
+*******************************************************************************/
+
+using namespace std;
+
+#include <time.h>
+#include "DSLScheduler.h"
+
+//	Weighted CPU time advances by the CPU time times the weight of the
+//	lowest class over the weight of the class of the thread
+static const uint64_t g_classWeight[DSL_NUM_PRIO] = {4, 2, 1};
+
+DSLScheduler::DSLScheduler() 
+	: minVruntime(0), nextSeq(0), numSlices(0), numDemoted(0) {
+	for (int i = 0; i < DSL_NUM_PRIO; i++) {
+		classNS[i] = 0;
+	}
+}
+
+uint64_t DSLScheduler::nowNS() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void DSLScheduler::initThread(DSLThreadState* state, int in_priority) {
+	state->vruntime = 0;
+	state->cpuNS = 0;
+	state->seq = 0;
+	state->nsPerEval = DSL_INIT_NS_PER_EVAL;
+	state->priority = in_priority;
+	state->queued = false;
+}
+
+void DSLScheduler::enqueue(uint64_t in_qid, DSLThreadState* state) {
+	state->seq = nextSeq++;
+	state->queued = true;
+	DSLRunEntry entry = {state->vruntime, state->seq, in_qid};
+	runQueue.insert(entry);
+}
+
+void DSLScheduler::wake(uint64_t in_qid, DSLThreadState* state) {
+	if (state->queued) {
+		return;
+	}
+	if (!runQueue.empty() && runQueue.begin()->vruntime > minVruntime) {
+		minVruntime = runQueue.begin()->vruntime;
+	}
+	if (state->vruntime < minVruntime) {
+		state->vruntime = minVruntime;
+	}
+	enqueue(in_qid, state);
+}
+
+int DSLScheduler::next(uint64_t* out_qid) {
+	if (runQueue.empty()) {
+		return -1;
+	}
+	set<DSLRunEntry, ltDSLRunEntry>::iterator it = runQueue.begin();
+	*out_qid = it->qid;
+	if (it->vruntime > minVruntime) {
+		minVruntime = it->vruntime;
+	}
+	runQueue.erase(it);
+	return 0;
+}
+
+int DSLScheduler::sliceEvals(const DSLThreadState* state) const {
+	u_int evals = DSL_SLICE_NS / state->nsPerEval;
+	if (evals < DSL_MIN_SLICE_EVALS) {
+		return DSL_MIN_SLICE_EVALS;
+	}
+	if (evals > DSL_MAX_SLICE_EVALS) {
+		return DSL_MAX_SLICE_EVALS;
+	}
+	return evals;
+}
+
+void DSLScheduler::charge(uint64_t in_qid, DSLThreadState* state, 
+		int in_priority, uint64_t in_ns, int in_evals, bool in_runnable) {
+	numSlices++;
+	classNS[in_priority] += in_ns;
+	if (state == NULL) {
+		return;	// Thread ended
+	}
+	if (state->queued) {
+		//	Woken while it ran, queued again below with its new time
+		DSLRunEntry entry = {state->vruntime, state->seq, in_qid};
+		runQueue.erase(entry);
+		in_runnable = true;
+	}
+	state->queued = false;
+	state->cpuNS += in_ns;
+	state->vruntime += in_ns * g_classWeight[DSL_PRIO_LOW] / 
+		g_classWeight[state->priority];
+	if (in_evals > 0) {
+		u_int sample = in_ns / in_evals;
+		state->nsPerEval = (3 * state->nsPerEval + sample) / 4;
+		if (state->nsPerEval == 0) {
+			state->nsPerEval = 1;
+		}
+	}
+	if (state->priority != DSL_PRIO_LOW && state->cpuNS > DSL_DEMOTE_NS) {
+		state->priority = DSL_PRIO_LOW;
+		numDemoted++;
+	}
+	if (in_runnable) {
+		enqueue(in_qid, state);
+	}
+}
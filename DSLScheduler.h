@@ -0,0 +1,94 @@
+#ifndef CLASS_DSL_SCHEDULER
+#define CLASS_DSL_SCHEDULER
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <set>
+
+//	Priority classes of DSL threads. Each class gets CPU time in proportion
+//	to its weight, so a lower class is slowed down but never starved
+#define DSL_PRIO_HIGH			0	// Requests from ring members
+#define DSL_PRIO_NORMAL			1
+#define DSL_PRIO_LOW			2	// Used more than DSL_DEMOTE_NS of CPU
+#define DSL_NUM_PRIO			3
+
+//	Target length of a slice. Slices are counted in eval steps, the number
+//	of steps is derived from the measured cost of a step of each thread
+#define DSL_SLICE_NS			500000
+#define DSL_INIT_NS_PER_EVAL	50
+#define DSL_MIN_SLICE_EVALS		100
+#define DSL_MAX_SLICE_EVALS		1000000
+//	CPU time after which a thread is moved to DSL_PRIO_LOW
+#define DSL_DEMOTE_NS			50000000
+//	Longest the event loop runs DSL threads before polling its sockets
+#define DSL_TURN_NS				2000000
+
+//	Scheduling state of a DSL thread, kept in its DSLRecvQuery
+typedef struct {
+	uint64_t	vruntime;	// CPU time scaled by the weight of the class
+	uint64_t	cpuNS;		// CPU time used so far
+	uint64_t	seq;		// Of the run queue entry while queued
+	u_int		nsPerEval;	// Moving average of the cost of an eval step
+	int			priority;
+	bool		queued;
+} DSLThreadState;
+
+//	Run queue of the runnable DSL threads, ordered by weighted CPU time.
+//	The thread that has received the least runs next. A thread that
+//	becomes runnable starts no lower than the least weighted time queued,
+//	so blocking for a while does not buy it a long run of the CPU. Entries
+//	of threads that ended while queued are dropped by the caller of next
+class DSLScheduler {
+private:
+	typedef struct {
+		uint64_t	vruntime;
+		uint64_t	seq;		// FIFO among equal vruntimes
+		uint64_t	qid;
+	} DSLRunEntry;
+	struct ltDSLRunEntry {
+		bool operator()(const DSLRunEntry& s1, const DSLRunEntry& s2) const {
+			if (s1.vruntime != s2.vruntime) {
+				return s1.vruntime < s2.vruntime;
+			}
+			return s1.seq < s2.seq;
+		}
+	};
+	set<DSLRunEntry, ltDSLRunEntry>	runQueue;
+	uint64_t						minVruntime;
+	uint64_t						nextSeq;
+	uint64_t						numSlices;
+	uint64_t						numDemoted;
+	uint64_t						classNS[DSL_NUM_PRIO];
+
+	void enqueue(uint64_t in_qid, DSLThreadState* state);
+public:
+	DSLScheduler();
+
+	static uint64_t nowNS();
+	static void initThread(DSLThreadState* state, int in_priority);
+
+	//	Makes the thread runnable, does nothing if it already is
+	void wake(uint64_t in_qid, DSLThreadState* state);
+	//	Removes the next thread to run from the run queue. Returns -1 if
+	//	no thread is runnable. The caller looks the thread up and calls
+	//	dequeued on its state, unless the thread has ended
+	int next(uint64_t* out_qid);
+	void dequeued(DSLThreadState* state)	{ state->queued = false;	}
+	//	Eval steps making up a slice of the thread
+	int sliceEvals(const DSLThreadState* state) const;
+	//	Accounts a slice of in_ns in which in_evals steps ran. state is
+	//	NULL if the thread ended in the slice, otherwise the thread goes
+	//	back in the run queue if in_runnable
+	void charge(uint64_t in_qid, DSLThreadState* state, int in_priority,
+		uint64_t in_ns, int in_evals, bool in_runnable);
+
+	bool hasRunnable() const				{ return !runQueue.empty();	}
+	u_int getNumRunnable() const			{ return runQueue.size();	}
+	uint64_t getNumSlices() const			{ return numSlices;			}
+	uint64_t getNumDemoted() const			{ return numDemoted;		}
+	uint64_t getClassNS(int in_priority) const {
+		return classNS[in_priority];
+	}
+};
+
+#endif
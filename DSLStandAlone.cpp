@@ -42,7 +42,7 @@ void FloatingPointError(int sig_num) {
 	if (sig_num == SIGFPE) {
 		DSL_ERROR( "Floating point error\n");		
 		signal(SIGFPE, FloatingPointError);
-		setcontext(&global_env_thread);
+		fiber_escape(SIGFPE, &global_env_thread);
 		//longjmp(global_env_error, -1);
 	}
 }
@@ -298,9 +298,7 @@ int waitForProgram(int port) {
 			} else {
 				delete inPacket;	// TODO: Need this later
 				if (yyparse((void*)ps) != -1) {
-					if (ps->save_context() != -1) {
-						makecontext(ps->get_context(), 
-							(void (*)())(&jmp_eval), 1, ps);
+					if (ps->save_context(&jmp_eval) != -1) {
 						ps_list.push_back(ps);
 						FD_SET(dummy_sock, &write_set);
 					} else {
@@ -323,7 +321,7 @@ int waitForProgram(int port) {
 					it++, itCount++) {				
 				ParserState* ps = *it;
 				ps->allocateEvalCount(10000);			
-				swapcontext(&global_env_thread, ps->get_context());
+				fiber_switch(&global_env_thread, ps->get_context());
 				switch (ps->parser_state()) {
 					case PS_RUNNING: {
 						DSL_ERROR( "Exception occurred, exiting thread\n");
@@ -400,12 +398,11 @@ int main(int argc, char* argv[]) {
 		g_parser_line = 1;	// Reset line count for parser		
 		int ret = yyparse((void*)ps);
 		if (ret != -1) {
-			if (ps->save_context() == -1) {
+			//printf( "Creating child fiber\n" );
+			if (ps->save_context(&jmp_eval) == -1) {
 				delete ps;
 				continue;
 			}
-			//printf( "Creating child fiber\n" );
-			makecontext(ps->get_context(), (void (*)())(&jmp_eval), 1, ps);
 			ps_set.insert(ps);
 		}									
 	}
@@ -416,7 +413,7 @@ int main(int argc, char* argv[]) {
 		for (; it != ps_set.end(); it++) {
 			ParserState* ps = *it;
 			ps->allocateEvalCount(10000);			
-			swapcontext(&global_env_thread, ps->get_context());
+			fiber_switch(&global_env_thread, ps->get_context());
 			switch (ps->parser_state()) {
 				case PS_RUNNING: {
 					DSL_ERROR( "Exception occurred, exiting thread\n");
@@ -40,10 +40,16 @@ static int info_port = 0;
 static int nodes_per_primary = 4;
 static int nodes_per_second = 4;
 static int exponential_base = 2;
+static int num_rings = DEFAULT_NUM_RINGS;
+static int min_ring_radius = DEFAULT_MIN_RING_RADIUS_US;
 static int gossip_init_value = 5;
 static int gossip_init_period = 1;
 static int gossip_ss_value = 30;
 static int replace_period = 60;
+static int udp_batch_size = 32;
+static int num_workers = 1;
+static bool shared_cache = false;
+static char* snapshot_file = NULL;
 static uint32_t rendavous_addr = 0;
 static uint16_t rendavous_port = 0;
 
@@ -57,16 +63,23 @@ void usage() {
 	"  -p size\t\tNumber of nodes in each primary ring (default: %d)\n"
 	"  -s size\t\tNumber of nodes in each secondary ring (default: %d)\n"
 	"  -e base\t\tThe exponetial base of the ring (default: %d)\n"
+	"  -n num \t\tNumber of rings (default: %d)\n"
+	"  -u us  \t\tRadius of the innermost ring in us (default: %d)\n"
 	"  -h     \t\tHelp of command line parameters\n\n"
 	"  -g init:num:ss\tGossip interval in seconds, separated into initial\n" 
 	"                \tperiod, number of initial periods, and steady state\n"
 	"                \tperiod (default: %d:%d:%d)\n"
-	"  -r interval\t\tReplacement interval length in seconds (default: %d)\n\n"
+	"  -r interval\t\tReplacement interval length in seconds (default: %d)\n"
+	"  -b size\t\tPackets read or written per system call (default: %d)\n"
+	"  -w num \t\tNumber of query worker threads (default: %d)\n"
+	"  -c     \t\tShare probe latency caches with other local instances\n"
+	"  -f file\t\tSave and restore rings across restarts using file\n\n"
 	"  -d addr:port\t\tAddress and port of rendavous node (default: %d:%d)\n\n"	
 	"Seed Nodes should be specified in hostname:port format\n\n",
 	merid_port, info_port, nodes_per_primary, nodes_per_second, 
-	exponential_base, gossip_init_value, gossip_init_period, 
-	gossip_ss_value, replace_period, rendavous_addr, rendavous_port);			
+	exponential_base, num_rings, min_ring_radius, gossip_init_value, 
+	gossip_init_period, gossip_ss_value, replace_period, udp_batch_size, num_workers, 
+	rendavous_addr, rendavous_port);			
 }
 
 int main(int argc, char* argv[]) {
@@ -81,6 +94,12 @@ int main(int argc, char* argv[]) {
 		{"replacement_interval", 1, NULL, 7},
 		{"help", 0, NULL, 8},
 		{"d", 1, NULL, 9}, 
+		{"batch_size", 1, NULL, 10},
+		{"cache_shared", 0, NULL, 11},
+		{"f", 1, NULL, 12},
+		{"workers", 1, NULL, 13},
+		{"n", 1, NULL, 14},
+		{"u", 1, NULL, 15},
 		{0, 0, 0, 0}
 	};
 	// 	Start parsing parameters 
@@ -175,6 +194,24 @@ int main(int argc, char* argv[]) {
 				}
 			}
 			break;
+		case 10:
+			udp_batch_size = atoi(optarg);
+			break;
+		case 11:
+			shared_cache = true;
+			break;
+		case 12:
+			snapshot_file = optarg;
+			break;
+		case 13:
+			num_workers = atoi(optarg);
+			break;
+		case 14:
+			num_rings = atoi(optarg);
+			break;
+		case 15:
+			min_ring_radius = atoi(optarg);
+			break;
 		case '?':
 			usage();
 			return -1;
@@ -189,7 +226,8 @@ int main(int argc, char* argv[]) {
 	}
 	//	Create the actual meridian object with the parsed params
 	meridian* mInst = new meridian(merid_port, info_port, 
-		nodes_per_primary, nodes_per_second, exponential_base);
+		nodes_per_primary, nodes_per_second, exponential_base, 
+		num_rings, min_ring_radius);
 	//	Set rendavous node
 	mInst->setRendavousNode(rendavous_addr, rendavous_port);	
 	//	Load seed nodes
@@ -222,6 +260,10 @@ int main(int argc, char* argv[]) {
 	mInst->setGossipInterval(
 		gossip_init_value, gossip_init_period, gossip_ss_value);
 	mInst->setReplaceInterval(replace_period);
+	mInst->setUDPBatchSize(udp_batch_size);
+	mInst->setNumWorkers(num_workers);
+	mInst->setSharedLatencyCache(shared_cache);
+	mInst->setSnapshotFile(snapshot_file);
 	mInst->start();
 	wait(NULL);	
 	delete mInst;	// Deleting object automatically calls stop	
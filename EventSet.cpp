@@ -0,0 +1,292 @@
+/******************************************************************************
+Meridian prototype distribution
+Copyright (C) 2005 Bernard Wong
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+The copyright owner can be contacted by e-mail at bwong@cs.cornell.edu
+*******************************************************************************/
+
+using namespace std;
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/param.h>
+#include "Common.h"
+#include "EventSet.h"
+
+EventSet::EventSet()
+		: readyPos(0), numWaits(0), numDispatched(0) {
+#ifdef MERIDIAN_EPOLL
+	epollFD = -1;
+	numReady = 0;
+#else
+	FD_ZERO(&readSet);
+	FD_ZERO(&writeSet);
+	FD_ZERO(&curReadSet);
+	FD_ZERO(&curWriteSet);
+	maxFD = -1;
+#endif
+}
+
+EventSet::~EventSet() {
+#ifdef MERIDIAN_EPOLL
+	if (epollFD != -1) {
+		close(epollFD);
+	}
+#endif
+}
+
+const char* EventSet::backendName() {
+#ifdef MERIDIAN_EPOLL
+	return "epoll";
+#else
+	return "select";
+#endif
+}
+
+int EventSet::init() {
+#ifdef MERIDIAN_EPOLL
+	if (epollFD != -1) {
+		return 0;	// Already initialized
+	}
+	//	The size hint is ignored by modern kernels but must be positive
+	if ((epollFD = epoll_create(MAX_READY_EVENTS)) == -1) {
+		perror("Cannot create epoll fd");
+		return -1;
+	}
+#endif
+	return 0;
+}
+
+EventEntry* EventSet::getEntry(int fd) {
+	if (fd < 0 || (u_int)fd >= fdTable.size()) {
+		return NULL;
+	}
+	return &(fdTable[fd]);
+}
+
+int EventSet::updateInterest(int fd, bool newFD) {
+	EventEntry* entry = getEntry(fd);
+	if (entry == NULL) {
+		return -1;
+	}
+#ifdef MERIDIAN_EPOLL
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(struct epoll_event));
+	if (entry->events & EVENT_READ) {
+		ev.events |= EPOLLIN;
+	}
+	if (entry->events & EVENT_WRITE) {
+		ev.events |= EPOLLOUT;
+	}
+	if (!(entry->events & EVENT_LEVEL)) {
+		ev.events |= EPOLLET;
+	}
+	//	Tag the event with the generation, so that readiness reported for
+	//	a previous user of this fd number can be recognized
+	ev.data.u64 = (((uint64_t)entry->gen) << 32) | (uint32_t)fd;
+	if (epoll_ctl(epollFD,
+			newFD ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &ev) == -1) {
+		perror("epoll_ctl");
+		return -1;
+	}
+#else
+	if (entry->events & EVENT_READ) {
+		FD_SET(fd, &readSet);
+	} else {
+		FD_CLR(fd, &readSet);
+		FD_CLR(fd, &curReadSet);
+	}
+	if (entry->events & EVENT_WRITE) {
+		FD_SET(fd, &writeSet);
+	} else {
+		FD_CLR(fd, &writeSet);
+		FD_CLR(fd, &curWriteSet);
+	}
+	maxFD = MAX(maxFD, fd);
+#endif
+	return 0;
+}
+
+int EventSet::addFD(int fd, u_int owner, u_int events) {
+	if (fd < 0 || owner == 0) {
+		return -1;
+	}
+#ifndef MERIDIAN_EPOLL
+	if (fd >= FD_SETSIZE) {
+		ERROR_LOG_1("fd %d exceeds FD_SETSIZE\n", fd);
+		return -1;
+	}
+#endif
+	if ((u_int)fd >= fdTable.size()) {
+		EventEntry emptyEntry = {0, 0, 0};
+		fdTable.resize(fd + 1, emptyEntry);
+	}
+	EventEntry* entry = getEntry(fd);
+	if (entry->owner != 0) {
+		ERROR_LOG_1("fd %d is already registered\n", fd);
+		return -1;
+	}
+	entry->owner = owner;
+	entry->events = events;
+	if (updateInterest(fd, true) == -1) {
+		entry->owner = 0;
+		entry->events = 0;
+		return -1;
+	}
+	return 0;
+}
+
+int EventSet::removeFD(int fd) {
+	EventEntry* entry = getEntry(fd);
+	if (entry == NULL || entry->owner == 0) {
+		return -1;
+	}
+#ifdef MERIDIAN_EPOLL
+	struct epoll_event ev;	// Ignored, but must be non-NULL on old kernels
+	memset(&ev, 0, sizeof(struct epoll_event));
+	epoll_ctl(epollFD, EPOLL_CTL_DEL, fd, &ev);
+#else
+	FD_CLR(fd, &readSet);
+	FD_CLR(fd, &writeSet);
+	FD_CLR(fd, &curReadSet);
+	FD_CLR(fd, &curWriteSet);
+	while (maxFD >= 0 && (u_int)maxFD < fdTable.size() &&
+			(maxFD == fd || fdTable[maxFD].owner == 0)) {
+		maxFD--;
+	}
+#endif
+	entry->owner = 0;
+	entry->events = 0;
+	entry->gen++;
+	return 0;
+}
+
+int EventSet::addEvents(int fd, u_int events) {
+	EventEntry* entry = getEntry(fd);
+	if (entry == NULL || entry->owner == 0) {
+		return -1;
+	}
+	if ((entry->events & events) == events) {
+		return 0;	// Nothing new, avoid the system call
+	}
+	entry->events |= events;
+	return updateInterest(fd, false);
+}
+
+int EventSet::clearEvents(int fd, u_int events) {
+	EventEntry* entry = getEntry(fd);
+	if (entry == NULL || entry->owner == 0) {
+		return -1;
+	}
+	if ((entry->events & events) == 0) {
+		return 0;	// Already cleared
+	}
+	entry->events &= ~events;
+	return updateInterest(fd, false);
+}
+
+int EventSet::wait(struct timeval* timeOutTV) {
+	numWaits++;
+	readyPos = 0;
+#ifdef MERIDIAN_EPOLL
+	int timeoutMS = -1;
+	if (timeOutTV != NULL) {
+		//	Round up, otherwise we wake up just before the timer expires
+		//	and spin until it does
+		timeoutMS = timeOutTV->tv_sec * 1000 +
+			(timeOutTV->tv_usec + 999) / 1000;
+	}
+	numReady = epoll_wait(epollFD, readyEvents, MAX_READY_EVENTS, timeoutMS);
+	if (numReady == -1) {
+		int savedErrno = errno;
+		numReady = 0;
+		errno = savedErrno;
+		return -1;
+	}
+	return numReady;
+#else
+	memcpy(&curReadSet, &readSet, sizeof(fd_set));
+	memcpy(&curWriteSet, &writeSet, sizeof(fd_set));
+	int selectRet = select(maxFD + 1,
+		&curReadSet, &curWriteSet, NULL, timeOutTV);
+	if (selectRet <= 0) {
+		readyPos = maxFD + 1;	// Nothing to retrieve
+	}
+	return selectRet;
+#endif
+}
+
+int EventSet::nextReady(int* fd, u_int* owner, u_int* events) {
+#ifdef MERIDIAN_EPOLL
+	while (readyPos < numReady) {
+		struct epoll_event* ev = &(readyEvents[readyPos++]);
+		int curFD = (int)(ev->data.u64 & 0xffffffff);
+		uint32_t curGen = (uint32_t)(ev->data.u64 >> 32);
+		EventEntry* entry = getEntry(curFD);
+		if (entry == NULL || entry->owner == 0 || entry->gen != curGen) {
+			continue;	// Removed (and possibly reused) since the wait
+		}
+		//	Errors and hangups are reported to whichever side is interested,
+		//	the owner discovers the actual error when it reads or writes
+		u_int ready = 0;
+		if (ev->events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+			ready |= EVENT_READ;
+		}
+		if (ev->events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+			ready |= EVENT_WRITE;
+		}
+		ready &= entry->events;
+		if (ready == 0) {
+			continue;
+		}
+		*fd = curFD;
+		*owner = entry->owner;
+		*events = ready;
+		numDispatched++;
+		return 0;
+	}
+#else
+	for (; readyPos <= maxFD; readyPos++) {
+		u_int ready = 0;
+		if (FD_ISSET(readyPos, &curReadSet)) {
+			ready |= EVENT_READ;
+		}
+		if (FD_ISSET(readyPos, &curWriteSet)) {
+			ready |= EVENT_WRITE;
+		}
+		if (ready == 0) {
+			continue;
+		}
+		EventEntry* entry = getEntry(readyPos);
+		if (entry == NULL || entry->owner == 0) {
+			continue;
+		}
+		ready &= entry->events;
+		if (ready == 0) {
+			continue;
+		}
+		*fd = readyPos;
+		*owner = entry->owner;
+		*events = ready;
+		numDispatched++;
+		readyPos++;
+		return 0;
+	}
+#endif
+	return -1;
+}
@@ -0,0 +1,97 @@
+#ifndef CLASS_EVENT_SET
+#define CLASS_EVENT_SET
+
+//	epoll is used on Linux unless the select fallback is explicitly requested
+//	(configure --enable-select defines MERIDIAN_SELECT)
+#if defined(__linux__) && !defined(MERIDIAN_SELECT)
+#define MERIDIAN_EPOLL
+#endif
+
+#include <stdint.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <vector>
+#ifdef MERIDIAN_EPOLL
+#include <sys/epoll.h>
+#else
+#include <sys/select.h>
+#endif
+
+//	Interest/readiness flags
+#define EVENT_READ			0x1
+#define EVENT_WRITE			0x2
+//	Registration flag: report the fd on every wait while it is ready, rather
+//	than only on transitions (edge-triggered, the default under epoll)
+#define EVENT_LEVEL			0x4
+
+//	Maximum number of ready fds returned by a single wait
+#define MAX_READY_EVENTS	256
+
+//	Per-fd registration state, indexed by fd
+struct EventEntry {
+	u_int		owner;		// Caller supplied tag, 0 means not registered
+	u_int		events;		// EVENT_READ | EVENT_WRITE | EVENT_LEVEL
+	uint32_t	gen;		// Incremented whenever the fd is removed, so
+							// stale readiness of a reused fd is discarded
+};
+
+//	Set of file descriptors the main loop is interested in. Ready fds are
+//	handed back one at a time along with the owner tag given at registration,
+//	so the caller can dispatch straight to the owner instead of scanning
+//	all of its connections. Under epoll, fds are edge-triggered by default
+//	and owners must drain them (read/write until EAGAIN).
+class EventSet {
+private:
+	vector<EventEntry>	fdTable;
+#ifdef MERIDIAN_EPOLL
+	int					epollFD;
+	struct epoll_event	readyEvents[MAX_READY_EVENTS];
+	int					numReady;
+#else
+	fd_set				readSet;
+	fd_set				writeSet;
+	fd_set				curReadSet;		// Result of the last select
+	fd_set				curWriteSet;
+	int					maxFD;
+#endif
+	int					readyPos;		// Position of the next ready entry
+	uint64_t			numWaits;		// Stats
+	uint64_t			numDispatched;
+
+	//	Push the interest of fd to the kernel (epoll) or fd_sets (select)
+	int updateInterest(int fd, bool newFD);
+	EventEntry* getEntry(int fd);
+
+public:
+	EventSet();
+	~EventSet();
+
+	//	Must be called (and succeed) before any other call
+	int init();
+
+	//	Register fd with the given owner tag (must be non-zero) and interest
+	int addFD(int fd, u_int owner, u_int events);
+
+	//	Unregister fd. Must be called before the fd is closed
+	int removeFD(int fd);
+
+	//	Turn on/off read/write interest of an already registered fd
+	int addEvents(int fd, u_int events);
+	int clearEvents(int fd, u_int events);
+
+	//	Wait for readiness or until the timeout. Returns the number of ready
+	//	fds, 0 on timeout and -1 on error (errno is preserved)
+	int wait(struct timeval* timeOutTV);
+
+	//	Retrieve the next ready fd from the last wait. Readiness is masked by
+	//	the current interest, so fds removed or changed by an earlier handler
+	//	in the same iteration are skipped. Returns -1 when no fds remain
+	int nextReady(int* fd, u_int* owner, u_int* events);
+
+	uint64_t getNumWaits() const		{ return numWaits; 		}
+	uint64_t getNumDispatched() const	{ return numDispatched; }
+	static const char* backendName();
+};
+
+#endif
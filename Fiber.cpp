@@ -0,0 +1,190 @@
+/******************************************************************************
+Meridian prototype distribution
+Copyright (C) 2005 Bernard Wong
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+The copyright owner can be contacted by e-mail at bwong@cs.cornell.edu
+*******************************************************************************/
+
+using namespace std;
+
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "Fiber.h"
+
+#ifdef FIBER_UCONTEXT
+void fiber_make(FiberContext* ctx, void* stack, size_t size,
+		FiberEntry entry, void* arg) {
+	getcontext(&(ctx->uc));
+	ctx->uc.uc_link = 0;
+	ctx->uc.uc_stack.ss_sp = stack;
+	ctx->uc.uc_stack.ss_size = size;
+	ctx->uc.uc_stack.ss_flags = 0;
+	makecontext(&(ctx->uc), (void (*)())entry, 1, arg);
+}
+#else
+//	Pushes the callee saved registers and the MXCSR and x87 control words
+//	on the current stack, saves the stack pointer in *save_sp, and pops
+//	the same from load_sp. A new fiber returns into the trampoline, which
+//	calls the entry function left in r12 with the argument left in r13
+__asm__(
+	".text\n"
+	".globl meridian_fiber_swap\n"
+	".type meridian_fiber_swap, @function\n"
+	"meridian_fiber_swap:\n"
+	"	pushq %rbp\n"
+	"	pushq %rbx\n"
+	"	pushq %r12\n"
+	"	pushq %r13\n"
+	"	pushq %r14\n"
+	"	pushq %r15\n"
+	"	subq $8, %rsp\n"
+	"	stmxcsr (%rsp)\n"
+	"	fnstcw 4(%rsp)\n"
+	"	movq %rsp, (%rdi)\n"
+	"	movq %rsi, %rsp\n"
+	"	ldmxcsr (%rsp)\n"
+	"	fldcw 4(%rsp)\n"
+	"	addq $8, %rsp\n"
+	"	popq %r15\n"
+	"	popq %r14\n"
+	"	popq %r13\n"
+	"	popq %r12\n"
+	"	popq %rbx\n"
+	"	popq %rbp\n"
+	"	ret\n"
+	".size meridian_fiber_swap, .-meridian_fiber_swap\n"
+	".type meridian_fiber_start, @function\n"
+	"meridian_fiber_start:\n"
+	"	movq %r13, %rdi\n"
+	"	callq *%r12\n"
+	"	ud2\n"
+	".size meridian_fiber_start, .-meridian_fiber_start\n"
+);
+
+extern "C" void meridian_fiber_start();
+
+//	Default MXCSR (all exceptions masked) and x87 control word
+#define FIBER_INIT_MXCSR		0x1F80
+#define FIBER_INIT_FPU_CW		0x037F
+
+void fiber_make(FiberContext* ctx, void* stack, size_t size,
+		FiberEntry entry, void* arg) {
+	//	Aligned so that entry is called with the stack the ABI expects
+	uintptr_t top = ((uintptr_t)stack + size - 16) & ~((uintptr_t)15);
+	uint64_t* frame = (uint64_t*)top;
+	frame[-1] = (uint64_t)(uintptr_t)&meridian_fiber_start;
+	frame[-2] = 0;							// rbp
+	frame[-3] = 0;							// rbx
+	frame[-4] = (uint64_t)(uintptr_t)entry;	// r12
+	frame[-5] = (uint64_t)(uintptr_t)arg;	// r13
+	frame[-6] = 0;							// r14
+	frame[-7] = 0;							// r15
+	frame[-8] = FIBER_INIT_MXCSR | ((uint64_t)FIBER_INIT_FPU_CW << 32);
+	ctx->sp = &(frame[-8]);
+}
+#endif
+
+void fiber_escape(int sig_num, FiberContext* to) {
+	sigset_t sigSet;
+	sigemptyset(&sigSet);
+	sigaddset(&sigSet, sig_num);
+	sigprocmask(SIG_UNBLOCK, &sigSet, NULL);
+	FiberContext abandoned;
+	fiber_switch(&abandoned, to);
+}
+
+FiberStackPool::FiberStackPool(u_int in_maxFree)
+	: 	pageSize(sysconf(_SC_PAGESIZE)), maxFree(in_maxFree), numInUse(0), 
+		numHits(0), numMisses(0), highWater(0) {}
+
+FiberStackPool::~FiberStackPool() {
+	for (u_int i = 0; i < freeStacks.size(); i++) {
+		unmap(freeStacks[i]);
+	}
+}
+
+//	One pool per thread like the payload pool. Never destroyed, parser
+//	states may still be deleted during exit
+FiberStackPool* FiberStackPool::pool() {
+	static __thread FiberStackPool* stackPool = NULL;
+	if (stackPool == NULL) {
+		stackPool = new FiberStackPool();
+	}
+	return stackPool;
+}
+
+void* FiberStackPool::alloc() {
+	numInUse++;
+	if (!freeStacks.empty()) {
+		numHits++;
+		char* stack = freeStacks.back();
+		freeStacks.pop_back();
+		return stack;
+	}
+	numMisses++;
+	char* base = (char*)mmap(NULL, pageSize + FIBER_STACK, 
+		PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED) {
+		numInUse--;
+		return NULL;
+	}
+	//	Stacks grow down, the guard page is at the bottom
+	if (mprotect(base, pageSize, PROT_NONE) == -1) {
+		munmap(base, pageSize + FIBER_STACK);
+		numInUse--;
+		return NULL;
+	}
+	return base + pageSize;
+}
+
+void FiberStackPool::unmap(char* stack) {
+	munmap(stack - pageSize, pageSize + FIBER_STACK);
+}
+
+//	Pages are only backed once touched, so the lowest resident page is the
+//	deepest the stack has been used since it was mapped
+void FiberStackPool::measure(char* stack) {
+	u_int numPages = (FIBER_STACK + pageSize - 1) / pageSize;
+	vector<u_char> resident(numPages);
+	if (mincore(stack, FIBER_STACK, &(resident[0])) == -1) {
+		return;
+	}
+	for (u_int i = 0; i < numPages; i++) {
+		if (resident[i] & 1) {
+			size_t used = FIBER_STACK - i * pageSize;
+			if (used > highWater) {
+				highWater = used;
+			}
+			return;
+		}
+	}
+}
+
+void FiberStackPool::release(void* stack) {
+	if (stack == NULL) {
+		return;
+	}
+	numInUse--;
+	measure((char*)stack);
+	if (freeStacks.size() < maxFree) {
+		freeStacks.push_back((char*)stack);
+	} else {
+		unmap((char*)stack);
+	}
+}
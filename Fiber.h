@@ -0,0 +1,93 @@
+#ifndef CLASS_FIBER
+#define CLASS_FIBER
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <vector>
+
+//	The register switch below is x86-64 only. It does not maintain the CET
+//	shadow stack, so builds that enable shadow stacks have to define
+//	MERIDIAN_UCONTEXT_FIBERS as well
+#if !defined(__x86_64__) || !defined(__ELF__) || \
+		defined(MERIDIAN_UCONTEXT_FIBERS)
+#define FIBER_UCONTEXT
+#include <ucontext.h>
+#endif
+
+//	Usable stack of each DSL thread. A guard page below it turns an
+//	overflow into a SIGSEGV
+#define FIBER_STACK				(256 * 1024)
+//	Released stacks beyond this many are unmapped instead of kept
+#define FIBER_POOL_MAX_FREE		64
+
+typedef void (*FiberEntry)(void* arg);
+
+//	Execution context of a suspended fiber, or of the scheduler while a
+//	fiber runs
+typedef struct {
+#ifdef FIBER_UCONTEXT
+	ucontext_t	uc;
+#else
+	void*		sp;		// Saved registers are on the stack
+#endif
+} FiberContext;
+
+//	Sets up ctx to call entry(arg) on the given stack the first time it is
+//	switched to. entry must never return
+extern void fiber_make(FiberContext* ctx, void* stack, size_t size,
+	FiberEntry entry, void* arg);
+
+#ifdef FIBER_UCONTEXT
+inline void fiber_switch(FiberContext* from, FiberContext* to) {
+	swapcontext(&(from->uc), &(to->uc));
+}
+#else
+extern "C" void meridian_fiber_swap(void** save_sp, void* load_sp);
+
+//	Saves the current context in from and resumes to. Only the callee saved
+//	registers and the floating point control words are switched, unlike
+//	swapcontext there is no system call for the signal mask
+inline void fiber_switch(FiberContext* from, FiberContext* to) {
+	meridian_fiber_swap(&(from->sp), to->sp);
+}
+#endif
+
+//	Resumes to from a handler of sig_num running on a fiber, abandoning the
+//	fiber. Unblocks sig_num, which fiber_switch would leave blocked
+extern void fiber_escape(int sig_num, FiberContext* to);
+
+//	Stacks of the DSL threads. Each is mapped with a guard page and kept for
+//	reuse when its thread ends, so a new query neither maps a fresh stack
+//	nor faults its pages in again. Not thread safe, one pool per thread
+class FiberStackPool {
+private:
+	vector<char*>	freeStacks;		// Lowest usable address of each
+	size_t			pageSize;
+	u_int			maxFree;
+	u_int			numInUse;
+	uint64_t		numHits;		// Reused a stack
+	uint64_t		numMisses;		// Had to map a new one
+	size_t			highWater;		// Deepest use of any stack in bytes
+
+	void measure(char* stack);
+	void unmap(char* stack);
+public:
+	FiberStackPool(u_int in_maxFree = FIBER_POOL_MAX_FREE);
+	~FiberStackPool();
+
+	//	Returns the lowest address of FIBER_STACK usable bytes, or NULL
+	void* alloc();
+	void release(void* stack);
+
+	static FiberStackPool* pool();
+
+	u_int getNumInUse() const		{ return numInUse;			}
+	u_int getNumFree() const		{ return freeStacks.size();	}
+	uint64_t getNumHits() const		{ return numHits;			}
+	uint64_t getNumMisses() const	{ return numMisses;			}
+	//	Page granularity, counted when stacks are released
+	size_t getHighWater() const		{ return highWater;			}
+};
+
+#endif
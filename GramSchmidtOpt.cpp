@@ -27,74 +27,283 @@ using namespace std;
 #include <vector>
 #include "GramSchmidtOpt.h"
 
+#ifdef MERIDIAN_CBLAS
 extern "C" {
 	#include <cblas-atlas.h>
 }
+#elif defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GS_AVX2
+#endif
 
-int GramSchmidtOpt::addVector(double* inVector) {
-	if (numRows >= gsSize) {
-		return 0;
+//	For each of the n rows, dots[j] = rows[j] . q
+static void multiDotPlain(
+		const double* q, double** rows, int n, int size, double* dots) {
+	for (int j = 0; j < n; j++) {
+		dots[j] = 0.0;
 	}
+	for (int i = 0; i < size; i++) {
+		for (int j = 0; j < n; j++) {
+			dots[j] += rows[j][i] * q[i];
+		}
+	}
+}
 
-	cblas_dcopy(gsSize, inVector, 1, &orthVectors[numRows * gsSize], 1);
+//	For each of the n rows, rows[j] -= dots[j] * q
+static void multiSubPlain(
+		const double* q, double** rows, int n, int size, const double* dots) {
+	for (int i = 0; i < size; i++) {
+		for (int j = 0; j < n; j++) {
+			rows[j][i] -= dots[j] * q[i];
+		}
+	}
+}
 
-	if (numRows > 0) {
-		for (int i = 0; i < numRows; i++) {
-			double topValue = 
-				cblas_ddot(gsSize, inVector, 1, &orthVectors[i * gsSize], 1);
+#ifdef MERIDIAN_CBLAS
+//	Only used on single rows, the finished rows are removed by projectOut
+static void multiDot(
+		const double* q, double** rows, int n, int size, double* dots) {
+	for (int j = 0; j < n; j++) {
+		dots[j] = cblas_ddot(size, rows[j], 1, q, 1);
+	}
+}
 
-			cblas_daxpy(gsSize,
-				-1.0 * topValue, &orthVectors[i * gsSize], 1, 
-				&orthVectors[numRows * gsSize], 1);
-		}	
+static void multiSub(
+		const double* q, double** rows, int n, int size, const double* dots) {
+	for (int j = 0; j < n; j++) {
+		cblas_daxpy(size, -dots[j], q, 1, rows[j], 1);
 	}
+}
 
-	for (int i = 0; i < gsSize; i++) {
-		if (orthVectors[numRows * gsSize + i] != 0.0) {	
-			cblas_dscal(gsSize, 
-				1.0 / cblas_dnrm2(gsSize, &orthVectors[numRows * gsSize], 1), 
-				&orthVectors[numRows * gsSize], 1);
-			numRows++;
-			break;
+//	Remove from row its components along the numPrev rows of the row major
+//	matrix Q: c = Q row, then row -= Q^T c. Two dgemv for every 
+//	GS_CBLAS_ROWS rows of Q, each chunk removed before the next is read
+static void projectOut(
+		const double* matrix, int numPrev, int size, double* row) {
+	double coeffs[GS_CBLAS_ROWS];
+	for (int p = 0; p < numPrev; p += GS_CBLAS_ROWS) {
+		int numRows = numPrev - p;
+		if (numRows > GS_CBLAS_ROWS) {
+			numRows = GS_CBLAS_ROWS;
 		}
+		const double* q = &(matrix[p * size]);
+		cblas_dgemv(CblasRowMajor, CblasNoTrans, numRows, size, 1.0, 
+			q, size, row, 1, 0.0, coeffs, 1);
+		cblas_dgemv(CblasRowMajor, CblasTrans, numRows, size, -1.0, 
+			q, size, coeffs, 1, 1.0, row, 1);
 	}
-	return 0;
+}
+#elif defined(GS_AVX2)
+__attribute__((target("avx2,fma")))
+static double horizontalSum(__m256d v) {
+	__m128d sum = _mm_add_pd(
+		_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+	return _mm_cvtsd_f64(_mm_add_sd(sum, _mm_unpackhi_pd(sum, sum)));
 }
 
-double* GramSchmidtOpt::returnOrth(int* retRows) {
-	*retRows = numRows;
-	return orthVectors;
+__attribute__((target("avx2,fma")))
+static void multiDotAVX2(
+		const double* q, double** rows, int n, int size, double* dots) {
+	if (n != GS_BLOCK_ROWS) {
+		multiDotPlain(q, rows, n, size, dots);
+		return;
+	}
+	__m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+	__m256d acc2 = _mm256_setzero_pd(), acc3 = _mm256_setzero_pd();
+	int i = 0;
+	for (; i + 4 <= size; i += 4) {
+		__m256d qv = _mm256_loadu_pd(q + i);
+		acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(rows[0] + i), qv, acc0);
+		acc1 = _mm256_fmadd_pd(_mm256_loadu_pd(rows[1] + i), qv, acc1);
+		acc2 = _mm256_fmadd_pd(_mm256_loadu_pd(rows[2] + i), qv, acc2);
+		acc3 = _mm256_fmadd_pd(_mm256_loadu_pd(rows[3] + i), qv, acc3);
+	}
+	dots[0] = horizontalSum(acc0);
+	dots[1] = horizontalSum(acc1);
+	dots[2] = horizontalSum(acc2);
+	dots[3] = horizontalSum(acc3);
+	for (; i < size; i++) {
+		for (int j = 0; j < GS_BLOCK_ROWS; j++) {
+			dots[j] += rows[j][i] * q[i];
+		}
+	}
 }
 
-#if 0
-int main() {
-	GramSchmidtOpt gs(3);
+__attribute__((target("avx2,fma")))
+static void multiSubAVX2(
+		const double* q, double** rows, int n, int size, const double* dots) {
+	if (n != GS_BLOCK_ROWS) {
+		multiSubPlain(q, rows, n, size, dots);
+		return;
+	}
+	__m256d d0 = _mm256_set1_pd(dots[0]), d1 = _mm256_set1_pd(dots[1]);
+	__m256d d2 = _mm256_set1_pd(dots[2]), d3 = _mm256_set1_pd(dots[3]);
+	int i = 0;
+	for (; i + 4 <= size; i += 4) {
+		__m256d qv = _mm256_loadu_pd(q + i);
+		_mm256_storeu_pd(rows[0] + i, 
+			_mm256_fnmadd_pd(d0, qv, _mm256_loadu_pd(rows[0] + i)));
+		_mm256_storeu_pd(rows[1] + i, 
+			_mm256_fnmadd_pd(d1, qv, _mm256_loadu_pd(rows[1] + i)));
+		_mm256_storeu_pd(rows[2] + i, 
+			_mm256_fnmadd_pd(d2, qv, _mm256_loadu_pd(rows[2] + i)));
+		_mm256_storeu_pd(rows[3] + i, 
+			_mm256_fnmadd_pd(d3, qv, _mm256_loadu_pd(rows[3] + i)));
+	}
+	for (; i < size; i++) {
+		for (int j = 0; j < GS_BLOCK_ROWS; j++) {
+			rows[j][i] -= dots[j] * q[i];
+		}
+	}
+}
 
-	double a[3] = {1.0, -1.0, 1.0};
-	double b[3] = {2.0, 2.0, -2.0};
+static bool detectAVX2() {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
 
-	gs.addVector((double*)&a);
-	gs.addVector((double*)&b);
+static bool haveAVX2() {
+	static const bool supported = detectAVX2();	// Once, thread safe
+	return supported;
+}
 
-	vector<double*>* vv = gs.returnOrth();
+static void multiDot(
+		const double* q, double** rows, int n, int size, double* dots) {
+	if (haveAVX2()) {
+		multiDotAVX2(q, rows, n, size, dots);
+	} else {
+		multiDotPlain(q, rows, n, size, dots);
+	}
+}
 
-	printf("[");
-	for (u_int i = 0; i < vv->size(); i++) {
-		for (u_int j = 0; j < 3; j++) {
-			printf("%f ", ((*vv)[i])[j]);
-		}
-		printf(";\n");
+static void multiSub(
+		const double* q, double** rows, int n, int size, const double* dots) {
+	if (haveAVX2()) {
+		multiSubAVX2(q, rows, n, size, dots);
+	} else {
+		multiSubPlain(q, rows, n, size, dots);
 	}
-	printf("]\n");
+}
+#else
+static void multiDot(
+		const double* q, double** rows, int n, int size, double* dots) {
+	multiDotPlain(q, rows, n, size, dots);
+}
 
-	double a1, a2, b1, b2;
-	a1 = cblas_ddot(3, (double*)&a, 1, (*vv)[0], 1);
-	a2 = cblas_ddot(3, (double*)&a, 1, (*vv)[1], 1);
+static void multiSub(
+		const double* q, double** rows, int n, int size, const double* dots) {
+	multiSubPlain(q, rows, n, size, dots);
+}
+#endif
 
-	b1 = cblas_ddot(3, (double*)&b, 1, (*vv)[0], 1);
-	b2 = cblas_ddot(3, (double*)&b, 1, (*vv)[1], 1);
+const char* GramSchmidtOpt::kernelName() {
+#ifdef MERIDIAN_CBLAS
+	return "cblas";
+#elif defined(GS_AVX2)
+	return haveAVX2() ? "avx2" : "plain";
+#else
+	return "plain";
+#endif
+}
 
-	printf("A = [%f %f; %f %f];\n", a1, a2, b1, b2);
-	return 0;
+//	Normalize row, returns its norm or 0 if it is below minNorm (the row
+//	is then zeroed)
+static double normalizeRow(double* row, int size, double minNorm) {
+	double* rows[1] = {row};
+	double norm;
+	multiDot(row, rows, 1, size, &norm);
+	norm = sqrt(norm);
+	if (norm <= minNorm || norm == 0.0) {
+		for (int i = 0; i < size; i++) {
+			row[i] = 0.0;
+		}
+		return 0.0;
+	}
+	double scale = 1.0 / norm;
+	for (int i = 0; i < size; i++) {
+		row[i] *= scale;
+	}
+	return norm;
 }
+
+int GramSchmidtOpt::orthogonalizeRows(double* matrix, int numRows, 
+		int rowSize, double* norms, double relEps) {
+	int rank = 0;
+	for (int b = 0; b < numRows; b += GS_BLOCK_ROWS) {
+		int blockSize = numRows - b;
+		if (blockSize > GS_BLOCK_ROWS) {
+			blockSize = GS_BLOCK_ROWS;
+		}
+		double* rows[GS_BLOCK_ROWS];
+		double dots[GS_BLOCK_ROWS];
+		for (int j = 0; j < blockSize; j++) {
+			rows[j] = &(matrix[(b + j) * rowSize]);
+			//	Original norms, to detect dependent rows
+			multiDot(rows[j], &(rows[j]), 1, rowSize, &(norms[b + j]));
+			norms[b + j] = sqrt(norms[b + j]);
+		}
+		//	Remove the components along all the finished rows, one
+		//	finished row at a time for the whole block (modified GS). 
+		//	With cblas, all of them at once for each row of the block,
+		//	dependent rows are zeroed so they remove nothing
+#ifdef MERIDIAN_CBLAS
+		for (int j = 0; j < blockSize; j++) {
+			projectOut(matrix, b, rowSize, rows[j]);
+		}
+#else
+		for (int p = 0; p < b; p++) {
+			if (norms[p] == 0.0) {
+				continue;	// Dependent row, zeroed
+			}
+			const double* q = &(matrix[p * rowSize]);
+			multiDot(q, rows, blockSize, rowSize, dots);
+			multiSub(q, rows, blockSize, rowSize, dots);
+		}
 #endif
+		//	Then within the block
+		for (int j = 0; j < blockSize; j++) {
+			for (int p = 0; p < j; p++) {
+				if (norms[b + p] == 0.0) {
+					continue;
+				}
+				multiDot(rows[p], &(rows[j]), 1, rowSize, dots);
+				multiSub(rows[p], &(rows[j]), 1, rowSize, dots);
+			}
+			norms[b + j] = 
+				normalizeRow(rows[j], rowSize, norms[b + j] * relEps);
+			if (norms[b + j] != 0.0) {
+				rank++;
+			}
+		}
+	}
+	return rank;
+}
+
+int GramSchmidtOpt::addVector(double* inVector) {
+	if (numRows >= gsSize) {
+		return 0;
+	}
+	double* curRow = &orthVectors[numRows * gsSize];
+	for (int i = 0; i < gsSize; i++) {
+		curRow[i] = inVector[i];
+	}
+	//	Classical GS against the input, as before: the orthogonal rows are
+	//	all non-zero, only the new row is updated
+	double* rows[1] = {curRow};
+	for (int p = 0; p < numRows; p++) {
+		const double* q = &orthVectors[p * gsSize];
+		double dot;
+		double* inRows[1] = {inVector};
+		multiDot(q, inRows, 1, gsSize, &dot);
+		multiSub(q, rows, 1, gsSize, &dot);
+	}
+	if (normalizeRow(curRow, gsSize, 0.0) != 0.0) {
+		numRows++;
+	}
+	return 0;
+}
+
+double* GramSchmidtOpt::returnOrth(int* retRows) {
+	*retRows = numRows;
+	return orthVectors;
+}
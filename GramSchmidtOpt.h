@@ -3,23 +3,54 @@
 
 #include "Common.h"
 
+//	Rows orthogonalized together. Each previous row is then read once per
+//	block instead of once per row
+#define GS_BLOCK_ROWS	4
+
+//	Finished rows projected out of a row by each pair of cblas_dgemv
+#define GS_CBLAS_ROWS	64
+
+//	Gram-Schmidt orthogonalization. The dot product and update kernels use
+//	cblas when configure found it (MERIDIAN_CBLAS), otherwise AVX2 when the
+//	CPU supports it, otherwise plain C
 class GramSchmidtOpt {
 private:
 	double* orthVectors;
 	int gsSize, numRows;
+	bool ownVectors;		// orthVectors was malloc'ed by us
 
 public:
-	GramSchmidtOpt(int size) : gsSize(size) {
+	GramSchmidtOpt(int size) : gsSize(size), ownVectors(true) {
 		numRows = 0;
 		orthVectors = (double*)malloc(sizeof(double) * gsSize * gsSize);
 	}
 
+	//	Use the caller's workspace of at least size * size doubles
+	GramSchmidtOpt(int size, double* workspace) 
+		: orthVectors(workspace), gsSize(size), numRows(0), 
+		  ownVectors(false) {}
+
 	int addVector(double* inVector);
 	double* returnOrth(int* retRows);
 
 	~GramSchmidtOpt() {
-		free(orthVectors);
+		if (ownVectors) {
+			free(orthVectors);
+		}
 	}
+
+	//	Batch interface. Orthonormalizes the rows of the row major matrix
+	//	(numRows x rowSize) in place with blocked modified Gram-Schmidt.
+	//	norms[i] is set to the norm of row i once its components along the
+	//	previous rows are removed, i.e. the diagonal of R in the QR of the
+	//	transposed matrix. A row whose norm drops to relEps times its
+	//	original norm is linearly dependent, it is zeroed and its norm set
+	//	to 0. No memory is allocated. Returns the rank
+	static int orthogonalizeRows(double* matrix, int numRows, int rowSize,
+		double* norms, double relEps);
+
+	//	Name of the kernel in use, for benchmarks
+	static const char* kernelName();
 };
 
 #endif
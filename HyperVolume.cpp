@@ -0,0 +1,180 @@
+/******************************************************************************
+Meridian prototype distribution
+Copyright (C) 2005 Bernard Wong
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+The copyright owner can be contacted by e-mail at bwong@cs.cornell.edu
+*******************************************************************************/
+
+using namespace std;
+
+#include <math.h>
+#include "Common.h"
+#include "GramSchmidtOpt.h"
+#include "HyperVolume.h"
+
+//	log(k!). Not lgamma, which sets the global signgam and races when
+//	volumes are computed from several threads
+static double logFactorial(int k) {
+	double sum = 0.0;
+	for (int i = 2; i <= k; i++) {
+		sum += log((double)i);
+	}
+	return sum;
+}
+
+double HyperVolume::directLogVolume(
+		const double* matrix, int N, int n, int skip) {
+	//	Nodes in use, the last one is the anchor all edges start from
+	nodes.resize(n);
+	int m = 0;
+	for (int i = 0; i < n; i++) {
+		if (i != skip) {
+			nodes[m++] = i;
+		}
+	}
+	if (m < 1) {
+		return -HUGE_VAL;
+	}
+	int numEdges = m - 1;
+	int anchor = nodes[m - 1];
+	orthEdges.resize(numEdges * m);
+	edgeNorms.resize(numEdges);
+	for (int i = 0; i < numEdges; i++) {
+		for (int j = 0; j < m; j++) {
+			orthEdges[i * m + j] = matrix[nodes[i] * N + nodes[j]] -
+				matrix[anchor * N + nodes[j]];
+		}
+	}
+	//	The volume of the parallelotope is the product of the diagonal of R
+	if (numEdges > 0 && GramSchmidtOpt::orthogonalizeRows(&(orthEdges[0]), 
+			numEdges, m, &(edgeNorms[0]), HV_DEGENERATE_EPS) < numEdges) {
+		return -HUGE_VAL;
+	}
+	double logVolume = 0.0;
+	for (int i = 0; i < numEdges; i++) {
+		logVolume += log(edgeNorms[i]);
+	}
+	//	The simplex is 1/k! of the parallelotope spanned by its k edges
+	return logVolume - logFactorial(numEdges);
+}
+
+int HyperVolume::logVolumesWithout(
+		const double* matrix, int N, int n, double* logVolumes) {
+	if (n < 1 || n > N) {
+		return -1;
+	}
+	int k = n - 1;	// Edges, from every node to the anchor (the last node)
+	int anchor = n - 1;
+	if (k < 2) {
+		for (int c = 0; c < n; c++) {
+			logVolumes[c] = directLogVolume(matrix, N, n, c);
+		}
+		return 0;
+	}
+	edges.resize(k * n);
+	for (int i = 0; i < k; i++) {
+		for (int j = 0; j < n; j++) {
+			edges[i * n + j] = matrix[i * N + j] - matrix[anchor * N + j];
+		}
+	}
+	//	Cholesky factor L of the Gram matrix G = E * E^T, lower triangle
+	gram.resize(k * k);
+	double logDetGram = 0.0;
+	bool singular = false;
+	for (int i = 0; i < k && !singular; i++) {
+		for (int j = 0; j <= i; j++) {
+			double sum = 0.0;
+			for (int x = 0; x < n; x++) {
+				sum += edges[i * n + x] * edges[j * n + x];
+			}
+			double diag = sum;	// G(i, i) before elimination
+			for (int p = 0; p < j; p++) {
+				sum -= gram[i * k + p] * gram[j * k + p];
+			}
+			if (j < i) {
+				gram[i * k + j] = sum / gram[j * k + j];
+			} else if (sum <= diag * HV_DEGENERATE_EPS || sum <= 0.0) {
+				singular = true;
+			} else {
+				gram[i * k + i] = sqrt(sum);
+				logDetGram += log(sum);
+			}
+		}
+	}
+	if (singular) {
+		//	The full set is degenerate, some subsets may not be
+		for (int c = 0; c < n; c++) {
+			logVolumes[c] = directLogVolume(matrix, N, n, c);
+		}
+		return 0;
+	}
+	//	W = L^-1, so that G^-1 = W^T * W
+	gramInv.assign(k * k, 0.0);
+	for (int j = 0; j < k; j++) {
+		gramInv[j * k + j] = 1.0 / gram[j * k + j];
+		for (int i = j + 1; i < k; i++) {
+			double sum = 0.0;
+			for (int p = j; p < i; p++) {
+				sum += gram[i * k + p] * gramInv[p * k + j];
+			}
+			gramInv[i * k + j] = -sum / gram[i * k + i];
+		}
+	}
+	work.resize(2 * k);
+	double* y = &(work[0]);
+	double* d = &(work[k]);
+	double logFactorialK = logFactorial(k - 1);	// Edges left after removal
+	//	Removing node c (not the anchor) removes coordinate c from every
+	//	edge, G' = G - d * d^T where d is column c of E, and then removes
+	//	edge c. With u = G^-1 * d,
+	//		det(G') = det(G) * (1 - d^T * u)
+	//		det(G' without c) = det(G') * G'^-1(c, c)
+	//		G'^-1(c, c) = G^-1(c, c) + u(c)^2 / (1 - d^T * u)
+	//	so det(G' without c) / det(G) = (1 - d^T * u) * G^-1(c, c) + u(c)^2
+	for (int c = 0; c < k; c++) {
+		for (int i = 0; i < k; i++) {
+			d[i] = edges[i * n + c];
+		}
+		double dGd = 0.0;	// d^T * G^-1 * d = |W * d|^2
+		for (int i = 0; i < k; i++) {
+			double sum = 0.0;
+			for (int p = 0; p <= i; p++) {
+				sum += gramInv[i * k + p] * d[p];
+			}
+			y[i] = sum;
+			dGd += sum * sum;
+		}
+		double uc = 0.0;	// u(c) = (W^T * y)(c)
+		double invDiag = 0.0;	// G^-1(c, c)
+		for (int i = c; i < k; i++) {
+			uc += gramInv[i * k + c] * y[i];
+			invDiag += gramInv[i * k + c] * gramInv[i * k + c];
+		}
+		double rest = 1.0 - dGd;
+		if (rest < 1e-6) {
+			//	Coordinate c carries almost all of the volume, too much
+			//	cancellation to trust the update
+			logVolumes[c] = directLogVolume(matrix, N, n, c);
+			continue;
+		}
+		double ratio = rest * invDiag + uc * uc;
+		logVolumes[c] = 0.5 * (logDetGram + log(ratio)) - logFactorialK;
+	}
+	//	Removing the anchor changes every edge, compute it directly
+	logVolumes[anchor] = directLogVolume(matrix, N, n, anchor);
+	return 0;
+}
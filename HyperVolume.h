@@ -0,0 +1,50 @@
+#ifndef CLASS_HYPER_VOLUME
+#define CLASS_HYPER_VOLUME
+
+#include <vector>
+
+//	Relative size below which an orthogonalized edge is considered zero,
+//	i.e. the points are degenerate and the volume is 0
+#define HV_DEGENERATE_EPS	1e-12
+
+//	Volume of the simplex spanned by a set of nodes, where each node is a
+//	point whose coordinates are its latencies to the other nodes of the set.
+//	The points are given by a row major latency matrix with a row stride of
+//	N, the first n rows and columns of which are in use. Volumes are
+//	returned as natural logs, as they easily overflow a double on large
+//	rings, and are -HUGE_VAL if the points are degenerate.
+//	The buffers are kept from call to call, so a single object should be
+//	reused for all the computations of a ring replacement.
+class HyperVolume {
+private:
+	vector<double>	edges;		// Edge vectors to the anchor node, row major
+	vector<double>	gram;		// Cholesky factor of the edge Gram matrix
+	vector<double>	gramInv;	// Inverse of the Cholesky factor
+	vector<double>	work;
+	vector<double>	orthEdges;	// Used by directLogVolume only
+	vector<double>	edgeNorms;
+	vector<int>		nodes;
+
+	//	Log volume computed from scratch through a QR (modified Gram-Schmidt)
+	//	of the edge matrix, leaving out node skip (-1 for none)
+	double directLogVolume(const double* matrix, int N, int n, int skip);
+
+public:
+	//	Log volume of the simplex of the first n nodes
+	double logVolume(const double* matrix, int N, int n) {
+		return directLogVolume(matrix, N, n, -1);
+	}
+
+	//	For each of the first n nodes, the log volume of the simplex of the
+	//	n - 1 other nodes with its row and column removed. This is what
+	//	the ring replacement evaluates for every candidate, and costs about
+	//	as much as a single logVolume: removing a node downdates the Gram
+	//	matrix of the full set by one rank (its coordinate) and drops one
+	//	row and column (its edge), both of which are folded into the
+	//	determinant through the inverse of the Cholesky factor.
+	//	Returns -1 on error
+	int logVolumesWithout(
+		const double* matrix, int N, int n, double* logVolumes);
+};
+
+#endif
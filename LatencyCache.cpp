@@ -21,47 +21,138 @@ The copyright owner can be contacted by e-mail at bwong@cs.cornell.edu
 
 using namespace std;
 
-#include "QueryTable.h"
+#include <time.h>
 #include "LatencyCache.h"
 
+LatencyCache::LatencyCache(u_int in_maxSize, u_int in_periodUS) 
+		: head(LATENCY_CACHE_NIL), tail(LATENCY_CACHE_NIL), 
+		  freeHead(LATENCY_CACHE_NIL), numEntries(0), 
+		  maxSize(in_maxSize), periodUS(in_periodUS), sharedTable(NULL) {
+	//	Keep the hash index at most half full
+	u_int hashSize = 2;
+	hashShift = 63;
+	while (hashSize < 2 * maxSize) {
+		hashSize <<= 1;
+		hashShift--;
+	}
+	hashMask = hashSize - 1;
+	hashIndex.resize(hashSize, LATENCY_CACHE_NIL);
+	entries.resize(maxSize);
+	//	Chain all entries into the free list
+	for (u_int i = 0; i < maxSize; i++) {
+		entries[i].next = freeHead;
+		freeHead = i;
+	}
+}
+
 LatencyCache::~LatencyCache() {
-	//	Not the fastest way, but speed doesn't really matter
-	//	Push all entries into allEntries vector
-	vector<NodeIdent> allEntries;
-	map<NodeIdent, pair<struct timeval, uint32_t>*, ltNodeIdent>::iterator
-		it = latencyMap.begin();
-	for (; it != latencyMap.end(); it++) {
-		allEntries.push_back(it->first);						
-	}
-	// Iterate through all entries vector and call eraseEntry
-	for (u_int i = 0; i < allEntries.size(); i++) {
-		eraseEntry(allEntries[i]);	
-	}
-	assert(timeoutMap.size() == 0);
-	assert(latencyMap.size() == 0);
+	if (sharedTable) {
+		delete sharedTable;
+	}
+}
+
+int LatencyCache::attachShared(const char* name) {
+	if (sharedTable != NULL || maxSize == 0) {
+		return -1;
+	}
+	//	Room for the working sets of several processes
+	SharedLatencyTable* newTable = new SharedLatencyTable();
+	if (newTable->attach(name, 4 * (hashMask + 1)) == -1) {
+		delete newTable;
+		return -1;
+	}
+	sharedTable = newTable;
+	return 0;
+}
+
+uint64_t LatencyCache::coarseTimeMS() {
+	struct timespec curTS;
+#ifdef CLOCK_MONOTONIC_COARSE
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &curTS);
+#else
+	clock_gettime(CLOCK_MONOTONIC, &curTS);
+#endif
+	return ((uint64_t)curTS.tv_sec) * 1000 + curTS.tv_nsec / 1000000;
+}
+
+u_int LatencyCache::findSlot(const NodeIdent& inNode) const {
+	for (u_int slot = homeSlot(inNode); ; slot = (slot + 1) & hashMask) {
+		u_int pos = hashIndex[slot];
+		if (pos == LATENCY_CACHE_NIL) {
+			return LATENCY_CACHE_NIL;
+		}
+		if (entries[pos].node.addr == inNode.addr && 
+				entries[pos].node.port == inNode.port) {
+			return slot;
+		}
+	}
+}
+
+void LatencyCache::unlinkEntry(u_int pos) {
+	LatencyEntry* curEntry = &(entries[pos]);
+	if (curEntry->prev != LATENCY_CACHE_NIL) {
+		entries[curEntry->prev].next = curEntry->next;
+	} else {
+		head = curEntry->next;
+	}
+	if (curEntry->next != LATENCY_CACHE_NIL) {
+		entries[curEntry->next].prev = curEntry->prev;
+	} else {
+		tail = curEntry->prev;
+	}
 }
 
+void LatencyCache::appendEntry(u_int pos) {
+	LatencyEntry* curEntry = &(entries[pos]);
+	curEntry->prev = tail;
+	curEntry->next = LATENCY_CACHE_NIL;
+	if (tail != LATENCY_CACHE_NIL) {
+		entries[tail].next = pos;
+	} else {
+		head = pos;
+	}
+	tail = pos;
+}
+
+//	Remove the entry referenced by the hash slot and return it to the
+//	free list
+void LatencyCache::removeEntry(u_int slot) {
+	u_int pos = hashIndex[slot];
+	unlinkEntry(pos);
+	entries[pos].next = freeHead;
+	freeHead = pos;
+	numEntries--;
+	//	Shift following entries back into the hole, no tombstones
+	u_int hole = slot;
+	for (u_int cur = (hole + 1) & hashMask; 
+			hashIndex[cur] != LATENCY_CACHE_NIL; cur = (cur + 1) & hashMask) {
+		u_int home = homeSlot(entries[hashIndex[cur]].node);
+		if (((cur - home) & hashMask) >= ((cur - hole) & hashMask)) {
+			hashIndex[hole] = hashIndex[cur];
+			hole = cur;
+		}
+	}
+	hashIndex[hole] = LATENCY_CACHE_NIL;
+}
 
 int LatencyCache::getLatency(const NodeIdent& inNode, uint32_t* latencyUS) {
-	map<NodeIdent, pair<struct timeval, uint32_t>*, ltNodeIdent>::iterator
-		findIt = latencyMap.find(inNode);
-	if (findIt != latencyMap.end()) {
-		//	Get current normalized time
-		struct timeval curTime;
-		gettimeofday(&curTime, NULL);
-		QueryTable::normalizeTime(curTime);
-		//	Get timeout time of entry
-		struct timeval s1 = findIt->second->first;			
-		if ((s1.tv_sec < curTime.tv_sec) || 
-				((s1.tv_sec == curTime.tv_sec) && 
-				(s1.tv_usec <= curTime.tv_usec))) {
-			//	Timed out. Don't even bother to remove
-			return -1;	
-		}					
-		*latencyUS = findIt->second->second;
-		return 0;
+	if (maxSize == 0) {
+		return -1;
+	}
+	if (sharedTable) {
+		return sharedTable->lookup(inNode, coarseTimeMS(), latencyUS);
+	}
+	u_int slot = findSlot(inNode);
+	if (slot == LATENCY_CACHE_NIL) {
+		return -1;
 	}
-	return -1;
+	LatencyEntry* curEntry = &(entries[hashIndex[slot]]);
+	if (curEntry->expireMS <= coarseTimeMS()) {
+		//	Timed out. Don't even bother to remove
+		return -1;	
+	}
+	*latencyUS = curEntry->latencyUS;
+	return 0;
 }
 
 int LatencyCache::insertMeasurement(
@@ -69,73 +160,85 @@ int LatencyCache::insertMeasurement(
 	if (maxSize == 0) {
 		return 0;
 	}
-	//	Remove existing measurements of this node
-	if (eraseEntry(inNode) == -1) {
-		return -1;	// Error on removing node, just return
-	}		
-	if (latencyMap.size() >= maxSize) {			
-		//	Erase oldest entry. There should always be at least
-		//	one entry in a vector
-		NodeIdent tmp = (*((timeoutMap.begin())->second))[0];
-		eraseEntry(tmp);
-	}		
-	//	Get the next timeout
-	struct timeval curTime, nextTimeOut;
-	gettimeofday(&curTime, NULL);	
-	struct timeval offsetTV = 
-			{ periodUS / MICRO_IN_SECOND, periodUS % MICRO_IN_SECOND}; 			
-	timeradd(&curTime, &offsetTV, &nextTimeOut);
-	QueryTable::normalizeTime(nextTimeOut);
-	//	See if the timeout is already there. If it is, add to the vector
-	//	If not, create a new vector
-	map<struct timeval, vector<NodeIdent>*, timevalLT>::iterator 
-		findIt = timeoutMap.find(nextTimeOut);
-	if (findIt != timeoutMap.end()) {
-		findIt->second->push_back(inNode);
+	uint64_t curMS = coarseTimeMS();
+	if (sharedTable) {
+		sharedTable->publish(inNode, latencyUS, curMS, curMS + periodUS / 1000);
+		return 0;
+	}
+	return insertEntry(inNode, latencyUS, curMS, curMS + periodUS / 1000);
+}
+
+int LatencyCache::insertEntry(const NodeIdent& inNode, uint32_t latencyUS,
+		uint64_t curMS, uint64_t expireMS) {
+	//	Drop expired entries, they are all at the front of the list
+	while (head != LATENCY_CACHE_NIL && entries[head].expireMS <= curMS) {
+		removeEntry(findSlot(entries[head].node));
+	}
+	u_int pos;
+	u_int slot = findSlot(inNode);
+	if (slot != LATENCY_CACHE_NIL) {
+		//	Replace existing measurement of this node
+		pos = hashIndex[slot];
+		unlinkEntry(pos);
 	} else {
-		vector<NodeIdent>* tmpVect = new vector<NodeIdent>();
-		tmpVect->push_back(inNode);
-		timeoutMap[nextTimeOut] = tmpVect;	
+		if (numEntries >= maxSize) {
+			removeEntry(findSlot(entries[head].node));	// Evict oldest
+		}
+		pos = freeHead;
+		freeHead = entries[pos].next;
+		numEntries++;
+		entries[pos].node = inNode;
+		for (slot = homeSlot(inNode); hashIndex[slot] != LATENCY_CACHE_NIL; 
+				slot = (slot + 1) & hashMask);
+		hashIndex[slot] = pos;
 	}
-	//	Add the new pair into the latencyMap
-	latencyMap[inNode] 
-		= new pair<struct timeval, uint32_t>(nextTimeOut, latencyUS);
+	entries[pos].latencyUS = latencyUS;
+	entries[pos].expireMS = expireMS;
+	appendEntry(pos);
 	return 0;
 }
-	
-int LatencyCache::eraseEntry(const NodeIdent& inNode) {
-	map<NodeIdent, pair<struct timeval, uint32_t>*, ltNodeIdent>::iterator
-		findIt = latencyMap.find(inNode);
-	if (findIt != latencyMap.end()) {
-		//	Get the pair that contains the latency and timeout info
-		pair<struct timeval, uint32_t>* curPair = findIt->second;
-		//	We can remove the entry from latencyMap now
-		latencyMap.erase(findIt);
-		//	Get the corresponding vector from timeoutMap
-		map<struct timeval, vector<NodeIdent>*, timevalLT>::iterator
-			findTO = timeoutMap.find(curPair->first);
-		if (findTO == timeoutMap.end()) {
-			ERROR_LOG("Data structure in inconsistent state\n");
-			assert(false);
-		}						
-		delete curPair;	//	We no longer need the pair
-		vector<NodeIdent>* toVect = findTO->second;
-		//	Iterate through the vector to remove inNode
-		for (u_int i = 0; i < toVect->size(); i++) {
-			if ((*toVect)[i].addr == inNode.addr &&	
-					(*toVect)[i].port == inNode.port) {
-				(*toVect)[i] = toVect->back();
-				toVect->pop_back();
-				break;
-			}
-		}
-		//	If vector is now empty, remove the entry from timeoutMap
-		//	and also delete the vector
-		if (toVect->empty()) {
-			timeoutMap.erase(findTO);
-			delete toVect;				
+
+int LatencyCache::getEntries(vector<LatencyRecord>& records) {
+	if (sharedTable) {
+		return 0;	// Outlives the process anyway
+	}
+	uint64_t curMS = coarseTimeMS();
+	for (u_int pos = head; pos != LATENCY_CACHE_NIL; pos = entries[pos].next) {
+		if (entries[pos].expireMS <= curMS) {
+			continue;
 		}
+		LatencyRecord curRecord = {entries[pos].node, 
+			entries[pos].latencyUS, 
+			(uint32_t)(entries[pos].expireMS - curMS)};
+		records.push_back(curRecord);
 	}
 	return 0;
 }
 
+int LatencyCache::restoreEntry(const LatencyRecord& inRecord) {
+	if (maxSize == 0 || sharedTable || inRecord.remainingMS == 0) {
+		return 0;
+	}
+	uint64_t curMS = coarseTimeMS();
+	//	Keep the list in expiry order, anything expiring before the
+	//	current tail would break it
+	uint64_t expireMS = curMS + inRecord.remainingMS;
+	if (tail != LATENCY_CACHE_NIL && expireMS < entries[tail].expireMS) {
+		return -1;
+	}
+	return insertEntry(inRecord.node, inRecord.latencyUS, curMS, expireMS);
+}
+	
+int LatencyCache::eraseEntry(const NodeIdent& inNode) {
+	if (maxSize == 0) {
+		return 0;
+	}
+	if (sharedTable) {
+		return sharedTable->erase(inNode);
+	}
+	u_int slot = findSlot(inNode);
+	if (slot != LATENCY_CACHE_NIL) {
+		removeEntry(slot);
+	}
+	return 0;
+}
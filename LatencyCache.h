@@ -1,26 +1,83 @@
 #ifndef CLASS_LATENCY_CACHE
 #define CLASS_LATENCY_CACHE
 
+#include <stdint.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
-#include <map>
+#include <vector>
 #include "Marshal.h"
+#include "SharedLatencyTable.h"
 
+#define LATENCY_CACHE_NIL	0xFFFFFFFF	// Null entry index
+
+//	A cached measurement. Entries live in a fixed array allocated up front
+//	and are linked by index, either into the expiry list or the free list
+struct LatencyEntry {
+	NodeIdent	node;
+	uint32_t	latencyUS;
+	uint64_t	expireMS;	// Coarse monotonic time
+	u_int		prev;
+	u_int		next;
+};
+
+//	Measurement as saved in and restored from a snapshot
+struct LatencyRecord {
+	NodeIdent	node;
+	uint32_t	latencyUS;
+	uint32_t	remainingMS;	// Time left before it expires
+};
+
+//	Fixed size cache of recent latency measurements. All entries share the
+//	same lifetime, so the expiry list is kept in insertion order: the head
+//	is both the next entry to expire and the one to evict when full
 class LatencyCache {
 private:	
-	map<struct timeval, vector<NodeIdent>*, timevalLT>				timeoutMap;
-	map<NodeIdent, pair<struct timeval, uint32_t>*, ltNodeIdent>	latencyMap;
-	u_int 															maxSize;
-	u_int															periodUS;	
+	vector<LatencyEntry>	entries;
+	vector<u_int>			hashIndex;	// Open addressing, entry index or NIL
+	u_int					hashMask;
+	u_int					hashShift;
+	u_int					head;		// Oldest entry
+	u_int					tail;		// Newest entry
+	u_int					freeHead;
+	u_int					numEntries;
+	u_int 					maxSize;
+	u_int					periodUS;	
+	SharedLatencyTable*		sharedTable;	// Used instead of the local
+											// table if set
+
+	u_int homeSlot(const NodeIdent& inNode) const {
+		uint64_t key = (((uint64_t)inNode.addr) << 16) | inNode.port;
+		return (u_int)((key * 0x9E3779B97F4A7C15ULL) >> hashShift);
+	}
+	//	Returns the hash slot holding inNode, or NIL
+	u_int findSlot(const NodeIdent& inNode) const;
+	void unlinkEntry(u_int pos);
+	void appendEntry(u_int pos);
+	void removeEntry(u_int slot);
+	int insertEntry(const NodeIdent& inNode, uint32_t latencyUS,
+		uint64_t curMS, uint64_t expireMS);
+	
 public:
-	LatencyCache(u_int in_maxSize, u_int in_periodUS) 
-		: maxSize(in_maxSize), periodUS(in_periodUS) {}
-		
+	LatencyCache(u_int in_maxSize, u_int in_periodUS);
 	~LatencyCache();
+
+	//	Keep measurements in the named shared memory segment instead, so
+	//	that they are shared by all Meridian processes on the host.
+	//	Returns -1 (and keeps using the local table) on failure
+	int attachShared(const char* name);
+
+	//	Cheap clock used for expiry, only needs to be accurate to a few ms
+	static uint64_t coarseTimeMS();
+
 	int getLatency(const NodeIdent& inNode, uint32_t* latencyUS);
 	int insertMeasurement(const NodeIdent& inNode, uint32_t latencyUS);
 	int eraseEntry(const NodeIdent& inNode);
+
+	//	Append the live entries, oldest first. Shared caches have none
+	int getEntries(vector<LatencyRecord>& records);
+	//	Records must be restored in the order getEntries returned them
+	int restoreEntry(const LatencyRecord& inRecord);
 };
 
 #endif
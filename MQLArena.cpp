@@ -0,0 +1,113 @@
+/******************************************************************************
+Meridian prototype distribution
+Copyright (C) 2005 Bernard Wong
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+The copyright owner can be contacted by e-mail at bwong@cs.cornell.edu
+*******************************************************************************/
+
+using namespace std;
+
+#include <stdlib.h>
+#include "MQLArena.h"
+
+//	Free chunks of this thread, linked through their headers
+static __thread void*	freeChunks = NULL;
+static __thread u_int	numFreeChunks = 0;
+static __thread u_int	numChunksInUse = 0;
+
+void* MQLArena::grow(size_t in_size) {
+	//	Headers are two words, which keeps what follows them aligned
+	size_t header = sizeof(MQLArenaChunk);
+	MQLArenaChunk* chunk = NULL;
+	if (in_size > MQL_ARENA_CHUNK - header) {
+		//	Too big to share a chunk. Linked behind the current chunk so
+		//	the space left in it is still used
+		if ((chunk = (MQLArenaChunk*)malloc(header + in_size)) == NULL) {
+			return NULL;
+		}
+		chunk->size = in_size;
+		numChunksInUse++;
+		if (chunks == NULL) {
+			chunk->next = NULL;
+			chunks = chunk;
+		} else {
+			chunk->next = chunks->next;
+			chunks->next = chunk;
+		}
+		return ((char*)chunk) + header;
+	}
+	if (freeChunks != NULL) {
+		chunk = (MQLArenaChunk*)freeChunks;
+		freeChunks = chunk->next;
+		numFreeChunks--;
+	} else if ((chunk = (MQLArenaChunk*)malloc(MQL_ARENA_CHUNK)) == NULL) {
+		return NULL;
+	}
+	chunk->size = MQL_ARENA_CHUNK - header;
+	numChunksInUse++;
+	chunk->next = chunks;
+	chunks = chunk;
+	cur = ((char*)chunk) + header;
+	end = cur + chunk->size;
+	void* retVal = cur;
+	cur += in_size;
+	return retVal;
+}
+
+void* MQLArena::alloc_final(size_t in_size, void (*in_destroy)(void*)) {
+	size_t header = sizeof(MQLArenaFinal);
+	MQLArenaFinal* entry = (MQLArenaFinal*)alloc(header + in_size);
+	if (entry == NULL) {
+		return NULL;
+	}
+	entry->destroy = in_destroy;
+	entry->next = finals;
+	finals = entry;
+	return ((char*)entry) + header;
+}
+
+void MQLArena::release() {
+	size_t header = sizeof(MQLArenaFinal);
+	while (finals != NULL) {
+		MQLArenaFinal* entry = finals;
+		finals = entry->next;
+		entry->destroy(((char*)entry) + header);
+	}
+	header = sizeof(MQLArenaChunk);
+	while (chunks != NULL) {
+		MQLArenaChunk* chunk = chunks;
+		chunks = chunk->next;
+		numChunksInUse--;
+		if (chunk->size == MQL_ARENA_CHUNK - header &&
+				numFreeChunks < MQL_ARENA_MAX_FREE) {
+			chunk->next = (MQLArenaChunk*)freeChunks;
+			freeChunks = chunk;
+			numFreeChunks++;
+		} else {
+			free(chunk);
+		}
+	}
+	cur = end = NULL;
+}
+
+u_int MQLArena::getNumInUse() {
+	return numChunksInUse;
+}
+
+u_int MQLArena::getNumFree() {
+	return numFreeChunks;
+}
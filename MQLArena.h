@@ -0,0 +1,74 @@
+#ifndef CLASS_MQL_ARENA
+#define CLASS_MQL_ARENA
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <new>
+
+//	Size of a chunk, larger allocations get a chunk of their own
+#define MQL_ARENA_CHUNK			(4 * 1024)
+//	Released chunks beyond this many per thread are freed
+#define MQL_ARENA_MAX_FREE		256
+//	Alignment of every allocation, enough for any ASTNode member
+#define MQL_ARENA_ALIGN			8
+
+//	Region allocator for the temporaries of one DSL scope. Allocation bumps
+//	a pointer within the current chunk and everything is freed at once by
+//	release. Objects with destructors are linked into a list that release
+//	runs first. Chunks go back to a per thread free list, so the next scope
+//	reuses them without calling malloc
+class MQLArena {
+private:
+	typedef struct MQLArenaChunk_t {
+		struct MQLArenaChunk_t*	next;
+		size_t					size;		// Usable bytes
+	} MQLArenaChunk;
+	typedef struct MQLArenaFinal_t {
+		struct MQLArenaFinal_t*	next;
+		void					(*destroy)(void*);
+	} MQLArenaFinal;
+
+	MQLArenaChunk*	chunks;		// Current chunk first
+	char*			cur;
+	char*			end;
+	MQLArenaFinal*	finals;		// Most recently created first
+
+	void* grow(size_t in_size);
+	void* alloc_final(size_t in_size, void (*in_destroy)(void*));
+	template <class T> static void destroy(void* in_obj) {
+		((T*)in_obj)->~T();
+	}
+public:
+	MQLArena() : chunks(NULL), cur(NULL), end(NULL), finals(NULL) {}
+	~MQLArena() { release(); }
+
+	//	Returns NULL if out of memory
+	void* alloc(size_t in_size) {
+		in_size = (in_size + MQL_ARENA_ALIGN - 1) & ~(MQL_ARENA_ALIGN - 1);
+		if ((size_t)(end - cur) >= in_size) {
+			void* retVal = cur;
+			cur += in_size;
+			return retVal;
+		}
+		return grow(in_size);
+	}
+
+	//	Default constructs a T that release destroys. Returns NULL if out
+	//	of memory
+	template <class T> T* create() {
+		void* mem = alloc_final(sizeof(T), &MQLArena::destroy<T>);
+		if (mem == NULL) {
+			return NULL;
+		}
+		return new (mem) T();
+	}
+
+	void release();
+
+	//	Chunks of the calling thread
+	static u_int getNumInUse();
+	static u_int getNumFree();
+};
+
+#endif
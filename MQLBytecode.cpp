@@ -0,0 +1,1162 @@
+/******************************************************************************
+Meridian prototype distribution
+Copyright (C) 2005 Bernard Wong
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+The copyright owner can be contacted by e-mail at bwong@cs.cornell.edu
+*******************************************************************************/
+
+using namespace std;
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <ucontext.h>
+#include "Marshal.h"
+#include "MQLState.h"
+#include "MeridianDSL.h"
+
+//	A compiled call costs this many levels of MAX_RECURSE_COUNT, roughly
+//	what the tree walker uses up per call
+#define MQL_CALL_RECURSE_COST	4
+#define MQL_CHUNK_REGS			1024
+
+//	Compiles one function body. Every construct the tree walker handles in
+//	a function body is supported, anything else (or a program error the
+//	tree walker only reports at run time, such as a name declared twice in
+//	the same scope) makes the compile fail and the function is left to the
+//	tree walker
+class MQLCompiler {
+private:
+	typedef struct {
+		int			contextDepth;	// Contexts entered outside the loop
+		vector<int>	breaks;			// Jumps to patch to the loop exit
+		vector<int>	continues;		// Jumps to patch to the next iteration
+	} MQLLoop;
+
+	ParserState*			ps;
+	MQLFunction*			fn;
+	vector<map<string, int> >	scopes;
+	vector<MQLLoop>			loops;
+	int						nextReg;		// First free register
+	int						contextDepth;
+	bool					failed;
+
+	int emit(int op, int a = 0, int b = 0, int c = 0, int d = 0) {
+		MQLInstr instr = {op, a, b, c, d};
+		fn->code.push_back(instr);
+		return fn->code.size() - 1;
+	}
+	int here() const	{ return fn->code.size(); }
+	int newReg() {
+		int reg = nextReg++;
+		if ((u_int)nextReg > fn->numRegs) {
+			fn->numRegs = nextReg;
+		}
+		return reg;
+	}
+	int fail() {
+		failed = true;
+		return -1;
+	}
+	int addConst(ASTNode* node) {
+		fn->consts.push_back(node);
+		return fn->consts.size() - 1;
+	}
+	int addName(const string* name) {
+		for (u_int i = 0; i < fn->names.size(); i++) {
+			if (*(fn->names[i]) == *name) {
+				return i;
+			}
+		}
+		fn->names.push_back(name);
+		fn->globals.push_back(NULL);
+		return fn->names.size() - 1;
+	}
+	int findLocal(const string& name) const {
+		for (int i = scopes.size() - 1; i >= 0; i--) {
+			map<string, int>::const_iterator it = scopes[i].find(name);
+			if (it != scopes[i].end()) {
+				return it->second;
+			}
+		}
+		return -1;
+	}
+	int declareLocal(const string& name) {
+		if (scopes.back().find(name) != scopes.back().end()) {
+			return fail();	// Collision, let the tree walker report it
+		}
+		int reg = newReg();
+		scopes.back()[name] = reg;
+		return reg;
+	}
+
+	static int nativeArity(int type);
+	static bool allocates(const ASTNode* node);
+	int compileArgs(const ASTNode* sep, int* first);
+	int compileExpr(const ASTNode* node);
+	void compileExprTo(const ASTNode* node, int dst);
+	void compileStatement(const ASTNode* node);
+	void compileContext(const ASTNode* node);
+	void compileJump(bool isBreak);
+public:
+	MQLCompiler(ParserState* in_ps, MQLFunction* in_fn)
+		: ps(in_ps), fn(in_fn), nextReg(0), contextDepth(0), failed(false) {}
+	int compile(const ASTNode* func_node);
+};
+
+int MQLCompiler::nativeArity(int type) {
+	switch (type) {
+		case GET_SELF:
+			return 0;
+		case POW:
+		case PUSH_BACK:
+		case ARRAY_INTERSECT:
+		case ARRAY_UNION:
+			return 2;
+		case GET_DISTANCE_TCP:
+		case GET_DISTANCE_DNS:
+		case GET_DISTANCE_PING:
+		case GET_DISTANCE_ICMP:
+			return 3;
+	}
+	return 1;
+}
+
+//	Whether evaluating node allocates in the current VarTable. Nested
+//	contexts are not looked into, they get a VarTable of their own. A
+//	block that never allocates is run without pushing a context
+bool MQLCompiler::allocates(const ASTNode* node) {
+	switch (node->type) {
+		case NEW_VAR_TYPE:
+		case NEW_VAR_ASSIGN_TYPE:
+		case FUNC_REF_TYPE:
+		case RPC_TYPE:
+		case NATIVE_FUNC_TYPE:
+			return true;
+		case AST_TYPE:
+		case BIN_TYPE:
+		case ASSIGN_ADT_TYPE:
+			return allocates(node->val.b_val.b_left_node) ||
+				allocates(node->val.b_val.b_right_node);
+		case UNARY_TYPE:
+		case PRINT_TYPE:
+		case PRINTLN_TYPE:
+		case RETURN_TYPE:
+			return allocates(node->val.u_val.u_node);
+		case REF_VAR_ARRAY_TYPE:
+			return allocates(node->val.v_val.v_name_ast) ||
+				allocates(node->val.v_val.v_access_ast);
+		case REF_VAR_ADT_TYPE:
+			return allocates(node->val.v_val.v_name_ast);
+		case IF_TYPE:
+			return allocates(node->val.if_val.if_eval) ||
+				allocates(node->val.if_val.if_left_node) ||
+				allocates(node->val.if_val.if_right_node);
+		case LOOP_TYPE:
+			return allocates(node->val.l_val.l_eval) ||
+				allocates(node->val.l_val.l_node);
+		case FOR_LOOP_TYPE:
+			return allocates(node->val.for_val.for_node_1) ||
+				allocates(node->val.for_val.for_node_2) ||
+				allocates(node->val.for_val.for_node_3) ||
+				allocates(node->val.for_val.for_node_4);
+		default:
+			break;
+	}
+	return false;
+}
+
+//	Evaluates the expressions of a SEP list into consecutive registers
+int MQLCompiler::compileArgs(const ASTNode* sep, int* first) {
+	*first = nextReg;
+	if (sep->type != SEP_TYPE) {
+		return 0;
+	}
+	vector<ASTNode*>* args = sep->val.p_val.p_vector;
+	vector<int> regs;
+	for (u_int i = 0; i < args->size(); i++) {
+		regs.push_back(newReg());
+	}
+	if (!regs.empty()) {
+		*first = regs[0];
+	}
+	for (u_int i = 0; i < args->size(); i++) {
+		compileExprTo((*args)[i], regs[i]);
+	}
+	return args->size();
+}
+
+void MQLCompiler::compileExprTo(const ASTNode* node, int dst) {
+	int reg = compileExpr(node);
+	if (reg != -1 && reg != dst) {
+		emit(MQL_OP_MOVE, dst, reg);
+	}
+}
+
+//	Returns the register holding the value of the expression. References
+//	to locals return the slot of the local without emitting anything
+int MQLCompiler::compileExpr(const ASTNode* node) {
+	if (failed) {
+		return -1;
+	}
+	switch (node->type) {
+		case EMPTY_TYPE:
+		case INT_TYPE:
+		case DOUBLE_TYPE:
+		case STRING_TYPE: {
+			int dst = newReg();
+			emit(MQL_OP_CONST, dst, addConst(const_cast<ASTNode*>(node)));
+			return dst;
+		}
+		case REF_VAR_TYPE: {
+			int slot = findLocal(*(node->val.v_val.v_name));
+			if (slot != -1) {
+				return slot;
+			}
+			int dst = newReg();
+			emit(MQL_OP_GLOBAL, dst, addName(node->val.v_val.v_name));
+			return dst;
+		}
+		case REF_VAR_ARRAY_TYPE: {
+			//	Same order as the tree walker, index first
+			int index = compileExpr(node->val.v_val.v_access_ast);
+			int array = compileExpr(node->val.v_val.v_name_ast);
+			int dst = newReg();
+			emit(MQL_OP_INDEX, dst, array, index);
+			return dst;
+		}
+		case REF_VAR_ADT_TYPE: {
+			int adt = compileExpr(node->val.v_val.v_name_ast);
+			int dst = newReg();
+			emit(MQL_OP_FIELD, dst, adt,
+				addName(node->val.v_val.v_name_dot_name));
+			return dst;
+		}
+		case PRINT_TYPE:
+		case PRINTLN_TYPE: {
+			int src = compileExpr(node->val.u_val.u_node);
+			int dst = newReg();
+			emit(MQL_OP_PRINT, dst, src, node->type == PRINTLN_TYPE);
+			return dst;
+		}
+		case UNARY_TYPE: {
+			int src = compileExpr(node->val.u_val.u_node);
+			int dst = newReg();
+			if (node->val.u_val.u_type == '-') {
+				emit(MQL_OP_NEG, dst, src);
+			} else if (node->val.u_val.u_type == '!') {
+				emit(MQL_OP_NOT, dst, src);
+			} else {
+				return fail();
+			}
+			return dst;
+		}
+		case BIN_TYPE: {
+			int right = compileExpr(node->val.b_val.b_right_node);
+			int left = compileExpr(node->val.b_val.b_left_node);
+			int dst = newReg();
+			emit(MQL_OP_ARITH, dst, left, right, node->val.b_val.b_type);
+			return dst;
+		}
+		case ASSIGN_ADT_TYPE: {
+			int right = compileExpr(node->val.b_val.b_right_node);
+			int left = compileExpr(node->val.b_val.b_left_node);
+			int dst = newReg();
+			emit(MQL_OP_ASSIGN, dst, left, right);
+			return dst;
+		}
+		case FUNC_REF_TYPE: {
+			int first;
+			int count = compileArgs(node->val.f_val.f_actual_param, &first);
+			int dst = newReg();
+			emit(MQL_OP_CALL, dst, addName(node->val.f_val.f_name),
+				first, count);
+			return dst;
+		}
+		case NATIVE_FUNC_TYPE: {
+			int arity = nativeArity(node->val.n_val.n_type);
+			const ASTNode* params[3] = { node->val.n_val.n_param_1,
+				node->val.n_val.n_param_2, node->val.n_val.n_param_3 };
+			int first = nextReg;
+			for (int i = 0; i < arity; i++) {
+				newReg();
+			}
+			for (int i = 0; i < arity; i++) {
+				compileExprTo(params[i], first + i);
+			}
+			int dst = newReg();
+			emit(MQL_OP_NATIVE, dst, node->val.n_val.n_type, first, arity);
+			return dst;
+		}
+		case RPC_TYPE: {
+			int dest = newReg();
+			vector<int> regs;
+			int first;
+			if (node->val.rpc_val.rpc_param->type == SEP_TYPE) {
+				//	Destination and arguments must be consecutive
+				vector<ASTNode*>* args =
+					node->val.rpc_val.rpc_param->val.p_val.p_vector;
+				for (u_int i = 0; i < args->size(); i++) {
+					regs.push_back(newReg());
+				}
+				compileExprTo(node->val.rpc_val.rpc_dest, dest);
+				for (u_int i = 0; i < args->size(); i++) {
+					compileExprTo((*args)[i], regs[i]);
+				}
+			} else {
+				compileExprTo(node->val.rpc_val.rpc_dest, dest);
+			}
+			first = dest;
+			int dst = newReg();
+			emit(MQL_OP_RPC, dst, first, regs.size(),
+				addName(node->val.rpc_val.rpc_func_name));
+			return dst;
+		}
+		default:
+			break;
+	}
+	return fail();
+}
+
+void MQLCompiler::compileContext(const ASTNode* node) {
+	bool needContext = allocates(node->val.u_val.u_node);
+	int savedReg = nextReg;
+	scopes.push_back(map<string, int>());
+	if (needContext) {
+		emit(MQL_OP_ENTER);
+		contextDepth++;
+	}
+	compileStatement(node->val.u_val.u_node);
+	if (needContext) {
+		emit(MQL_OP_LEAVE, 1);
+		contextDepth--;
+	}
+	scopes.pop_back();
+	nextReg = savedReg;
+}
+
+void MQLCompiler::compileJump(bool isBreak) {
+	if (loops.empty()) {
+		fail();	// The tree walker reports it when the function returns
+		return;
+	}
+	MQLLoop& loop = loops.back();
+	if (contextDepth > loop.contextDepth) {
+		emit(MQL_OP_LEAVE, contextDepth - loop.contextDepth);
+	}
+	int jump = emit(MQL_OP_JUMP);
+	if (isBreak) {
+		loop.breaks.push_back(jump);
+	} else {
+		loop.continues.push_back(jump);
+	}
+}
+
+void MQLCompiler::compileStatement(const ASTNode* node) {
+	if (failed) {
+		return;
+	}
+	//	Temporaries only live for the statement
+	int savedReg = nextReg;
+	switch (node->type) {
+		case EMPTY_TYPE:
+			break;
+		case AST_TYPE:
+			//	Statement lists are built right to left
+			compileStatement(node->val.b_val.b_right_node);
+			compileStatement(node->val.b_val.b_left_node);
+			return;	// Keep the locals declared by the list
+		case CONTEXT_TYPE:
+			compileContext(node);
+			break;
+		case NEW_VAR_TYPE: {
+			int size = -1;
+			if (node->val.v_val.v_type == ARRAY_TYPE) {
+				size = compileExpr(node->val.v_val.v_array_size);
+			}
+			nextReg = savedReg;
+			int slot = declareLocal(*(node->val.v_val.v_name));
+			fn->decls.push_back(node);
+			emit(MQL_OP_DECL, slot, fn->decls.size() - 1, size);
+			return;	// Keep the slot
+		}
+		case NEW_VAR_ASSIGN_TYPE: {
+			//	The initial value is evaluated before the variable exists
+			int value;
+			if (node->val.v_val.v_assign->type == SEP_TYPE) {
+				int first;
+				int count = compileArgs(node->val.v_val.v_assign, &first);
+				value = newReg();
+				emit(MQL_OP_SEP, value, first, count);
+			} else {
+				value = compileExpr(node->val.v_val.v_assign);
+			}
+			//	The slot goes after the temporaries holding the value, which
+			//	stay reserved for the rest of the scope
+			int slot = declareLocal(*(node->val.v_val.v_name));
+			fn->decls.push_back(node);
+			emit(MQL_OP_DECL_INIT, slot, fn->decls.size() - 1, value);
+			return;	// Keep the slot
+		}
+		case IF_TYPE: {
+			int cond = compileExpr(node->val.if_val.if_eval);
+			int branch = emit(MQL_OP_BRANCH, cond);
+			compileStatement(node->val.if_val.if_left_node);
+			int jump = emit(MQL_OP_JUMP);
+			fn->code[branch].b = here();
+			compileStatement(node->val.if_val.if_right_node);
+			fn->code[jump].a = here();
+			fn->code[branch].c = here();
+			break;
+		}
+		case LOOP_TYPE: {
+			int top = here();
+			int cond = compileExpr(node->val.l_val.l_eval);
+			int exit = emit(MQL_OP_JUMP_FALSE, cond);
+			MQLLoop loop;
+			loop.contextDepth = contextDepth;
+			loops.push_back(loop);
+			compileStatement(node->val.l_val.l_node);
+			emit(MQL_OP_JUMP, top);
+			fn->code[exit].b = here();
+			for (u_int i = 0; i < loops.back().breaks.size(); i++) {
+				fn->code[loops.back().breaks[i]].a = here();
+			}
+			for (u_int i = 0; i < loops.back().continues.size(); i++) {
+				fn->code[loops.back().continues[i]].a = top;
+			}
+			loops.pop_back();
+			break;
+		}
+		case FOR_LOOP_TYPE: {
+			//	The loop is wrapped in a context, so the variables of the
+			//	initializer stay declared until the loop is done
+			compileStatement(node->val.for_val.for_node_1);
+			int loopReg = nextReg;
+			int top = here();
+			int cond = compileExpr(node->val.for_val.for_node_2);
+			int exit = emit(MQL_OP_JUMP_FALSE, cond);
+			MQLLoop loop;
+			loop.contextDepth = contextDepth;
+			loops.push_back(loop);
+			nextReg = loopReg;
+			compileStatement(node->val.for_val.for_node_4);
+			int next = here();
+			nextReg = loopReg;
+			compileStatement(node->val.for_val.for_node_3);
+			emit(MQL_OP_JUMP, top);
+			fn->code[exit].b = here();
+			for (u_int i = 0; i < loops.back().breaks.size(); i++) {
+				fn->code[loops.back().breaks[i]].a = here();
+			}
+			for (u_int i = 0; i < loops.back().continues.size(); i++) {
+				fn->code[loops.back().continues[i]].a = next;
+			}
+			loops.pop_back();
+			break;
+		}
+		case BREAK_TYPE:
+			compileJump(true);
+			break;
+		case CONTINUE_TYPE:
+			compileJump(false);
+			break;
+		case RETURN_TYPE: {
+			int src = -1;
+			if (node->val.u_val.u_node->type != EMPTY_TYPE) {
+				src = compileExpr(node->val.u_val.u_node);
+			}
+			emit(MQL_OP_RETURN, src);
+			break;
+		}
+		default:
+			compileExpr(node);	// Expression statement
+			break;
+	}
+	nextReg = savedReg;
+}
+
+int MQLCompiler::compile(const ASTNode* func_node) {
+	scopes.push_back(map<string, int>());
+	const ASTNode* formal = func_node->val.f_val.f_formal_param;
+	if (formal->type == SEP_TYPE) {
+		vector<ASTNode*>* params = formal->val.p_val.p_vector;
+		for (u_int i = 0; i < params->size(); i++) {
+			if ((*params)[i]->type != NEW_VAR_TYPE) {
+				return -1;
+			}
+			declareLocal(*((*params)[i]->val.v_val.v_name));
+		}
+		fn->numParams = params->size();
+	}
+	compileStatement(func_node->val.f_val.f_node);
+	emit(MQL_OP_END);
+	if (failed) {
+		return -1;
+	}
+	return 0;
+}
+
+MQLProgram::~MQLProgram() {
+	map<const ASTNode*, MQLFunction*>::iterator it = functions.begin();
+	for (; it != functions.end(); it++) {
+		if (it->second != NULL) {
+			delete it->second;
+		}
+	}
+	for (u_int i = 0; i < chunks.size(); i++) {
+		free(chunks[i].regs);
+		free(chunks[i].scratch);
+	}
+}
+
+MQLFunction* MQLProgram::lookup(ParserState* ps, const ASTNode* func_node) {
+	//	Keyed by body, all FUNC_CALL nodes of a function share it
+	const ASTNode* body = func_node->val.f_val.f_node;
+	map<const ASTNode*, MQLFunction*>::iterator it = functions.find(body);
+	if (it != functions.end()) {
+		return it->second;
+	}
+	MQLFunction* fn = new MQLFunction();
+	MQLCompiler compiler(ps, fn);
+	if (compiler.compile(func_node) == -1) {
+		delete fn;
+		fn = NULL;
+		numFailed++;
+	} else {
+		numCompiled++;
+		numInstrs += fn->size();
+	}
+	functions[body] = fn;
+	return fn;
+}
+
+int MQLProgram::allocFrame(u_int numRegs, ASTNode*** regs, ASTNode** scratch) {
+	if (!chunks.empty() &&
+			chunks[curChunk].used + numRegs > chunks[curChunk].size) {
+		curChunk++;
+	}
+	if (curChunk == chunks.size()) {
+		MQLChunk newChunk = {NULL, NULL, 0, 0};
+		chunks.push_back(newChunk);
+	}
+	MQLChunk* chunk = &(chunks[curChunk]);
+	if (chunk->size < numRegs) {
+		//	Only ever an empty chunk
+		u_int size = MAX(numRegs, MQL_CHUNK_REGS);
+		free(chunk->regs);
+		free(chunk->scratch);
+		chunk->regs = (ASTNode**)malloc(size * sizeof(ASTNode*));
+		chunk->scratch = (ASTNode*)malloc(size * sizeof(ASTNode));
+		if (chunk->regs == NULL || chunk->scratch == NULL) {
+			free(chunk->regs);
+			free(chunk->scratch);
+			chunk->regs = NULL;
+			chunk->scratch = NULL;
+			chunk->size = 0;
+			return -1;
+		}
+		chunk->size = size;
+	}
+	*regs = chunk->regs + chunk->used;
+	*scratch = chunk->scratch + chunk->used;
+	chunk->used += numRegs;
+	return 0;
+}
+
+void MQLProgram::freeFrame(u_int numRegs) {
+	chunks[curChunk].used -= numRegs;
+	if (chunks[curChunk].used == 0 && curChunk > 0) {
+		curChunk--;
+	}
+}
+
+ASTNode* MQLFunction::lookupGlobal(ParserState* ps, int name) {
+	if (globals[name] == NULL) {
+		ASTNode* node = NULL;
+		if (ps->get_var_table()->lookup(*(names[name]), &node) == -1) {
+			return NULL;
+		}
+		//	Functions and structs, declared once before main runs
+		globals[name] = node;
+	}
+	return globals[name];
+}
+
+//	Calls a function from compiled code, compiled or not
+static ASTNode* mql_invoke(ParserState* ps, ASTNode* func_node,
+		ASTNode** args, u_int num_args, int recurse_count) {
+	ASTNode* retNode = NULL;
+	if (ps->use_bytecode()) {
+		retNode = mql_call(ps, func_node, args, num_args, recurse_count);
+	}
+	if (retNode != NULL) {
+		return retNode;
+	}
+	//	Hand the values to the tree walker, they evaluate to themselves
+	ASTNode* sep_node = ps->empty_token();
+	if (num_args > 0) {
+		vector<ASTNode*>* param = ps->get_var_table()->new_stack_vector();
+		if (param == NULL) {
+			return ps->empty_token();
+		}
+		param->assign(args, args + num_args);
+		sep_node = mk_sep_list(ps, param);
+	}
+	func_node->val.f_val.f_actual_param = sep_node;
+	return eval(ps, func_node, recurse_count);
+}
+
+ASTNode* mql_call(ParserState* ps, ASTNode* func_node,
+		ASTNode** args, u_int num_args, int recurse_count) {
+	MQLFunction* fn = ps->get_program()->lookup(ps, func_node);
+	if (fn == NULL) {
+		return NULL;
+	}
+	return fn->call(ps, func_node, args, num_args, recurse_count);
+}
+
+static void printValue(ParserState* ps, const ASTNode* node, bool newline) {
+	const char* end = newline ? "\n" : "";
+	switch (node->type) {
+		case INT_TYPE:
+			printf("%d%s", node->val.i_val, end);
+			break;
+		case DOUBLE_TYPE:
+			printf("%0.2f%s", node->val.d_val, end);
+			break;
+		case STRING_TYPE:
+			printf("%s%s", (node->val.s_val)->c_str(), end);
+			break;
+		default:
+			DSL_ERROR("Unknown type %d encountered (parser error)\n",
+				node->type);
+			break;
+	}
+}
+
+//	Integer operators, false if op needs the generic path
+static inline bool arithInt(int op, int a, int b, int* ret) {
+	switch (op) {
+		case '*':		*ret = a * b;		break;
+		case '+':		*ret = a + b;		break;
+		case '-':		*ret = a - b;		break;
+		case '/':		*ret = a / b;		break;
+		case '%':		*ret = a % b;		break;
+		case '&':		*ret = a & b;		break;
+		case '^':		*ret = a ^ b;		break;
+		case '|':		*ret = a | b;		break;
+		case LEFT_OP:	*ret = a << b;		break;
+		case RIGHT_OP:	*ret = a >> b;		break;
+		case AND_OP:	*ret = a && b;		break;
+		case OR_OP:		*ret = a || b;		break;
+		case '<':		*ret = a < b;		break;
+		case '>':		*ret = a > b;		break;
+		case LE_OP:		*ret = a <= b;		break;
+		case GE_OP:		*ret = a >= b;		break;
+		case EQ_OP:		*ret = a == b;		break;
+		case NE_OP:		*ret = a != b;		break;
+		default:
+			return false;
+	}
+	return true;
+}
+
+//	Double operators, setting *isInt for the comparisons
+static inline bool arithDouble(
+		int op, double a, double b, double* ret, int* intRet, bool* isInt) {
+	*isInt = false;
+	switch (op) {
+		case '*':		*ret = a * b;			return true;
+		case '+':		*ret = a + b;			return true;
+		case '-':		*ret = a - b;			return true;
+		case '/':		*ret = a / b;			return true;
+		case '%':		*ret = fmod(a, b);		return true;
+		default:
+			break;
+	}
+	*isInt = true;
+	switch (op) {
+		case AND_OP:	*intRet = a && b;		break;
+		case OR_OP:		*intRet = a || b;		break;
+		case '<':		*intRet = a < b;		break;
+		case '>':		*intRet = a > b;		break;
+		case LE_OP:		*intRet = a <= b;		break;
+		case GE_OP:		*intRet = a >= b;		break;
+		case EQ_OP:		*intRet = a == b;		break;
+		case NE_OP:		*intRet = a != b;		break;
+		default:
+			return false;	// Int only operators
+	}
+	return true;
+}
+
+//	Natives that only compute a number, written into the scratch node.
+//	Returns false for every other case, including type errors, which are
+//	reported by evalNativeFunctions
+static bool nativeNumber(int type, ASTNode** args, ASTNode* ret) {
+	const ASTNode* arg = args[0];
+	switch (type) {
+		case DBL:
+			if (arg->type != INT_TYPE) {
+				return false;
+			}
+			ret->type = DOUBLE_TYPE;
+			ret->val.d_val = (double)(arg->val.i_val);
+			return true;
+		case ARRAY_SIZE:
+			if (arg->type != ARRAY_TYPE) {
+				return false;
+			}
+			ret->type = INT_TYPE;
+			ret->val.i_val = arg->val.a_val.a_vector->size();
+			return true;
+		case POW:
+			if (arg->type != DOUBLE_TYPE || args[1]->type != DOUBLE_TYPE) {
+				return false;
+			}
+			ret->type = DOUBLE_TYPE;
+			ret->val.d_val = pow(arg->val.d_val, args[1]->val.d_val);
+			return true;
+		case ROUND:
+		case CEIL:
+		case FLOOR:
+		case SIN:
+		case COS:
+		case TAN:
+		case ASIN:
+		case ACOS:
+		case ATAN:
+		case LOG_OP:
+		case EXP:
+			if (arg->type != DOUBLE_TYPE) {
+				return false;
+			}
+			break;
+		default:
+			return false;
+	}
+	double d = arg->val.d_val;
+	ret->type = DOUBLE_TYPE;
+	switch (type) {
+		case ROUND:
+			ret->type = INT_TYPE;
+			ret->val.i_val = lrint(d);
+			break;
+		case CEIL:
+			ret->type = INT_TYPE;
+			ret->val.i_val = (int)ceil(d);
+			break;
+		case FLOOR:
+			ret->type = INT_TYPE;
+			ret->val.i_val = (int)floor(d);
+			break;
+		case SIN:		ret->val.d_val = sin(d);	break;
+		case COS:		ret->val.d_val = cos(d);	break;
+		case TAN:		ret->val.d_val = tan(d);	break;
+		case ASIN:		ret->val.d_val = asin(d);	break;
+		case ACOS:		ret->val.d_val = acos(d);	break;
+		case ATAN:		ret->val.d_val = atan(d);	break;
+		case LOG_OP:	ret->val.d_val = log(d);	break;
+		case EXP:		ret->val.d_val = exp(d);	break;
+	}
+	return true;
+}
+
+static ASTNode* rpcCall(ParserState* ps, ASTNode* destNode,
+		const string* func_name, ASTNode** args, u_int num_args) {
+	NodeIdentRendv tmpNodeIdent;
+	if (createNodeIdent(destNode, &tmpNodeIdent) == -1) {
+		DSL_ERROR("Destination must be a Node\n");
+		return ps->empty_token();
+	}
+	vector<ASTNode*> actual_param(args, args + num_args);
+	ASTNode* sep_node;
+	if (actual_param.size() == 0) {
+		sep_node = ps->empty_token();
+	} else {
+		sep_node = mk_sep_list(ps, &actual_param);
+	}
+	return handleRPC(ps, tmpNodeIdent,
+		const_cast<string*>(func_name), sep_node);
+}
+
+ASTNode* MQLFunction::call(ParserState* ps, ASTNode* func_node,
+		ASTNode** args, u_int num_args, int recurse_count) {
+	if (recurse_count > MAX_RECURSE_COUNT) {
+		DSL_ERROR("Maximum recurse count reached\n");
+		return ps->empty_token();
+	}
+	//	Create return type in the calling function's scope
+	ASTNode* tmp_node = NULL;
+	if (func_node->val.f_val.f_type != VOID_TYPE) {
+		tmp_node = ASTCreate(ps, func_node->val.f_val.f_type,
+			func_node->val.f_val.f_type_name,
+			func_node->val.f_val.f_array_type, 0);
+	}
+	VarTable* old_table = NULL;
+	if (ps->new_var_table(&old_table) == -1 || old_table == NULL) {
+		DSL_ERROR("Error creating function context\n");
+		return ps->empty_token();
+	}
+	MQLProgram* program = ps->get_program();
+	ASTNode** regs;
+	ASTNode* scratch;
+	if (program->allocFrame(numRegs, &regs, &scratch) == -1) {
+		DSL_ERROR("Cannot allocate registers\n");
+		ps->remove_var_table();
+		return ps->empty_token();
+	}
+	for (u_int i = 0; i < numRegs; i++) {
+		regs[i] = ps->empty_token();
+	}
+	//	Assign formal param to actual param
+	bool paramOkay = (numParams == num_args);
+	if (!paramOkay) {
+		DSL_ERROR("Formal and actual parameters don't match\n");
+	}
+	for (u_int i = 0; paramOkay && i < numParams; i++) {
+		const ASTNode* formal =
+			(*(func_node->val.f_val.f_formal_param->val.p_val.p_vector))[i];
+		regs[i] = ASTCreate(ps, formal->val.v_val.v_type,
+			formal->val.v_val.v_adt_name, formal->val.v_val.v_array_type, 0);
+		if (regs[i]->type == EMPTY_TYPE ||
+				ps->get_var_table()->updateADT(regs[i], args[i]) == -1) {
+			paramOkay = false;
+		}
+	}
+	if (!paramOkay) {
+		DSL_ERROR("Error assigning to parameter list\n");
+	} else {
+		run(ps, regs, scratch, old_table, tmp_node,
+			recurse_count + MQL_CALL_RECURSE_COST);
+	}
+	program->freeFrame(numRegs);
+	//	Go back to previous var table
+	if (ps->remove_var_table() == -1) {
+		DSL_ERROR("Error deleting function context\n");
+		return ps->empty_token();
+	}
+	if (tmp_node) {
+		return tmp_node;
+	}
+	return ps->empty_token();
+}
+
+ASTNode* MQLFunction::run(ParserState* ps, ASTNode** regs, ASTNode* scratch,
+		VarTable* callerTable, ASTNode* retNode, int recurse_count) {
+	const MQLInstr* start = &(code[0]);
+	const MQLInstr* pc = start;
+	int numContexts = 0;
+	while (true) {
+		//	Same yield point as every step of the tree walker
+		eval_step(ps);
+		const MQLInstr* in = pc++;
+		switch (in->op) {
+			case MQL_OP_CONST:
+				regs[in->a] = consts[in->b];
+				break;
+			case MQL_OP_GLOBAL: {
+				ASTNode* node = lookupGlobal(ps, in->b);
+				if (node == NULL) {
+					DSL_ERROR("Variable name %s not found\n",
+						names[in->b]->c_str());
+					node = ps->empty_token();
+				}
+				regs[in->a] = node;
+				break;
+			}
+			case MQL_OP_MOVE:
+				regs[in->a] = regs[in->b];
+				break;
+			case MQL_OP_DECL:
+			case MQL_OP_DECL_INIT: {
+				const ASTNode* decl = decls[in->b];
+				int arraySize = 0;
+				if (in->op == MQL_OP_DECL_INIT) {
+					if (regs[in->c]->type == EMPTY_TYPE) {
+						regs[in->a] = ps->empty_token();
+						break;
+					}
+				} else if (in->c != -1) {
+					if (regs[in->c]->type != INT_TYPE) {
+						regs[in->a] = ps->empty_token();
+						break;
+					}
+					arraySize = regs[in->c]->val.i_val;
+				}
+				ASTNode* newAst = ASTCreate(ps, decl->val.v_val.v_type,
+					decl->val.v_val.v_adt_name,
+					decl->val.v_val.v_array_type, arraySize);
+				if (newAst->type == EMPTY_TYPE) {
+					DSL_ERROR("Cannot create variable %s not found\n",
+						decl->val.v_val.v_name->c_str());
+				} else if (in->op == MQL_OP_DECL_INIT &&
+						ps->get_var_table()->updateADT(
+							newAst, regs[in->c]) == -1) {
+					DSL_ERROR("Assign failed on ADT\n");
+				}
+				regs[in->a] = newAst;
+				break;
+			}
+			case MQL_OP_SEP: {
+				vector<ASTNode*>* newArray =
+					ps->get_var_table()->new_stack_vector();
+				if (newArray == NULL) {
+					regs[in->a] = ps->empty_token();
+					break;
+				}
+				newArray->assign(regs + in->b, regs + in->b + in->c);
+				regs[in->a] = mk_sep_list(ps, newArray);
+				break;
+			}
+			case MQL_OP_ASSIGN: {
+				ASTNode* l_node = regs[in->b];
+				ASTNode* r_node = regs[in->c];
+				if (r_node->type == EMPTY_TYPE) {
+					regs[in->a] = r_node;
+					break;
+				}
+				regs[in->a] = l_node;
+				if (l_node->type == INT_TYPE && r_node->type == INT_TYPE) {
+					l_node->val.i_val = r_node->val.i_val;
+				} else if (l_node->type == DOUBLE_TYPE &&
+						r_node->type == DOUBLE_TYPE) {
+					l_node->val.d_val = r_node->val.d_val;
+				} else if (l_node->type != EMPTY_TYPE) {
+					if (ps->get_var_table()->updateADT(l_node, r_node) == -1) {
+						DSL_ERROR("Assign failed on ADT\n");
+						regs[in->a] = ps->empty_token();
+					}
+				}
+				break;
+			}
+			case MQL_OP_INDEX: {
+				ASTNode* array = regs[in->b];
+				ASTNode* access = regs[in->c];
+				if (array->type != ARRAY_TYPE || access->type != INT_TYPE) {
+					DSL_ERROR("Invalid array access expression\n");
+					regs[in->a] = ps->empty_token();
+				} else if (access->val.i_val < 0 || ((u_int)access->val.i_val)
+						>= array->val.a_val.a_vector->size()) {
+					DSL_ERROR("Array out of bounds\n");
+					regs[in->a] = ps->empty_token();
+				} else {
+					regs[in->a] =
+						(*(array->val.a_val.a_vector))[access->val.i_val];
+				}
+				break;
+			}
+			case MQL_OP_FIELD: {
+				ASTNode* adt = regs[in->b];
+				regs[in->a] = ps->empty_token();
+				if (adt->type != VAR_ADT_TYPE) {
+					break;
+				}
+				ASTNode* field = adt_field(adt, *(names[in->c]));
+				if (field == NULL) {
+					DSL_ERROR(
+						"The field %s does not exist in ADT variable\n",
+						names[in->c]->c_str());
+					break;
+				}
+				regs[in->a] = field;
+				break;
+			}
+			case MQL_OP_ARITH: {
+				const ASTNode* l_node = regs[in->b];
+				const ASTNode* r_node = regs[in->c];
+				ASTNode* dst = &(scratch[in->a]);
+				if (l_node->type == INT_TYPE && r_node->type == INT_TYPE) {
+					int ret;
+					if (arithInt(in->d,
+							l_node->val.i_val, r_node->val.i_val, &ret)) {
+						dst->type = INT_TYPE;
+						dst->val.i_val = ret;
+						regs[in->a] = dst;
+						break;
+					}
+				} else if (l_node->type == DOUBLE_TYPE &&
+						r_node->type == DOUBLE_TYPE) {
+					double ret;
+					int intRet;
+					bool isInt;
+					if (arithDouble(in->d, l_node->val.d_val,
+							r_node->val.d_val, &ret, &intRet, &isInt)) {
+						if (isInt) {
+							dst->type = INT_TYPE;
+							dst->val.i_val = intRet;
+						} else {
+							dst->type = DOUBLE_TYPE;
+							dst->val.d_val = ret;
+						}
+						regs[in->a] = dst;
+						break;
+					}
+				}
+				//	Empty operands and type errors
+				if (r_node->type == EMPTY_TYPE) {
+					regs[in->a] = regs[in->c];
+				} else if (l_node->type == EMPTY_TYPE) {
+					regs[in->a] = regs[in->b];
+				} else {
+					regs[in->a] = arith_operation(ps, in->d, l_node, r_node);
+					if (regs[in->a]->type == EMPTY_TYPE) {
+						DSL_ERROR("Error performing arith operation\n");
+					}
+				}
+				break;
+			}
+			case MQL_OP_NEG: {
+				const ASTNode* src = regs[in->b];
+				ASTNode* dst = &(scratch[in->a]);
+				regs[in->a] = dst;
+				switch (src->type) {
+					case INT_TYPE:
+						dst->type = INT_TYPE;
+						dst->val.i_val = -1 * src->val.i_val;
+						break;
+					case DOUBLE_TYPE:
+						dst->type = DOUBLE_TYPE;
+						dst->val.d_val = -1.0 * src->val.d_val;
+						break;
+					case EMPTY_TYPE:
+						regs[in->a] = regs[in->b];
+						break;
+					case STRING_TYPE:
+						DSL_ERROR(
+							"Cannot perform unary operation on string\n");
+						regs[in->a] = ps->empty_token();
+						break;
+					default:
+						DSL_ERROR(
+							"Unknown type encountered (parser error)\n");
+						regs[in->a] = ps->empty_token();
+						break;
+				}
+				break;
+			}
+			case MQL_OP_NOT: {
+				const ASTNode* src = regs[in->b];
+				if (src->type == EMPTY_TYPE) {
+					regs[in->a] = regs[in->b];
+				} else if (src->type != INT_TYPE) {
+					DSL_ERROR(
+						"Cannot perform unary operation on non-integers\n");
+					regs[in->a] = ps->empty_token();
+				} else {
+					ASTNode* dst = &(scratch[in->a]);
+					dst->type = INT_TYPE;
+					dst->val.i_val = !(src->val.i_val);
+					regs[in->a] = dst;
+				}
+				break;
+			}
+			case MQL_OP_PRINT: {
+				ASTNode* src = regs[in->b];
+				regs[in->a] = src;
+				if (src->type != EMPTY_TYPE) {
+					printValue(ps, src, in->c);
+				}
+				break;
+			}
+			case MQL_OP_JUMP:
+				pc = start + in->a;
+				break;
+			case MQL_OP_JUMP_FALSE:
+				if (regs[in->a]->type != INT_TYPE || !regs[in->a]->val.i_val) {
+					pc = start + in->b;
+				}
+				break;
+			case MQL_OP_BRANCH:
+				if (regs[in->a]->type != INT_TYPE) {
+					pc = start + in->c;		// Neither branch is taken
+				} else if (!regs[in->a]->val.i_val) {
+					pc = start + in->b;
+				}
+				break;
+			case MQL_OP_ENTER:
+				if (ps->new_context() == -1) {
+					DSL_ERROR("Error creating context\n");
+					goto done;
+				}
+				numContexts++;
+				break;
+			case MQL_OP_LEAVE:
+				for (int i = 0; i < in->a; i++) {
+					if (ps->remove_context() == -1) {
+						DSL_ERROR("Error deleting old context\n");
+					}
+				}
+				numContexts -= in->a;
+				break;
+			case MQL_OP_CALL: {
+				ASTNode* func_node = lookupGlobal(ps, in->b);
+				if (func_node == NULL || func_node->type != FUNC_CALL_TYPE) {
+					DSL_ERROR("Cannot find function reference\n");
+					regs[in->a] = ps->empty_token();
+					break;
+				}
+				regs[in->a] = mql_invoke(ps, func_node, regs + in->c,
+					in->d, recurse_count + 1);
+				break;
+			}
+			case MQL_OP_NATIVE: {
+				if (nativeNumber(in->b, regs + in->c, &(scratch[in->a]))) {
+					regs[in->a] = &(scratch[in->a]);
+					break;
+				}
+				//	The parameters evaluate to themselves
+				ASTNode native;
+				native.type = NATIVE_FUNC_TYPE;
+				native.val.n_val.n_type = in->b;
+				native.val.n_val.n_param_1 =
+					(in->d > 0) ? regs[in->c] : ps->empty_token();
+				native.val.n_val.n_param_2 =
+					(in->d > 1) ? regs[in->c + 1] : ps->empty_token();
+				native.val.n_val.n_param_3 =
+					(in->d > 2) ? regs[in->c + 2] : ps->empty_token();
+				regs[in->a] = evalNativeFunctions(ps, &native, recurse_count);
+				break;
+			}
+			case MQL_OP_RPC:
+				regs[in->a] = rpcCall(ps, regs[in->b],
+					names[in->d], regs + in->b + 1, in->c);
+				break;
+			case MQL_OP_RETURN:
+				if (in->a != -1 && regs[in->a]->type != EMPTY_TYPE) {
+					//	Copied out before the contexts it may live in go
+					if (retNode == NULL) {
+						DSL_ERROR("Cannot update unknown variable %s found\n",
+							ps->return_string()->c_str());
+					} else if (callerTable->updateADT(
+							retNode, regs[in->a]) == -1) {
+						DSL_ERROR("Cannot update $TEMP_VALUE$ variable "
+							"(parser error)\n");
+					}
+				}
+				goto done;
+			case MQL_OP_END:
+				goto done;
+		}
+	}
+done:
+	for (; numContexts > 0; numContexts--) {
+		ps->remove_context();
+	}
+	return retNode;
+}
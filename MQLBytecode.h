@@ -0,0 +1,118 @@
+#ifndef CLASS_MQL_BYTECODE
+#define CLASS_MQL_BYTECODE
+
+//	Included by MQLState.h once ASTNode is defined
+
+#include <map>
+#include <vector>
+
+//	Each function body is compiled, on its first call, into a flat list of
+//	register instructions. Parameters and local variables are resolved to
+//	register slots at compile time, so the interpreter no longer looks
+//	names up in the VarTable maps. Registers hold ASTNode pointers, as the
+//	tree walker's return values do. Intermediate int and double results
+//	are written into a scratch node owned by the destination register
+//	instead of a newly allocated ASTNode
+enum MQLOpcode {
+	MQL_OP_CONST,		// a = dst, b = constant
+	MQL_OP_GLOBAL,		// a = dst, b = name
+	MQL_OP_MOVE,		// a = dst, b = src
+	MQL_OP_DECL,		// a = slot, b = declaration, c = array size or -1
+	MQL_OP_DECL_INIT,	// a = slot, b = declaration, c = initial value
+	MQL_OP_SEP,			// a = dst, b = first value, c = number of values
+	MQL_OP_ASSIGN,		// a = dst, b = variable, c = value
+	MQL_OP_INDEX,		// a = dst, b = array, c = index
+	MQL_OP_FIELD,		// a = dst, b = struct, c = field name
+	MQL_OP_ARITH,		// a = dst, b = left, c = right, d = operator
+	MQL_OP_NEG,			// a = dst, b = src
+	MQL_OP_NOT,			// a = dst, b = src
+	MQL_OP_PRINT,		// a = dst, b = src, c = 1 for println
+	MQL_OP_JUMP,		// a = target
+	MQL_OP_JUMP_FALSE,	// a = cond, b = target, taken unless cond is a
+						// non-zero int
+	MQL_OP_BRANCH,		// a = cond, b = target if zero, c = target if
+						// cond is not an int
+	MQL_OP_ENTER,		// Push a context
+	MQL_OP_LEAVE,		// a = number of contexts to pop
+	MQL_OP_CALL,		// a = dst, b = name, c = first arg, d = number of args
+	MQL_OP_NATIVE,		// a = dst, b = native, c = first arg, d = number
+	MQL_OP_RPC,			// a = dst, b = destination followed by the args,
+						// c = number of args, d = function name
+	MQL_OP_RETURN,		// a = src or -1
+	MQL_OP_END
+};
+
+typedef struct {
+	int		op;
+	int		a;
+	int		b;
+	int		c;
+	int		d;
+} MQLInstr;
+
+class MQLProgram;
+
+class MQLFunction {
+friend class MQLCompiler;
+private:
+	vector<MQLInstr>		code;
+	vector<ASTNode*>		consts;		// Literals of the AST
+	vector<const string*>	names;		// Globals, fields and RPC targets
+	vector<ASTNode*>		globals;	// Resolved names, NULL until found
+	vector<const ASTNode*>	decls;		// NEW_VAR(_ASSIGN) nodes
+	u_int					numRegs;
+	u_int					numParams;
+
+	ASTNode* run(ParserState* ps, ASTNode** regs, ASTNode* scratch,
+		VarTable* callerTable, ASTNode* retNode, int recurse_count);
+	ASTNode* lookupGlobal(ParserState* ps, int name);
+public:
+	MQLFunction() : numRegs(0), numParams(0) {}
+
+	//	Same contract as the FUNC_CALL_TYPE case of eval. The caller has
+	//	already evaluated the actual parameters
+	ASTNode* call(ParserState* ps, ASTNode* func_node,
+		ASTNode** args, u_int num_args, int recurse_count);
+	u_int size() const		{ return code.size(); }
+};
+
+//	Compiled functions of one ParserState along with the register stack
+//	they run on. Frames are strictly LIFO. The stack is made of chunks that
+//	are never moved, so registers may point at scratch nodes of any live
+//	frame
+class MQLProgram {
+private:
+	map<const ASTNode*, MQLFunction*>	functions;	// NULL if not compilable
+	typedef struct {
+		ASTNode**	regs;
+		ASTNode*	scratch;
+		u_int		size;
+		u_int		used;
+	} MQLChunk;
+	vector<MQLChunk>	chunks;
+	u_int				curChunk;
+	u_int				numCompiled;
+	u_int				numFailed;
+	u_int				numInstrs;
+public:
+	MQLProgram() : curChunk(0), numCompiled(0), numFailed(0), numInstrs(0) {}
+	~MQLProgram();
+
+	//	Compiled form of the function (a FUNC_CALL_TYPE node), compiling
+	//	it on first use. Returns NULL if the body uses a construct the
+	//	compiler does not handle, the tree walker runs it instead
+	MQLFunction* lookup(ParserState* ps, const ASTNode* func_node);
+
+	int allocFrame(u_int numRegs, ASTNode*** regs, ASTNode** scratch);
+	void freeFrame(u_int numRegs);
+
+	u_int getNumCompiled() const	{ return numCompiled; }
+	u_int getNumFailed() const		{ return numFailed; }
+	u_int getNumInstrs() const		{ return numInstrs; }
+};
+
+//	Runs the compiled form of func_node. Returns NULL if it has none
+extern ASTNode* mql_call(ParserState* ps, ASTNode* func_node,
+	ASTNode** args, u_int num_args, int recurse_count);
+
+#endif
@@ -23,6 +23,30 @@ using namespace std;
 
 #include <assert.h>
 #include "MQLState.h"
+#include "ProgramCache.h"
+
+static const string addrField("addr");
+static const string portField("port");
+static const string rendvAddrField("rendvAddr");
+static const string rendvPortField("rendvPort");
+static const string distanceField("distance");
+static const string nodeName("Node");
+static const string measurementName("Measurement");
+static const string* builtinFields[] = { &addrField, &portField, 
+	&rendvAddrField, &rendvPortField, &distanceField };
+
+const ADTLayout adt_node_layout = { 4, builtinFields };
+const ADTLayout adt_measurement_layout = { 5, builtinFields };
+
+const ADTLayout* adt_builtin_layout(const string& in_name) {
+	if (in_name == nodeName) {
+		return &adt_node_layout;
+	}
+	if (in_name == measurementName) {
+		return &adt_measurement_layout;
+	}
+	return NULL;
+}
 
 //#define MAX_POOL_SIZE 10
 //extern void flatten_ast(vector<ASTNode*>* list, ASTNode* tree);
@@ -33,35 +57,10 @@ int VarTable::remove_var_map_context() {
 	return 0;
 }
 
-int VarTable::remove_AST_context() {
-	for (u_int i = 0; i < v_stack_ast.size(); i++) {
-		v_ps->delete_ast(v_stack_ast[i]);
-	}
-	v_stack_ast.clear();
-	return 0;	
-}
-
-int VarTable::remove_string_context() {
-	for (u_int i = 0; i < v_stack_string.size(); i++) {	
-		v_ps->delete_string(v_stack_string[i]);
-	}
-	v_stack_string.clear();
-	return 0;	
-}
-
-int VarTable::remove_vector_context() {
-	for (u_int i = 0; i < v_stack_vector.size(); i++) {
-		v_ps->delete_vector(v_stack_vector[i]);
-	}
-	v_stack_vector.clear();
-	return 0;	
-}
-
-int VarTable::remove_map_context() {
-	for (u_int i = 0; i < v_stack_map.size(); i++) {
-		v_ps->delete_map(v_stack_map[i]);			
-	}
-	v_stack_map.clear();
+int VarTable::remove_arena_context() {
+	v_ps->delete_ast(v_num_ast);
+	v_num_ast = 0;
+	v_arena.release();
 	return 0;	
 }
 
@@ -117,39 +116,143 @@ int VarTable::update(const string& in_string, const ASTNode* in_var) {
 }
 
 ASTNode* VarTable::new_stack_ast() {
-	ASTNode* retAst = v_ps->new_ast();
+	ASTNode* retAst = v_ps->new_ast(&v_arena);
 	if (retAst == NULL) {
 		return NULL;	
 	}
-	v_stack_ast.push_back(retAst);
+	v_num_ast++;
 	return retAst;
 }
 
 string* VarTable::new_stack_string() {
-	string* retString = v_ps->new_string();
-	if (retString == NULL) {
-		return NULL;	
-	}
-	v_stack_string.push_back(retString);
-	return retString;
+	return v_arena.create<string>();
 }
 
 vector<ASTNode*>* VarTable::new_stack_vector() {
-	vector<ASTNode*>* retVector = v_ps->new_vector();
-	if (retVector == NULL) {
-		return NULL;	
+	return v_arena.create<vector<ASTNode*> >();
+}
+
+ASTNode** VarTable::new_stack_fields(u_int in_num_fields) {
+	//	Not empty so that NULL only means failure
+	if (in_num_fields == 0) {
+		in_num_fields = 1;
 	}
-	v_stack_vector.push_back(retVector);	
-	return retVector;
+	return (ASTNode**)v_arena.alloc(in_num_fields * sizeof(ASTNode*));
 }
 
-map<string, ASTNode*>* VarTable::new_stack_map() {
-	map<string, ASTNode*>* retMap = v_ps->new_map();
-	if (retMap == NULL) {
-		return NULL;	
+const ADTLayout* VarTable::new_stack_layout(
+		const string* in_name, const ASTNode* in_param) {
+	const vector<ASTNode*>* fields = NULL;
+	u_int numFields = 0;
+	if (in_param->type == SEP_TYPE) {
+		fields = in_param->val.p_val.p_vector;
+		numFields = fields->size();
+	}
+	//	Node and Measurement share the built in layout so that natives can
+	//	get at their fields by index
+	const ADTLayout* builtin = adt_builtin_layout(*in_name);
+	if (builtin != NULL && builtin->numFields == numFields) {
+		u_int i = 0;
+		while (i < numFields && *(builtin->fieldNames[i]) 
+				== *((*fields)[i]->val.v_val.v_name)) {
+			i++;
+		}
+		if (i == numFields) {
+			return builtin;
+		}
+	}
+	vector<string*> names;
+	for (u_int i = 0; i < numFields; i++) {
+		names.push_back((*fields)[i]->val.v_val.v_name);
+	}
+	return new_stack_layout(names);
+}
+
+const ADTLayout* VarTable::new_stack_layout(const vector<string*>& in_names) {
+	ADTLayout* layout = (ADTLayout*)v_arena.alloc(sizeof(ADTLayout));
+	if (layout == NULL) {
+		return NULL;
+	}
+	layout->numFields = in_names.size();
+	layout->fieldNames = (const string**)v_arena.alloc(
+		(in_names.empty() ? 1 : in_names.size()) * sizeof(string*));
+	if (layout->fieldNames == NULL) {
+		return NULL;
+	}
+	for (u_int i = 0; i < in_names.size(); i++) {
+		layout->fieldNames[i] = in_names[i];
+	}
+	return layout;
+}
+
+const ADTLayout* VarTable::lookup_layout(const string& in_name) {
+	const ADTLayout* builtin = adt_builtin_layout(in_name);
+	if (builtin != NULL) {
+		return builtin;
+	}
+	const ASTNode* adtNode = lookup_adt(in_name);
+	if (adtNode == NULL) {
+		return NULL;
+	}
+	return adtNode->val.adt_val.adt_layout;
+}
+
+const ASTNode* VarTable::lookup_adt(const string& in_name) {
+	ASTNode* adtNode = NULL;
+	if (lookup(in_name, &adtNode) == -1 || adtNode->type != ADT_TYPE) {
+		return NULL;
+	}
+	return adtNode;
+}
+
+//	A value copied from another scope may point at strings in the arena of
+//	that scope, e.g. a struct received in an rpc. Declarations are found
+//	through this table, so they outlive it
+const string* VarTable::copy_adt_name(const string* in_name) {
+	const ASTNode* adtNode = lookup_adt(*in_name);
+	if (adtNode != NULL) {
+		return adtNode->val.adt_val.adt_type_name;
+	}
+	string* retName = new_stack_string();
+	if (retName == NULL) {
+		return NULL;
+	}
+	*retName = *in_name;
+	return retName;
+}
+
+const ADTLayout* VarTable::copy_layout(
+		const string& in_name, const ADTLayout* in_layout) {
+	//	Built in layouts are static
+	if (in_layout == &adt_node_layout || 
+			in_layout == &adt_measurement_layout) {
+		return in_layout;
+	}
+	const ADTLayout* declared = lookup_layout(in_name);
+	if (declared == in_layout) {
+		return declared;
+	}
+	if (declared != NULL && declared->numFields == in_layout->numFields) {
+		u_int i = 0;
+		while (i < in_layout->numFields && 
+				*(declared->fieldNames[i]) == *(in_layout->fieldNames[i])) {
+			i++;
+		}
+		if (i == in_layout->numFields) {
+			return declared;
+		}
+	}
+	//	Laid out as received, the names go with the layout
+	vector<string*> names;
+	for (u_int i = 0; i < in_layout->numFields; i++) {
+		string* name = new_stack_string();
+		if (name == NULL) {
+			return NULL;
+		}
+		*name = *(in_layout->fieldNames[i]);
+		names.push_back(name);
 	}
-	v_stack_map.push_back(retMap);	
-	return retMap;
+	return new_stack_layout(names);
 }
 
 ASTNode* VarTable::create_basic_type(const ASTType in_type) {
@@ -208,9 +311,13 @@ ASTNode* VarTable::ASTCreate(const ASTType in_type,
 		//retVar->val.adt_val.adt_type_name = adt_name;
 		retVar->val.adt_val.adt_type_name 
 			= adtNode->val.adt_val.adt_type_name;
-		retVar->val.adt_val.adt_map = new_stack_map();
+		retVar->val.adt_val.adt_layout = adtNode->val.adt_val.adt_layout;
 		vector<ASTNode*>* tmpList 
 			= adtNode->val.adt_val.adt_param->val.p_val.p_vector;		
+		retVar->val.adt_val.adt_fields = new_stack_fields(tmpList->size());
+		if (retVar->val.adt_val.adt_fields == NULL) {
+			return NULL;
+		}
 		for (u_int i = 0; i < tmpList->size(); i++) {
 			ASTNode* field_node = (*tmpList)[i];
 
@@ -233,8 +340,7 @@ ASTNode* VarTable::ASTCreate(const ASTType in_type,
 				DSL_ERROR("Create fields failed\n");
 				return NULL;
 			}
-			(*(retVar->val.adt_val.adt_map))
-				[*(field_node->val.v_val.v_name)] = tmpNode;
+			retVar->val.adt_val.adt_fields[i] = tmpNode;
 		}		
 	} else if (in_type == ARRAY_TYPE) {
 		if (array_size < 0) {
@@ -280,36 +386,16 @@ ASTNode* VarTable::ASTCreate(const ASTType in_type,
 int VarTable::updateADT(ASTNode* retVar, const ASTNode* in_var) {	
 	if (retVar->type == VAR_ADT_TYPE && in_var->type == SEP_TYPE) {
 		// Handling initialization of ADT with parameter list
-		ASTNode* adt_name = NULL;
-		if (lookup(
-				*(retVar->val.adt_val.adt_type_name), &adt_name) == -1) {
-			DSL_ERROR("Struct definition not found (parser error)\n");
-			return -1;				
-		}
-		if (adt_name->val.adt_val.adt_param->type != SEP_TYPE) {
-			DSL_ERROR(
-				"Struct definition contains no entries (parser error)\n");
-			return -1;									
-		}
-		vector<ASTNode*>* tmpList 
-			= adt_name->val.adt_val.adt_param->val.p_val.p_vector;
+		const ADTLayout* layout = retVar->val.adt_val.adt_layout;
 		vector<ASTNode*>* paramListVector = in_var->val.p_val.p_vector;
-		if (tmpList->size() != paramListVector->size()) {
+		if (layout->numFields != paramListVector->size()) {
 			DSL_ERROR("Initiation list of incorrect size/type\n");
 			return -1;
 		}				
-		for (u_int i = 0; i < tmpList->size(); i++) {					
-			string* tmpString = (*tmpList)[i]->val.v_val.v_name;
-			map<string, ASTNode*>::iterator findItA = 
-				retVar->val.adt_val.adt_map->find(*tmpString);
-			if (findItA	== retVar->val.adt_val.adt_map->end()) {
-				DSL_ERROR(
-					"Struct definition inconsistent (parser error)\n");
-				return -1;							
-			}
+		for (u_int i = 0; i < layout->numFields; i++) {					
 			//printf("Param type is %d\n", (*paramListVector)[i]->type);		
-			if (updateADT(
-					findItA->second, (*paramListVector)[i]) == -1) {
+			if (updateADT(retVar->val.adt_val.adt_fields[i], 
+					(*paramListVector)[i]) == -1) {
 				return -1;
 			}		
 		}
@@ -392,33 +478,21 @@ int VarTable::updateADT(ASTNode* retVar, const ASTNode* in_var) {
 				DSL_ERROR("Incorrect struct type assignment\n");
 				return -1;
 			}
-			ASTNode* adt_name = NULL;
-			if (lookup(
-					*(retVar->val.adt_val.adt_type_name), &adt_name) == -1) {
-				DSL_ERROR("Struct definition not found (parser error)\n");
-				return -1;				
-			}
-			if (adt_name->val.adt_val.adt_param->type != SEP_TYPE) {
-				DSL_ERROR(
-					"Struct definition contains no entries (parser error)\n");
-				return -1;									
-			}
-			vector<ASTNode*>* tmpList 
-				= adt_name->val.adt_val.adt_param->val.p_val.p_vector;			
-			for (u_int i = 0; i < tmpList->size(); i++) {
-				string* tmpString = (*tmpList)[i]->val.v_val.v_name;
-				//printf("Assign field name %s\n", tmpString->c_str());
-				map<string, ASTNode*>::iterator findItA = 
-					retVar->val.adt_val.adt_map->find(*tmpString);
-				map<string, ASTNode*>::iterator findItB = 
-					in_var->val.adt_val.adt_map->find(*tmpString);
-				if (findItA	== retVar->val.adt_val.adt_map->end() ||
-						findItB	== in_var->val.adt_val.adt_map->end() ) {
+			//	Structs received in packets may have their own layout
+			const ADTLayout* layoutA = retVar->val.adt_val.adt_layout;
+			const ADTLayout* layoutB = in_var->val.adt_val.adt_layout;
+			for (u_int i = 0; i < layoutA->numFields; i++) {
+				int j = i;
+				if (layoutB != layoutA) {
+					j = adt_field_index(layoutB, *(layoutA->fieldNames[i]));
+				}
+				if (j == -1) {
 					DSL_ERROR(
 						"Struct definition inconsistent (parser error)\n");
 					return -1;							
 				}
-				if (updateADT(findItA->second, findItB->second) == -1) {
+				if (updateADT(retVar->val.adt_val.adt_fields[i], 
+						in_var->val.adt_val.adt_fields[j]) == -1) {
 					return -1;
 				}				
 			}
@@ -431,3 +505,105 @@ int VarTable::updateADT(ASTNode* retVar, const ASTNode* in_var) {
 	return 0;
 }
 
+
+ASTNode* VarTable::copy_value(const ASTNode* in_var) {
+	ASTNode* retVar = new_stack_ast();
+	if (retVar == NULL) {
+		return NULL;
+	}
+	*retVar = *in_var;
+	switch (in_var->type) {
+		case INT_TYPE:
+		case DOUBLE_TYPE:
+			break;
+		case STRING_TYPE:
+			if ((retVar->val.s_val = new_stack_string()) == NULL) {
+				return NULL;
+			}
+			*(retVar->val.s_val) = *(in_var->val.s_val);
+			break;
+		case VAR_ADT_TYPE: {
+			const string* typeName = in_var->val.adt_val.adt_type_name;
+			if ((retVar->val.adt_val.adt_type_name = 
+					copy_adt_name(typeName)) == NULL ||
+				(retVar->val.adt_val.adt_layout = copy_layout(*typeName,
+					in_var->val.adt_val.adt_layout)) == NULL) {
+				return NULL;
+			}
+			u_int numFields = in_var->val.adt_val.adt_layout->numFields;
+			ASTNode** fields = new_stack_fields(numFields);
+			if (fields == NULL) {
+				return NULL;
+			}
+			for (u_int i = 0; i < numFields; i++) {
+				fields[i] = copy_value(in_var->val.adt_val.adt_fields[i]);
+				if (fields[i] == NULL) {
+					return NULL;
+				}
+			}
+			retVar->val.adt_val.adt_fields = fields;
+			break;
+		}
+		case ARRAY_TYPE: {
+			vector<ASTNode*>* inVect = in_var->val.a_val.a_vector;
+			vector<ASTNode*>* retVect = new_stack_vector();
+			if (retVect == NULL) {
+				return NULL;
+			}
+			if (in_var->val.a_val.a_type == ADT_TYPE && 
+					(retVar->val.a_val.a_adt_name = 
+						copy_adt_name(in_var->val.a_val.a_adt_name)) == NULL) {
+				return NULL;
+			}
+			retVect->reserve(inVect->size());
+			for (u_int i = 0; i < inVect->size(); i++) {
+				ASTNode* entry = copy_value((*inVect)[i]);
+				if (entry == NULL) {
+					return NULL;
+				}
+				retVect->push_back(entry);
+			}
+			retVar->val.a_val.a_vector = retVect;
+			retVar->val.a_val.a_var_table = this;
+			break;
+		}
+		default:
+			DSL_ERROR("Unsupported type %d in copy\n", in_var->type);
+			return NULL;
+	}
+	return retVar;
+}
+
+void ParserState::set_source(CachedProgram* in_source) {
+	in_source->addRef();
+	if (source) source->release();
+	source = in_source;
+	set_start(source->getStart());
+}
+
+void ParserState::fiber_main(void* in_ps) {
+	ParserState* ps = (ParserState*)in_ps;
+	ps->fiber_entry(ps);
+}
+
+int ParserState::save_context(void (*in_entry)(ParserState*)) {
+	if (context_stack != NULL) {
+		return -1;	
+	}
+	if ((context_stack = FiberStackPool::pool()->alloc()) == NULL) {
+		return -1;	
+	}
+	fiber_entry = in_entry;
+	fiber_make(&parse_context, context_stack, FIBER_STACK, 
+		&ParserState::fiber_main, this);
+	return 0;
+}
+
+ParserState::~ParserState() {
+	if (lexer) delete lexer;
+	while (remove_var_table() != -1);
+	if (program) delete program;
+	if (context_stack) FiberStackPool::pool()->release(context_stack);
+	//	Released last, the var tables may point into the shared AST
+	if (source) source->release();
+}
@@ -7,11 +7,13 @@
 #include <vector>
 #include <stdint.h>
 #include <FlexLexer.h>
-#include <ucontext.h>
+#include "Fiber.h"
+#include "MQLArena.h"
 
 // Forward typedef and declaration		
 typedef struct ASTNode_t ASTNode;		 
 class ParserState;
+class CachedProgram;
 class VarTable;
 
 enum ASTType {	EMPTY_TYPE = 0, 
@@ -51,6 +53,35 @@ enum ASTType {	EMPTY_TYPE = 0,
 			
 #include "Marshal.h"
 
+//	Field names of a struct type in declaration order. A struct variable
+//	keeps its fields in an array in the same order
+typedef struct {
+	u_int				numFields;
+	const string**		fieldNames;
+} ADTLayout;
+
+//	Fields of the built in Node and Measurement structs, Measurement
+//	starts with the fields of Node
+#define ADT_FIELD_ADDR			0
+#define ADT_FIELD_PORT			1
+#define ADT_FIELD_RENDV_ADDR	2
+#define ADT_FIELD_RENDV_PORT	3
+#define ADT_FIELD_DISTANCE		4
+
+extern const ADTLayout adt_node_layout;
+extern const ADTLayout adt_measurement_layout;
+//	Layout of the built in struct of that name, or NULL
+extern const ADTLayout* adt_builtin_layout(const string& in_name);
+
+inline int adt_field_index(const ADTLayout* in_layout, const string& in_name) {
+	for (u_int i = 0; i < in_layout->numFields; i++) {
+		if (*(in_layout->fieldNames[i]) == in_name) {
+			return i;
+		}
+	}
+	return -1;
+}
+
 typedef union ASTVal_t {
 	double 	 					d_val;
 	int32_t	 					i_val;
@@ -133,8 +164,9 @@ typedef union ASTVal_t {
 	//	Adt type
 	struct {
 		const string*			adt_type_name;
-		ASTNode*				adt_param;
-		map<string, ASTNode*>*	adt_map;
+		ASTNode*				adt_param;	// Field declarations of ADT_TYPE
+		const ADTLayout*		adt_layout;
+		ASTNode**				adt_fields;	// Of VAR_ADT_TYPE, in layout order
 	} adt_val;
 	
 	//	For if statements
@@ -156,42 +188,49 @@ typedef struct ASTNode_t {
 	ASTVal		val;
 };
 
+//	Field of a struct variable, NULL if it has none of that name
+inline ASTNode* adt_field(const ASTNode* in_adt, const string& in_name) {
+	int i = adt_field_index(in_adt->val.adt_val.adt_layout, in_name);
+	if (i == -1) {
+		return NULL;
+	}
+	return in_adt->val.adt_val.adt_fields[i];
+}
+
 class ParserState;
 class VarTable{
 private:
 	ParserState*						v_ps;	
 	map<const string, ASTNode*> 		v_map;
-	vector<ASTNode*> 					v_stack_ast;
-	vector<string*> 					v_stack_string;
-	vector<vector<ASTNode*>*> 			v_stack_vector;
-	vector<map<string, ASTNode*>*> 		v_stack_map;	
+	MQLArena							v_arena;	// Temporaries of the scope
+	int									v_num_ast;	// In v_arena
 	
 	VarTable* prev_var_table;	// Pointer to a prev var table that 
 								// contains the global variables/declarations
 		
 	int remove_var_map_context();
-	int remove_AST_context();
-	int remove_string_context();
-	int remove_vector_context();
-	int remove_map_context();
+	int remove_arena_context();
 	
 	static bool local_exists(const map<const string, ASTNode*>* in_map, 
 		const string& in_string);	
 	static int local_lookup(const map<const string, ASTNode*>* in_map, 
 		const string& in_string, ASTNode** in_type);
 	ASTNode* create_basic_type(const ASTType in_type);
+	//	Declaration of the struct type of that name, NULL if not declared
+	const ASTNode* lookup_adt(const string& in_name);
+	//	Type name and layout of in_var that live as long as this table
+	const string* copy_adt_name(const string* in_name);
+	const ADTLayout* copy_layout(
+		const string& in_name, const ADTLayout* in_layout);
 	
 public:
 	VarTable(ParserState* in_ps, VarTable* in_prev) 
-		: v_ps(in_ps), prev_var_table(in_prev) {		
+		: v_ps(in_ps), v_num_ast(0), prev_var_table(in_prev) {		
 	}
 	
 	~VarTable() {
 		remove_var_map_context();
-		remove_AST_context();
-		remove_string_context();
-		remove_vector_context();
-		remove_map_context();		
+		remove_arena_context();
 	}
 	
 	int local_remove(const string& in_string);
@@ -199,17 +238,27 @@ public:
 	int insert(const string& in_string, ASTNode* in_type);	
 	int update(const string& in_string, const ASTNode* in_var);
 	
+	//	Freed together when the scope ends. Return NULL on failure
 	ASTNode* new_stack_ast();
 	string* new_stack_string();
 	vector<ASTNode*>* new_stack_vector();
-	map<string, ASTNode*>* new_stack_map();
+	ASTNode** new_stack_fields(u_int in_num_fields);
+	//	Layout of a struct declared with the given fields
+	const ADTLayout* new_stack_layout(
+		const string* in_name, const ASTNode* in_param);
+	const ADTLayout* new_stack_layout(const vector<string*>& in_names);
+	//	Layout of the struct type of that name, NULL if not declared
+	const ADTLayout* lookup_layout(const string& in_name);
 		
 	ASTNode* ASTCreate(const ASTType in_type, 
 		const string* adt_name, const ASTType array_type, int array_size);			
 	int updateADT(ASTNode* retVar, const ASTNode* in_var);
+	//	Deep copy of an int, double, string, struct or array
+	ASTNode* copy_value(const ASTNode* in_var);
 };
 
 #include "MQL.tab.hpp"
+#include "MQLBytecode.h"
 
 class MyFlexLexer : public yyFlexLexer {
 public:	
@@ -305,45 +354,40 @@ private:
 	int					evalCount;
 	PSState				state;
 	void*				context_stack;
-	ucontext_t			parse_context;
+	FiberContext		parse_context;
+	void				(*fiber_entry)(ParserState*);
+	
+	static void fiber_main(void* in_ps);
 	//ASTNode* 			rpc_return;
 	ASTNode*			query_return;
 	DSLRecvQuery*		queryPtr;
 	MeridianProcess*	meridProcess;
 	ASTNode*			rpc_recv;
+	MQLProgram*			program;	// Compiled functions
+	bool				bytecode;	// Run functions compiled if possible
+	CachedProgram*		source;		// Shared parsed program, or NULL
+	ProgramHash			source_hash;	// Program sent by hash
+	bool				source_by_hash;
 
 	int 				ASTAllocationCount;	
 	
 	
-	void delete_map(map<string, ASTNode*>* in_map) 		{	delete in_map; }
-	void delete_vector(vector<ASTNode*>* in_vect) 		{	delete in_vect; }
-	void delete_string(string* in_str) 					{	delete in_str; }
-	void delete_ast(ASTNode* in_ast)  {
-		ASTAllocationCount--;
-		free(in_ast);	
+	void delete_ast(int in_count) {
+		ASTAllocationCount -= in_count;
 	}
-	// This functions are the only ones that ParserState can return NULL
-	// They should not be called directly except by the VarTable and the
+	// This function is the only one that ParserState can return NULL
+	// It should not be called directly except by the VarTable and the
 	// return value should be checked 	
-	map<string, ASTNode*>* new_map() {
-		map<string, ASTNode*>* retMap = new map<string, ASTNode*>();
-		return retMap;
-	}	
-	vector<ASTNode*>* new_vector() {
-		vector<ASTNode*>* retVect = new vector<ASTNode*>();
-		return retVect;
-	}	
-	string* new_string() {
-		string* retStr = new string();
-		return retStr;
-	}	
 #define MAX_AST_PER_STACK	100000	
-	ASTNode* new_ast() {		
-		if (++ASTAllocationCount > MAX_AST_PER_STACK) {
+	ASTNode* new_ast(MQLArena* in_arena) {		
+		if (ASTAllocationCount >= MAX_AST_PER_STACK) {
 			fprintf(stderr, "Maximum allocation count reached\n");
 			return NULL;
 		}
-		ASTNode* retNode = (ASTNode*)malloc(sizeof(ASTNode));
+		ASTNode* retNode = (ASTNode*)in_arena->alloc(sizeof(ASTNode));
+		if (retNode != NULL) {
+			ASTAllocationCount++;
+		}
 		return retNode;
 	}		
 
@@ -364,26 +408,11 @@ public:
 	PSState parser_state() const				{ return state; }
 
 	ParserInputBuffer	input_buffer;
-	//ucontext_t 			save_context;
-	int save_context() {
-		if (context_stack != NULL) {
-			return -1;	
-		}
-#define FIBER_STACK	(256 * 1024)				
-		if ((context_stack = malloc(FIBER_STACK)) == NULL) {
-			return -1;	
-		}		
-		// Get the current execution context
-		getcontext(&(parse_context));			
-		// Modify the context to a new stack
-		parse_context.uc_link = 0;		
-		parse_context.uc_stack.ss_sp = context_stack;
-		parse_context.uc_stack.ss_size = FIBER_STACK;
-		parse_context.uc_stack.ss_flags = 0;
-		return 0;
-	}
+	//	Creates the thread that runs in_entry(this) when first switched to,
+	//	on a stack from the fiber stack pool
+	int save_context(void (*in_entry)(ParserState*));
 	
-	ucontext_t* get_context() {
+	FiberContext* get_context() {
 		if (context_stack == NULL) {
 			return NULL;	
 		}
@@ -525,10 +554,51 @@ public:
 	MeridianProcess* getMeridProcess() {
 		return meridProcess;	
 	}
+	
+	MQLProgram* get_program() {
+		if (program == NULL) {
+			program = new MQLProgram();
+		}
+		return program;
+	}
+	
+	void set_bytecode(bool in_bytecode) {
+		bytecode = in_bytecode;
+	}
+	
+	bool use_bytecode() const {
+		return bytecode;
+	}
+	
+	//	Runs the program parsed by a program cache entry instead of parsing
+	//	input_buffer. Holds a reference to the entry
+	void set_source(CachedProgram* in_source);
+	
+	CachedProgram* get_source() {
+		return source;
+	}
+	
+	void set_source_hash(const ProgramHash& in_hash) {
+		source_hash = in_hash;
+		source_by_hash = true;
+	}
+	
+	bool by_hash() const {
+		return source_by_hash;
+	}
+	
+	const ProgramHash& get_source_hash() const {
+		return source_hash;
+	}
+	
+	int getASTAllocationCount() const {
+		return ASTAllocationCount;
+	}
 		
 	ParserState() : parse_result(NULL), evalCount(0),  
-			state(PS_READY), context_stack(NULL), queryPtr(NULL), 
-			meridProcess(NULL), ASTAllocationCount(0) {		
+			state(PS_READY), context_stack(NULL), fiber_entry(NULL), 
+			queryPtr(NULL), meridProcess(NULL), program(NULL), bytecode(true), 
+			source(NULL), source_by_hash(false), ASTAllocationCount(0) {		
 		//	This symbol cannot ever actuall be used by the user,
 		//	so there can not be a collision
 		ret_string = "$RETURN_VALUE$";
@@ -546,11 +616,23 @@ public:
 		caller_id.addr = 0; caller_id.port = 0;
 	}
 	
-	~ParserState(){
-		if (lexer) delete lexer;
-		while (remove_var_table() != -1);
-		if (context_stack) free(context_stack);
-	}
+	~ParserState();
 };
 
+extern FiberContext global_env_thread;
+
+//	Charged once per evaluation step (an AST node for the tree walker, an
+//	instruction for compiled functions). Gives the CPU back to the
+//	scheduler when the budget given by allocateEvalCount is used up
+inline void eval_step(ParserState* ps) {
+	if (ps->getEvalCount() != -1) {
+		while (ps->getEvalCount() == 0) {
+			ps->set_parser_state(PS_READY);
+			fiber_switch(ps->get_context(), &global_env_thread);
+		}		
+		ps->decrementEvalCount();		
+	}	
+	ps->set_parser_state(PS_RUNNING);
+}
+
 #endif
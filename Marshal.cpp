@@ -22,9 +22,99 @@ The copyright owner can be contacted by e-mail at bwong@cs.cornell.edu
 using namespace std;
 
 #include <map>
+#include <pthread.h>
+#include <zlib.h>
 #include "Marshal.h"
 #include "RingSet.h"
 
+//	One pool per thread, so that workers never contend on it. A payload
+//	released by another thread than the one that allocated it simply
+//	moves to the pool of the releasing thread. Never destroyed, packets 
+//	may still be released during exit
+FreeListPool* RealPacket::payLoadPool() {
+	static __thread FreeListPool* pool = NULL;
+	if (pool == NULL) {
+		pool = new FreeListPool(MAX_UDP_PACKET_SIZE);
+	}
+	return pool;
+}
+
+
+//	The master table is shared by all workers and only used under the
+//	lock. Each worker reads its own copy, refreshed when the generation
+//	changes, so reading a version never writes to shared memory
+static pthread_mutex_t g_peerLock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t g_peerGen = 0;		// Bumped by every change of the master
+//	Whether the table has any entry, so that nodes whose peers all speak
+//	v1 never copy it
+static int g_anyWireV2 = 0;
+
+typedef map<NodeIdent, int, ltNodeIdent> PeerVersionMap;
+
+//	Never destroyed, like the payload pool
+PeerVersionMap* PeerWireVersion::peers() {
+	static PeerVersionMap* table = new PeerVersionMap();
+	return table;
+}
+
+//	Copy of the calling thread, never destroyed either
+const PeerVersionMap* PeerWireVersion::localPeers() {
+	static __thread PeerVersionMap* table = NULL;
+	static __thread uint64_t tableGen = 0;
+	if (table == NULL) {
+		table = new PeerVersionMap();
+	}
+	if (__atomic_load_n(&g_peerGen, __ATOMIC_ACQUIRE) != tableGen) {
+		pthread_mutex_lock(&g_peerLock);
+		*table = *(peers());
+		tableGen = g_peerGen;
+		pthread_mutex_unlock(&g_peerLock);
+	}
+	return table;
+}
+
+int PeerWireVersion::get(uint32_t addr, uint16_t port) {
+	if (!__atomic_load_n(&g_anyWireV2, __ATOMIC_ACQUIRE)) {
+		return WIRE_VERSION_1;
+	}
+	const PeerVersionMap* table = localPeers();
+	NodeIdent tmp = {addr, port};
+	PeerVersionMap::const_iterator it = table->find(tmp);
+	if (it == table->end()) {
+		return WIRE_VERSION_1;
+	}
+	return it->second;
+}
+
+void PeerWireVersion::set(const NodeIdent& peer, int version) {
+	version = MAX(WIRE_VERSION_1, MIN(version, WIRE_VERSION_MAX));
+	//	Every PING and PONG sets the version, almost always to what it was
+	if (get(peer.addr, peer.port) == version) {
+		return;
+	}
+	PeerVersionMap* table = peers();
+	pthread_mutex_lock(&g_peerLock);
+	if (version == WIRE_VERSION_1) {
+		table->erase(peer);	// Peer was downgraded
+	} else {
+		if (table->size() >= MAX_WIRE_PEERS && 
+				table->find(peer) == table->end()) {
+			WARN_LOG("Wire version table full, resetting\n");
+			table->clear();
+		}
+		(*table)[peer] = version;
+	}
+	__atomic_store_n(&g_anyWireV2, !(table->empty()), __ATOMIC_RELEASE);
+	__atomic_store_n(&g_peerGen, g_peerGen + 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&g_peerLock);
+}
+
+u_int PeerWireVersion::numPeers() {
+	pthread_mutex_lock(&g_peerLock);
+	u_int numPeers = peers()->size();
+	pthread_mutex_unlock(&g_peerLock);
+	return numPeers;
+}
 
 // This Hash function is used to hash the application name
 // into a magic number unique to the application string
@@ -48,40 +138,94 @@ uint32_t marshalHashName(char* in_name) {
 	return g_marshal_hash_val;
 }
 
-int InfoPacket::createRealPacket(RealPacket& inPacket) const {
-	inPacket.append_char(getPacketType());
-	write_id(inPacket);		
-	int dummyPos = inPacket.getPayLoadSize();	// Save position in packet
-	inPacket.append_uint(0);					// Put in dummy value for now
+//	Ring members along with the ring they are in
+void InfoPacket::getMembers(vector<pair<u_int, NodeIdentLat> >& members) const {
 	uint32_t numRings = rings->getNumberOfRings();
-	uint32_t numMembers = 0;
 	for (uint32_t i = 0; i < numRings; i++) {
 		const vector<NodeIdent>* primRing = rings->returnPrimaryRing(i);			
-		if (primRing != NULL && primRing->size() > 0) {
-			for (uint32_t j = 0; j < primRing->size(); j++) {
-				NodeIdent tmp = (*primRing)[j];
-				uint32_t latencyUS;
-				if (rings->getNodeLatency(tmp, &latencyUS) == -1) {
-					ERROR_LOG("Latency of ring member not avaliable\n");
-					continue;
-				}
-				numMembers++;
-				inPacket.append_uint(htonl(i));					
-				inPacket.append_uint(htonl(tmp.addr));
-				inPacket.append_ushort(htons(tmp.port));
-				inPacket.append_uint(htonl(latencyUS));					
+		if (primRing == NULL) {
+			continue;
+		}
+		for (uint32_t j = 0; j < primRing->size(); j++) {
+			NodeIdent tmp = (*primRing)[j];
+			uint32_t latencyUS;
+			if (rings->getNodeLatency(tmp, &latencyUS) == -1) {
+				ERROR_LOG("Latency of ring member not avaliable\n");
+				continue;
 			}
+			NodeIdentLat tmpLat = {tmp.addr, tmp.port, latencyUS};
+			members.push_back(pair<u_int, NodeIdentLat>(i, tmpLat));
 		}
-	}				
+	}
+}
+
+int InfoPacket::createRealPacket(RealPacket& inPacket) const {
+	vector<pair<u_int, NodeIdentLat> > members;
+	getMembers(members);
+	write_type(inPacket);
+	write_id(inPacket);		
+	if (!inPacket.useWireV2()) {
+		inPacket.append_uint(htonl(members.size()));
+		for (u_int i = 0; i < members.size(); i++) {
+			inPacket.append_uint(htonl(members[i].first));					
+			inPacket.append_uint(htonl(members[i].second.addr));
+			inPacket.append_ushort(htons(members[i].second.port));
+			inPacket.append_uint(htonl(members[i].second.latencyUS));
+		}
+		if (!inPacket.completeOkay()) { 
+			return -1; 
+		}
+		return 0;
+	}
+	//	v2 body: number of members, then the ring number and the v2 node
+	//	list entry of each member
+	NodeIdent dummy = {0, 0};
+	RealPacket body(dummy, inPacket.getPacketSize());
+	body.append_varint(members.size());
+	NodeListEncoder enc(body);
+	for (u_int i = 0; i < members.size(); i++) {
+		body.append_varint(members[i].first);
+		enc.appendNode(members[i].second.addr, members[i].second.port);
+		enc.appendValue(members[i].second.latencyUS);
+	}
+	if (!body.completeOkay()) {
+		return -1;
+	}
+	//	Compress the body unless that does not save space. compress fails
+	//	if the result does not fit in compSize
+	int maxCompSize = MIN(body.getPayLoadSize() - 1, inPacket.getPacketSize() 
+		- inPacket.getPayLoadSize() - (int)sizeof(char) - 5);
+	uLongf compSize = MAX(maxCompSize, 0);
+	char* compBuf = (compSize > 0) ? (char*) malloc(compSize) : NULL;
+	if (compBuf != NULL && compress((Bytef*)compBuf, &compSize, 
+			(Bytef*)body.getPayLoad(), body.getPayLoadSize()) == Z_OK) {
+		inPacket.append_char(INFO_FLAG_COMPRESSED);
+		inPacket.append_varint(body.getPayLoadSize());
+		inPacket.append_str(compBuf, compSize);
+	} else {
+		//	Incompressible, or larger than the packet
+		inPacket.append_char(0);
+		inPacket.append_packet(body);
+	}
+	free(compBuf);
 	if (!inPacket.completeOkay()) { 
 		return -1; 
 	}
-	//	Overwrite previous dummy position with real value
-	numMembers = htonl(numMembers);
-	memcpy(inPacket.getPayLoad() + dummyPos, &numMembers, sizeof(uint32_t));
 	return 0;
 }
 
+static void addInfoMember(map<u_int, vector<NodeIdentLat>*>& inMap, 
+		u_int in_ring, const NodeIdentLat& tmpNode) {
+	map<u_int, vector<NodeIdentLat>*>::iterator it = inMap.find(in_ring); 	
+	if (it == inMap.end()) {			
+		vector<NodeIdentLat>* tmp = new vector<NodeIdentLat>();
+		tmp->push_back(tmpNode);
+		inMap[in_ring] = tmp;			
+	}  else {
+		it->second->push_back(tmpNode);	
+	}
+}
+
 int InfoPacket::parse(const char* buf, int numBytes, 
 		map<u_int, vector<NodeIdentLat>*>& inMap) {
 	if (inMap.size() > 0) {
@@ -90,7 +234,7 @@ int InfoPacket::parse(const char* buf, int numBytes,
 	}
 	BufferWrapper rb(buf, numBytes);
 	char queryType = rb.retrieve_char();
-	if (rb.error() || queryType != INFO_PACKET) {
+	if (rb.error() || baseType(queryType) != INFO_PACKET) {
 		ERROR_LOG("Wrong type received\n");
 		return -1;	
 	}
@@ -101,23 +245,55 @@ int InfoPacket::parse(const char* buf, int numBytes,
 		ERROR_LOG("Wrong magic number in packet received\n");		
 		return -1;			
 	}
-	uint32_t numMembers = ntohl(rb.retrieve_uint());
-	for (uint32_t i = 0; i < numMembers; i++) {
-		NodeIdentLat tmpNode;
-		uint32_t in_ring = ntohl(rb.retrieve_uint());
-		tmpNode.addr = ntohl(rb.retrieve_uint());
-		tmpNode.port = ntohs(rb.retrieve_ushort());
-		tmpNode.latencyUS  = ntohl(rb.retrieve_uint());
-		map<u_int, vector<NodeIdentLat>*>::iterator it = inMap.find(in_ring); 	
-		if (it == inMap.end()) {			
-			vector<NodeIdentLat>* tmp = new vector<NodeIdentLat>();
-			tmp->push_back(tmpNode);
-			inMap[in_ring] = tmp;			
-		}  else {
-			it->second->push_back(tmpNode);	
+	bool parseError = false;
+	if (isWireV2(queryType)) {
+		char* rawBuf = NULL;
+		BufferWrapper bodyRB(NULL, 0);
+		u_char flags = (u_char)rb.retrieve_char();
+		if (flags & INFO_FLAG_COMPRESSED) {
+			uLongf rawSize = rb.retrieve_varint();
+			uint32_t compSize = rb.remainBufSize();
+			const char* compBuf = rb.retrieve_buf(compSize);
+			if (rb.error() || rawSize > MAX_INFO_RAW_SIZE ||
+					(rawBuf = (char*) malloc(rawSize + 1)) == NULL ||
+					uncompress((Bytef*)rawBuf, &rawSize, 
+						(const Bytef*)compBuf, compSize) != Z_OK) {
+				free(rawBuf);
+				ERROR_LOG("Cannot decompress info packet\n");
+				return -1;
+			}
+			bodyRB = BufferWrapper(rawBuf, rawSize);
+		} else {
+			bodyRB = BufferWrapper(buf + rb.returnPos(), rb.remainBufSize());
+		}
+		uint32_t numMembers = bodyRB.retrieve_varint();
+		NodeListDecoder dec(bodyRB);
+		for (uint32_t i = 0; (!bodyRB.error() && i < numMembers); i++) {
+			NodeIdentLat tmpNode;
+			u_int in_ring = bodyRB.retrieve_varint();
+			dec.retrieveNode(&(tmpNode.addr), &(tmpNode.port));
+			tmpNode.latencyUS = dec.retrieveValue();
+			if (!bodyRB.error()) {
+				addInfoMember(inMap, in_ring, tmpNode);
+			}
+		}
+		parseError = rb.error() || bodyRB.error();
+		free(rawBuf);
+	} else {
+		uint32_t numMembers = ntohl(rb.retrieve_uint());
+		for (uint32_t i = 0; (!rb.error() && i < numMembers); i++) {
+			NodeIdentLat tmpNode;
+			uint32_t in_ring = ntohl(rb.retrieve_uint());
+			tmpNode.addr = ntohl(rb.retrieve_uint());
+			tmpNode.port = ntohs(rb.retrieve_ushort());
+			tmpNode.latencyUS  = ntohl(rb.retrieve_uint());
+			if (!rb.error()) {
+				addInfoMember(inMap, in_ring, tmpNode);
+			}
 		}
+		parseError = rb.error();
 	}
-	if (rb.error()) {
+	if (parseError) {
 		map<u_int, vector<NodeIdentLat>*>::iterator it = inMap.begin();
 		for (; it != inMap.end(); it++) {
 			delete it->second;
@@ -11,9 +11,12 @@
 #include <vector>
 #include <map>
 #include <openssl/md5.h>
+#include <openssl/sha.h>
 #include "Common.h"
+#include "Pool.h"
 
 class RingSet;	// Need ot have forward declaration of ringset for infopacket
+class RetResponseView;
 
 uint32_t marshalHashName(char* in_name); 
 
@@ -49,6 +52,13 @@ uint32_t marshalHashName(char* in_name);
 #ifdef MERIDIAN_DSL
 #define	DSL_REQUEST					24
 #define	DSL_REPLY					25
+#define	DSL_PROGRAM_MISS			29	// Program hash not in the cache
+//	Program size of a DSL_REQUEST carrying the hash of the program instead
+//	of its text. Only sent to peers that reported having the program
+#define DSL_PROGRAM_BY_HASH			0xFFFFFFFF
+//	Trailer of a DSL_REPLY, followed by the hash of the program the replying
+//	node cached. v1 nodes ignore the trailing bytes
+#define DSL_CACHED_MARK				0x5C
 #endif
 
 #ifdef PLANET_LAB_SUPPORT
@@ -57,6 +67,34 @@ uint32_t marshalHashName(char* in_name);
 #define REQ_CONSTRAINT_N_ICMP		28
 #endif
 
+//	Wire format versions. Version 2 packets have WIRE_V2_FLAG set in the
+//	type byte and carry their node lists in the compact encoding of
+//	NodeListEncoder. The header (type, id, magic) is the same in both
+#define WIRE_VERSION_1				1
+#define WIRE_VERSION_2				2
+#define WIRE_VERSION_MAX			WIRE_VERSION_2
+#define WIRE_V2_FLAG				0x80
+#define PACKET_HEADER_SIZE			13
+#define PUSH_HEADER_SIZE			(PACKET_HEADER_SIZE + 6)
+#define PULL_HEADER_SIZE			(PACKET_HEADER_SIZE + 10)
+//	PING and PONG end with WIRE_CAPS_MARK and the highest version the sender
+//	understands. v1 nodes ignore the trailing bytes
+#define WIRE_CAPS_MARK				0x5A
+//	The peer table only remembers peers above v1. When full it is cleared
+//	and the peers fall back to v1 until they are pinged again
+#define MAX_WIRE_PEERS				65536
+//	Flags in the first byte of each v2 node list entry
+#define NODE_SHARED_MASK			0x07	// Address bytes shared with previous
+#define NODE_FLAG_RENDV				0x08	// Followed by a rendavous node
+#define NODE_FLAG_SAME_PORT			0x10	// Port omitted, same as previous
+//	Node list layouts, the v1 entry sizes are 6, 10 and 12 bytes
+#define NODE_LIST_PLAIN				0	// NodeIdent
+#define NODE_LIST_VALUE				1	// NodeIdent and latency
+#define NODE_LIST_RENDV				2	// NodeIdentRendv
+//	Flags of a v2 INFO_PACKET body
+#define INFO_FLAG_COMPRESSED		0x01
+#define MAX_INFO_RAW_SIZE			(1 << 24)
+
 class BufferWrapper {
 private:	
 	bool 			errorFlag;
@@ -109,6 +147,23 @@ public:
 		return 0;		
 	}
 
+	//	LEB128, at most 5 bytes for 32 bits
+	uint32_t retrieve_varint() {
+		uint32_t retVal = 0;
+		for (int shift = 0; shift < 35; shift += 7) {
+			u_char tmp = (u_char)retrieve_char();
+			if (errorFlag) {
+				return 0;
+			}
+			retVal |= ((uint32_t)(tmp & 0x7F)) << shift;
+			if ((tmp & 0x80) == 0) {
+				return retVal;
+			}
+		}
+		errorFlag = true;	// Too long
+		return 0;
+	}
+
 	int32_t retrieve_int() {
 		if (!errorFlag && ((counter + (int)sizeof(int32_t)) <= bufSize)) {
 			int32_t retVal;
@@ -131,6 +186,10 @@ public:
 	
 	bool error() { 
 		return errorFlag;	
+	}
+	
+	void setError() {
+		errorFlag = true;
 	}			
 };
 
@@ -198,6 +257,33 @@ struct ltNodeIdentRendv {
 	}
 };
 
+//	Identifies a DSL program by the SHA-256 of its text
+#define PROGRAM_HASH_SIZE			SHA256_DIGEST_LENGTH
+typedef struct ProgramHash_t {
+	u_char		bytes[PROGRAM_HASH_SIZE];
+} ProgramHash;
+
+struct ltProgramHash {
+	bool operator()(const ProgramHash& s1, const ProgramHash& s2) const {
+		return memcmp(s1.bytes, s2.bytes, PROGRAM_HASH_SIZE) < 0;
+	}
+};
+
+//	Highest wire format version known to be understood by each peer.
+//	Peers not in the table are sent v1. Learned by any worker thread and
+//	read by all of them through a copy per thread. Queries look a peer up
+//	once and set the version of the packets they send it, packets are v1
+//	by default
+class PeerWireVersion {
+private:
+	static map<NodeIdent, int, ltNodeIdent>* peers();
+	static const map<NodeIdent, int, ltNodeIdent>* localPeers();
+public:
+	static int get(uint32_t addr, uint16_t port);
+	static void set(const NodeIdent& peer, int version);
+	static u_int numPeers();
+};
+
 class RealPacket {
 private:
 	char* 			packet;		// 	Payload
@@ -206,6 +292,7 @@ private:
 	NodeIdentRendv	dest;
 	uint32_t		maxPacketSize;
 	int			pos;
+	int				wireVersion;	// Encoding used by createRealPacket
 	
 	bool verifySpace(int typeSize) const {
 		if ((uint32_t)(size + typeSize) >  maxPacketSize)
@@ -215,35 +302,55 @@ private:
 	
 public:
 	RealPacket(const NodeIdentRendv& in_dest, uint32_t packetSize) : size(0), 
-			complete(true), dest(in_dest), maxPacketSize(packetSize), pos(0) {				
-		packet = (char*) malloc(sizeof(char) * maxPacketSize);		
+			complete(true), dest(in_dest), maxPacketSize(packetSize), pos(0), 
+			wireVersion(WIRE_VERSION_1) {
+		packet = allocPayLoad(maxPacketSize);
 	}
 
 	RealPacket(const NodeIdentRendv& in_dest) : size(0), complete(true), 
-			dest(in_dest), maxPacketSize(MAX_UDP_PACKET_SIZE), pos(0) {				
-		packet = (char*) malloc(sizeof(char) * maxPacketSize);		
+			dest(in_dest), maxPacketSize(MAX_UDP_PACKET_SIZE), pos(0), 
+			wireVersion(WIRE_VERSION_1) {
+		packet = allocPayLoad(maxPacketSize);
 	}
 	
 	RealPacket(const NodeIdent& in_dest) : size(0), 
-			complete(true), maxPacketSize(MAX_UDP_PACKET_SIZE), pos(0) {
+			complete(true), maxPacketSize(MAX_UDP_PACKET_SIZE), pos(0), 
+			wireVersion(WIRE_VERSION_1) {
 		dest.addr = in_dest.addr;
 		dest.port = in_dest.port;
 		dest.addrRendv = 0;
 		dest.portRendv = 0;			 		
-		packet = (char*) malloc(sizeof(char) * maxPacketSize);		
+		packet = allocPayLoad(maxPacketSize);
 	}
 	
 	RealPacket(const NodeIdent& in_dest, uint32_t packetSize) : size(0), 
-			complete(true), maxPacketSize(packetSize), pos(0) {
+			complete(true), maxPacketSize(packetSize), pos(0), 
+			wireVersion(WIRE_VERSION_1) {
 		dest.addr = in_dest.addr;
 		dest.port = in_dest.port;
 		dest.addrRendv = 0;
 		dest.portRendv = 0;			 		
-		packet = (char*) malloc(sizeof(char) * maxPacketSize);		
+		packet = allocPayLoad(maxPacketSize);
 	}			
 	
 	~RealPacket() {
-		if (packet) free(packet);
+		if (packet) releasePayLoad(packet, maxPacketSize);
+	}
+
+	//	Full sized payloads are recycled through a free list
+	static FreeListPool* payLoadPool();
+	static char* allocPayLoad(uint32_t packetSize) {
+		if (packetSize == MAX_UDP_PACKET_SIZE) {
+			return (char*) payLoadPool()->alloc();
+		}
+		return (char*) malloc(sizeof(char) * packetSize);
+	}
+	static void releasePayLoad(char* payLoad, uint32_t packetSize) {
+		if (packetSize == MAX_UDP_PACKET_SIZE) {
+			payLoadPool()->release(payLoad);
+		} else {
+			free(payLoad);
+		}
 	}
 	
 	int getPos() const			{ return pos;				}	
@@ -260,6 +367,10 @@ public:
 	int getPayLoadSize() const	{ return size;				}
 	bool completeOkay() const	{ return complete;			}
 	
+	int getWireVersion() const		{ return wireVersion;	}
+	void setWireVersion(int val)	{ wireVersion = val;	}
+	bool useWireV2() const	{ return wireVersion >= WIRE_VERSION_2;	}
+	
 	void setPayLoadSize(int val)	{
 		if (!complete) return;
 		if (val < 0 || ((uint32_t)val) > maxPacketSize) {
@@ -300,6 +411,16 @@ public:
 			size += sizeof(char);
 		}
 	}
+	
+	//	LEB128, 7 bits per byte
+	void append_varint(uint32_t value) {
+		if (!complete) return; // Already failed once
+		while (value >= 0x80) {
+			append_char((char)((value & 0x7F) | 0x80));
+			value >>= 7;
+		}
+		append_char((char)value);
+	}
 
 	void append_str(const char* in_str, int in_size) {
 		if (!complete || in_size <= 0) return; 
@@ -320,6 +441,256 @@ public:
 	
 };
 
+//	v2 node lists. Each entry starts with a byte holding the number of
+//	leading address bytes shared with the previous entry and flags, followed
+//	by the remaining address bytes and, unless it is unchanged, the zigzag
+//	encoded difference to the previous port. Lists with latencies follow
+//	each node with the zigzag encoded difference to the previous latency.
+//	Nodes listening on the same port take 2 to 5 bytes per entry plus up to
+//	3 bytes of latency, instead of 6 to 10
+class NodeListEncoder {
+private:
+	RealPacket&	out;
+	uint32_t	prevAddr;
+	uint16_t	prevPort;
+	uint32_t	prevValue;
+
+	static uint32_t zigzag(int32_t val) {
+		return (((uint32_t)val) << 1) ^ ((uint32_t)(val >> 31));
+	}
+public:
+	NodeListEncoder(RealPacket& in_out)
+		: out(in_out), prevAddr(0), prevPort(0), prevValue(0) {}
+
+	void appendNode(uint32_t addr, uint16_t port, u_char flags = 0) {
+		int shared = 0;
+		while (shared < 4 && ((addr ^ prevAddr) >> (24 - 8 * shared)) == 0) {
+			shared++;
+		}
+		if (port == prevPort) {
+			flags |= NODE_FLAG_SAME_PORT;
+		}
+		out.append_char((char)(shared | flags));
+		for (int i = shared; i < 4; i++) {
+			out.append_char((char)(addr >> (24 - 8 * i)));
+		}
+		if (port != prevPort) {
+			out.append_varint(zigzag((int16_t)(port - prevPort)));
+		}
+		prevAddr = addr;
+		prevPort = port;
+	}
+
+	void appendValue(uint32_t value) {
+		out.append_varint(zigzag((int32_t)(value - prevValue)));
+		prevValue = value;
+	}
+};
+
+class NodeListDecoder {
+private:
+	BufferWrapper&	in;
+	uint32_t		prevAddr;
+	uint16_t		prevPort;
+	uint32_t		prevValue;
+
+	static int32_t unzigzag(uint32_t val) {
+		return (int32_t)((val >> 1) ^ (~(val & 1) + 1));
+	}
+public:
+	NodeListDecoder(BufferWrapper& in_in)
+		: in(in_in), prevAddr(0), prevPort(0), prevValue(0) {}
+
+	//	Errors are reported through the BufferWrapper, the outputs are set
+	//	to 0 on a malformed entry
+	void retrieveNode(uint32_t* addr, uint16_t* port, u_char* flags = NULL) {
+		u_char first = (u_char)in.retrieve_char();
+		int shared = first & NODE_SHARED_MASK;
+		if (shared > 4) {
+			in.setError();
+			*addr = 0;
+			*port = 0;
+			if (flags != NULL) {
+				*flags = 0;
+			}
+			return;
+		}
+		uint32_t tmpAddr = (shared == 4) ? prevAddr :
+			(prevAddr & ~(0xFFFFFFFF >> (8 * shared)));
+		for (int i = shared; i < 4; i++) {
+			tmpAddr |= ((uint32_t)(u_char)in.retrieve_char()) << (24 - 8 * i);
+		}
+		prevAddr = tmpAddr;
+		if (!(first & NODE_FLAG_SAME_PORT)) {
+			prevPort = (uint16_t)(prevPort + unzigzag(in.retrieve_varint()));
+		}
+		*addr = prevAddr;
+		*port = prevPort;
+		if (flags != NULL) {
+			*flags = first & ~(NODE_SHARED_MASK | NODE_FLAG_SAME_PORT);
+		}
+	}
+
+	uint32_t retrieveValue() {
+		prevValue += (uint32_t)unzigzag(in.retrieve_varint());
+		return prevValue;
+	}
+};
+
+//	A node list inside a received packet, in either wire format. init
+//	validates the whole list once, after which NodeListCursor can walk it
+//	in place. Only valid as long as the buffer it was initialized from
+class NodeListView {
+private:
+	const char*	rawBuf;		// Start of the list, including the count
+	int			rawSize;
+	const char*	entryBuf;	// Start of the first entry
+	int			entrySize;
+	uint32_t	numEntries;
+	bool		v2;
+	int			format;
+
+	static int v1EntrySize(int in_format) {
+		switch (in_format) {
+			case NODE_LIST_VALUE:	return 10;
+			case NODE_LIST_RENDV:	return 12;
+			default:				return 6;
+		}
+	}
+public:
+	NodeListView() : rawBuf(NULL), rawSize(0), entryBuf(NULL), entrySize(0),
+		numEntries(0), v2(false), format(NODE_LIST_PLAIN) {}
+
+	//	Reads the list at the current position of rb, leaving rb after it
+	int init(BufferWrapper& rb, bool in_v2, int in_format) {
+		v2 = in_v2;
+		format = in_format;
+		rawBuf = rb.retrieve_buf(0);
+		int startPos = rb.returnPos();
+		if (v2) {
+			numEntries = rb.retrieve_varint();
+			int entryPos = rb.returnPos();
+			NodeListDecoder dec(rb);
+			uint32_t addr = 0; uint16_t port = 0; u_char flags = 0;
+			for (uint32_t i = 0; (!rb.error() && i < numEntries); i++) {
+				dec.retrieveNode(&addr, &port, &flags);
+				if (rb.error()) {
+					break;
+				}
+				if (format == NODE_LIST_VALUE) {
+					dec.retrieveValue();
+				} else if (format == NODE_LIST_RENDV && 
+						(flags & NODE_FLAG_RENDV)) {
+					rb.retrieve_uint();
+					rb.retrieve_varint();
+				}
+			}
+			entryBuf = rawBuf + (entryPos - startPos);
+		} else {
+			numEntries = ntohl(rb.retrieve_uint());
+			uint64_t listSize = ((uint64_t)numEntries) * v1EntrySize(format);
+			if (listSize > rb.remainBufSize()) {
+				rb.setError();
+			} else {
+				entryBuf = rb.retrieve_buf(listSize);
+			}
+		}
+		if (rb.error()) {
+			numEntries = 0;
+			return -1;
+		}
+		entrySize = rb.returnPos() - (startPos + (entryBuf - rawBuf));
+		rawSize = rb.returnPos() - startPos;
+		return 0;
+	}
+
+	uint32_t size() const			{ return numEntries;	}
+	bool isWireV2() const			{ return v2;			}
+	int getFormat() const			{ return format;		}
+	//	Encoded list, count included
+	const char* getRaw() const		{ return rawBuf;		}
+	int getRawSize() const			{ return rawSize;		}
+	const char* getEntries() const	{ return entryBuf;		}
+	int getEntriesSize() const		{ return entrySize;		}
+};
+
+//	Walks a validated NodeListView from the beginning. Fields the list does
+//	not have are returned as 0
+class NodeListCursor {
+private:
+	BufferWrapper	rb;
+	NodeListDecoder	dec;
+	bool			v2;
+	int				format;
+	uint32_t		remaining;
+
+	bool nextEntry(uint32_t* addr, uint16_t* port, uint32_t* value,
+			uint32_t* rAddr, uint16_t* rPort) {
+		if (remaining == 0) {
+			return false;
+		}
+		remaining--;
+		*value = 0;
+		*rAddr = 0;
+		*rPort = 0;
+		if (v2) {
+			u_char flags = 0;
+			dec.retrieveNode(addr, port, &flags);
+			if (format == NODE_LIST_VALUE) {
+				*value = dec.retrieveValue();
+			} else if (format == NODE_LIST_RENDV && (flags & NODE_FLAG_RENDV)) {
+				*rAddr = ntohl(rb.retrieve_uint());
+				*rPort = rb.retrieve_varint();
+			}
+		} else {
+			*addr = ntohl(rb.retrieve_uint());
+			*port = ntohs(rb.retrieve_ushort());
+			if (format == NODE_LIST_VALUE) {
+				*value = ntohl(rb.retrieve_uint());
+			} else if (format == NODE_LIST_RENDV) {
+				*rAddr = ntohl(rb.retrieve_uint());
+				*rPort = ntohs(rb.retrieve_ushort());
+			}
+		}
+		return !rb.error();
+	}
+public:
+	NodeListCursor(const NodeListView& in_list)
+		: 	rb(in_list.getEntries(), in_list.getEntriesSize()), dec(rb),
+			v2(in_list.isWireV2()), format(in_list.getFormat()), 
+			remaining(in_list.size()) {}
+
+	bool next(NodeIdent* node) {
+		uint32_t value, rAddr; uint16_t rPort;
+		return nextEntry(&(node->addr), &(node->port), &value, &rAddr, &rPort);
+	}
+
+	bool next(NodeIdentLat* node) {
+		uint32_t rAddr; uint16_t rPort;
+		return nextEntry(&(node->addr), &(node->port), 
+			&(node->latencyUS), &rAddr, &rPort);
+	}
+
+	bool next(NodeIdentConst* node) {
+		uint32_t rAddr; uint16_t rPort;
+		return nextEntry(&(node->addr), &(node->port), 
+			&(node->latencyConstMS), &rAddr, &rPort);
+	}
+
+	bool next(NodeIdentRendv* node) {
+		uint32_t addr = 0, value = 0, rAddr = 0; 
+		uint16_t port = 0, rPort = 0;
+		if (!nextEntry(&addr, &port, &value, &rAddr, &rPort)) {
+			return false;
+		}
+		node->addr = addr;
+		node->port = port;
+		node->addrRendv = rAddr;
+		node->portRendv = rPort;
+		return true;
+	}
+};
+
 class Packet {
 private:
 	uint32_t 	req_id_1;
@@ -351,9 +722,57 @@ public:
 		inPacket.append_uint(htonl(MAGIC_NUMBER));
 	}
 	
+	//	Header of a packet that is not built from a Packet object
+	static void write_header(RealPacket& inPacket, char type, uint64_t id) {
+		if (inPacket.useWireV2()) {
+			type |= WIRE_V2_FLAG;
+		}
+		inPacket.append_char(type);
+		inPacket.append_uint(htonl(id >> 32));
+		inPacket.append_uint(htonl(id & 0xFFFFFFFF));
+		inPacket.append_uint(htonl(MAGIC_NUMBER));
+	}
+	
+	//	Write the type byte, flagged if the packet is encoded as v2
+	void write_type(RealPacket& inPacket) const {
+		char type = getPacketType();
+		if (inPacket.useWireV2()) {
+			type |= WIRE_V2_FLAG;
+		}
+		inPacket.append_char(type);
+	}
+	
+	static bool isWireV2(char type) {
+		return (type & WIRE_V2_FLAG) != 0;
+	}
+	
+	static char baseType(char type) {
+		return type & ~WIRE_V2_FLAG;
+	}
+	
+	//	Append the capabilities trailer of PING and PONG
+	static void write_caps(RealPacket& inPacket) {
+		inPacket.append_char(WIRE_CAPS_MARK);
+		inPacket.append_char(WIRE_VERSION_MAX);
+	}
+	
+	//	Version advertised by the trailer of a PING or PONG, v1 if absent
+	static int parseWireCaps(const char* buf, int numBytes) {
+		if (numBytes < PACKET_HEADER_SIZE + 2 || 
+				buf[PACKET_HEADER_SIZE] != WIRE_CAPS_MARK) {
+			return WIRE_VERSION_1;
+		}
+		int version = buf[PACKET_HEADER_SIZE + 1];
+		if (version < WIRE_VERSION_1) {
+			return WIRE_VERSION_1;
+		}
+		return MIN(version, WIRE_VERSION_MAX);
+	}
+	
+	//	queryType is returned without the v2 flag
 	static int parseHeader(
 			BufferWrapper& rb, char* queryType, uint64_t* queryID) {		
-		*queryType = rb.retrieve_char();
+		*queryType = baseType(rb.retrieve_char());
 		uint32_t queryID_1 = ntohl(rb.retrieve_uint());
 		uint32_t queryID_2 = ntohl(rb.retrieve_uint());
 		*queryID = to64(queryID_1, queryID_2);	
@@ -403,7 +822,7 @@ public:
 	static ReqGeneric* parse(const char* buf, int numBytes) {
 		BufferWrapper rb(buf, numBytes);
 		char queryType = rb.retrieve_char();
-		if (rb.error() || queryType != T::type()) {
+		if (rb.error() || baseType(queryType) != T::type()) {
 			ERROR_LOG("Wrong type received\n");
 			return NULL;	
 		}
@@ -418,13 +837,22 @@ public:
 			return NULL;			
 		}		
 		ReqGeneric* ret = new T(queryID, rendvAddr, rendvPort);			
-		uint32_t numEntry = ntohl(rb.retrieve_uint());
 		NodeIdent tmpIdent;		
-		//while (!rb.error() && numEntry-- > 0) {
-		for (uint32_t i = 0; (!rb.error() && i < numEntry); i++) { 			
-			tmpIdent.addr = ntohl(rb.retrieve_uint());
-			tmpIdent.port = ntohs(rb.retrieve_ushort());
-			ret->addTarget(tmpIdent);
+		if (isWireV2(queryType)) {
+			uint32_t numEntry = rb.retrieve_varint();
+			NodeListDecoder dec(rb);
+			for (uint32_t i = 0; (!rb.error() && i < numEntry); i++) {
+				dec.retrieveNode(&(tmpIdent.addr), &(tmpIdent.port));
+				ret->addTarget(tmpIdent);
+			}
+		} else {
+			uint32_t numEntry = ntohl(rb.retrieve_uint());
+			//while (!rb.error() && numEntry-- > 0) {
+			for (uint32_t i = 0; (!rb.error() && i < numEntry); i++) { 			
+				tmpIdent.addr = ntohl(rb.retrieve_uint());
+				tmpIdent.port = ntohs(rb.retrieve_ushort());
+				ret->addTarget(tmpIdent);
+			}
 		}
 		if (rb.error()) {
 			delete ret;
@@ -438,15 +866,23 @@ public:
 		if (num_targets == 0) {
 			return -1;
 		}
-		inPacket.append_char(getPacketType());
+		write_type(inPacket);
 		write_id(inPacket);		
 		write_rendv(inPacket);
-		inPacket.append_uint(htonl(num_targets));
-		for (uint32_t i = 0; i < num_targets; i++) {
-			NodeIdent tmp = targets[i];
-			inPacket.append_uint(htonl(tmp.addr));
-			inPacket.append_ushort(htons(tmp.port));			
-		}					
+		if (inPacket.useWireV2()) {
+			inPacket.append_varint(num_targets);
+			NodeListEncoder enc(inPacket);
+			for (uint32_t i = 0; i < num_targets; i++) {
+				enc.appendNode(targets[i].addr, targets[i].port);
+			}
+		} else {
+			inPacket.append_uint(htonl(num_targets));
+			for (uint32_t i = 0; i < num_targets; i++) {
+				NodeIdent tmp = targets[i];
+				inPacket.append_uint(htonl(tmp.addr));
+				inPacket.append_ushort(htons(tmp.port));			
+			}
+		}
 		if (!inPacket.completeOkay()) { 
 			return -1; 
 		}
@@ -461,6 +897,10 @@ public:
 		return &targets;	
 	}
 	
+	//	Layout, used by ReqView
+	static bool hasBeta()		{ return false;	}
+	static int listFormat()		{ return NODE_LIST_PLAIN;	}
+	
 	virtual char getPacketType() const = 0;
 	virtual ~ReqGeneric() {}			
 };
@@ -555,7 +995,7 @@ public:
 	static ReqConstraintGeneric* parse(const char* buf, int numBytes) {
 		BufferWrapper rb(buf, numBytes);
 		char queryType = rb.retrieve_char();
-		if (rb.error() || queryType != T::type()) {
+		if (rb.error() || baseType(queryType) != T::type()) {
 			ERROR_LOG("Wrong type received\n");
 			return NULL;	
 		}
@@ -573,14 +1013,24 @@ public:
 		}		
 		ReqConstraintGeneric* ret 
 			= new T(queryID, in_betaNum, in_betaDen, rendvAddr, rendvPort);			
-		uint32_t numEntry = ntohl(rb.retrieve_uint());
 		NodeIdentConst tmpIdent;		
-		//while (!rb.error() && numEntry-- > 0) {
-		for (uint32_t i = 0; (!rb.error() && i < numEntry); i++) {			
-			tmpIdent.addr = ntohl(rb.retrieve_uint());
-			tmpIdent.port = ntohs(rb.retrieve_ushort());
-			tmpIdent.latencyConstMS = ntohl(rb.retrieve_uint());	
-			ret->addTarget(tmpIdent);
+		if (isWireV2(queryType)) {
+			uint32_t numEntry = rb.retrieve_varint();
+			NodeListDecoder dec(rb);
+			for (uint32_t i = 0; (!rb.error() && i < numEntry); i++) {
+				dec.retrieveNode(&(tmpIdent.addr), &(tmpIdent.port));
+				tmpIdent.latencyConstMS = dec.retrieveValue();
+				ret->addTarget(tmpIdent);
+			}
+		} else {
+			uint32_t numEntry = ntohl(rb.retrieve_uint());
+			//while (!rb.error() && numEntry-- > 0) {
+			for (uint32_t i = 0; (!rb.error() && i < numEntry); i++) {			
+				tmpIdent.addr = ntohl(rb.retrieve_uint());
+				tmpIdent.port = ntohs(rb.retrieve_ushort());
+				tmpIdent.latencyConstMS = ntohl(rb.retrieve_uint());	
+				ret->addTarget(tmpIdent);
+			}
 		}
 		if (rb.error()) {
 			delete ret;
@@ -594,18 +1044,27 @@ public:
 		if (num_targets == 0) {
 			return -1;
 		}
-		inPacket.append_char(getPacketType());
+		write_type(inPacket);
 		write_id(inPacket);		
 		write_rendv(inPacket);
 		inPacket.append_ushort(htons(betaNum));
 		inPacket.append_ushort(htons(betaDen));
-		inPacket.append_uint(htonl(num_targets));
-		for (uint32_t i = 0; i < num_targets; i++) {
-			NodeIdentConst tmp = targets[i];
-			inPacket.append_uint(htonl(tmp.addr));
-			inPacket.append_ushort(htons(tmp.port));
-			inPacket.append_uint(htonl(tmp.latencyConstMS));
-		}					
+		if (inPacket.useWireV2()) {
+			inPacket.append_varint(num_targets);
+			NodeListEncoder enc(inPacket);
+			for (uint32_t i = 0; i < num_targets; i++) {
+				enc.appendNode(targets[i].addr, targets[i].port);
+				enc.appendValue(targets[i].latencyConstMS);
+			}
+		} else {
+			inPacket.append_uint(htonl(num_targets));
+			for (uint32_t i = 0; i < num_targets; i++) {
+				NodeIdentConst tmp = targets[i];
+				inPacket.append_uint(htonl(tmp.addr));
+				inPacket.append_ushort(htons(tmp.port));
+				inPacket.append_uint(htonl(tmp.latencyConstMS));
+			}
+		}
 		if (!inPacket.completeOkay()) { 
 			return -1; 
 		}
@@ -628,6 +1087,10 @@ public:
 		return &targets;	
 	}
 	
+	//	Layout, used by ReqView
+	static bool hasBeta()		{ return true;	}
+	static int listFormat()		{ return NODE_LIST_VALUE;	}
+	
 	virtual char getPacketType() const = 0;
 	virtual ~ReqConstraintGeneric() {}			
 };
@@ -763,7 +1226,7 @@ public:
 	static ReqClosestGeneric* parse(const char* buf, int numBytes) {
 		BufferWrapper rb(buf, numBytes);
 		char queryType = rb.retrieve_char();
-		if (rb.error() || queryType != T::type()) {
+		if (rb.error() || baseType(queryType) != T::type()) {
 			ERROR_LOG("Wrong type received\n");
 			return NULL;	
 		}
@@ -781,13 +1244,22 @@ public:
 		}		
 		ReqClosestGeneric* ret 
 			= new T(queryID, in_betaNum, in_betaDen, rendvAddr, rendvPort);			
-		uint32_t numEntry = ntohl(rb.retrieve_uint());
 		NodeIdent tmpIdent;		
-		//while (!rb.error() && numEntry-- > 0) {
-		for (uint32_t i = 0; (!rb.error() && i < numEntry); i++) {			
-			tmpIdent.addr = ntohl(rb.retrieve_uint());
-			tmpIdent.port = ntohs(rb.retrieve_ushort());
-			ret->addTarget(tmpIdent);
+		if (isWireV2(queryType)) {
+			uint32_t numEntry = rb.retrieve_varint();
+			NodeListDecoder dec(rb);
+			for (uint32_t i = 0; (!rb.error() && i < numEntry); i++) {
+				dec.retrieveNode(&(tmpIdent.addr), &(tmpIdent.port));
+				ret->addTarget(tmpIdent);
+			}
+		} else {
+			uint32_t numEntry = ntohl(rb.retrieve_uint());
+			//while (!rb.error() && numEntry-- > 0) {
+			for (uint32_t i = 0; (!rb.error() && i < numEntry); i++) {			
+				tmpIdent.addr = ntohl(rb.retrieve_uint());
+				tmpIdent.port = ntohs(rb.retrieve_ushort());
+				ret->addTarget(tmpIdent);
+			}
 		}
 		if (rb.error()) {
 			delete ret;
@@ -801,17 +1273,25 @@ public:
 		if (num_targets == 0) {
 			return -1;
 		}
-		inPacket.append_char(getPacketType());
+		write_type(inPacket);
 		write_id(inPacket);		
 		write_rendv(inPacket);
 		inPacket.append_ushort(htons(betaNum));
 		inPacket.append_ushort(htons(betaDen));
-		inPacket.append_uint(htonl(num_targets));
-		for (uint32_t i = 0; i < num_targets; i++) {
-			NodeIdent tmp = targets[i];
-			inPacket.append_uint(htonl(tmp.addr));
-			inPacket.append_ushort(htons(tmp.port));			
-		}					
+		if (inPacket.useWireV2()) {
+			inPacket.append_varint(num_targets);
+			NodeListEncoder enc(inPacket);
+			for (uint32_t i = 0; i < num_targets; i++) {
+				enc.appendNode(targets[i].addr, targets[i].port);
+			}
+		} else {
+			inPacket.append_uint(htonl(num_targets));
+			for (uint32_t i = 0; i < num_targets; i++) {
+				NodeIdent tmp = targets[i];
+				inPacket.append_uint(htonl(tmp.addr));
+				inPacket.append_ushort(htons(tmp.port));			
+			}
+		}
 		if (!inPacket.completeOkay()) { 
 			return -1; 
 		}
@@ -834,6 +1314,10 @@ public:
 		return &targets;	
 	}
 	
+	//	Layout, used by ReqView
+	static bool hasBeta()		{ return true;	}
+	static int listFormat()		{ return NODE_LIST_PLAIN;	}
+	
 	virtual char getPacketType() const = 0;
 	virtual ~ReqClosestGeneric() {}			
 };
@@ -1032,7 +1516,7 @@ public:
 			const NodeIdent& in_remote, const char* buf, int numBytes) {
 		BufferWrapper rb(buf, numBytes);
 		char queryType = rb.retrieve_char();
-		if (rb.error() || queryType != RET_RESPONSE) {
+		if (rb.error() || baseType(queryType) != RET_RESPONSE) {
 			ERROR_LOG("Wrong type received\n");
 			return NULL;	
 		}
@@ -1050,15 +1534,24 @@ public:
 			closestAddr = in_remote.addr;
 			closestPort = in_remote.port;
 		}
-		uint32_t numEntry = ntohl(rb.retrieve_uint());
 		map<NodeIdent, uint32_t, ltNodeIdent> tmpMap;				
 		NodeIdent tmpIdent;		
-		//while (!rb.error() && numEntry-- > 0) {
-		for (uint32_t i = 0; (!rb.error() && i < numEntry); i++) {			
-			tmpIdent.addr = ntohl(rb.retrieve_uint());
-			tmpIdent.port = ntohs(rb.retrieve_ushort());
-			uint32_t latencyUS = ntohl(rb.retrieve_uint());
-			tmpMap[tmpIdent] = latencyUS;
+		if (isWireV2(queryType)) {
+			uint32_t numEntry = rb.retrieve_varint();
+			NodeListDecoder dec(rb);
+			for (uint32_t i = 0; (!rb.error() && i < numEntry); i++) {
+				dec.retrieveNode(&(tmpIdent.addr), &(tmpIdent.port));
+				tmpMap[tmpIdent] = dec.retrieveValue();
+			}
+		} else {
+			uint32_t numEntry = ntohl(rb.retrieve_uint());
+			//while (!rb.error() && numEntry-- > 0) {
+			for (uint32_t i = 0; (!rb.error() && i < numEntry); i++) {			
+				tmpIdent.addr = ntohl(rb.retrieve_uint());
+				tmpIdent.port = ntohs(rb.retrieve_ushort());
+				uint32_t latencyUS = ntohl(rb.retrieve_uint());
+				tmpMap[tmpIdent] = latencyUS;
+			}
 		}
 		if (rb.error()) {
 			return NULL;
@@ -1069,16 +1562,26 @@ public:
 	}	
 	
 	virtual int createRealPacket(RealPacket& inPacket) const {
-		inPacket.append_char(getPacketType());
+		write_type(inPacket);
 		write_id(inPacket);
 		inPacket.append_uint(htonl(addr));
 		inPacket.append_ushort(htons(port));		
-		inPacket.append_uint(htonl(targets.size()));
-		for (uint32_t i = 0; i < targets.size(); i++) {
-			NodeIdentLat tmpIdent = targets[i];
-			inPacket.append_uint(htonl(tmpIdent.addr));
-			inPacket.append_ushort(htons(tmpIdent.port));
-			inPacket.append_uint(htonl(tmpIdent.latencyUS));
+		if (inPacket.useWireV2()) {
+			//	targets are sorted by address, so prefixes are shared
+			inPacket.append_varint(targets.size());
+			NodeListEncoder enc(inPacket);
+			for (uint32_t i = 0; i < targets.size(); i++) {
+				enc.appendNode(targets[i].addr, targets[i].port);
+				enc.appendValue(targets[i].latencyUS);
+			}
+		} else {
+			inPacket.append_uint(htonl(targets.size()));
+			for (uint32_t i = 0; i < targets.size(); i++) {
+				NodeIdentLat tmpIdent = targets[i];
+				inPacket.append_uint(htonl(tmpIdent.addr));
+				inPacket.append_ushort(htons(tmpIdent.port));
+				inPacket.append_uint(htonl(tmpIdent.latencyUS));
+			}
 		}
 		//inPacket.append_uint(htonl(addr));
 		//inPacket.append_ushort(htons(port));
@@ -1089,6 +1592,11 @@ public:
 	}	
 	virtual char getPacketType() const	{ return RET_RESPONSE; }
 	virtual ~RetResponse() {}	
+	
+	//	Re-encode a received RET_RESPONSE for the next hop. The target
+	//	list is copied verbatim if both hops use the same wire format and
+	//	it has no duplicates
+	static int relay(const RetResponseView& view, RealPacket& inPacket);
 };
 
 
@@ -1104,7 +1612,7 @@ public:
 	static GossipPacketGeneric* parse(const char* buf, int numBytes) {
 		BufferWrapper rb(buf, numBytes);
 		char queryType = rb.retrieve_char();
-		if (rb.error() || queryType != T::type()) {
+		if (rb.error() || baseType(queryType) != T::type()) {
 			return NULL;	
 		}
 		uint32_t queryID_1 = ntohl(rb.retrieve_uint());
@@ -1117,13 +1625,29 @@ public:
 			return NULL;			
 		}		
 		GossipPacketGeneric* ret = new T(queryID, outerRAddr, outerRPort);
-		uint32_t numEntry = ntohl(rb.retrieve_uint());		
-		for (uint32_t i = 0; (!rb.error() && i < numEntry); i++) {			
-			uint32_t addr = ntohl(rb.retrieve_uint());
-			uint16_t port = ntohs(rb.retrieve_ushort());
-			uint32_t rAddr = ntohl(rb.retrieve_uint());
-			uint16_t rPort = ntohs(rb.retrieve_ushort());
-			ret->addNode(addr, port, rAddr, rPort);
+		if (isWireV2(queryType)) {
+			uint32_t numEntry = rb.retrieve_varint();
+			NodeListDecoder dec(rb);
+			for (uint32_t i = 0; (!rb.error() && i < numEntry); i++) {
+				uint32_t addr, rAddr = 0;
+				uint16_t port, rPort = 0;
+				u_char flags = 0;
+				dec.retrieveNode(&addr, &port, &flags);
+				if (flags & NODE_FLAG_RENDV) {
+					rAddr = ntohl(rb.retrieve_uint());
+					rPort = rb.retrieve_varint();
+				}
+				ret->addNode(addr, port, rAddr, rPort);
+			}
+		} else {
+			uint32_t numEntry = ntohl(rb.retrieve_uint());		
+			for (uint32_t i = 0; (!rb.error() && i < numEntry); i++) {			
+				uint32_t addr = ntohl(rb.retrieve_uint());
+				uint16_t port = ntohs(rb.retrieve_ushort());
+				uint32_t rAddr = ntohl(rb.retrieve_uint());
+				uint16_t rPort = ntohs(rb.retrieve_ushort());
+				ret->addNode(addr, port, rAddr, rPort);
+			}
 		}
 		if (rb.error()) {
 			delete ret;
@@ -1139,16 +1663,33 @@ public:
 	virtual int createRealPacket(RealPacket& inPacket) const {
 		uint32_t num_targets = targets.size();
 		//	Must have at least one packet
-		inPacket.append_char(getPacketType());
+		write_type(inPacket);
 		write_id(inPacket);	
 		write_rendv(inPacket);
-		inPacket.append_uint(htonl(num_targets));
-		for (uint32_t i = 0; i < num_targets; i++) {
-			NodeIdentRendv tmp = targets[i];
-			inPacket.append_uint(htonl(tmp.addr));
-			inPacket.append_ushort(htons(tmp.port));
-			inPacket.append_uint(htonl(tmp.addrRendv));
-			inPacket.append_ushort(htons(tmp.portRendv));			
+		if (inPacket.useWireV2()) {
+			//	Most nodes are not behind a firewall, the rendavous node
+			//	is only sent when there is one
+			inPacket.append_varint(num_targets);
+			NodeListEncoder enc(inPacket);
+			for (uint32_t i = 0; i < num_targets; i++) {
+				NodeIdentRendv tmp = targets[i];
+				bool hasRendv = (tmp.addrRendv != 0 || tmp.portRendv != 0);
+				enc.appendNode(tmp.addr, tmp.port, 
+					hasRendv ? NODE_FLAG_RENDV : 0);
+				if (hasRendv) {
+					inPacket.append_uint(htonl(tmp.addrRendv));
+					inPacket.append_varint((uint16_t)tmp.portRendv);
+				}
+			}
+		} else {
+			inPacket.append_uint(htonl(num_targets));
+			for (uint32_t i = 0; i < num_targets; i++) {
+				NodeIdentRendv tmp = targets[i];
+				inPacket.append_uint(htonl(tmp.addr));
+				inPacket.append_ushort(htons(tmp.port));
+				inPacket.append_uint(htonl(tmp.addrRendv));
+				inPacket.append_ushort(htons(tmp.portRendv));			
+			}
 		}
 		if (!inPacket.completeOkay()) { 
 			return -1; 
@@ -1224,48 +1765,58 @@ public:
 		return 0;
 	}
 	
-	static RealPacket* parse(RealPacket& inPacket, NodeIdent& srcNode) {				
-		BufferWrapper rb(inPacket.getPayLoad(), inPacket.getPayLoadSize());
+	//	Locate the frame at the start of buf without copying it. Returns the
+	//	length of the whole frame, 0 if it is not complete yet and -1 if
+	//	it is malformed. The encapsulated packet is at buf + *payLoadPos
+	static int parseFrame(const char* buf, int numBytes, NodeIdent* srcNode,
+			int* payLoadPos, int* payLoadSize) {
+		BufferWrapper rb(buf, numBytes);
 		char queryType = rb.retrieve_char();
-		if (rb.error() || queryType != PULL) {
-			return NULL;	
-		}
 		rb.retrieve_uint();	// Skipping queryid_1
 		rb.retrieve_uint();	// Skipping queryid_2		
 		uint32_t magicNumber = ntohl(rb.retrieve_uint());
 		uint32_t in_srcIP = ntohl(rb.retrieve_uint());
 		uint16_t in_srcPort = ntohs(rb.retrieve_ushort());
 		uint32_t in_payLoadSize = ntohl(rb.retrieve_uint()); 		
-		if (rb.error() || magicNumber != MAGIC_NUMBER) {
-			return NULL;			
+		if (rb.error()) {
+			return 0;	// Header not complete
+		}
+		if (queryType != PULL || magicNumber != MAGIC_NUMBER ||
+				in_payLoadSize > MAX_UDP_PACKET_SIZE) {
+			return -1;			
 		}
 		if (rb.remainBufSize() < in_payLoadSize) {
+			return 0;
+		}
+		srcNode->addr = in_srcIP;
+		srcNode->port = in_srcPort;
+		*payLoadPos = rb.returnPos();
+		*payLoadSize = in_payLoadSize;
+		return rb.returnPos() + in_payLoadSize;
+	}
+	
+	static RealPacket* parse(RealPacket& inPacket, NodeIdent& srcNode) {				
+		int payLoadPos, payLoadSize;
+		int frameSize = parseFrame(inPacket.getPayLoad(), 
+			inPacket.getPayLoadSize(), &srcNode, &payLoadPos, &payLoadSize);
+		if (frameSize <= 0) {
 			return NULL;
 		}
 		// Destination doesn't matter, since it is not actually being sent
 		NodeIdent dummy = {0, 0};										
-		RealPacket* newPacket = new RealPacket(dummy, in_payLoadSize);
+		RealPacket* newPacket = new RealPacket(dummy, payLoadSize);
 		if (newPacket != NULL) {
-			srcNode.addr = in_srcIP;
-			srcNode.port = in_srcPort;			
-			memcpy(newPacket->getPayLoad(), inPacket.getPayLoad() + 
-				rb.returnPos(), in_payLoadSize);
-			newPacket->setPayLoadSize(in_payLoadSize);
+			memcpy(newPacket->getPayLoad(), 
+				inPacket.getPayLoad() + payLoadPos, payLoadSize);
+			newPacket->setPayLoadSize(payLoadSize);
 		}
 		//	Regardless of whether the "new RealPacket" succeeded or not,
 		//	return newPacket
-		if (rb.remainBufSize() > in_payLoadSize) {
-			//printf("Must perform memmove\n");
-			//	Move end parts of the buffer into beginning part
-			//	Must use memmove, the buffer might overlap
-			memmove(inPacket.getPayLoad(), inPacket.getPayLoad() + 
-				rb.returnPos() + in_payLoadSize,  
-				inPacket.getPayLoadSize() - (rb.returnPos() + in_payLoadSize));				
-			inPacket.setPayLoadSize(
-				inPacket.getPayLoadSize() - (rb.returnPos() + in_payLoadSize));
-		} else {
-			inPacket.setPayLoadSize(0);	
-		}
+		//	Move end parts of the buffer into beginning part
+		//	Must use memmove, the buffer might overlap
+		memmove(inPacket.getPayLoad(), inPacket.getPayLoad() + frameSize,  
+			inPacket.getPayLoadSize() - frameSize);				
+		inPacket.setPayLoadSize(inPacket.getPayLoadSize() - frameSize);
 		return newPacket;
 	}	
 	
@@ -1280,6 +1831,23 @@ protected:
 public:
 	PushPacket(uint64_t id, uint32_t in_dest_ip, uint16_t in_dest_port) 
 		: Packet(id), destIP(in_dest_ip), destPort(in_dest_port) {}
+		
+	//	Write the PUSH_HEADER_SIZE bytes produced by createRealPacket (with
+	//	a query id of 0) into buf, so that the header can be sent in front 
+	//	of an existing packet without copying it
+	static void writeHeader(char* buf, uint32_t in_dest_ip, 
+			uint16_t in_dest_port) {
+		uint32_t tmp = 0;
+		buf[0] = PUSH;
+		memcpy(buf + 1, &tmp, sizeof(uint32_t));
+		memcpy(buf + 5, &tmp, sizeof(uint32_t));
+		tmp = htonl(MAGIC_NUMBER);
+		memcpy(buf + 9, &tmp, sizeof(uint32_t));
+		tmp = htonl(in_dest_ip);
+		memcpy(buf + 13, &tmp, sizeof(uint32_t));
+		uint16_t tmpPort = htons(in_dest_port);
+		memcpy(buf + 17, &tmpPort, sizeof(uint16_t));
+	}
 	virtual int createRealPacket(RealPacket& inPacket) const {
 		inPacket.append_char(getPacketType());
 		write_id(inPacket);				
@@ -1337,7 +1905,7 @@ public:
 	static RetPing* parse(const char* buf, int numBytes) {
 		BufferWrapper rb(buf, numBytes);
 		char queryType = rb.retrieve_char();
-		if (rb.error() || queryType != RET_PING_REQ) {
+		if (rb.error() || baseType(queryType) != RET_PING_REQ) {
 			return NULL;	
 		}
 		uint32_t queryID_1 = ntohl(rb.retrieve_uint());
@@ -1348,14 +1916,23 @@ public:
 			return NULL;			
 		}		
 		RetPing* ret = new RetPing(queryID);
-		uint32_t numEntry = ntohl(rb.retrieve_uint());
 		NodeIdent tmpIdent;		
-		//while (!rb.error() && numEntry-- > 0) {
-		for (uint32_t i = 0; (!rb.error() && i < numEntry); i++) {	
-			tmpIdent.addr = ntohl(rb.retrieve_uint());
-			tmpIdent.port = ntohs(rb.retrieve_ushort());
-			uint32_t latencyUS = ntohl(rb.retrieve_uint());
-			ret->addNode(tmpIdent, latencyUS);
+		if (isWireV2(queryType)) {
+			uint32_t numEntry = rb.retrieve_varint();
+			NodeListDecoder dec(rb);
+			for (uint32_t i = 0; (!rb.error() && i < numEntry); i++) {
+				dec.retrieveNode(&(tmpIdent.addr), &(tmpIdent.port));
+				ret->addNode(tmpIdent, dec.retrieveValue());
+			}
+		} else {
+			uint32_t numEntry = ntohl(rb.retrieve_uint());
+			//while (!rb.error() && numEntry-- > 0) {
+			for (uint32_t i = 0; (!rb.error() && i < numEntry); i++) {	
+				tmpIdent.addr = ntohl(rb.retrieve_uint());
+				tmpIdent.port = ntohs(rb.retrieve_ushort());
+				uint32_t latencyUS = ntohl(rb.retrieve_uint());
+				ret->addNode(tmpIdent, latencyUS);
+			}
 		}
 		if (rb.error()) {
 			delete ret;
@@ -1370,15 +1947,24 @@ public:
 	
 	virtual int createRealPacket(RealPacket& inPacket) const {
 		uint32_t num_nodes = nodes.size();
-		inPacket.append_char(getPacketType());
+		write_type(inPacket);
 		write_id(inPacket);				
-		inPacket.append_uint(htonl(num_nodes));
-		for (uint32_t i = 0; i < num_nodes; i++) {
-			NodeIdentLat tmp = nodes[i];
-			inPacket.append_uint(htonl(tmp.addr));
-			inPacket.append_ushort(htons(tmp.port));
-			inPacket.append_uint(htonl(tmp.latencyUS));			
-		}		
+		if (inPacket.useWireV2()) {
+			inPacket.append_varint(num_nodes);
+			NodeListEncoder enc(inPacket);
+			for (uint32_t i = 0; i < num_nodes; i++) {
+				enc.appendNode(nodes[i].addr, nodes[i].port);
+				enc.appendValue(nodes[i].latencyUS);
+			}
+		} else {
+			inPacket.append_uint(htonl(num_nodes));
+			for (uint32_t i = 0; i < num_nodes; i++) {
+				NodeIdentLat tmp = nodes[i];
+				inPacket.append_uint(htonl(tmp.addr));
+				inPacket.append_ushort(htons(tmp.port));
+				inPacket.append_uint(htonl(tmp.latencyUS));			
+			}
+		}
 		if (!inPacket.completeOkay()) { 
 			return -1; 
 		}
@@ -1393,12 +1979,220 @@ public:
 	virtual ~RetPing() {}		
 };
 
+//	In place views of received packets. Unlike the parse methods, nothing
+//	is allocated or copied: init validates the packet and node lists are
+//	walked with NodeListCursor. A view is only valid as long as the buffer
+//	it was initialized from
+class PacketView {
+protected:
+	char		type;	// Without the v2 flag
+	bool		v2;
+	uint64_t	id;
+
+	int initHeader(BufferWrapper& rb, char expectType) {
+		char in_type = rb.retrieve_char();
+		type = Packet::baseType(in_type);
+		v2 = Packet::isWireV2(in_type);
+		if (rb.error() || type != expectType) {
+			ERROR_LOG("Wrong type received\n");
+			return -1;
+		}
+		uint32_t queryID_1 = ntohl(rb.retrieve_uint());
+		uint32_t queryID_2 = ntohl(rb.retrieve_uint());
+		id = Packet::to64(queryID_1, queryID_2);
+		uint32_t magicNumber = ntohl(rb.retrieve_uint());
+		if (rb.error() || magicNumber != MAGIC_NUMBER) {
+			ERROR_LOG("Wrong magic number in packet received\n");
+			return -1;
+		}
+		return 0;
+	}
+public:
+	PacketView() : type(0), v2(false), id(0) {}
+	uint64_t retReqID() const		{ return id;	}
+	char getPacketType() const		{ return type;	}
+	bool isWireV2() const			{ return v2;	}
+};
+
+//	ReqGeneric, ReqClosestGeneric and ReqConstraintGeneric
+class ReqView : public PacketView {
+private:
+	uint32_t		rendvAddr;
+	uint16_t		rendvPort;
+	uint16_t		betaNum;	// 0 if the request has no beta
+	uint16_t		betaDen;
+	NodeListView	targets;
+public:
+	ReqView() : rendvAddr(0), rendvPort(0), betaNum(0), betaDen(0) {}
+
+	int init(char expectType, bool hasBeta, int listFormat,
+			const char* buf, int numBytes) {
+		BufferWrapper rb(buf, numBytes);
+		if (initHeader(rb, expectType) == -1) {
+			return -1;
+		}
+		rendvAddr = ntohl(rb.retrieve_uint());
+		rendvPort = ntohs(rb.retrieve_ushort());
+		if (hasBeta) {
+			betaNum = ntohs(rb.retrieve_ushort());
+			betaDen = ntohs(rb.retrieve_ushort());
+		}
+		if (rb.error()) {
+			return -1;
+		}
+		return targets.init(rb, v2, listFormat);
+	}
+
+	//	T is the request packet class, e.g. ReqClosestTCP
+	template <class T>
+	int init(const char* buf, int numBytes) {
+		return init(T::type(), T::hasBeta(), T::listFormat(), buf, numBytes);
+	}
+
+	uint32_t getRendvAddr() const			{ return rendvAddr;	}
+	uint16_t getRendvPort() const			{ return rendvPort;	}
+	uint16_t getBetaNumerator() const		{ return betaNum;	}
+	uint16_t getBetaDenominator() const		{ return betaDen;	}
+	const NodeListView& getTargets() const	{ return targets;	}
+};
+
+class RetResponseView : public PacketView {
+private:
+	NodeIdent		closest;
+	NodeListView	targets;
+public:
+	RetResponseView() { closest.addr = 0; closest.port = 0; }
+
+	//	As in RetResponse::parse, a closest node of 0:0 is the sender
+	int init(const NodeIdent& in_remote, const char* buf, int numBytes) {
+		BufferWrapper rb(buf, numBytes);
+		if (initHeader(rb, RET_RESPONSE) == -1) {
+			return -1;
+		}
+		closest.addr = ntohl(rb.retrieve_uint());
+		closest.port = ntohs(rb.retrieve_ushort());
+		if (rb.error()) {
+			return -1;
+		}
+		if ((closest.addr == 0) && (closest.port == 0)) {
+			closest = in_remote;
+		}
+		return targets.init(rb, v2, NODE_LIST_VALUE);
+	}
+
+	NodeIdent getResponse() const			{ return closest;	}
+	const NodeListView& getTargets() const	{ return targets;	}
+};
+
+//	GOSSIP and GOSSIP_PULL
+class GossipView : public PacketView {
+private:
+	uint32_t		rendvAddr;
+	uint16_t		rendvPort;
+	NodeListView	targets;
+public:
+	GossipView() : rendvAddr(0), rendvPort(0) {}
+
+	int init(char expectType, const char* buf, int numBytes) {
+		BufferWrapper rb(buf, numBytes);
+		if (initHeader(rb, expectType) == -1) {
+			return -1;
+		}
+		rendvAddr = ntohl(rb.retrieve_uint());
+		rendvPort = ntohs(rb.retrieve_ushort());
+		if (rb.error()) {
+			return -1;
+		}
+		return targets.init(rb, v2, NODE_LIST_RENDV);
+	}
+
+	uint32_t getRendvAddr() const			{ return rendvAddr;	}
+	uint16_t getRendvPort() const			{ return rendvPort;	}
+	const NodeListView& getTargets() const	{ return targets;	}
+};
+
+class RetPingView : public PacketView {
+private:
+	NodeListView	nodes;
+public:
+	int init(const char* buf, int numBytes) {
+		BufferWrapper rb(buf, numBytes);
+		if (initHeader(rb, RET_PING_REQ) == -1) {
+			return -1;
+		}
+		return nodes.init(rb, v2, NODE_LIST_VALUE);
+	}
+
+	const NodeListView& getNodes() const	{ return nodes;		}
+};
+
+inline int RetResponse::relay(
+		const RetResponseView& view, RealPacket& inPacket) {
+	NodeIdent closest = view.getResponse();
+	const NodeListView& targets = view.getTargets();
+	//	parse merges duplicate targets, keeping the last latency, and sorts
+	//	them. Only a list that already is sorted and unique is passed on
+	//	as received
+	ltNodeIdent lessThan;
+	NodeListCursor check(targets);
+	NodeIdentLat tmpLat;
+	NodeIdent prev = {0, 0};
+	bool sortedUnique = true;
+	for (uint32_t i = 0; sortedUnique && check.next(&tmpLat); i++) {
+		NodeIdent cur = {tmpLat.addr, tmpLat.port};
+		if (i > 0 && !lessThan(prev, cur)) {
+			sortedUnique = false;
+		}
+		prev = cur;
+	}
+	if (!sortedUnique) {
+		map<NodeIdent, uint32_t, ltNodeIdent> tmpMap;
+		NodeListCursor cursor(targets);
+		while (cursor.next(&tmpLat)) {
+			NodeIdent cur = {tmpLat.addr, tmpLat.port};
+			tmpMap[cur] = tmpLat.latencyUS;
+		}
+		RetResponse resp(
+			view.retReqID(), closest.addr, closest.port, tmpMap);
+		return resp.createRealPacket(inPacket);
+	}
+	write_header(inPacket, RET_RESPONSE, view.retReqID());
+	inPacket.append_uint(htonl(closest.addr));
+	inPacket.append_ushort(htons(closest.port));
+	if (targets.isWireV2() == inPacket.useWireV2()) {
+		inPacket.append_str(targets.getRaw(), targets.getRawSize());
+	} else if (inPacket.useWireV2()) {
+		inPacket.append_varint(targets.size());
+		NodeListEncoder enc(inPacket);
+		NodeListCursor cursor(targets);
+		NodeIdentLat tmp;
+		while (cursor.next(&tmp)) {
+			enc.appendNode(tmp.addr, tmp.port);
+			enc.appendValue(tmp.latencyUS);
+		}
+	} else {
+		inPacket.append_uint(htonl(targets.size()));
+		NodeListCursor cursor(targets);
+		NodeIdentLat tmp;
+		while (cursor.next(&tmp)) {
+			inPacket.append_uint(htonl(tmp.addr));
+			inPacket.append_ushort(htons(tmp.port));
+			inPacket.append_uint(htonl(tmp.latencyUS));
+		}
+	}
+	if (!inPacket.completeOkay()) { 
+		return -1; 
+	}
+	return 0;
+}
+
 class PingPacket : public Packet {
 public:
 	PingPacket(uint64_t id) : Packet(id) {}
 	virtual int createRealPacket(RealPacket& inPacket) const {
 		inPacket.append_char(getPacketType());
-		write_id(inPacket);					
+		write_id(inPacket);
+		write_caps(inPacket);					
 		if (!inPacket.completeOkay()) { 
 			return -1; 
 		}
@@ -1413,7 +2207,8 @@ public:
 	PongPacket(uint64_t id) : Packet(id) {}
 	virtual int createRealPacket(RealPacket& inPacket) const {
 		inPacket.append_char(getPacketType());
-		write_id(inPacket);				
+		write_id(inPacket);
+		write_caps(inPacket);				
 		if (!inPacket.completeOkay()) { 
 			return -1; 
 		}
@@ -1456,6 +2251,7 @@ public:
 class InfoPacket : public Packet {
 private:
 	const RingSet* rings;
+	void getMembers(vector<pair<u_int, NodeIdentLat> >& members) const;
 public:
 	InfoPacket(uint64_t id, const RingSet* in_rings) : 
 		Packet(id), rings(in_rings) {}
@@ -1472,8 +2268,11 @@ public:
 #include "MeridianDSL.h"
 
 class DSLReplyPacket : public Packet {
+private:
+	bool			cached;
+	ProgramHash		cachedHash;
 public:	
-	DSLReplyPacket(uint64_t id) : Packet(id) {}		
+	DSLReplyPacket(uint64_t id) : Packet(id), cached(false) {}		
 		
 	static DSLReplyPacket* parse(ParserState* ps, 
 			const char* buf, int numBytes, ASTNode** ret_node) {
@@ -1493,8 +2292,30 @@ public:
 		}		
 		DSLReplyPacket* ret = new DSLReplyPacket(queryID);
 		*ret_node = unmarshal_ast(ps, &rb);		
+		if (!rb.error() && rb.retrieve_char() == DSL_CACHED_MARK) {
+			const char* hashBuf = rb.retrieve_buf(PROGRAM_HASH_SIZE);
+			if (!rb.error()) {
+				memcpy(ret->cachedHash.bytes, hashBuf, PROGRAM_HASH_SIZE);
+				ret->cached = true;
+			}
+		}
 		return ret; 		
 	}
+	
+	//	Appended after the return value, tells the requesting node that the
+	//	program can be sent by hash from now on
+	static void write_cached(RealPacket& inPacket, const ProgramHash& hash) {
+		inPacket.append_char(DSL_CACHED_MARK);
+		inPacket.append_str((const char*)hash.bytes, PROGRAM_HASH_SIZE);
+	}
+	
+	//	Whether the replying node cached the program, and its hash
+	bool peerCached(ProgramHash* hash) const {
+		if (cached) {
+			*hash = cachedHash;
+		}
+		return cached;
+	}
 
 	//	Note: Need to append actual payload using the marshal_packet call
 	//	This just creates the necessary Meridian headers
@@ -1514,6 +2335,28 @@ public:
 	virtual ~DSLReplyPacket() {}	
 };
 
+//	Answers a DSL_REQUEST sent by hash when the program is not cached. The
+//	requesting node then sends the request again with the full text
+class DSLProgramMissPacket : public Packet {
+public:
+	DSLProgramMissPacket(uint64_t id) : Packet(id) {}
+	
+	virtual int createRealPacket(RealPacket& inPacket) const {
+		inPacket.append_char(getPacketType());
+		write_id(inPacket);
+		if (!inPacket.completeOkay()) { 
+			return -1; 
+		}
+		return 0;
+	}
+	
+	virtual char getPacketType() const {
+		return DSL_PROGRAM_MISS;	
+	}
+	
+	virtual ~DSLProgramMissPacket() {}
+};
+
 class DSLRequestPacket : public RendvHeaderPacket {
 private:
 	uint16_t ms_remain;
@@ -38,6 +38,7 @@ using namespace std;
 #include "Marshal.h"
 #include "MQLState.h"
 #include "MeridianDSL.h"
+#include "ProgramCache.h"
 
 template <class T>
 T opr(int op, T param_1, T param_2) {
@@ -93,35 +94,62 @@ int opr_int_only(int op, int param_1, int param_2) {
 	return 0;
 }
 
-int marshal_packet(ParserState* ps, RealPacket& inPacket,
-		const string* func_name, const ASTNode* paramAST) {
-#if 0			
-	ASTNode* funcVar = NULL; 
-	if (ps->get_var_table()->lookup(*(func_name), &funcVar) == -1) {
-		DSL_ERROR("Function name %s not found\n", func_name->c_str());
-		return -1;
-	}
-#endif	
+int compress_program(const char* in_text, u_int in_size, 
+		char** out_buf, u_int* out_size) {
 	//	Allocate compression buffer
-	uLongf tmpCompBufSize = (2 * ps->input_buffer.get_buf_size()) + 12;
+	uLongf tmpCompBufSize = (2 * in_size) + 12;
 	char* tmpCompBuf = (char*) malloc(tmpCompBufSize);
 	if (tmpCompBuf == NULL) {
 		DSL_ERROR("Cannot allocate temporary compress buffer\n");
 		return -1;	
 	}
 	if (compress((Bytef*)tmpCompBuf, (uLongf*)&tmpCompBufSize,
-			(Bytef*)ps->input_buffer.get_raw_buf(), 
-			ps->input_buffer.get_buf_size()) != Z_OK) {
+			(const Bytef*)in_text, in_size) != Z_OK) {
 		DSL_ERROR("zlib compression failed\n");
 		free(tmpCompBuf);
 		return -1;
 	}
+	*out_buf = tmpCompBuf;
+	*out_size = tmpCompBufSize;
+	return 0;
+}
+
+int marshal_packet(ParserState* ps, RealPacket& inPacket,
+		const string* func_name, const ASTNode* paramAST, bool by_hash) {
+#if 0			
+	ASTNode* funcVar = NULL; 
+	if (ps->get_var_table()->lookup(*(func_name), &funcVar) == -1) {
+		DSL_ERROR("Function name %s not found\n", func_name->c_str());
+		return -1;
+	}
+#endif	
 	//	This packet MUST not have a rendavous host
-	// 	Save both original size and compressed size
-	inPacket.append_uint(htonl(ps->input_buffer.get_buf_size()));
-	inPacket.append_uint(htonl(tmpCompBufSize));			
-	inPacket.append_str(tmpCompBuf, tmpCompBufSize);
-	free(tmpCompBuf); // Done with compress buffer
+	CachedProgram* source = ps->get_source();
+	if (source != NULL && by_hash) {
+		inPacket.append_uint(htonl(DSL_PROGRAM_BY_HASH));
+		inPacket.append_str(
+			(const char*)(source->getHash().bytes), PROGRAM_HASH_SIZE);
+	} else if (source != NULL) {
+		//	Compressed when the program was cached
+		u_int compSize = 0;
+		const char* compBuf = source->getCompressed(&compSize);
+		inPacket.append_uint(htonl(source->getTextSize()));
+		inPacket.append_uint(htonl(compSize));
+		inPacket.append_str(compBuf, compSize);
+	} else {
+		char* tmpCompBuf = NULL;
+		u_int tmpCompBufSize = 0;
+		if (compress_program(ps->input_buffer.get_raw_buf(), 
+				ps->input_buffer.get_buf_size(), 
+				&tmpCompBuf, &tmpCompBufSize) == -1) {
+			return -1;
+		}
+		// 	Save both original size and compressed size
+		inPacket.append_uint(htonl(ps->input_buffer.get_buf_size()));
+		inPacket.append_uint(htonl(tmpCompBufSize));			
+		inPacket.append_str(tmpCompBuf, tmpCompBufSize);
+		free(tmpCompBuf); // Done with compress buffer
+	}
 	inPacket.append_uint(htonl(func_name->size()));
 	inPacket.append_str(func_name->c_str(), func_name->size());
 	if (!(inPacket.completeOkay())) {
@@ -238,26 +266,15 @@ ASTNode* ADTCreateAndCopy(ParserState* ps, const ASTNode* a) {
 		}
 		case INT_TYPE:
 		case DOUBLE_TYPE:
-		case STRING_TYPE: {
-			ASTNode* tmpNode = ASTCreate(ps, a->type, NULL, VOID_TYPE, 0);
-			if (tmpNode->type == EMPTY_TYPE) {
-				return ps->empty_token();
-			}
-			if (ps->get_var_table()->updateADT(tmpNode, a) == -1) {
-				return ps->empty_token();
-			}
-			return tmpNode;				
-		}
+		case STRING_TYPE:
 		case VAR_ADT_TYPE: {
-			ASTNode* tmpNode = ASTCreate(ps, ADT_TYPE, 
-				a->val.adt_val.adt_type_name, VOID_TYPE, 0);
-			if (tmpNode->type == EMPTY_TYPE) {
-				return ps->empty_token();
-			}
-			if (ps->get_var_table()->updateADT(tmpNode, a) == -1) {
+			//	Copies the fields of a struct directly instead of creating
+			//	it from its declaration and assigning
+			ASTNode* tmpNode = ps->get_var_table()->copy_value(a);
+			if (tmpNode == NULL) {
 				return ps->empty_token();
 			}
-			return tmpNode;					
+			return tmpNode;				
 		}
 		default:
 			break;
@@ -295,17 +312,21 @@ bool ADTEqual(const ASTNode* a, const ASTNode* b) {
 				*(b->val.adt_val.adt_type_name)) {
 			return false;
 		}
-		if (a->val.adt_val.adt_map->size() != b->val.adt_val.adt_map->size()) {
+		const ADTLayout* layoutA = a->val.adt_val.adt_layout;
+		const ADTLayout* layoutB = b->val.adt_val.adt_layout;
+		if (layoutA->numFields != layoutB->numFields) {
 			return false;	
 		}
-		map<string, ASTNode*>::iterator it = a->val.adt_val.adt_map->begin();
-		for (; it != a->val.adt_val.adt_map->end(); it++) {
-			map<string, ASTNode*>::const_iterator findIt =
-				b->val.adt_val.adt_map->find(it->first);
-			if (findIt == b->val.adt_val.adt_map->end()) {
+		for (u_int i = 0; i < layoutA->numFields; i++) {
+			int j = i;
+			if (layoutB != layoutA) {
+				j = adt_field_index(layoutB, *(layoutA->fieldNames[i]));
+			}
+			if (j == -1) {
 				return false;		
 			}
-			if (ADTEqual(it->second, findIt->second) == false) {
+			if (ADTEqual(a->val.adt_val.adt_fields[i], 
+					b->val.adt_val.adt_fields[j]) == false) {
 				return false;	
 			}
 		}
@@ -487,7 +508,7 @@ ASTNode* mk_sep_list(ParserState* in_state, ASTNode* a) {
 	return thisNode;	
 }
 
-//	Only used by NEW_VAR_ASSIGN_TYPE and RPC_TYPE 
+//	Only used by NEW_VAR_ASSIGN_TYPE, RPC_TYPE and compiled functions
 ASTNode* mk_sep_list(ParserState* in_state, vector<ASTNode*>* a) {
 	ASTNode* thisNode = in_state->get_var_table()->new_stack_ast();
 	if (thisNode == NULL) {
@@ -906,6 +927,43 @@ ASTNode* mk_rpc(ParserState* in_state,
 	return thisNode;	
 }
 
+//	Lays the fields of a received struct out as its type is declared here,
+//	or in the order received if the type is unknown or declared differently
+static int unmarshal_fields(ParserState* ps, ASTNode* in_node, 
+		const vector<string*>& names, const vector<ASTNode*>& values) {
+	VarTable* table = ps->get_var_table();
+	ASTNode** fields = table->new_stack_fields(names.size());
+	if (fields == NULL) {
+		return -1;
+	}
+	const ADTLayout* layout = 
+		table->lookup_layout(*(in_node->val.adt_val.adt_type_name));
+	if (layout != NULL && layout->numFields == names.size()) {
+		memset(fields, 0, names.size() * sizeof(ASTNode*));
+		for (u_int i = 0; i < names.size(); i++) {
+			int j = adt_field_index(layout, *(names[i]));
+			if (j == -1 || fields[j] != NULL) {
+				layout = NULL;
+				break;
+			}
+			fields[j] = values[i];
+		}
+	} else {
+		layout = NULL;
+	}
+	if (layout == NULL) {
+		if ((layout = table->new_stack_layout(names)) == NULL) {
+			return -1;
+		}
+		for (u_int i = 0; i < values.size(); i++) {
+			fields[i] = values[i];
+		}
+	}
+	in_node->val.adt_val.adt_layout = layout;
+	in_node->val.adt_val.adt_fields = fields;
+	return 0;
+}
+
 ASTNode* unmarshal_ast(ParserState* ps, BufferWrapper* bw) {
 	ASTNode* in_node = ps->get_var_table()->new_stack_ast();
 	if (in_node == NULL) {
@@ -992,14 +1050,10 @@ ASTNode* unmarshal_ast(ParserState* ps, BufferWrapper* bw) {
 			}			
 			tmp_string->append(buf, string_size);
 			in_node->val.adt_val.adt_type_name = tmp_string;
-			//	Get map size
+			//	Get number of fields
 			u_int map_size = ntohl(bw->retrieve_uint());
-			//	Create map
-			in_node->val.adt_val.adt_map 
-				= ps->get_var_table()->new_stack_map();
-			if (in_node->val.adt_val.adt_map == NULL) {
-				return ps->empty_token();				
-			}
+			vector<string*> names;
+			vector<ASTNode*> values;
 			for (u_int i = 0; i < map_size; i++) {
 				u_int map_string_size = ntohl(bw->retrieve_uint());
 				// Retrieve string
@@ -1007,12 +1061,20 @@ ASTNode* unmarshal_ast(ParserState* ps, BufferWrapper* bw) {
 				if (bw->error()) {
 					return ps->empty_token();
 				}
-				string map_string(map_buf, map_string_size);
+				string* map_string = ps->get_var_table()->new_stack_string();
+				if (map_string == NULL) {
+					return ps->empty_token();
+				}
+				map_string->append(map_buf, map_string_size);
 				ASTNode* map_node = unmarshal_ast(ps, bw);
 				if (map_node->type == EMPTY_TYPE) {
 					return ps->empty_token();
 				}
-				(*(in_node->val.adt_val.adt_map))[map_string] = map_node;				
+				names.push_back(map_string);
+				values.push_back(map_node);
+			}
+			if (unmarshal_fields(ps, in_node, names, values) == -1) {
+				return ps->empty_token();
 			}
 		}
 		break;
@@ -1107,16 +1169,16 @@ int marshal_ast(const ASTNode* in_node, RealPacket* in_packet) {
 				string_size);
 			//	NOTE: adt_param does NOT need to me marshalled, as it is
 			//	used in ADT_TYPE, not VAR_ADT_TYPE			
-			//	Map size and entries in map
-			u_int map_size = in_node->val.adt_val.adt_map->size();
-			in_packet->append_uint(htonl(map_size));
-			map<string, ASTNode*>::iterator map_it = 
-				in_node->val.adt_val.adt_map->begin();
-			for (; map_it != in_node->val.adt_val.adt_map->end(); map_it++) {
-				u_int map_str_size = (map_it->first).size();
+			//	Number of fields and the name and value of each
+			const ADTLayout* layout = in_node->val.adt_val.adt_layout;
+			in_packet->append_uint(htonl(layout->numFields));
+			for (u_int i = 0; i < layout->numFields; i++) {
+				u_int map_str_size = layout->fieldNames[i]->size();
 				in_packet->append_uint(htonl(map_str_size));			
-				in_packet->append_str((map_it->first).c_str(), map_str_size);				
-				if (marshal_ast(map_it->second, in_packet) == -1) {
+				in_packet->append_str(
+					layout->fieldNames[i]->c_str(), map_str_size);				
+				if (marshal_ast(
+						in_node->val.adt_val.adt_fields[i], in_packet) == -1) {
 					DSL_ERROR("Error marshaling ast\n");
 					return -1;
 				}				
@@ -1259,17 +1321,31 @@ int uniqueAdd(ParserState* ps,
 int unmarshal_packet(ParserState& ps, BufferWrapper& bw) {
 	// Actual program text size
 	uLongf prog_size = ntohl(bw.retrieve_uint());
+	u_int comp_prog_size = 0;
+	const char* buf = NULL;
+	bool by_hash = (prog_size == DSL_PROGRAM_BY_HASH);
+	if (by_hash) {
+		//	Program looked up in the program cache
+		const char* hashBuf = bw.retrieve_buf(PROGRAM_HASH_SIZE);
+		if (bw.error()) {
+			return -1;
+		}
+		ProgramHash hash;
+		memcpy(hash.bytes, hashBuf, PROGRAM_HASH_SIZE);
+		ps.set_source_hash(hash);
+	} else {
 #define MAX_PROGRAM_SIZE	10000
-	if (prog_size > MAX_PROGRAM_SIZE) {
-		DSL_ERROR("unmarshal_packet: received program size too large\n");
-		return -1;	
-	}
-	// Compressed size store in packet
-	u_int comp_prog_size = ntohl(bw.retrieve_uint());
-	//const char* buf = bw.retrieve_buf(prog_size);
-	const char* buf = bw.retrieve_buf(comp_prog_size);
-	if (bw.error()) {
-		return -1;
+		if (prog_size > MAX_PROGRAM_SIZE) {
+			DSL_ERROR("unmarshal_packet: received program size too large\n");
+			return -1;	
+		}
+		// Compressed size store in packet
+		comp_prog_size = ntohl(bw.retrieve_uint());
+		//const char* buf = bw.retrieve_buf(prog_size);
+		buf = bw.retrieve_buf(comp_prog_size);
+		if (bw.error()) {
+			return -1;
+		}
 	}
 	// Retrieve function name that will be called
 	u_int string_size = ntohl(bw.retrieve_uint());
@@ -1279,6 +1355,9 @@ int unmarshal_packet(ParserState& ps, BufferWrapper& bw) {
 	}
 	ps.set_func_string(func_name);			// Set func name to be called		
 	ps.set_param(unmarshal_ast(&ps, &bw));	// Unmarshal parameters
+	if (by_hash) {
+		return 0;
+	}
 	// Allocate temp buffer 	
 	char* tmpCompBuf = (char*)malloc(prog_size);
 	if (tmpCompBuf == NULL) {
@@ -1924,14 +2003,13 @@ void addGlobalModule(ParserState* ps) {
 	eval(ps, mk_adt(ps, adt_name, adt_fields), 0);		
 }
 
-int fillNodeIdentField(
-		const char* in_string, const map<string, ASTNode*>* inMap, 
-		int32_t* val) {
-	map<string, ASTNode*>::const_iterator findIt = inMap->find(in_string);
-	if (findIt == inMap->end() || findIt->second->type != INT_TYPE) {
+//	in_ast must have a built in layout
+int fillNodeIdentField(const ASTNode* in_ast, u_int in_field, int32_t* val) {
+	const ASTNode* field = in_ast->val.adt_val.adt_fields[in_field];
+	if (field->type != INT_TYPE) {
 		return -1;	
 	}		
-	*val = findIt->second->val.i_val;
+	*val = field->val.i_val;
 	return 0;
 }
 
@@ -1939,75 +2017,61 @@ int createNodeIdent(ASTNode* in_ast, NodeIdentRendv* in_NodeIdent) {
 	if (in_ast->type != VAR_ADT_TYPE) {
 		return -1;	
 	}
-	if (*(in_ast->val.adt_val.adt_type_name) != "Node") {
+	if (in_ast->val.adt_val.adt_layout != &adt_node_layout) {
 		return -1;
 	}
 	int32_t tmpVal;
-	if (fillNodeIdentField("addr", in_ast->val.adt_val.adt_map, 
-			&tmpVal) == -1) {				
+	if (fillNodeIdentField(in_ast, ADT_FIELD_ADDR, &tmpVal) == -1) {				
 		return -1;
 	}
 	in_NodeIdent->addr = (uint32_t)tmpVal;	
-	if (fillNodeIdentField("port", in_ast->val.adt_val.adt_map,
-			&tmpVal) == -1) {
+	if (fillNodeIdentField(in_ast, ADT_FIELD_PORT, &tmpVal) == -1) {
 		return -1;
 	}
 	in_NodeIdent->port = (uint16_t)tmpVal;
-	if (fillNodeIdentField("rendvAddr", in_ast->val.adt_val.adt_map,
-			&tmpVal) == -1) {
+	if (fillNodeIdentField(in_ast, ADT_FIELD_RENDV_ADDR, &tmpVal) == -1) {
 		return -1;
 	}
 	in_NodeIdent->addrRendv = (uint32_t)tmpVal;
-	if (fillNodeIdentField("rendvPort", in_ast->val.adt_val.adt_map,
-			&tmpVal) == -1) {		
+	if (fillNodeIdentField(in_ast, ADT_FIELD_RENDV_PORT, &tmpVal) == -1) {		
 		return -1;
 	}
 	in_NodeIdent->portRendv = (uint16_t)tmpVal;
 	return 0;
 }
 
+//	Sets the fields shared by Node and Measurement of a struct created from
+//	the built in declaration
+static int setNodeIdentFields(ASTNode* in_ast, const ADTLayout* in_layout,
+		const NodeIdentRendv& in_ident) {
+	if (in_ast->val.adt_val.adt_layout != in_layout) {
+		DSL_ERROR("Struct %s does not have the built in fields\n",
+			in_ast->val.adt_val.adt_type_name->c_str());
+		return -1;
+	}
+	ASTNode** fields = in_ast->val.adt_val.adt_fields;
+	for (u_int i = ADT_FIELD_ADDR; i <= ADT_FIELD_RENDV_PORT; i++) {
+		if (fields[i]->type != INT_TYPE) {
+			DSL_ERROR("Field of unexpected type\n");
+			return -1;
+		}
+	}
+	fields[ADT_FIELD_ADDR]->val.i_val = in_ident.addr;
+	fields[ADT_FIELD_PORT]->val.i_val = in_ident.port;
+	fields[ADT_FIELD_RENDV_ADDR]->val.i_val = in_ident.addrRendv;
+	fields[ADT_FIELD_RENDV_PORT]->val.i_val = in_ident.portRendv;
+	return 0;
+}
+
 // Returns empty on error
 ASTNode* createNodeIdent(ParserState* ps, const NodeIdentRendv& in_ident) {
-	string adtName = "Node";
-	//	Lookup ADT
-	ASTNode* adtNode = NULL;
-	if (ps->get_var_table()->lookup(adtName, &adtNode) == -1
-			|| adtNode->type != ADT_TYPE) {
-		DSL_ERROR("Cannot find specified ADT\n");
-		return ps->empty_token();
-	}	
+	static const string adtName("Node");
 	ASTNode* retVar = ASTCreate(ps, ADT_TYPE, &adtName, VOID_TYPE, 0);
 	if (retVar->type == EMPTY_TYPE) {
 		return ps->empty_token();	
 	}	
-	vector<ASTNode*>* tmpList 
-		= adtNode->val.adt_val.adt_param->val.p_val.p_vector;		
-	for (u_int i = 0; i < tmpList->size(); i++) {
-		ASTNode* field_node = (*tmpList)[i];
-		string* curField = field_node->val.v_val.v_name;		
-		map<string, ASTNode*>::iterator it = 
-			retVar->val.adt_val.adt_map->find(*curField);
-		if (it == retVar->val.adt_val.adt_map->end()) {
-			DSL_ERROR("Cannot find required field type in Node\n");
-			return ps->empty_token();			
-		}
-		ASTNode* tmpNode = it->second;
-		if (tmpNode->type != INT_TYPE) {
-			DSL_ERROR("Field of unexpected type\n");
-			return ps->empty_token();
-		}
-		if (*curField == "addr") {
-			tmpNode->val.i_val = in_ident.addr;	
-		} else if (*curField == "port") {
-			tmpNode->val.i_val = in_ident.port;			
-		} else if (*curField == "rendvAddr") {
-			tmpNode->val.i_val = in_ident.addrRendv;
-		} else if (*curField == "rendvPort") {
-			tmpNode->val.i_val = in_ident.portRendv;
-		} else {
-			DSL_ERROR("Unexpected field\n");
-			return ps->empty_token();
-		}				
+	if (setNodeIdentFields(retVar, &adt_node_layout, in_ident) == -1) {
+		return ps->empty_token();
 	}
 	return retVar;
 }
@@ -2015,70 +2079,37 @@ ASTNode* createNodeIdent(ParserState* ps, const NodeIdentRendv& in_ident) {
 // Returns empty on error
 ASTNode* createNodeIdentLat(ParserState* ps, const NodeIdentRendv& in_ident, 
 		const uint32_t* lat_us, u_int lat_size) {
-	string adtName = "Measurement";			
-	//	Lookup ADT
-	ASTNode* adtNode = NULL;
-	if (ps->get_var_table()->lookup(adtName, &adtNode) == -1
-			|| adtNode->type != ADT_TYPE) {
-		DSL_ERROR("Cannot find specified ADT\n");
-		return ps->empty_token();
-	}	
+	static const string adtName("Measurement");
 	ASTNode* retVar = ASTCreate(ps, ADT_TYPE, &adtName, VOID_TYPE, 0);
 	if (retVar->type == EMPTY_TYPE) {
 		return ps->empty_token();	
 	}	
-	vector<ASTNode*>* tmpList 
-		= adtNode->val.adt_val.adt_param->val.p_val.p_vector;		
-	for (u_int i = 0; i < tmpList->size(); i++) {
-		ASTNode* field_node = (*tmpList)[i];
-		string* curField = field_node->val.v_val.v_name;		
-		map<string, ASTNode*>::iterator it = 
-			retVar->val.adt_val.adt_map->find(*curField);
-		if (it == retVar->val.adt_val.adt_map->end()) {
-			DSL_ERROR(
-				"Cannot find required field type in Measurement\n");
-			return ps->empty_token();			
-		}
-		ASTNode* tmpNode = it->second;
-		if (tmpNode->type == INT_TYPE) {
-			if (*curField == "addr") {
-				tmpNode->val.i_val = in_ident.addr;	
-			} else if (*curField == "port") {
-				tmpNode->val.i_val = in_ident.port;			
-			} else if (*curField == "rendvAddr") {
-				tmpNode->val.i_val = in_ident.addrRendv;
-			} else if (*curField == "rendvPort") {
-				tmpNode->val.i_val = in_ident.portRendv;		 
-			} else {
-				DSL_ERROR("Unexpected field\n");
-				return ps->empty_token();
-			}
-		} else if (tmpNode->type == ARRAY_TYPE && 
-				tmpNode->val.a_val.a_type == DOUBLE_TYPE) {
-			//if (*curField == "latency_ms") {
-			if (*curField == "distance") {
-				//for (u_int j = 0; j < lat_us.size(); j++) {
-				for (u_int j = 0; j < lat_size; j++) {
-					ASTNode* tmpDoubleNode = 
-						ASTCreate(ps, DOUBLE_TYPE, NULL, VOID_TYPE, 0);
-					if (tmpDoubleNode->type == EMPTY_TYPE) {
-						return ps->empty_token();
-					}
-					//	Lat contains latency in us, where distance is in ms
-					//tmpDoubleNode->val.d_val = (lat_us[j] / 1000.0);
-					tmpDoubleNode->val.d_val = (*(lat_us + j) / 1000.0);
-					tmpNode->val.a_val.a_vector->push_back(tmpDoubleNode);
-				}
-			}				
-		} else {
-			DSL_ERROR("Unexpected field\n");
-			return ps->empty_token();			
+	if (setNodeIdentFields(retVar, &adt_measurement_layout, in_ident) == -1) {
+		return ps->empty_token();
+	}
+	ASTNode* distNode = retVar->val.adt_val.adt_fields[ADT_FIELD_DISTANCE];
+	if (distNode->type != ARRAY_TYPE || 
+			distNode->val.a_val.a_type != DOUBLE_TYPE) {
+		DSL_ERROR("Unexpected field\n");
+		return ps->empty_token();			
+	}
+	distNode->val.a_val.a_vector->reserve(lat_size);
+	for (u_int j = 0; j < lat_size; j++) {
+		ASTNode* tmpDoubleNode = 
+			ASTCreate(ps, DOUBLE_TYPE, NULL, VOID_TYPE, 0);
+		if (tmpDoubleNode->type == EMPTY_TYPE) {
+			return ps->empty_token();
 		}
+		//	Lat contains latency in us, where distance is in ms
+		tmpDoubleNode->val.d_val = (*(lat_us + j) / 1000.0);
+		distNode->val.a_val.a_vector->push_back(tmpDoubleNode);
 	}
 	return retVar;
 }
 
 void jmp_eval(ParserState* ps) {
+	//	Budget of the first slice, given back once the globals are done
+	int sliceEvals = ps->getEvalCount();
 	// Evaluate global variables
 	ps->allocateEvalCount(-1);	// -1 means no limit
 	// Global structs implemented in the language are added in here	
@@ -2092,12 +2123,13 @@ void jmp_eval(ParserState* ps) {
 	} else {
 		//	Set actual parameter
 		main_node->val.f_val.f_actual_param = ps->get_param();
-		ps->allocateEvalCount(10000);
+		ps->allocateEvalCount(sliceEvals);
 		ASTNode* this_node = eval(ps, main_node, 0);
 		ps->setQueryReturn(this_node);
 	}	
 	ps->set_parser_state(PS_DONE);
-	setcontext(&global_env_thread);
+	//	Never resumed, the stack goes back to the pool with ps
+	fiber_switch(ps->get_context(), &global_env_thread);
 }
 
 ASTNode* eval(ParserState* ps, ASTNode* cur_node, int recurse_count) {
@@ -2105,14 +2137,7 @@ ASTNode* eval(ParserState* ps, ASTNode* cur_node, int recurse_count) {
 		DSL_ERROR("Maximum recurse count reached\n");
 		return ps->empty_token();
 	}
-	if (ps->getEvalCount() != -1) {
-		while (ps->getEvalCount() == 0) {
-			ps->set_parser_state(PS_READY);
-			swapcontext(ps->get_context(), &global_env_thread);
-		}		
-		ps->decrementEvalCount();		
-	}	
-	ps->set_parser_state(PS_RUNNING);	
+	eval_step(ps);
 	//	Determine what type of instruction is being evaluated
 	switch(cur_node->type) {
 		case EMPTY_TYPE: {
@@ -2251,16 +2276,15 @@ ASTNode* eval(ParserState* ps, ASTNode* cur_node, int recurse_count) {
 			if (retVar->type != VAR_ADT_TYPE) {				
 				return ps->empty_token();
 			}
-			map<string, ASTNode*>::iterator findIt = 
-				retVar->val.adt_val.adt_map->find(
-					*(cur_node->val.v_val.v_name_dot_name));
-			if (findIt == retVar->val.adt_val.adt_map->end()) {
+			ASTNode* field = 
+				adt_field(retVar, *(cur_node->val.v_val.v_name_dot_name));
+			if (field == NULL) {
 				DSL_ERROR(
 					"The field %s does not exist in ADT variable\n",
 					cur_node->val.v_val.v_name_dot_name->c_str());			
 				return ps->empty_token();
 			}
-			return findIt->second;
+			return field;
 		}		
 		case STRING_TYPE: {		
 			//printf("String literal named %s\n", 
@@ -2360,6 +2384,15 @@ ASTNode* eval(ParserState* ps, ASTNode* cur_node, int recurse_count) {
 			if (newNode->type == EMPTY_TYPE) {
 				return newNode;
 			}
+			//	The operand may be a variable or a literal of the program,
+			//	so the result goes into a new node
+			ASTNode* retNode = ps->get_var_table()->new_stack_ast();
+			if (retNode == NULL) {
+				return ps->empty_token();
+			}
+			retNode->type = newNode->type;
+			retNode->val = newNode->val;
+			newNode = retNode;
 			if (cur_node->val.u_val.u_type == '-') {					
 				switch(newNode->type) {
 					case INT_TYPE:
@@ -2431,38 +2464,11 @@ ASTNode* eval(ParserState* ps, ASTNode* cur_node, int recurse_count) {
 			ASTNode* destNode = 
 				eval(ps, cur_node->val.rpc_val.rpc_dest, recurse_count + 1);
 
-			if (destNode->type != VAR_ADT_TYPE ||
-					*(destNode->val.adt_val.adt_type_name) != "Node") {
+			NodeIdentRendv tmpNodeIdent;
+			if (createNodeIdent(destNode, &tmpNodeIdent) == -1) {
 				DSL_ERROR("Destination must be a Node\n");
 				return ps->empty_token();
 			}
-
-			ASTNode* addrAST = 
-				(*(destNode->val.adt_val.adt_map))["addr"];
-			ASTNode* portAST = 
-				(*(destNode->val.adt_val.adt_map))["port"];
-			ASTNode* rendvAddrAST = 
-				(*(destNode->val.adt_val.adt_map))["rendvAddr"];
-			ASTNode* rendvPortAST = 
-				(*(destNode->val.adt_val.adt_map))["rendvPort"];
-#if 0	
-			// Should be an unnecessary check				
-			if (!addrAST || !portAST || !rendvAddrAST || !rendvPortAST) {
-				DSL_ERROR("Node definition inconsistent\n");
-				return ps->empty_token();				
-			}
-			
-			if (addrAST->type != INT_TYPE ||
-				portAST->type != INT_TYPE ||
-				rendvAddrAST->type != INT_TYPE ||
-				rendvPortAST->type != INT_TYPE) {
-				return ps->empty_token();		
-			}
-#endif						
-			
-			NodeIdentRendv tmpNodeIdent =  { 	
-				addrAST->val.i_val, portAST->val.i_val,
-				rendvAddrAST->val.i_val, rendvPortAST->val.i_val };
 			
 			vector<ASTNode*> actual_param;			
 			// Currently can't handle return values
@@ -2588,15 +2594,6 @@ ASTNode* eval(ParserState* ps, ASTNode* cur_node, int recurse_count) {
 			return eval(ps, call_func, recurse_count + 1);
 		} 
 		case FUNC_CALL_TYPE: {
-			//	Create return type in the calling function's scope
-			ASTNode* tmp_node = NULL;			 
-			if (cur_node->val.f_val.f_type != VOID_TYPE) {				
-				// 	NOTE: The overwrite flag must be on
-				//	NOTE: Array size is always 0 initially
-				tmp_node = ASTCreate(ps, cur_node->val.f_val.f_type,
-					cur_node->val.f_val.f_type_name,
-					cur_node->val.f_val.f_array_type, 0);
-			}
 			//	Push evaluated actual parameters into actual_param vector
 			vector<ASTNode*> actual_param;
 			if (cur_node->val.f_val.f_actual_param->type == SEP_TYPE) {
@@ -2609,6 +2606,24 @@ ASTNode* eval(ParserState* ps, ASTNode* cur_node, int recurse_count) {
 						eval(ps, (*f_param)[i], recurse_count + 1));
 				}
 			}
+			//	Run the compiled function if the body could be compiled
+			if (ps->use_bytecode()) {
+				ASTNode* retNode = mql_call(ps, cur_node, 
+					actual_param.empty() ? NULL : &(actual_param[0]),
+					actual_param.size(), recurse_count + 1);
+				if (retNode != NULL) {
+					return retNode;
+				}
+			}
+			//	Create return type in the calling function's scope
+			ASTNode* tmp_node = NULL;			 
+			if (cur_node->val.f_val.f_type != VOID_TYPE) {				
+				// 	NOTE: The overwrite flag must be on
+				//	NOTE: Array size is always 0 initially
+				tmp_node = ASTCreate(ps, cur_node->val.f_val.f_type,
+					cur_node->val.f_val.f_type_name,
+					cur_node->val.f_val.f_array_type, 0);
+			}
 			//	Create new var table that can only access prev var_table's 
 			//	global variables
 			VarTable* old_table = NULL;
@@ -2678,9 +2693,25 @@ ASTNode* eval(ParserState* ps, ASTNode* cur_node, int recurse_count) {
 			return cur_node;			
 		}
 		case DEF_ADT_TYPE: {
-			cur_node->type = ADT_TYPE;
+			//	The AST may be shared with other ParserStates through the
+			//	program cache, declare a copy
+			ASTNode* adtNode = ps->get_var_table()->new_stack_ast();
+			if (adtNode == NULL) {
+				DSL_ERROR("Out of memory\n");
+				return ps->empty_token();
+			}
+			*adtNode = *cur_node;
+			adtNode->type = ADT_TYPE;
+			adtNode->val.adt_val.adt_layout = 
+				ps->get_var_table()->new_stack_layout(
+					adtNode->val.adt_val.adt_type_name, 
+					adtNode->val.adt_val.adt_param);
+			if (adtNode->val.adt_val.adt_layout == NULL) {
+				DSL_ERROR("Out of memory\n");
+				return ps->empty_token();
+			}
 			if (ps->get_var_table()->insert(
-					*(cur_node->val.adt_val.adt_type_name), cur_node) == -1) {
+					*(adtNode->val.adt_val.adt_type_name), adtNode) == -1) {
 				DSL_ERROR(
 					"ADT declaration clashes with another symbol\n");				
 			}
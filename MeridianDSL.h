@@ -3,8 +3,9 @@
 
 #include <setjmp.h>
 #include "Marshal.h"
+#include "Fiber.h"
 
-extern ucontext_t global_env_thread;
+extern FiberContext global_env_thread;
 //extern jmp_buf global_env_pc;
 extern int g_parser_line;
 extern int yyparse(void*);
@@ -19,6 +20,7 @@ extern ASTNode* mk_context(ParserState* in_state, ASTNode* a);
 extern ASTNode* mk_continue(ParserState* in_state);
 extern ASTNode* mk_node_list(ParserState* in_state, ASTNode* a, ASTNode* b);
 extern ASTNode* mk_sep_list(ParserState* in_state, ASTNode* a);
+extern ASTNode* mk_sep_list(ParserState* in_state, vector<ASTNode*>* a);
 extern ASTNode* mk_type(ParserState* in_state, ASTType in_type);
 extern ASTNode* mk_new_var(ParserState* in_state, ASTType in_type, string* a);		
 extern ASTNode* mk_ref_var(ParserState* in_state, string* a);
@@ -79,9 +81,15 @@ extern ASTNode* unmarshal_ast(ParserState* ps, BufferWrapper* bw);
 // Performs RPC (handleRPC performs marshalling as well)
 extern ASTNode* handleRPC(ParserState* ps, 
 		const NodeIdentRendv& dest, string* func_name, ASTNode* paramAST);
+// If by_hash, only the hash of the program is sent (the program must
+// come from the program cache)
 extern int marshal_packet(ParserState* ps, RealPacket& inPacket,
-		const string* func_name, const ASTNode* paramAST);		
+		const string* func_name, const ASTNode* paramAST, 
+		bool by_hash = false);		
 extern int unmarshal_packet(ParserState& ps, BufferWrapper& bw);
+// Compresses a program text into a newly malloc'ed buffer
+extern int compress_program(const char* in_text, u_int in_size, 
+		char** out_buf, u_int* out_size);
 		
 // Used in evaluating the constructed AST
 extern ASTNode* evalNativeFunctions(
@@ -191,7 +191,7 @@ int MeridianProcess::eraseTCPConnection(
 	int tmpSock = conIt->first;	
 	pair<uint64_t, NodeIdent>* curPair = conIt->second;		
 	g_tcpProbeConnections.erase(conIt);			
-	FD_CLR(tmpSock, &g_writeSet);
+	g_events.removeFD(tmpSock);
 	close(tmpSock);
 	delete curPair;
 	return 0;
@@ -202,7 +202,7 @@ int MeridianProcess::eraseDNSConnection(
 	int tmpSock = conIt->first;	
 	pair<uint64_t, NodeIdent>* curPair = conIt->second;		
 	g_dnsProbeConnections.erase(conIt);			
-	FD_CLR(tmpSock, &g_readSet);	// Note that we are clearing readSet
+	g_events.removeFD(tmpSock);
 	close(tmpSock);
 	delete curPair;
 	return 0;
@@ -233,12 +233,19 @@ int MeridianProcess::eraseDNSConnection(int in_sock) {
 }
 
 MeridianProcess::MeridianProcess(u_short meridian_port, u_short info_port, 
-				u_int prim_size, u_int second_size, int ring_base, int stopFD) 
+				u_int prim_size, u_int second_size, int ring_base, 
+				u_int num_rings, u_int min_ring_radius_us, int stopFD) 
 		: 	g_meridPort(meridian_port), g_infoPort(info_port), 
 			g_meridSock(-1), g_infoSock(-1), g_rendvFD(-1), g_rendvListener(-1), 
-			g_maxFD(0), g_stopFD(stopFD)
+			g_stopFD(stopFD), g_udpBatchSize(DEFAULT_UDP_BATCH_SIZE),
+			g_udpRecvCalls(0), g_udpRecvPackets(0), g_udpSendCalls(0),
+			g_udpSendPackets(0), g_probesStarted(0),
+			g_probesCoalesced(0), g_revalidatePos(0), g_usefulRingMS(-1),
+			g_numWorkers(1), g_workerIndex(0), g_owner(this), 
+			g_inboxNotified(false), g_sharedCache(false), g_packetsForwarded(0)
 #ifdef MERIDIAN_DSL
-			, g_dummySock(-1), g_max_ttl(DEFAULT_MAX_TTL)
+			, g_max_ttl(DEFAULT_MAX_TTL)
+			, g_programCache(NULL)
 #endif
 #ifdef PLANET_LAB_SUPPORT
 			, g_icmpSock(-1)
@@ -248,20 +255,89 @@ MeridianProcess::MeridianProcess(u_short meridian_port, u_short info_port,
 	NodeIdent dummy = {0, 0};
 	g_rendvRecvPacket = new RealPacket(dummy);
 	setRendavousNode(0, 0);
-	FD_ZERO(&g_readSet);
-	FD_ZERO(&g_writeSet);
 	setGossipInterval(10, 10, 60);
 	setReplaceInterval(300);
-	g_rings = new RingSet(prim_size, second_size, ring_base);
+	g_rings = new RingSet(prim_size, second_size, ring_base, 
+		num_rings, min_ring_radius_us);
+	g_ringMatrices.resize(g_rings->getNumberOfRings());
+	g_ringPublisher = new RingPublisher(*g_rings);
 	g_tcpCache = new LatencyCache(PROBE_CACHE_SIZE, PROBE_CACHE_TIMEOUT_US);
 	g_dnsCache = new LatencyCache(PROBE_CACHE_SIZE, PROBE_CACHE_TIMEOUT_US);
 	g_pingCache = new LatencyCache(PROBE_CACHE_SIZE, PROBE_CACHE_TIMEOUT_US);
 #ifdef PLANET_LAB_SUPPORT
 	g_icmpCache = new LatencyCache(PROBE_CACHE_SIZE, PROBE_CACHE_TIMEOUT_US);
 #endif
+#ifdef MERIDIAN_DSL
+	g_programCache = new ProgramCache(DEFAULT_PROGRAM_CACHE_SIZE);
+#endif
+	pthread_mutex_init(&g_inboxLock, NULL);
+	g_inboxPipe[0] = -1;
+	g_inboxPipe[1] = -1;
+}
+
+MeridianProcess::MeridianProcess(MeridianProcess* in_owner, u_int in_index)
+		: 	g_meridPort(in_owner->g_meridPort), g_infoPort(0), 
+			g_meridSock(-1), g_infoSock(-1), g_rendvFD(-1), g_rendvListener(-1), 
+			g_rings(in_owner->g_rings), g_localAddr(in_owner->g_localAddr),
+			g_stopFD(-1), g_udpBatchSize(in_owner->g_udpBatchSize),
+			g_udpRecvCalls(0), g_udpRecvPackets(0), g_udpSendCalls(0),
+			g_udpSendPackets(0), g_probesStarted(0),
+			g_probesCoalesced(0), g_revalidatePos(0), g_usefulRingMS(-1),
+			g_numWorkers(in_owner->g_numWorkers), g_workerIndex(in_index), 
+			g_owner(in_owner), g_ringPublisher(NULL), g_ringsDirty(false),
+			g_inboxNotified(false), g_sharedCache(false), 
+			g_packetsForwarded(0)
+#ifdef MERIDIAN_DSL
+			, g_max_ttl(DEFAULT_MAX_TTL)
+			, g_programCache(NULL)
+#endif
+#ifdef PLANET_LAB_SUPPORT
+			, g_icmpSock(-1)
+#endif
+			{
+	NodeIdent dummy = {0, 0};
+	g_rendvRecvPacket = new RealPacket(dummy);
+	g_rendvNode = in_owner->g_rendvNode;
+	memcpy(g_hostname, in_owner->g_hostname, HOST_NAME_MAX);
+	gettimeofday(&g_startTime, NULL);
+	g_tcpCache = new LatencyCache(PROBE_CACHE_SIZE, PROBE_CACHE_TIMEOUT_US);
+	g_dnsCache = new LatencyCache(PROBE_CACHE_SIZE, PROBE_CACHE_TIMEOUT_US);
+	g_pingCache = new LatencyCache(PROBE_CACHE_SIZE, PROBE_CACHE_TIMEOUT_US);
+#ifdef PLANET_LAB_SUPPORT
+	g_icmpCache = new LatencyCache(PROBE_CACHE_SIZE, PROBE_CACHE_TIMEOUT_US);
+#endif
+	if (in_owner->g_sharedCache) {
+		useSharedLatencyCache();
+	}
+	pthread_mutex_init(&g_inboxLock, NULL);
+	g_inboxPipe[0] = -1;
+	g_inboxPipe[1] = -1;
 }
 		
+int MeridianProcess::useSharedLatencyCache() {
+	int retVal = 0;
+	g_sharedCache = true;
+	if (g_tcpCache->attachShared(SHARED_TCP_CACHE_NAME) == -1) {
+		WARN_LOG("Cannot share the TCP latency cache\n");
+		retVal = -1;
+	}
+	if (g_dnsCache->attachShared(SHARED_DNS_CACHE_NAME) == -1) {
+		WARN_LOG("Cannot share the DNS latency cache\n");
+		retVal = -1;
+	}
+#ifdef PLANET_LAB_SUPPORT
+	if (g_icmpCache->attachShared(SHARED_ICMP_CACHE_NAME) == -1) {
+		WARN_LOG("Cannot share the ICMP latency cache\n");
+		retVal = -1;
+	}
+#endif
+	return retVal;
+}
+
 MeridianProcess::~MeridianProcess() {
+	//	Workers must be gone before anything else is torn down
+	stopWorkers();
+	g_replacer.stop();
 	//	Delete caches
 	if (g_tcpCache) {
 		delete g_tcpCache;	
@@ -272,10 +348,13 @@ MeridianProcess::~MeridianProcess() {
 	if (g_pingCache) {
 		delete g_pingCache;	
 	}	
-	// Delete ring set
-	if (g_rings) {
+	// Delete ring set, unless it belongs to another worker
+	if (g_rings && g_owner == this) {
 		delete g_rings;	
 	}
+	if (g_ringPublisher) {
+		delete g_ringPublisher;
+	}
 	//	Cleanup sockets
 	if (g_meridSock != -1) {
 		close(g_meridSock);	
@@ -351,8 +430,9 @@ MeridianProcess::~MeridianProcess() {
 	}
 
 #ifdef MERIDIAN_DSL
-	if (g_dummySock != -1) {
-		close(g_dummySock);	
+	//	Entries still used by parser states are freed with them
+	if (g_programCache) {
+		delete g_programCache;
 	}
 #endif
 
@@ -361,7 +441,19 @@ MeridianProcess::~MeridianProcess() {
 		close(g_icmpSock);	
 	}	
 #endif
-	
+	//	Packets passed on by the other workers but never handled
+	list<WorkerMsg>::iterator inboxIt = g_inbox.begin();
+	for (; inboxIt != g_inbox.end(); inboxIt++) {
+		if (inboxIt->packet != NULL) {
+			delete inboxIt->packet;
+		}
+	}
+	for (int i = 0; i < 2; i++) {
+		if (g_inboxPipe[i] != -1) {
+			close(g_inboxPipe[i]);
+		}
+	}
+	pthread_mutex_destroy(&g_inboxLock);
 }
 
 int MeridianProcess::evaluateTimeout() {
@@ -372,7 +464,9 @@ int MeridianProcess::evaluateTimeout() {
 uint64_t MeridianProcess::getNewQueryID() {
 	uint64_t retVal;		
 	for (u_int i = 0; i < USHRT_MAX; i++) {		
-		u_short randVal = rand() % USHRT_MAX;
+		//	Random value that maps to this worker, see queryShard
+		u_short randVal = (rand() % (USHRT_MAX / g_numWorkers)) * 
+			g_numWorkers + g_workerIndex;
 		//	Concat with port
 		u_int secondParam = g_meridPort;
 		secondParam = secondParam << 16;
@@ -386,9 +480,51 @@ uint64_t MeridianProcess::getNewQueryID() {
 	}
 	//	The system seem to be processing near capcity, let's create a 
 	//	random 64 value for a query id instead, which is unluckly to collide
-	retVal = Packet::to64(rand(), rand());
+	u_short randVal = (rand() % (USHRT_MAX / g_numWorkers)) * 
+		g_numWorkers + g_workerIndex;
+	retVal = Packet::to64(rand(), (rand() & 0xffff0000) | randVal);
 	return retVal;
 }
+
+//	Key of the in flight probe registry
+static uint64_t probeKey(int probeType, const NodeIdent& target) {
+	return (((uint64_t)probeType) << 48) | (((uint64_t)target.addr) << 16) |
+		target.port;
+}
+
+int MeridianProcess::startProbe(
+		ProbeQueryGeneric* newQuery, uint64_t in_subscriber) {
+	uint64_t key = probeKey(newQuery->getProbeType(), newQuery->getRemoteNode());
+	map<uint64_t, uint64_t>::iterator it = g_inflightProbes.find(key);
+	if (it != g_inflightProbes.end()) {
+		ProbeQueryGeneric* curProbe = dynamic_cast<ProbeQueryGeneric*>(
+			g_queryTable.getQuery(it->second));
+		if (curProbe != NULL && !(curProbe->isFinished())) {
+			delete newQuery;
+			g_probesCoalesced++;
+			return curProbe->subscribeLatency(in_subscriber);
+		}
+		g_inflightProbes.erase(it);	// Stale, should not happen
+	}
+	if (g_queryTable.insertNewQuery(newQuery) == -1) {
+		delete newQuery;
+		return -1;
+	}
+	g_inflightProbes[key] = newQuery->getQueryID();
+	g_probesStarted++;
+	newQuery->subscribeLatency(in_subscriber);
+	newQuery->init();
+	return 0;
+}
+
+void MeridianProcess::probeFinished(const ProbeQueryGeneric* in_probe) {
+	map<uint64_t, uint64_t>::iterator it = g_inflightProbes.find(
+		probeKey(in_probe->getProbeType(), in_probe->getRemoteNode()));
+	//	Only remove the entry if it belongs to this probe
+	if (it != g_inflightProbes.end() && it->second == in_probe->getQueryID()) {
+		g_inflightProbes.erase(it);
+	}
+}
 	
 int MeridianProcess::addNodeToRing(const NodeIdentRendv& in_remote) {
 	//	To avoid rapid pinging of a node, we skip ping nodes that
@@ -425,6 +561,41 @@ int MeridianProcess::performGossip() {
 	return 0;
 }
 
+int MeridianProcess::saveSnapshot() {
+	if (g_snapshotFile.empty()) {
+		return 0;
+	}
+	LatencyCache* caches[] = {g_tcpCache, g_dnsCache, g_pingCache,
+#ifdef PLANET_LAB_SUPPORT
+		g_icmpCache
+#else
+		NULL
+#endif
+	};
+	vector<char> buf;
+	Snapshot::encode(g_rings, caches, sizeof(caches) / sizeof(LatencyCache*),
+		&buf);
+	if (g_snapshotWriter.isRunning()) {
+		return g_snapshotWriter.submit(buf);
+	}
+	return Snapshot::write(g_snapshotFile.c_str(), buf);
+}
+
+int MeridianProcess::performRevalidation() {
+	for (u_int i = 0; i < REVALIDATE_BATCH && 
+			g_revalidatePos < g_revalidateNodes.size(); i++) {
+		addNodeToRing(g_revalidateNodes[g_revalidatePos++]);
+	}
+	if (g_revalidatePos == g_revalidateNodes.size() && 
+			!g_revalidateNodes.empty()) {
+		WARN_LOG_1("Revalidated %d restored ring members\n", 
+			(int)g_revalidateNodes.size());
+		g_revalidateNodes.clear();
+		g_revalidatePos = 0;
+	}
+	return g_revalidateNodes.size() - g_revalidatePos;
+}
+
 int MeridianProcess::performRingManagement() {
 	//	Find all full rings
 	int numRings = g_rings->getNumberOfRings();
@@ -435,6 +606,9 @@ int MeridianProcess::performRingManagement() {
 			eligibleRings.push_back(i);
 		}
 	}
+	//	Testing may have swapped members between the primary and secondary
+	//	ring
+	ringsChanged();
 	if (eligibleRings.empty()) {
 		return 0;	
 	}
@@ -449,32 +623,220 @@ int MeridianProcess::performRingManagement() {
 	return 0;	
 }
 
+int MeridianProcess::submitReplacement(ReplaceJob* job) {
+	g_rings->freezeRing(job->ringNum);
+	if (g_replacer.submit(job) == -1) {
+		job->status = job->run();
+		applyReplacement(job);
+	}
+	return 0;
+}
+
+void MeridianProcess::applyReplacement(ReplaceJob* job) {
+	g_rings->unfreezeRing(job->ringNum);
+	int setRet = -1;
+	if (job->status != -1) {
+		setRet = g_rings->setRingMembers(
+			job->ringNum, job->primNodes, job->removedNodes);
+		ringsChanged();
+	}
+	if (job->status == -1) {
+		WARN_LOG("!!!!!!!!!!!! RING REPLACEMENT SEARCH FAILED !!!!!!!!\n");
+		g_ringMatrices[job->ringNum].setChanged();	// Retry next round
+	} else if (setRet == -1) {
+		WARN_LOG("!!!!!!!!!!!! RING REPLACEMENT UNSUCCESSFUL !!!!!!!!\n");
+		g_ringMatrices[job->ringNum].setChanged();
+	} else {
+		WARN_LOG_1("@@@@@@@@@@@ Max hypervolume is %0.2f @@@@@@@@@@@@\n", 
+			job->hyperVolume);
+		WARN_LOG("************ RING REPLACEMENT SUCCESSFUL **********\n");
+	}
+	delete job;
+}
+
+int MeridianProcess::ringInsertNode(const NodeIdent& inNode, 
+		u_int latencyUS, const NodeIdent& rendvNode) {
+	if (!isRingOwner()) {
+		WorkerMsg msg = 
+			{WORKER_MSG_RING_INSERT, inNode, rendvNode, latencyUS, NULL};
+		return postToWorker(0, msg);
+	}
+	int retVal = g_rings->insertNode(inNode, latencyUS, rendvNode);
+	ringsChanged();
+	return retVal;
+}
+
+int MeridianProcess::ringEraseNode(const NodeIdent& inNode) {
+	if (!isRingOwner()) {
+		NodeIdent dummy = {0, 0};
+		WorkerMsg msg = {WORKER_MSG_RING_ERASE, inNode, dummy, 0, NULL};
+		return postToWorker(0, msg);
+	}
+	int retVal = g_rings->eraseNode(inNode);
+	ringsChanged();
+	return retVal;
+}
+
+u_int MeridianProcess::packetOwner(char queryType, uint64_t queryID) const {
+	switch (queryType) {
+		case PING:
+			return g_workerIndex;	// Stateless, answer right here
+		//	Node wide state, see g_workers
+		case PUSH:
+		case GOSSIP:
+		case GOSSIP_PULL:
+#ifdef MERIDIAN_DSL
+		case DSL_REQUEST:
+#endif
+#ifdef PLANET_LAB_SUPPORT
+		case REQ_CONSTRAINT_N_ICMP:
+		case REQ_CLOSEST_N_ICMP:
+		case REQ_MEASURE_N_ICMP:
+#endif
+			return 0;
+		default:
+			return queryShard(queryID);
+	}
+}
+
+int MeridianProcess::postToWorker(u_int in_index, const WorkerMsg& msg) {
+	MeridianProcess* target = g_owner->g_workers[in_index];
+	pthread_mutex_lock(&(target->g_inboxLock));
+	target->g_inbox.push_back(msg);
+	if (!(target->g_inboxNotified)) {
+		char wakeByte = 0;
+		if (write(target->g_inboxPipe[1], &wakeByte, sizeof(char)) == 1) {
+			target->g_inboxNotified = true;
+		}
+	}
+	pthread_mutex_unlock(&(target->g_inboxLock));
+	return 0;
+}
+
+int MeridianProcess::handleInbox() {
+	list<WorkerMsg> msgs;
+	pthread_mutex_lock(&g_inboxLock);
+	msgs.swap(g_inbox);
+	//	Drain the pipe under the lock, so that the next post writes again
+	char drainBuf[64];
+	while (read(g_inboxPipe[0], drainBuf, sizeof(drainBuf)) > 0) {}
+	g_inboxNotified = false;
+	pthread_mutex_unlock(&g_inboxLock);
+	int retVal = 0;
+	list<WorkerMsg>::iterator it = msgs.begin();
+	for (; it != msgs.end(); it++) {
+		switch (it->type) {
+			case WORKER_MSG_PACKET: {
+					handleNewPacket(it->packet->getPayLoad(), 
+						it->packet->getPayLoadSize(), it->remoteNode);
+					delete it->packet;
+				} break;
+			case WORKER_MSG_RING_INSERT: {
+					ringInsertNode(
+						it->remoteNode, it->latencyUS, it->rendvNode);
+				} break;
+			case WORKER_MSG_RING_ERASE: {
+					ringEraseNode(it->remoteNode);
+				} break;
+			case WORKER_MSG_STOP: {
+					retVal = -1;	// Finish the rest first
+				} break;
+			default:
+				break;
+		}
+	}
+	return retVal;
+}
+
 int MeridianProcess::addOutPacket(RealPacket* in_packet) {
 	g_outPacketList.push_back(in_packet);
-	FD_SET(g_meridSock, &g_writeSet);
-	g_maxFD = MAX(g_meridSock, g_maxFD); 
+	g_events.addEvents(g_meridSock, EVENT_WRITE);
 	return 0;
 }
 
 void MeridianProcess::writePending() {
-	while (true) {
-		assert(!(g_outPacketList.empty()));
-		RealPacket* firstPacket = g_outPacketList.front();
-		if (performSend(g_meridSock, firstPacket) == -1) {
+	while (!(g_outPacketList.empty())) {
+		//	Gather up to g_udpBatchSize packets into one sendmmsg
+		u_int numMsgs = 0;
+		list<RealPacket*>::iterator it = g_outPacketList.begin();
+		while (it != g_outPacketList.end() && numMsgs < g_udpBatchSize) {
+			RealPacket* curPacket = *it;
+			struct sockaddr_in* hostAddr = &(g_sendAddrs[numMsgs]);
+			struct iovec* curIOV = &(g_sendIOV[numMsgs * 2]);
+			// Handle firewall host by prepending a PUSH header
+			if (curPacket->getRendvAddr() != 0 || 
+					curPacket->getRendvPort() != 0) {
+				if (preparePush(curPacket, 
+						&(g_pushHeaders[numMsgs * PUSH_HEADER_SIZE]),
+						curIOV, hostAddr) == -1) {
+					//	Can never be sent, just remove it
+					it = g_outPacketList.erase(it);
+					delete curPacket;
+					continue;
+				}
+				g_sendMsgs[numMsgs].msg_hdr.msg_iovlen = 2;
+			} else {
+				hostAddr->sin_family         = AF_INET;
+				hostAddr->sin_port           = htons(curPacket->getPort());
+				hostAddr->sin_addr.s_addr    = htonl(curPacket->getAddr());
+				memset(&(hostAddr->sin_zero), '\0', 8);
+				curIOV[0].iov_base = curPacket->getPayLoad();
+				curIOV[0].iov_len = curPacket->getPayLoadSize();
+				g_sendMsgs[numMsgs].msg_hdr.msg_iovlen = 1;
+			}
+			numMsgs++;
+			it++;
+		}
+		int sendRet = 0;
+		if (numMsgs > 0) {
+			sendRet = sendmmsg(g_meridSock, &(g_sendMsgs[0]), numMsgs, 0);
+			g_udpSendCalls++;
+		}
+		if (sendRet == -1) {
 			if (errno == EAGAIN || errno == EWOULDBLOCK) {									
 				break; // Retry again later when ready to send
-			} else {
-				//	Let's just continute still, but remove this packet
-				ERROR_LOG("Error calling send\n");	
 			}
-		}		
-		g_outPacketList.pop_front();
-		delete firstPacket;	// Done with packet
-		if (g_outPacketList.empty()) {
-			FD_CLR(g_meridSock, &g_writeSet);
-			break;	// No more to send
+			//	Let's just continute still, but remove this packet
+			ERROR_LOG("Error calling send\n");	
+			sendRet = 1;
+		} else {
+			g_udpSendPackets += sendRet;
+		}
+		//	Remove the packets that were sent. If not all of them were, the
+		//	next call reports why
+		for (int i = 0; i < sendRet; i++) {
+			RealPacket* firstPacket = g_outPacketList.front();
+			g_outPacketList.pop_front();
+			delete firstPacket;	// Done with packet
 		}
 	}
+	if (g_outPacketList.empty()) {
+		g_events.clearEvents(g_meridSock, EVENT_WRITE);
+	}
+}
+
+int MeridianProcess::preparePush(const RealPacket* in_packet, char* header, 
+		struct iovec* iov, struct sockaddr_in* rendvAddr) {
+#ifdef DEBUG		
+	u_int netAddr = htonl(in_packet->getRendvAddr());		
+	char* ringNodeStr = inet_ntoa(*(struct in_addr*)&(netAddr));		
+	WARN_LOG_2("Redirecting to rendavous node, %s:%d\n", ringNodeStr, 
+		in_packet->getRendvPort());
+#endif			
+	if (in_packet->getPayLoadSize() + PUSH_HEADER_SIZE > MAX_UDP_PACKET_SIZE) {
+		ERROR_LOG("Cannot create PUSH packet\n");
+		return -1;
+	}
+	PushPacket::writeHeader(header, in_packet->getAddr(), in_packet->getPort());
+	iov[0].iov_base = header;
+	iov[0].iov_len = PUSH_HEADER_SIZE;
+	iov[1].iov_base = in_packet->getPayLoad();
+	iov[1].iov_len = in_packet->getPayLoadSize();
+	rendvAddr->sin_family		= AF_INET;
+	rendvAddr->sin_port			= htons(in_packet->getRendvPort());
+	rendvAddr->sin_addr.s_addr	= htonl(in_packet->getRendvAddr());
+	memset(&(rendvAddr->sin_zero), '\0', 8);
+	return 0;
 }
 
 int MeridianProcess::performSend(int sock, RealPacket* in_packet) {
@@ -485,30 +847,21 @@ int MeridianProcess::performSend(int sock, RealPacket* in_packet) {
 		ringNodeStr, in_packet->getPort(), in_packet->getPayLoadSize());
 #endif		
 
-	// Handle firewall host by wrapping it around a PUSH packet
+	// Handle firewall host by prepending a PUSH header
 	if (in_packet->getRendvAddr() != 0 || in_packet->getRendvPort() != 0) {
-#ifdef DEBUG		
-		u_int netAddr = htonl(in_packet->getRendvAddr());		
-		char* ringNodeStr = inet_ntoa(*(struct in_addr*)&(netAddr));		
-		WARN_LOG_2("Redirecting to rendavous node, %s:%d\n", ringNodeStr, 
-			in_packet->getRendvPort());
-#endif			
-		//	QID for push packet should never be used, just set it to 0
-		PushPacket pushPacket(0, in_packet->getAddr(), in_packet->getPort());
-		NodeIdent rendvNode 
-			= {in_packet->getRendvAddr(), in_packet->getRendvPort()};
-		//	This packet MUST not have a rendavous host
-		RealPacket tmpPacket(rendvNode);
-		if (pushPacket.createRealPacket(tmpPacket) == -1) {
-			ERROR_LOG("Cannot create PUSH packet\n");
-			return -1;
-		}
-		tmpPacket.append_packet(*in_packet);
-		if (!(tmpPacket.completeOkay())) {			
-			ERROR_LOG("Cannot create PUSH packet\n");
+		char header[PUSH_HEADER_SIZE];
+		struct iovec iov[2];
+		struct sockaddr_in rendvAddr;
+		if (preparePush(in_packet, header, iov, &rendvAddr) == -1) {
 			return -1;
 		}
-		return performSend(sock, &tmpPacket);
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(struct msghdr));
+		msg.msg_name = &rendvAddr;
+		msg.msg_namelen = sizeof(struct sockaddr_in);
+		msg.msg_iov = iov;
+		msg.msg_iovlen = 2;
+		return sendmsg(sock, &msg, 0);
 	}				
 	struct sockaddr_in hostAddr;
 	//memset(&(hostAddr), '\0', sizeof(struct sockaddr_in));
@@ -523,20 +876,35 @@ int MeridianProcess::performSend(int sock, RealPacket* in_packet) {
 }
 
 int MeridianProcess::readPacket() {
-	char buf[MAX_UDP_PACKET_SIZE];
-	struct sockaddr_in theirAddr;
-	int addrLen = sizeof(struct sockaddr);
-	//	Perform actual recv on socket
-	int numBytes = recvfrom(g_meridSock, buf, MAX_UDP_PACKET_SIZE, 0,
-		(struct sockaddr*)&theirAddr, (socklen_t*)&addrLen);		
-	if (numBytes == -1) {
-		perror("Error on recvfrom");
-		return -1;		
+	//	Drain the socket, as the event set may only report it once
+	while (true) {
+		for (u_int i = 0; i < g_udpBatchSize; i++) {
+			//	Reset by the kernel on every call
+			g_recvMsgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+		}
+		int numMsgs = recvmmsg(g_meridSock, &(g_recvMsgs[0]), 
+			g_udpBatchSize, 0, NULL);
+		if (numMsgs == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return 0;	// Nothing more to read
+			}
+			perror("Error on recvmmsg");
+			return -1;		
+		}
+		g_udpRecvCalls++;
+		g_udpRecvPackets += numMsgs;
+		for (int i = 0; i < numMsgs; i++) {
+			NodeIdent remoteNode = {ntohl(g_recvAddrs[i].sin_addr.s_addr), 
+									ntohs(g_recvAddrs[i].sin_port) };
+			handleNewPacket((char*)(g_recvMsgs[i].msg_hdr.msg_iov->iov_base), 
+				g_recvMsgs[i].msg_len, remoteNode);
+		}
+		//	A short batch means the queue was empty, and any packet arriving
+		//	after it raises a new event
+		if ((u_int)numMsgs < g_udpBatchSize) {
+			return 0;
+		}
 	}
-	NodeIdent remoteNode = {ntohl(theirAddr.sin_addr.s_addr), 
-							ntohs(theirAddr.sin_port) };
-							
-	return handleNewPacket(buf, numBytes, remoteNode);
 }
 
 int MeridianProcess::handleNewPacket(
@@ -544,6 +912,34 @@ int MeridianProcess::handleNewPacket(
 	BufferWrapper rb(buf, numBytes);		
 	char queryType;	uint64_t queryID;
 	if (Packet::parseHeader(rb, &queryType, &queryID) != -1) {
+		if (g_numWorkers > 1) {
+			u_int ownerIndex = packetOwner(queryType, queryID);
+			if (ownerIndex != g_workerIndex) {
+				//	The receive buffer is reused, pass on a copy
+				NodeIdent dummy = {0, 0};
+				RealPacket* inPacket = new RealPacket(dummy);
+				if (numBytes > inPacket->getPacketSize()) {
+					delete inPacket;
+					return -1;
+				}
+				memcpy(inPacket->getPayLoad(), buf, numBytes);
+				inPacket->setPayLoadSize(numBytes);
+				WorkerMsg msg = 
+					{WORKER_MSG_PACKET, remoteNode, dummy, 0, inPacket};
+				g_packetsForwarded++;
+				return postToWorker(ownerIndex, msg);
+			}
+		}
+		//	Anyone sending v2 can receive it. PING and PONG say explicitly
+		//	which version the peer speaks, so a downgraded peer is noticed
+		if (queryType == PING || queryType == PONG) {
+			PeerWireVersion::set(remoteNode, 
+				Packet::parseWireCaps(buf, numBytes));
+		} else if (Packet::isWireV2(buf[0]) && 
+				PeerWireVersion::get(remoteNode.addr, remoteNode.port) 
+					< WIRE_VERSION_2) {
+			PeerWireVersion::set(remoteNode, WIRE_VERSION_2);
+		}
 		switch (queryType) {
 			case PUSH: {
 					RealPacket* inPacket 
@@ -572,8 +968,7 @@ int MeridianProcess::handleNewPacket(
 						} else {
 							//	Push it into queue and then on fd in writeSet
 							rendvQIt->second->push_back(inPacket);
-							FD_SET(rendvQIt->first, &g_writeSet);
-							g_maxFD = MAX(rendvQIt->first, g_maxFD);
+							g_events.addEvents(rendvQIt->first, EVENT_WRITE);
 						}
 					}					
 				} break;
@@ -595,33 +990,25 @@ int MeridianProcess::handleNewPacket(
 						WARN_LOG("Received a GOSSIP_PULL packet\n");
 					}
 #endif
-					GossipPacketGeneric* tmp = NULL;
-					if (queryType == GOSSIP) {					
-						tmp = GossipPacketGeneric::
-							parse<GossipPacketPush>(buf, numBytes);
-					} else {
-						tmp = GossipPacketGeneric::
-							parse<GossipPacketPull>(buf, numBytes);
-					}
-					if (tmp != NULL) {
+					GossipView tmp;
+					if (tmp.init(queryType, buf, numBytes) != -1) {
 						//	Add remote node to ring
 						NodeIdentRendv remoteNodeRendv = { 
 							remoteNode.addr, remoteNode.port, 
-							tmp->getRendvAddr(), tmp->getRendvPort() };
+							tmp.getRendvAddr(), tmp.getRendvPort() };
 #ifdef DEBUG							
-						u_int netAddr = htonl(tmp->getRendvAddr());
+						u_int netAddr = htonl(tmp.getRendvAddr());
 						char* ringNodeStr = 
 							inet_ntoa(*(struct in_addr*)&(netAddr));
 						WARN_LOG_2("Rendv in GOSSIP packet is %s:%d\n", 
-							ringNodeStr, tmp->getRendvPort());
+							ringNodeStr, tmp.getRendvPort());
 #endif							
 						addNodeToRing(remoteNodeRendv);
 						// 	Add nodes in gossip packet to ring						
-						const vector<NodeIdentRendv>* tmpVect 
-							= tmp->returnTargets();
-						for (u_int i = 0; i < tmpVect->size(); i++) {
-							//NodeIdentRendv tmpRendv = (*tmpVect)[i];
-							addNodeToRing((*tmpVect)[i]);
+						NodeListCursor cursor(tmp.getTargets());
+						NodeIdentRendv tmpRendv;
+						while (cursor.next(&tmpRendv)) {
+							addNodeToRing(tmpRendv);
 						}
 #ifdef GOSSIP_PUSHPULL
 						if (queryType == GOSSIP) {
@@ -632,6 +1019,8 @@ int MeridianProcess::handleNewPacket(
 								WARN_LOG("Creating GOSSIP_PULL ###########\n");
 								RealPacket* inPacket = 
 									new RealPacket(remoteNodeRendv);
+								inPacket->setWireVersion(PeerWireVersion::get(
+									remoteNode.addr, remoteNode.port));
 								if (gPacket.createRealPacket(*inPacket) == -1) {
 									delete inPacket;	
 								} else {
@@ -640,7 +1029,6 @@ int MeridianProcess::handleNewPacket(
 							}
 						}
 #endif						
-						delete tmp;	// Finished with gossip packet
 					}					
 				} break;
 #ifdef PLANET_LAB_SUPPORT				
@@ -727,7 +1115,8 @@ int MeridianProcess::handleNewPacket(
 						queryID, remoteNode, buf, numBytes);					
 				} break;
 #ifdef MERIDIAN_DSL
-			case DSL_REPLY: {
+			case DSL_REPLY: 
+			case DSL_PROGRAM_MISS: {
 					g_queryTable.notifyQPacket(
 						queryID, remoteNode, buf, numBytes);
 				} break;
@@ -756,19 +1145,36 @@ int MeridianProcess::handleNewPacket(
 						delete new_state;
 						break;						
 					}					
-					g_parser_line = 1;	// Reset line count for parser
-					if (yyparse((void*)new_state) == -1) {
+					//	Parses the program unless it is cached
+					if (g_programCache->attach(new_state) == -1) {
+						if (new_state->by_hash()) {
+							//	Evicted, ask for the text
+							DSLProgramMissPacket missPacket(prevID);
+							RealPacket* outPacket 
+								= new RealPacket(remoteNodeRendv);
+							if (missPacket.createRealPacket(*outPacket) 
+									== -1) {
+								delete outPacket;
+							} else {
+								addOutPacket(outPacket);
+							}
+						}
 						delete new_state;
 						break;	// Parse error
 					}
-					if (new_state->save_context() == -1) {
+					if (new_state->save_context(&jmp_eval) == -1) {
 						delete new_state;
 						break;	// Error saving context
 					}					
-					makecontext(new_state->get_context(), 
-						(void (*)())(&jmp_eval), 1, new_state);
+					//	Only ring members get the high class. The TTL is
+					//	chosen by the sender and cannot be trusted for this
+					u_int memberUS;
+					int prio = (g_rings->getNodeLatency(
+						remoteNode, &memberUS) == 0) ? 
+							DSL_PRIO_HIGH : DSL_PRIO_NORMAL;
 					DSLRecvQuery* newQ = new DSLRecvQuery(new_state, 
-						this, remoteNodeRendv, prevID, q_timeout, q_ttl);
+						this, remoteNodeRendv, prevID, q_timeout, q_ttl,
+						prio);
 					if (newQ == NULL) {
 						delete new_state;
 						break; // Error creating new Query						
@@ -781,9 +1187,7 @@ int MeridianProcess::handleNewPacket(
 						delete newQ;	// State is deleted with newQ
 					} else {
 						newQ->init();
-						g_psList.push_back(newQ->getQueryID());
-						FD_SET(g_dummySock, &g_writeSet);
-						g_maxFD = MAX(g_dummySock, g_maxFD);
+						addPS(newQ->getQueryID());
 					}			
 				} break;
 #endif
@@ -835,6 +1239,74 @@ int MeridianProcess::getInfoPacket(RealPacket& inPacket) {
 		}
 	}	
 	pos += snprintf(buf + pos, packetSize - pos, "</TBODY>\n</TABLE>\n");
+	pos += snprintf(buf + pos, packetSize - pos,
+		"<BR>UDP packets per system call: %0.2f received, %0.2f sent\n",
+		recvPacketsPerCall(), sendPacketsPerCall());
+	if (!(g_workers.empty())) {
+		uint64_t packetsForwarded = 0;
+		for (u_int i = 0; i < g_workers.size(); i++) {
+			packetsForwarded += g_workers[i]->g_packetsForwarded;
+		}
+		pos += snprintf(buf + pos, packetSize - pos,
+			"<BR>Workers: %u, packets passed between workers: %llu\n",
+			(u_int)g_workers.size(), (unsigned long long)packetsForwarded);
+		pos += snprintf(buf + pos, packetSize - pos,
+			"<BR>Rings published: %llu, copies awaiting readers: %u\n",
+			(unsigned long long)g_ringPublisher->getVersion(),
+			g_ringPublisher->getNumRetired());
+	}
+	if (g_usefulRingMS != -1) {
+		pos += snprintf(buf + pos, packetSize - pos,
+			"<BR>Time to first ring member: %d ms\n", g_usefulRingMS);
+	}
+	uint64_t pairsRequested = 0, pairsReused = 0;
+	for (u_int i = 0; i < g_ringMatrices.size(); i++) {
+		pairsRequested += g_ringMatrices[i].getNumRequested();
+		pairsReused += g_ringMatrices[i].getNumReused();
+	}
+	pos += snprintf(buf + pos, packetSize - pos,
+		"<BR>Ring member pairs: %llu measured, %llu reused\n",
+		(unsigned long long)pairsRequested, (unsigned long long)pairsReused);
+	pos += snprintf(buf + pos, packetSize - pos,
+		"<BR>Peers using wire format v2: %u\n", PeerWireVersion::numPeers());
+	pos += snprintf(buf + pos, packetSize - pos,
+		"<BR>Probes: %llu started, %llu coalesced (%0.1f%%)\n",
+		(unsigned long long)g_probesStarted,
+		(unsigned long long)g_probesCoalesced,
+		probeCoalescingRate() * 100.0);
+	pos += snprintf(buf + pos, packetSize - pos,
+		"<BR>Query pool: %llu hits, %llu misses\n",
+		(unsigned long long)Query::pool()->getNumHits(),
+		(unsigned long long)Query::pool()->getNumMisses());
+	pos += snprintf(buf + pos, packetSize - pos,
+		"<BR>Packet buffer pool: %llu hits, %llu misses\n",
+		(unsigned long long)RealPacket::payLoadPool()->getNumHits(),
+		(unsigned long long)RealPacket::payLoadPool()->getNumMisses());
+#ifdef MERIDIAN_DSL
+	pos += snprintf(buf + pos, packetSize - pos,
+		"<BR>DSL programs cached: %u (%u KB), %u hits, %u misses, "
+		"%u evicted\n", g_programCache->getNumPrograms(),
+		g_programCache->getMemUsed() / 1024, g_programCache->getNumHits(),
+		g_programCache->getNumMisses(), g_programCache->getNumEvictions());
+	pos += snprintf(buf + pos, packetSize - pos,
+		"<BR>DSL threads: %u runnable, %llu slices, %llu demoted, CPU ms "
+		"%0.1f high, %0.1f normal, %0.1f low\n", 
+		g_dslScheduler.getNumRunnable(), 
+		(unsigned long long)g_dslScheduler.getNumSlices(),
+		(unsigned long long)g_dslScheduler.getNumDemoted(),
+		g_dslScheduler.getClassNS(DSL_PRIO_HIGH) / 1000000.0,
+		g_dslScheduler.getClassNS(DSL_PRIO_NORMAL) / 1000000.0,
+		g_dslScheduler.getClassNS(DSL_PRIO_LOW) / 1000000.0);
+	FiberStackPool* stackPool = FiberStackPool::pool();
+	pos += snprintf(buf + pos, packetSize - pos,
+		"<BR>DSL thread stacks: %u in use, %u pooled, deepest use %u of "
+		"%u KB\n", stackPool->getNumInUse(), stackPool->getNumFree(),
+		(u_int)(stackPool->getHighWater() / 1024), FIBER_STACK / 1024);
+	pos += snprintf(buf + pos, packetSize - pos,
+		"<BR>DSL arena chunks: %u in use, %u pooled, %u KB each\n",
+		MQLArena::getNumInUse(), MQLArena::getNumFree(), 
+		MQL_ARENA_CHUNK / 1024);
+#endif
 	gettimeofday(&tvEnd, NULL);
 	pos += snprintf(buf + pos, packetSize - pos,
 		"<BR>Time to create this page is %0.2f ms\n",
@@ -849,95 +1321,111 @@ int MeridianProcess::getInfoPacket(RealPacket& inPacket) {
 	return 0;
 }
 
-int MeridianProcess::handleInfoConnections(
-		fd_set* curReadSet, fd_set* curWriteSet) {			
-	if (g_infoSock == -1) {
-		return 0;	// Info service not started, just exit function
-	}
-	u_int numConnections = 0;	// Keep a counter of the number of live
-								// connections in order to put a upper bound
-								
-	// Handle existing requests
-	vector<list<pair<int, RealPacket*>*>::iterator> deleteVector;	
+int MeridianProcess::eraseInfoConnection(
+		const list<pair<int, RealPacket*>*>::iterator& conIt) {
+	pair<int, RealPacket*>* curPair = *conIt;
+	g_infoConnects.erase(conIt);
+	g_events.removeFD(curPair->first);
+	close(curPair->first);		
+	delete curPair->second;
+	delete curPair;
+	return 0;
+}
+
+int MeridianProcess::handleInfoConnection(int fd, u_int events) {
+	//	There are at most MAX_INFO_CONNECTIONS entries, just search the list
 	list<pair<int, RealPacket*>*>::iterator conIt = g_infoConnects.begin();
 	for (; conIt != g_infoConnects.end(); conIt++) {
-		numConnections++;
-		if (FD_ISSET((*conIt)->first, curReadSet)) {
-			int recvRet = 
-				recv((*conIt)->first, g_webDrainBuf, DRAIN_BUFFER_SIZE, 0);				
-			if (recvRet == -1 || recvRet == 0) {				
-				deleteVector.push_back(conIt);	// Error reading				
-			} else {
-				//	HACK: If the received first character is M, then return
-				//	a binary packet with info instead of a formatted string					
-				if (g_webDrainBuf[0] == 'M') {
-					// Fill using info packet
-					InfoPacket tmpInfo(0, getRings());
-					if (tmpInfo.createRealPacket(*((*conIt)->second)) == -1) {
-						deleteVector.push_back(conIt);
-						continue;
-					}
-				} else {
-					//	Fill a formatted output
-					if (getInfoPacket(*((*conIt)->second)) == -1) {
-						deleteVector.push_back(conIt);
-						continue;
-					}	
-				}
-				FD_CLR((*conIt)->first, &g_readSet);
-				FD_SET((*conIt)->first, &g_writeSet);
+		if ((*conIt)->first == fd) {
+			break;
+		}
+	}
+	if (conIt == g_infoConnects.end()) {
+		return 0;	// Already removed
+	}
+	if (events & EVENT_READ) {
+		int recvRet = recv(fd, g_webDrainBuf, DRAIN_BUFFER_SIZE, 0);
+		if (recvRet == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return 0;	// Nothing to read after all
+		}
+		if (recvRet == -1 || recvRet == 0) {				
+			return eraseInfoConnection(conIt);	// Error reading
+		}
+		//	HACK: If the received first character is M, then return
+		//	a binary packet with info instead of a formatted string.
+		//	"M2" asks for the v2 encoding					
+		if (g_webDrainBuf[0] == 'M') {
+			// Fill using info packet
+			InfoPacket tmpInfo(0, getRings());
+			(*conIt)->second->setWireVersion(
+				(recvRet > 1 && g_webDrainBuf[1] == '2') ? 
+					WIRE_VERSION_2 : WIRE_VERSION_1);
+			if (tmpInfo.createRealPacket(*((*conIt)->second)) == -1) {
+				return eraseInfoConnection(conIt);
 			}
-		} else if (FD_ISSET((*conIt)->first, curWriteSet)) {
-			//	Write out the info to the browser
-			RealPacket* curPacket = (*conIt)->second; 
-			int sendRet = send((*conIt)->first, 
+		} else {
+			//	Fill a formatted output
+			if (getInfoPacket(*((*conIt)->second)) == -1) {
+				return eraseInfoConnection(conIt);
+			}	
+		}
+		g_events.clearEvents(fd, EVENT_READ);
+		g_events.addEvents(fd, EVENT_WRITE);
+	} else if (events & EVENT_WRITE) {
+		//	Write out the info to the browser until done or the socket
+		//	buffer is full
+		RealPacket* curPacket = (*conIt)->second; 
+		while (true) {
+			int sendRet = send(fd, 
 				curPacket->getPayLoad() + curPacket->getPos(), 
 				curPacket->getPayLoadSize() - curPacket->getPos(), 0);
+			if (sendRet == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				break;	// Wait until writeable again
+			}
 			if (sendRet == -1 || 
 				sendRet == curPacket->getPayLoadSize() - curPacket->getPos()) {	
-				deleteVector.push_back(conIt);
-			} else {
-				curPacket->incrPos(sendRet);
+				return eraseInfoConnection(conIt);
 			}
+			curPacket->incrPos(sendRet);
 		}
 	}
-	//	Check for new requests
-	if (FD_ISSET(g_infoSock, curReadSet)) {	
+	return 0;
+}
+
+int MeridianProcess::handleInfoListener() {
+	//	Accept all pending connections
+	while (true) {
 		struct sockaddr_in tmpAddr;
 		int sinSize = sizeof(struct sockaddr_in);
 		int infoSock = accept(g_infoSock,
 			(struct sockaddr*)&tmpAddr, (socklen_t*)&sinSize);
-		if (infoSock != -1) {			
-			NodeIdent remoteNode = {ntohl(tmpAddr.sin_addr.s_addr), 
-									ntohs(tmpAddr.sin_port) };									
-			RealPacket* inPacket = 
-				new RealPacket(remoteNode, MAX_INFO_PACKET_SIZE);
-			if (inPacket != NULL) {
-				g_infoConnects.push_back(
-					new pair<int, RealPacket*>(infoSock, inPacket));
-				numConnections++;					
-				//	Only allow MAX_INFO_CONNECTIONS simultaneous connections
-				if (numConnections > 
-						(MAX_INFO_CONNECTIONS + deleteVector.size())) {
-					deleteVector.push_back(g_infoConnects.begin());				
-				}
-				FD_SET(infoSock, &g_readSet);
-				g_maxFD = MAX(g_maxFD, infoSock);
-			} else {
-				ERROR_LOG("Cannot create RealPacket\n");
-				close(infoSock);	
-			}
+		if (infoSock == -1) {
+			break;
+		}
+		if (setNonBlock(infoSock) == -1) {
+			close(infoSock);
+			continue;
+		}
+		NodeIdent remoteNode = {ntohl(tmpAddr.sin_addr.s_addr), 
+								ntohs(tmpAddr.sin_port) };									
+		RealPacket* inPacket = 
+			new RealPacket(remoteNode, MAX_INFO_PACKET_SIZE);
+		if (inPacket == NULL) {
+			ERROR_LOG("Cannot create RealPacket\n");
+			close(infoSock);	
+			continue;
+		}
+		if (g_events.addFD(infoSock, FD_OWNER_INFO, EVENT_READ) == -1) {
+			delete inPacket;
+			close(infoSock);
+			continue;
+		}
+		g_infoConnects.push_back(
+			new pair<int, RealPacket*>(infoSock, inPacket));
+		//	Only allow MAX_INFO_CONNECTIONS simultaneous connections
+		if (g_infoConnects.size() > MAX_INFO_CONNECTIONS) {
+			eraseInfoConnection(g_infoConnects.begin());				
 		}
-	}	
-	//	Cleanup all finished connections
-	for (u_int i = 0; i < deleteVector.size(); i++) {
-		pair<int, RealPacket*>* curPair = *(deleteVector[i]);
-		g_infoConnects.erase(deleteVector[i]);
-		FD_CLR(curPair->first, &g_readSet);				
-		FD_CLR(curPair->first, &g_writeSet);
-		close(curPair->first);		
-		delete curPair->second;
-		delete curPair;
 	}
 	return 0;
 }
@@ -957,23 +1445,25 @@ int MeridianProcess::increaseSockBuf(int sock) {
 	return 0;
 }
 	
-int MeridianProcess::start() {
-	signal(SIGPIPE, SIG_IGN);	// Ignore sigpipe		
-	srand(time(NULL));	// Set random seed
-	gethostname(g_hostname, HOST_NAME_MAX);	//	Get the host name of this node
-	g_hostname[HOST_NAME_MAX - 1] = '\0';
-	struct hostent* he = gethostbyname(g_hostname);
-	if (he == NULL) {
-		perror("Cannot resolve localhost\n");
-		return -1;
-	}
-	g_localAddr = ntohl(((struct in_addr *)(he->h_addr))->s_addr);
+int MeridianProcess::openMeridSocket() {
 	//	Main meridian UDP socket
 	if ((g_meridSock = socket(AF_INET, SOCK_DGRAM, 0)) == -1) {
 		perror("Cannot create UDP socket");			
 		return -1;
 	}
 	increaseSockBuf(g_meridSock);	
+#ifdef SO_REUSEPORT
+	//	Every worker binds its own socket to the port, the kernel spreads
+	//	the incoming packets over them by source address
+	if (g_numWorkers > 1) {
+		int reuseOn = 1;
+		if (setsockopt(g_meridSock, SOL_SOCKET, SO_REUSEPORT, 
+				&reuseOn, sizeof(reuseOn)) == -1) {
+			perror("Cannot set SO_REUSEPORT");
+			return -1;
+		}
+	}
+#endif
 	//	Set up to listen to meridian port
 	struct sockaddr_in myAddr;
 	myAddr.sin_family 		= AF_INET;
@@ -990,21 +1480,63 @@ int MeridianProcess::start() {
 		ERROR_LOG("Cannot set socket to be non-blocking\n");		
 		return -1;
 	}
-#ifdef MERIDIAN_DSL	
-	// Used only to allow scheduling of processes
-	if ((g_dummySock = socket(AF_INET, SOCK_DGRAM, 0)) == -1) {
-		perror("Cannot create UDP socket");			
+	//	Set up the message headers for batched sends and receives. Each
+	//	receive header points to its own buffer in g_recvBufs
+	g_recvBufs.resize(g_udpBatchSize * MAX_UDP_PACKET_SIZE);
+	g_recvMsgs.resize(g_udpBatchSize);
+	g_recvIOV.resize(g_udpBatchSize);
+	g_recvAddrs.resize(g_udpBatchSize);
+	g_sendMsgs.resize(g_udpBatchSize);
+	g_sendIOV.resize(g_udpBatchSize * 2);
+	g_sendAddrs.resize(g_udpBatchSize);
+	g_pushHeaders.resize(g_udpBatchSize * PUSH_HEADER_SIZE);
+	memset(&(g_recvMsgs[0]), 0, sizeof(struct mmsghdr) * g_udpBatchSize);
+	memset(&(g_sendMsgs[0]), 0, sizeof(struct mmsghdr) * g_udpBatchSize);
+	for (u_int i = 0; i < g_udpBatchSize; i++) {
+		g_recvIOV[i].iov_base = &(g_recvBufs[i * MAX_UDP_PACKET_SIZE]);
+		g_recvIOV[i].iov_len = MAX_UDP_PACKET_SIZE;
+		g_recvMsgs[i].msg_hdr.msg_iov = &(g_recvIOV[i]);
+		g_recvMsgs[i].msg_hdr.msg_iovlen = 1;
+		g_recvMsgs[i].msg_hdr.msg_name = &(g_recvAddrs[i]);
+		g_recvMsgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+		g_sendMsgs[i].msg_hdr.msg_iov = &(g_sendIOV[i * 2]);
+		g_sendMsgs[i].msg_hdr.msg_iovlen = 1;
+		g_sendMsgs[i].msg_hdr.msg_name = &(g_sendAddrs[i]);
+		g_sendMsgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+	}
+	return 0;
+}
+
+int MeridianProcess::start() {
+	signal(SIGPIPE, SIG_IGN);	// Ignore sigpipe		
+	srand(time(NULL));	// Set random seed
+	gethostname(g_hostname, HOST_NAME_MAX);	//	Get the host name of this node
+	g_hostname[HOST_NAME_MAX - 1] = '\0';
+	struct hostent* he = gethostbyname(g_hostname);
+	if (he == NULL) {
+		perror("Cannot resolve localhost\n");
+		return -1;
+	}
+	g_localAddr = ntohl(((struct in_addr *)(he->h_addr))->s_addr);
+#ifndef SO_REUSEPORT
+	if (g_numWorkers > 1) {
+		WARN_LOG("SO_REUSEPORT is not supported, using a single worker\n");
+		g_numWorkers = 1;
+	}
+#endif
+	if (openMeridSocket() == -1) {
+		return -1;
+	}
+	if (g_events.init() == -1) {
+		ERROR_LOG("Cannot initialize event set\n");
 		return -1;
 	}
-	//FD_SET(g_dummySock, &g_writeSet);
-	//g_maxFD = MAX(g_dummySock, g_maxFD); 
-#endif	
 	//	Adding socket to read set 
-	FD_SET(g_meridSock, &g_readSet);
-	g_maxFD = MAX(g_meridSock, g_maxFD);
-	//	Adding stop fd to read set
-	FD_SET(g_stopFD, &g_readSet);
-	g_maxFD = MAX(g_stopFD, g_maxFD);
+	if (g_events.addFD(g_meridSock, FD_OWNER_MERID, EVENT_READ) == -1 ||
+			g_events.addFD(g_stopFD, FD_OWNER_STOP, EVENT_READ) == -1) {
+		ERROR_LOG("Cannot add sockets to event set\n");
+		return -1;
+	}
 	//	An info port of 0 means that no info service should be started
 	if (g_infoPort > 0) { 
 		//	Create listener for info requests
@@ -1013,29 +1545,44 @@ int MeridianProcess::start() {
 			return -1;			
 		}
 		//	Adding socket to read set 
-		FD_SET(g_infoSock, &g_readSet);
-		g_maxFD = MAX(g_infoSock, g_maxFD);		
+		if (g_events.addFD(
+				g_infoSock, FD_OWNER_INFO_LISTENER, EVENT_READ) == -1) {
+			ERROR_LOG("Cannot add info socket to event set\n");
+			return -1;
+		}
 	}
 	//	If this node is not behind a firewall, it can potentially be a
 	//	rendavous point for another node
 	if (g_rendvNode.addr == 0 && g_rendvNode.port == 0) {
 		if ((g_rendvListener = createTCPListener(g_meridPort)) == -1) {
 			perror("Cannot create TCP listener socket (rendavous port)");					
-		} else {
-			FD_SET(g_rendvListener, &g_readSet);
-			g_maxFD = MAX(g_rendvListener, g_maxFD);
+		} else if (g_events.addFD(g_rendvListener, 
+				FD_OWNER_RENDV_LISTENER, EVENT_READ) == -1) {
+			close(g_rendvListener);
+			g_rendvListener = -1;
 		}
 	} else {
 		g_rendvFD = createRendavousTunnel(g_rendvNode);
-		if (g_rendvFD != -1) {
-			FD_SET(g_rendvFD, &g_readSet);
-			g_maxFD = MAX(g_rendvFD, g_maxFD);
-		} else {
+		if (g_rendvFD != -1 && g_events.addFD(
+				g_rendvFD, FD_OWNER_RENDV_TUNNEL, EVENT_READ) == -1) {
+			close(g_rendvFD);
+			g_rendvFD = -1;
+		}
+		if (g_rendvFD == -1) {
 			ERROR_LOG("FATAL: Cannot create rendavous tunnel\n");
 			// TODO: Might be a better way to handle this
 			return -1;
 		}
 	}	
+	//	Ring replacement searches are run in the event loop if the workers
+	//	cannot be started
+	if (g_replacer.start(DEFAULT_REPLACE_WORKERS) == -1) {
+		WARN_LOG("Cannot start ring replacement workers\n");
+	} else if (g_events.addFD(
+			g_replacer.getNotifyFD(), FD_OWNER_REPLACE, EVENT_READ) == -1) {
+		ERROR_LOG("Cannot add replacement pipe to event set\n");
+		g_replacer.stop();
+	}
 #ifdef PLANET_LAB_SUPPORT
 	if (createICMPSocket() == -1) {
 		ERROR_LOG("Cannot create ICMP socket\n");
@@ -1043,9 +1590,37 @@ int MeridianProcess::start() {
 	}
 	// TODO: call setuid to not be root anymore	
 	//	Adding socket to read set 
-	FD_SET(g_icmpSock, &g_readSet);
-	g_maxFD = MAX(g_icmpSock, g_maxFD);	
+	if (g_events.addFD(g_icmpSock, FD_OWNER_ICMP, EVENT_READ) == -1) {
+		ERROR_LOG("Cannot add ICMP socket to event set\n");
+		return -1;
+	}
 #endif	
+	//	Warm restart from the last snapshot, if there is one
+	gettimeofday(&g_startTime, NULL);
+	if (!g_snapshotFile.empty()) {
+		LatencyCache* caches[] = {g_tcpCache, g_dnsCache, g_pingCache,
+#ifdef PLANET_LAB_SUPPORT
+			g_icmpCache
+#else
+			NULL
+#endif
+		};
+		if (Snapshot::load(g_snapshotFile.c_str(), g_rings, caches, 
+				sizeof(caches) / sizeof(LatencyCache*), 
+				&g_revalidateNodes) == 0) {
+			WARN_LOG_1("Restored %d ring members from snapshot\n", 
+				(int)g_revalidateNodes.size());
+			ringsChanged();
+		}
+	}
+	//	Workers start once the rings are restored, and before this worker
+	//	creates any query
+	if (g_numWorkers > 1 && startWorkers() == -1) {
+		ERROR_LOG("Cannot start workers, running a single one\n");
+		stopWorkers();
+		g_events.removeFD(g_inboxPipe[0]);
+		g_numWorkers = 1;
+	}
 	// Add all seed nodes as ring members (performs probing)
 	for (u_int i = 0; i < g_seedNodes.size(); i++) {
 		NodeIdentRendv tmpNIR = g_seedNodes[i];
@@ -1078,170 +1653,332 @@ int MeridianProcess::start() {
 	} else {
 		ringScheduler->init();	
 	}
+	//	Re-ping restored ring members and save snapshots periodically
+	SchedRevalidate revalidateCallBack(this);
+	QueryScheduler* revalidateScheduler = NULL;
+	SchedSnapshot snapshotCallBack(this);
+	QueryScheduler* snapshotScheduler = NULL;
+	if (!g_revalidateNodes.empty()) {
+		revalidateScheduler = new QueryScheduler(0, 0, 
+			REVALIDATE_INTERVAL_MS, this, &revalidateCallBack);
+		if (g_queryTable.insertNewQuery(revalidateScheduler) == -1) {		
+			ERROR_LOG("Cannot add revalidation scheduler\n");
+			delete revalidateScheduler;
+		} else {
+			revalidateScheduler->init();	
+		}
+	}
+	if (!g_snapshotFile.empty()) {
+		if (g_snapshotWriter.start(g_snapshotFile.c_str()) == -1) {
+			ERROR_LOG("Cannot start snapshot writer, saving on the loop\n");
+		}
+		snapshotScheduler = new QueryScheduler(0, 0, 
+			SNAPSHOT_INTERVAL_S * 1000, this, &snapshotCallBack);
+		if (g_queryTable.insertNewQuery(snapshotScheduler) == -1) {		
+			ERROR_LOG("Cannot add snapshot scheduler\n");
+			delete snapshotScheduler;
+		} else {
+			snapshotScheduler->init();	
+		}
+	}
+	int retVal = runEventLoop();
+	stopWorkers();
+	//	The last snapshot is written here, once any periodic one is done
+	g_snapshotWriter.stop();
+	saveSnapshot();
+	return retVal;
+}
+
+int MeridianProcess::runEventLoop() {
 	//	Declaring structures that will be reused over and over
-	fd_set currentReadSet, currentWriteSet;
 	struct timeval curTime;
 	struct timeval nextEventTime;
 	struct timeval timeOutTV;
-	//	Main event driven select loop
+	//	Main event loop
 	while (true) {	
+		if (g_usefulRingMS == -1 && isRingOwner()) {
+			checkUsefulRing();
+		}
+		//	Everything changed in the last turn becomes visible to the 
+		//	other workers at once
+		if (g_ringsDirty) {
+			g_ringPublisher->publish(*g_rings);
+			g_ringsDirty = false;
+		}
+#ifdef MERIDIAN_DSL
+		if (g_dslScheduler.hasRunnable()) {
+			runDSLThreads();
+		}
+#endif
 		//	Set timeout			
-		gettimeofday(&curTime, NULL);			
+		Query::getCurrentTime(&curTime);
 		g_queryTable.nextTimeout(&nextEventTime);		
 		//	Set time out length
 		if (timeoutLength(&curTime, &nextEventTime, &timeOutTV) == -1) {			
 			evaluateTimeout();	//	Already expired
 			continue;	// Loop again
 		}
-		//	Reset fd_set values
-		memcpy(&currentReadSet, &g_readSet, sizeof(fd_set));
-		memcpy(&currentWriteSet, &g_writeSet, sizeof(fd_set));
-		
-		int selectRet = select(g_maxFD+1, 
-			&currentReadSet, &currentWriteSet, NULL, &timeOutTV);
-			
-		if (selectRet == -1) {
+#ifdef MERIDIAN_DSL
+		//	Only poll while DSL threads are waiting for the CPU
+		if (g_dslScheduler.hasRunnable()) {
+			timeOutTV.tv_sec = 0;
+			timeOutTV.tv_usec = 0;
+		}
+#endif
+		int waitRet = g_events.wait(&timeOutTV);
+		if (waitRet == -1) {
 			if (errno == EINTR) {					
 				continue; // Interrupted by signal, retry
 			}
-			ERROR_LOG("Select returned an error\n");
+			ERROR_LOG("Waiting for events returned an error\n");
 			return -1;	// Return with error
-		} else if (selectRet == 0) {		
+		} else if (waitRet == 0) {		
 			evaluateTimeout();	
 			continue;
 		}
-		if (FD_ISSET(g_stopFD, &currentReadSet)) {
-			ERROR_LOG("Received stop request\n");
-			//	Don't even bother reading it
-			break;			
-		}
-		if (FD_ISSET(g_meridSock, &currentReadSet)) {
-			readPacket();	
+		//	Hand each ready fd directly to its owner
+		int readyFD;
+		u_int readyOwner, readyEvents;
+		bool stopLoop = false;
+		while (!stopLoop && 
+				g_events.nextReady(&readyFD, &readyOwner, &readyEvents) != -1) {
+			if (handleEvent(readyFD, readyOwner, readyEvents) == -1) {
+				stopLoop = true;
+			}
 		}
-		if (FD_ISSET(g_meridSock, &currentWriteSet)) {
-			writePending();
+		if (stopLoop) {
+			break;
 		}
-#ifdef PLANET_LAB_SUPPORT
-		if (FD_ISSET(g_icmpSock, &currentReadSet)) {
-			WARN_LOG("ICMP Read pending!!!!\n");
-			readICMPPacket();	
+	}
+	return 0;
+}
+
+int MeridianProcess::startWorkers() {
+	g_workers.push_back(this);
+	for (u_int i = 1; i < g_numWorkers; i++) {
+		g_workers.push_back(new MeridianProcess(this, i));
+	}
+	//	Every inbox must exist before any packet can be passed on
+	for (u_int i = 0; i < g_workers.size(); i++) {
+		MeridianProcess* curWorker = g_workers[i];
+		if (pipe(curWorker->g_inboxPipe) == -1) {
+			perror("Cannot create worker inbox");
+			curWorker->g_inboxPipe[0] = -1;
+			curWorker->g_inboxPipe[1] = -1;
+			return -1;
 		}
-		if (FD_ISSET(g_icmpSock, &currentWriteSet)) {
-			icmpWritePending();					
+		if (setNonBlock(curWorker->g_inboxPipe[0]) == -1 || 
+				setNonBlock(curWorker->g_inboxPipe[1]) == -1) {
+			return -1;
 		}
-#endif		
-#ifdef MERIDIAN_DSL		
-		if (FD_ISSET(g_dummySock, &currentWriteSet)) {
-			//vector<list<uint64_t>::iterator> delete_vect;
-			vector<list<uint64_t>::iterator> clear_vect;
-			list<uint64_t>::iterator psIt = g_psList.begin();
-			vector<NodeIdentLat> dummyVect; 
-#define MAX_THREADS_PER_ITERATION 	5
-			for (int itCount = 0; psIt != g_psList.end() && 
-					itCount < MAX_THREADS_PER_ITERATION; psIt++, itCount++) {
-				uint64_t curQueryID = *psIt;
-				clear_vect.push_back(psIt);
-				if (getQueryTable()->isQueryInTable(curQueryID)) {
-					const DSLRecvQuery* thisQ 
-						= getQueryTable()->getDSLRecvQ(curQueryID);
-					// If thisQ is NULL (error due to cast?), remove from list
-					if (thisQ == NULL) {
-						fprintf(stderr,	
-							"g_psList contains a non-DSLRecvQuery query\n");
-						continue;
-					}
-					// If thread is blocked, remove from g_psList
-					if (thisQ->parserState() == PS_BLOCKED) {
-						//printf("Thread is blocked, skip\n");
-						continue;	
-					}
-					getQueryTable()->notifyQLatency(curQueryID, dummyVect);
-					// If thread no longer active, remove from g_psList
-					if (getQueryTable()->isQueryInTable(curQueryID)) {
-						g_psList.push_back(curQueryID);												
-					}															
-				} 											
-			}
-			//	Just remove it from the list, as we moved 
-			//	it to another position
-			for (u_int i = 0; i < clear_vect.size(); i++) {
-				g_psList.erase(clear_vect[i]);
-			}			
-			//	Turn off trigger if no process need to be executed
-			if (g_psList.empty()) {
-				FD_CLR(g_dummySock, &g_writeSet);	
-			}
+	}
+	if (g_events.addFD(g_inboxPipe[0], FD_OWNER_INBOX, EVENT_READ) == -1) {
+		ERROR_LOG("Cannot add inbox to event set\n");
+		return -1;
+	}
+	for (u_int i = 1; i < g_workers.size(); i++) {
+		MeridianProcess* curWorker = g_workers[i];
+		if (curWorker->openMeridSocket() == -1 || 
+				curWorker->g_events.init() == -1 ||
+				curWorker->g_events.addFD(curWorker->g_meridSock, 
+					FD_OWNER_MERID, EVENT_READ) == -1 ||
+				curWorker->g_events.addFD(curWorker->g_inboxPipe[0], 
+					FD_OWNER_INBOX, EVENT_READ) == -1) {
+			ERROR_LOG_1("Cannot set up worker %d\n", i);
+			return -1;
 		}
-#endif		
-		if (handleRendavous(&currentReadSet, &currentWriteSet) == -1) { 
-			break;	// Connection to rendavous node broken
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, workerMain, curWorker) != 0) {
+			ERROR_LOG_1("Cannot start worker %d\n", i);
+			return -1;
 		}
-		handleInfoConnections(&currentReadSet, &currentWriteSet);
-		handleTCPConnections(&currentReadSet, &currentWriteSet);
-		handleDNSConnections(&currentReadSet, &currentWriteSet);
+		g_workerThreads.push_back(thread);
 	}
 	return 0;
 }
 
-int MeridianProcess::handleTCPConnections(
-		fd_set* curReadSet, fd_set* curWriteSet) {			
-	// Handle existing requests
-	vector<map<int, pair<uint64_t, NodeIdent>*>::iterator> deleteVector;	
-	map<int, pair<uint64_t, NodeIdent>*>::iterator conIt 
-		= g_tcpProbeConnections.begin();
-	for (; conIt != g_tcpProbeConnections.end(); conIt++) {
-		if (FD_ISSET(conIt->first, curWriteSet)) {			
-			struct sockaddr	peerAddr;
-			socklen_t peerLen = sizeof(struct sockaddr);			
-			if (getpeername(conIt->first, &peerAddr, &peerLen) != -1){			
-				pair<uint64_t, NodeIdent>* thisPair = conIt->second;
-				//	Pass back latency of 0, as the timing is done 
-				//	within the query, not in the TCP connection
-				NodeIdentLat outNIL = 
-					{(thisPair->second).addr, (thisPair->second).port, 0};
-				vector<NodeIdentLat> subVect;
-				subVect.push_back(outNIL);				
-				g_queryTable.notifyQLatency(thisPair->first, subVect);
-			}
-			// TODO: Add notifyError for quicker notification of error
-			deleteVector.push_back(conIt);	// We can delete this now
-		}
-	}	
-	//	Cleanup all finished connections
-	for (u_int i = 0; i < deleteVector.size(); i++) {
-		eraseTCPConnection(deleteVector[i]);
+void MeridianProcess::stopWorkers() {
+	NodeIdent dummy = {0, 0};
+	WorkerMsg msg = {WORKER_MSG_STOP, dummy, dummy, 0, NULL};
+	for (u_int i = 1; i < g_workerThreads.size() + 1; i++) {
+		postToWorker(i, msg);
 	}
-	return 0;
+	for (u_int i = 0; i < g_workerThreads.size(); i++) {
+		pthread_join(g_workerThreads[i], NULL);
+	}
+	g_workerThreads.clear();
+	for (u_int i = 1; i < g_workers.size(); i++) {
+		delete g_workers[i];
+	}
+	g_workers.clear();
 }
 
+void* MeridianProcess::workerMain(void* arg) {
+	MeridianProcess* worker = (MeridianProcess*)arg;
+	if (worker->runEventLoop() == -1) {
+		ERROR_LOG_1("Worker %d failed\n", worker->g_workerIndex);
+	}
+	return NULL;
+}
 
-int MeridianProcess::handleDNSConnections(
-		fd_set* curReadSet, fd_set* curWriteSet) {			
-	// Handle existing requests
-	vector<map<int, pair<uint64_t, NodeIdent>*>::iterator> deleteVector;	
-	map<int, pair<uint64_t, NodeIdent>*>::iterator conIt 
-		= g_dnsProbeConnections.begin();
-	for (; conIt != g_dnsProbeConnections.end(); conIt++) {		
-		if (FD_ISSET(conIt->first, curReadSet)) {
-			WARN_LOG("Response from DNS server\n");
-			pair<uint64_t, NodeIdent>* thisPair = conIt->second;
-			//	Pass back latency of 0, as the timing is done 
-			//	within the query, not in the DNS connection
-			NodeIdentLat outNIL = 
-				{(thisPair->second).addr, (thisPair->second).port, 0};
-			vector<NodeIdentLat> subVect;
-			subVect.push_back(outNIL);				
-			g_queryTable.notifyQLatency(thisPair->first, subVect);
-			deleteVector.push_back(conIt);	// We can delete this now
+void MeridianProcess::checkUsefulRing() {
+	for (int i = 0; i < g_rings->getNumberOfRings(); i++) {
+		if (!(g_rings->returnPrimaryRing(i)->empty())) {
+			struct timeval curTime;
+			gettimeofday(&curTime, NULL);
+			g_usefulRingMS = (curTime.tv_sec - g_startTime.tv_sec) * 1000 +
+				(curTime.tv_usec - g_startTime.tv_usec) / 1000;
+			WARN_LOG_1("Rings useful %d ms after start\n", g_usefulRingMS);
+			return;
 		}
-	}	
-	//	Cleanup all finished connections
-	for (u_int i = 0; i < deleteVector.size(); i++) {
-		eraseDNSConnection(deleteVector[i]);
+	}
+}
+
+int MeridianProcess::handleEvent(int fd, u_int owner, u_int events) {
+	switch (owner) {
+		case FD_OWNER_STOP: {
+				ERROR_LOG("Received stop request\n");
+				//	Don't even bother reading it
+				return -1;
+			} break;
+		case FD_OWNER_MERID: {
+				if (events & EVENT_READ) {
+					readPacket();	
+				}
+				if ((events & EVENT_WRITE) && !(g_outPacketList.empty())) {
+					writePending();
+				}
+			} break;
+#ifdef PLANET_LAB_SUPPORT
+		case FD_OWNER_ICMP: {
+				if (events & EVENT_READ) {
+					WARN_LOG("ICMP Read pending!!!!\n");
+					readICMPPacket();	
+				}
+				if ((events & EVENT_WRITE) && 
+						!(g_icmpOutPacketList.empty())) {
+					icmpWritePending();					
+				}
+			} break;
+#endif		
+		case FD_OWNER_INFO_LISTENER: {
+				handleInfoListener();
+			} break;
+		case FD_OWNER_INFO: {
+				handleInfoConnection(fd, events);
+			} break;
+		case FD_OWNER_RENDV_TUNNEL: {
+				//	Connection to rendavous node broken
+				return handleRendavousTunnel();
+			} break;
+		case FD_OWNER_RENDV_LISTENER: {
+				handleRendavousListener();
+			} break;
+		case FD_OWNER_RENDV_CLIENT: {
+				handleRendavousClient(fd);
+			} break;
+		case FD_OWNER_TCP_PROBE: {
+				handleTCPConnection(fd);
+			} break;
+		case FD_OWNER_DNS_PROBE: {
+				handleDNSConnection(fd);
+			} break;
+		case FD_OWNER_INBOX: {
+				return handleInbox();
+			} break;
+		case FD_OWNER_REPLACE: {
+				vector<ReplaceJob*> doneJobs;
+				g_replacer.collect(doneJobs);
+				for (u_int i = 0; i < doneJobs.size(); i++) {
+					applyReplacement(doneJobs[i]);
+				}
+			} break;
+		default: {
+				ERROR_LOG_1("Unknown owner of ready fd %d\n", fd);
+			} break;
 	}
 	return 0;
 }
 
+#ifdef MERIDIAN_DSL
+void MeridianProcess::runDSLThreads() {
+	vector<NodeIdentLat> dummyVect; 
+	uint64_t turnStart = DSLScheduler::nowNS();
+	uint64_t curQueryID;
+	while (g_dslScheduler.next(&curQueryID) != -1) {
+		DSLRecvQuery* thisQ = getQueryTable()->getDSLRecvQ(curQueryID);
+		if (thisQ == NULL) {
+			continue;	// Ended while it was runnable
+		}
+		DSLThreadState* state = thisQ->getThreadState();
+		g_dslScheduler.dequeued(state);
+		//	Woken again when its RPC or measurement completes
+		if (thisQ->parserState() == PS_BLOCKED) {
+			continue;	
+		}
+		int priority = state->priority;
+		thisQ->setSliceEvals(g_dslScheduler.sliceEvals(state));
+		uint64_t sliceStart = DSLScheduler::nowNS();
+		getQueryTable()->notifyQLatency(curQueryID, dummyVect);
+		uint64_t sliceEnd = DSLScheduler::nowNS();
+		//	The query is deleted if the thread ended
+		thisQ = getQueryTable()->getDSLRecvQ(curQueryID);
+		if (thisQ == NULL) {
+			g_dslScheduler.charge(curQueryID, NULL, priority, 
+				sliceEnd - sliceStart, 0, false);
+		} else {
+			g_dslScheduler.charge(curQueryID, thisQ->getThreadState(), 
+				priority, sliceEnd - sliceStart, thisQ->getEvalsUsed(), 
+				thisQ->parserState() == PS_READY);
+		}
+		if (sliceEnd - turnStart >= DSL_TURN_NS) {
+			break;	// Let the event loop poll the sockets
+		}
+	}
+}
+#endif
+
+int MeridianProcess::handleTCPConnection(int fd) {			
+	map<int, pair<uint64_t, NodeIdent>*>::iterator conIt 
+		= g_tcpProbeConnections.find(fd);
+	if (conIt == g_tcpProbeConnections.end()) {
+		return 0;	// Already erased
+	}
+	struct sockaddr	peerAddr;
+	socklen_t peerLen = sizeof(struct sockaddr);			
+	if (getpeername(fd, &peerAddr, &peerLen) != -1){			
+		pair<uint64_t, NodeIdent>* thisPair = conIt->second;
+		//	Pass back latency of 0, as the timing is done 
+		//	within the query, not in the TCP connection
+		NodeIdentLat outNIL = 
+			{(thisPair->second).addr, (thisPair->second).port, 0};
+		vector<NodeIdentLat> subVect;
+		subVect.push_back(outNIL);				
+		g_queryTable.notifyQLatency(thisPair->first, subVect);
+	}
+	// TODO: Add notifyError for quicker notification of error
+	//	The query may have changed the map, look the fd up again
+	return eraseTCPConnection(fd);
+}
+
+int MeridianProcess::handleDNSConnection(int fd) {
+	map<int, pair<uint64_t, NodeIdent>*>::iterator conIt 
+		= g_dnsProbeConnections.find(fd);
+	if (conIt == g_dnsProbeConnections.end()) {
+		return 0;	// Already erased
+	}
+	WARN_LOG("Response from DNS server\n");
+	pair<uint64_t, NodeIdent>* thisPair = conIt->second;
+	//	Pass back latency of 0, as the timing is done 
+	//	within the query, not in the DNS connection
+	NodeIdentLat outNIL = 
+		{(thisPair->second).addr, (thisPair->second).port, 0};
+	vector<NodeIdentLat> subVect;
+	subVect.push_back(outNIL);				
+	g_queryTable.notifyQLatency(thisPair->first, subVect);
+	return eraseDNSConnection(fd);
+}
+
 
 int MeridianProcess::removeRendavousConnection(
 		map<NodeIdent, int, ltNodeIdent>::iterator& in_it) {
@@ -1259,114 +1996,174 @@ int MeridianProcess::removeRendavousConnection(
 		delete *listIt;
 	}		
 	delete packetList;	//	Delete the queue itself
-	//	Make sure we FD_CLR and close the socket
-	FD_CLR(oldSock, &g_writeSet);
+	//	Make sure we remove it from the event set and close the socket
+	g_events.removeFD(oldSock);
 	close(oldSock);	
 	return 0;
 }
 
-int MeridianProcess::handleRendavous(
-		fd_set* curReadSet, fd_set* curWriteSet) {
-	// 	If we are behind a firewall, check to see if any new data has been
-	//	pushed via the rendavous tunnel
-	if (g_rendvFD != -1) {
-		if (FD_ISSET(g_rendvFD, curReadSet)) {			
-			int recvRet = recv(g_rendvFD, g_rendvRecvPacket->getPayLoad() + 
-				g_rendvRecvPacket->getPayLoadSize(),
-				g_rendvRecvPacket->getPacketSize() - 
-				g_rendvRecvPacket->getPayLoadSize(), 0);				
-			if (recvRet == -1 || recvRet == 0) {
-				// Error reading
-				ERROR_LOG("Rendavous host has disconnected\n");
-				// TODO: Need to find another host
-				FD_CLR(g_rendvFD, &g_readSet);
-				close(g_rendvFD);
-				g_rendvFD = -1;
-				return -1;
-			} else {
-				//	Update payload size;
-				g_rendvRecvPacket->setPayLoadSize(
-					g_rendvRecvPacket->getPayLoadSize() + recvRet);
-				//	See if we have complete PULL packet. If we do, read
-				//	it and extract the inner packet. The rendv packet must also
-				// 	be updated (portion of next packet must be moved to front
-				//	of buffer
-				NodeIdent srcNode;				
-				RealPacket* newPacket 
-					= PullPacket::parse(*g_rendvRecvPacket, srcNode);
-				if (newPacket) {					
-					handleNewPacket(newPacket->getPayLoad(), 
-						newPacket->getPayLoadSize(), srcNode);
-					delete newPacket;						
-				}
-			}						
+int MeridianProcess::handleRendavousTunnel() {
+	// 	We are behind a firewall, read all new data that has been pushed 
+	//	via the rendavous tunnel
+	while (true) {
+		int recvRet = recv(g_rendvFD, g_rendvRecvPacket->getPayLoad() + 
+			g_rendvRecvPacket->getPayLoadSize(),
+			g_rendvRecvPacket->getPacketSize() - 
+			g_rendvRecvPacket->getPayLoadSize(), 0);				
+		if (recvRet == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return 0;	// Drained
 		}
-		return 0;
+		if (recvRet == -1 || recvRet == 0) {
+			// Error reading
+			ERROR_LOG("Rendavous host has disconnected\n");
+			// TODO: Need to find another host
+			return resetRendavousTunnel();
+		}
+		//	Update payload size;
+		g_rendvRecvPacket->setPayLoadSize(
+			g_rendvRecvPacket->getPayLoadSize() + recvRet);
+		//	Handle all complete PULL packets in place, then move the portion
+		//	of the next packet to the front of the buffer
+		char* buf = g_rendvRecvPacket->getPayLoad();
+		int bufSize = g_rendvRecvPacket->getPayLoadSize();
+		int pos = 0;
+		while (pos < bufSize) {
+			NodeIdent srcNode;
+			int payLoadPos, payLoadSize;
+			int frameSize = PullPacket::parseFrame(buf + pos, bufSize - pos,
+				&srcNode, &payLoadPos, &payLoadSize);
+			if (frameSize == 0) {
+				break;
+			}
+			if (frameSize == -1) {
+				//	The next frame boundary cannot be found, so nothing
+				//	more on this stream can be trusted
+				ERROR_LOG("Malformed PULL packet, resetting tunnel\n");
+				return resetRendavousTunnel();
+			}
+			handleNewPacket(buf + pos + payLoadPos, payLoadSize, srcNode);
+			pos += frameSize;
+		}
+		if (pos > 0) {
+			memmove(buf, buf + pos, bufSize - pos);
+			g_rendvRecvPacket->setPayLoadSize(bufSize - pos);
+		}
+	}
+}
+
+int MeridianProcess::resetRendavousTunnel() {
+	g_events.removeFD(g_rendvFD);
+	//	Reset rather than close, the new connection is made from the same
+	//	port and must not find the old one in TIME_WAIT
+	struct linger noLinger = {1, 0};
+	setsockopt(g_rendvFD, SOL_SOCKET, SO_LINGER, &noLinger, sizeof(noLinger));
+	close(g_rendvFD);
+	g_rendvRecvPacket->setPayLoadSize(0);
+	g_rendvFD = createRendavousTunnel(g_rendvNode);
+	if (g_rendvFD != -1 && g_events.addFD(
+			g_rendvFD, FD_OWNER_RENDV_TUNNEL, EVENT_READ) == -1) {
+		close(g_rendvFD);
+		g_rendvFD = -1;
+	}
+	if (g_rendvFD == -1) {
+		ERROR_LOG("Cannot reconnect rendavous tunnel\n");
+		return -1;
 	}
-	//	If we are a host to rendavous nodes
-	//	Check for new requests. This must happen before checking existing
-	//	connections, as we may modify the g_rendvConnections data-structure
-	if (FD_ISSET(g_rendvListener, curReadSet)) {	
+	return 0;
+}
+
+int MeridianProcess::handleRendavousListener() {
+	//	We are a host to rendavous nodes, accept all new requests
+	while (true) {
 		struct sockaddr_in tmpAddr;
 		int sinSize = sizeof(struct sockaddr_in);
 		int newRendvSock = accept(g_rendvListener,
 			(struct sockaddr*)&tmpAddr, (socklen_t*)&sinSize);
-		if (newRendvSock != -1) {			
-			NodeIdent remoteNode = {ntohl(tmpAddr.sin_addr.s_addr), 
-									ntohs(tmpAddr.sin_port) };		
-			map<NodeIdent, int, ltNodeIdent>::iterator findRendvIt = 
-				g_rendvConnections.find(remoteNode);
-			if (findRendvIt != g_rendvConnections.end()) {
-				ERROR_LOG("Rendavous connection already exists\n");				
-				ERROR_LOG("Closing existing connection\n");
-				removeRendavousConnection(findRendvIt);
-			}		
+		if (newRendvSock == -1) {
+			break;
+		}
+		if (setNonBlock(newRendvSock) == -1 || g_events.addFD(
+				newRendvSock, FD_OWNER_RENDV_CLIENT, 0) == -1) {
+			close(newRendvSock);
+			continue;
+		}
+		NodeIdent remoteNode = {ntohl(tmpAddr.sin_addr.s_addr), 
+								ntohs(tmpAddr.sin_port) };		
+		map<NodeIdent, int, ltNodeIdent>::iterator findRendvIt = 
+			g_rendvConnections.find(remoteNode);
+		if (findRendvIt != g_rendvConnections.end()) {
+			ERROR_LOG("Rendavous connection already exists\n");				
+			ERROR_LOG("Closing existing connection\n");
+			removeRendavousConnection(findRendvIt);
+		}		
 #ifdef DEBUG			
-			u_int netAddr = htonl(remoteNode.addr);
-			char* ringNodeStr = inet_ntoa(*(struct in_addr*)&(netAddr));
-			WARN_LOG_2("Adding connection for %s:%d\n", 
-				ringNodeStr, remoteNode.port);
+		u_int netAddr = htonl(remoteNode.addr);
+		char* ringNodeStr = inet_ntoa(*(struct in_addr*)&(netAddr));
+		WARN_LOG_2("Adding connection for %s:%d\n", 
+			ringNodeStr, remoteNode.port);
 #endif				
-			g_rendvConnections[remoteNode] = newRendvSock;
-			g_rendvQueue[newRendvSock] = new list<RealPacket*>();
-		}
-	}	
-	//	Handle existing connections
-	vector<map<NodeIdent, int, ltNodeIdent>::iterator> deleteVector;
-	map<NodeIdent, int, ltNodeIdent>::iterator it =	g_rendvConnections.begin();
-	for (; it != g_rendvConnections.end(); it++) {
-		if (FD_ISSET(it->second, curWriteSet)) {
-			//WARN_LOG("Ready to write through tunnel\n");
-			map<int, list<RealPacket*>*>::iterator queueIt =
-				g_rendvQueue.find(it->second);
-			assert(queueIt != g_rendvQueue.end()); 				
-			list<RealPacket*>* packetList = queueIt->second;			
-			RealPacket* curPacket = packetList->front();
+		g_rendvConnections[remoteNode] = newRendvSock;
+		g_rendvQueue[newRendvSock] = new list<RealPacket*>();
+	}
+	return 0;
+}
+
+int MeridianProcess::handleRendavousClient(int fd) {
+	map<int, list<RealPacket*>*>::iterator queueIt = g_rendvQueue.find(fd);
+	if (queueIt == g_rendvQueue.end()) {
+		return 0;	// Already removed
+	}
+	list<RealPacket*>* packetList = queueIt->second;
+	//	Write through the tunnel until the queue is empty or the socket 
+	//	buffer is full, gathering the queued packets into one sendmsg
+	struct iovec iov[MAX_RENDV_SEND_PACKETS];
+	while (!(packetList->empty())) {
+		int numIOV = 0;
+		list<RealPacket*>::iterator it = packetList->begin();
+		for (; it != packetList->end() && numIOV < MAX_RENDV_SEND_PACKETS;
+				it++) {
+			RealPacket* curPacket = *it;
 			assert(curPacket != NULL);
-			int sendRet = send(it->second, 
-				curPacket->getPayLoad() + curPacket->getPos(), 
-				curPacket->getPayLoadSize() - curPacket->getPos(), 0);
-			if (sendRet == -1 || sendRet == 0) {
-				ERROR_LOG("Connection to rendvaous client closed\n");
-				// Connection closed
-				deleteVector.push_back(it);						
-			} else if (sendRet 
-					== (curPacket->getPayLoadSize() - curPacket->getPos())) {
-				packetList->pop_front();
-				if (packetList->empty()) {					
-					FD_CLR(it->second, &g_writeSet); //	Turn off writeable	
+			iov[numIOV].iov_base = curPacket->getPayLoad() + curPacket->getPos();
+			iov[numIOV].iov_len = 
+				curPacket->getPayLoadSize() - curPacket->getPos();
+			numIOV++;
+		}
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(struct msghdr));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = numIOV;
+		int sendRet = sendmsg(fd, &msg, 0);
+		if (sendRet == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return 0;	// Wait until writeable again
+		}
+		if (sendRet == -1 || sendRet == 0) {
+			ERROR_LOG("Connection to rendvaous client closed\n");
+			// Connection closed, find the entry keyed on the client
+			map<NodeIdent, int, ltNodeIdent>::iterator it 
+				= g_rendvConnections.begin();
+			for (; it != g_rendvConnections.end(); it++) {
+				if (it->second == fd) {
+					return removeRendavousConnection(it);
 				}
-				delete curPacket;
-			} else {
+			}
+			assert(false);
+			return -1;
+		}
+		//	Remove the packets that were completely sent, the last one may
+		//	have been sent partially
+		for (int i = 0; i < numIOV && sendRet > 0; i++) {
+			RealPacket* curPacket = packetList->front();
+			if ((u_int)sendRet < iov[i].iov_len) {
 				curPacket->incrPos(sendRet);
-			}						
-		}		
-	}	
-
-	//	All dead connections are cleaned up here
-	for (u_int i = 0; i < deleteVector.size(); i++) {		
-		removeRendavousConnection(deleteVector[i]);	
+				break;
+			}
+			sendRet -= iov[i].iov_len;
+			packetList->pop_front();
+			delete curPacket;
+		}
 	}
+	g_events.clearEvents(fd, EVENT_WRITE); //	Turn off writeable	
 	return 0;
 }
 
@@ -1396,9 +2193,12 @@ int MeridianProcess::addTCPConnection(
 	if (it != g_tcpProbeConnections.end()) {
 		assert(false);			
 	}
+	if (g_events.addFD(newSock, FD_OWNER_TCP_PROBE, EVENT_WRITE) == -1) {
+		close(newSock);
+		delete tmp;
+		return -1;
+	}
 	g_tcpProbeConnections[newSock] = tmp;
-	FD_SET(newSock, &g_writeSet);
-	g_maxFD = MAX(newSock, g_maxFD); 				
 	return newSock;
 }
 
@@ -1447,11 +2247,14 @@ int MeridianProcess::addDNSConnection(
 	if (it != g_dnsProbeConnections.end()) {
 		assert(false);			
 	}
+	//	Add socket to event set, wait for response
+	if (g_events.addFD(newSock, FD_OWNER_DNS_PROBE, EVENT_READ) == -1) {
+		close(newSock);
+		delete tmp;
+		return -1;
+	}
 	//	Add connection to DNS map
 	g_dnsProbeConnections[newSock] = tmp;
-	//	Set socket to select loop, wait for response
-	FD_SET(newSock, &g_readSet);
-	g_maxFD = MAX(newSock, g_maxFD); 				
 	return newSock;
 }
 
@@ -1578,8 +2381,7 @@ int MeridianProcess::sendICMPProbe(
 
 int MeridianProcess::addICMPOutPacket(RealPacket* in_packet) {
 	g_icmpOutPacketList.push_back(in_packet);
-	FD_SET(g_icmpSock, &g_writeSet);
-	g_maxFD = MAX(g_icmpSock, g_maxFD); 
+	g_events.addEvents(g_icmpSock, EVENT_WRITE);
 	return 0;
 }
 
@@ -1598,7 +2400,7 @@ void MeridianProcess::icmpWritePending() {
 		g_icmpOutPacketList.pop_front();
 		delete firstPacket;	// Done with packet
 		if (g_icmpOutPacketList.empty()) {
-			FD_CLR(g_icmpSock, &g_writeSet);
+			g_events.clearEvents(g_icmpSock, EVENT_WRITE);
 			break;	// No more to send
 		}
 	}
@@ -1608,16 +2410,27 @@ void MeridianProcess::icmpWritePending() {
 
 int MeridianProcess::readICMPPacket() {
 	char buf[MAX_ICMP_PACKET_SIZE];
-	struct sockaddr_in theirAddr;
-	int addrLen = sizeof(struct sockaddr);
-	//	Perform actual recv on socket
-	int numBytes = recvfrom(g_icmpSock, buf, MAX_ICMP_PACKET_SIZE, 0,
-		(struct sockaddr*)&theirAddr, (socklen_t*)&addrLen);		
-	if (numBytes == -1) {
-		perror("Error on recvfrom");
-		return -1;		
+	//	Drain the socket, as the event set may only report it once
+	while (true) {
+		struct sockaddr_in theirAddr;
+		int addrLen = sizeof(struct sockaddr);
+		//	Perform actual recv on socket
+		int numBytes = recvfrom(g_icmpSock, buf, MAX_ICMP_PACKET_SIZE, 0,
+			(struct sockaddr*)&theirAddr, (socklen_t*)&addrLen);		
+		if (numBytes == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return 0;	// Nothing more to read
+			}
+			perror("Error on recvfrom");
+			return -1;		
+		}
+		NodeIdent remoteNode = {ntohl(theirAddr.sin_addr.s_addr), 0};
+		handleICMPPacket(buf, numBytes, remoteNode);
 	}
-	NodeIdent remoteNode = {ntohl(theirAddr.sin_addr.s_addr), 0};							
+}
+
+int MeridianProcess::handleICMPPacket(
+		char* buf, int numBytes, const NodeIdent& remoteNode) {
 	// Get query id from ICMP ECHO reply
     uint16_t icmpPacketSize = sizeof(struct iphdr) +
         sizeof(struct icmphdr) + sizeof(uint64_t);		
@@ -8,11 +8,23 @@
 #include <errno.h>
 #include <vector>
 #include <list>
+#include <string>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <pthread.h>
 #include "QueryTable.h"
 #include "RingSet.h"
 #include "Marshal.h"
 #include "LatencyCache.h"
+#include "EventSet.h"
+#include "RingLatencyMatrix.h"
+#include "RingReplacer.h"
+#include "RingPublisher.h"
+#include "Snapshot.h"
+#ifdef MERIDIAN_DSL
+#include "DSLScheduler.h"
+#include "ProgramCache.h"
+#endif
 
 #ifndef HOST_NAME_MAX
 #define HOST_NAME_MAX			1024
@@ -23,6 +35,50 @@
 #define DRAIN_BUFFER_SIZE		65536
 #define	PROBE_CACHE_SIZE		1024
 #define PROBE_CACHE_TIMEOUT_US	(5*1000*1000)
+//	Shared memory segments of the host wide probe caches
+#define SHARED_TCP_CACHE_NAME	"/meridian_tcp_cache"
+#define SHARED_DNS_CACHE_NAME	"/meridian_dns_cache"
+#define SHARED_ICMP_CACHE_NAME	"/meridian_icmp_cache"
+#define SNAPSHOT_INTERVAL_S		60	// Period of snapshot writes
+#define REVALIDATE_INTERVAL_MS	500	// Pace of re-pinging restored nodes
+#define REVALIDATE_BATCH		8	// Nodes re-pinged per interval
+#define DEFAULT_UDP_BATCH_SIZE	32	// Packets per recvmmsg/sendmmsg call
+#define MAX_UDP_BATCH_SIZE		1024
+#define MAX_RENDV_SEND_PACKETS	64	// PULL packets per tunnel write
+#define MAX_NUM_WORKERS			64	// Event loops sharing the Meridian port
+#if MAX_NUM_WORKERS > MAX_RING_READERS
+#error "Every worker needs a ring reader slot"
+#endif
+
+//	Owner tags of the fds registered with the event set
+#define FD_OWNER_STOP			1
+#define FD_OWNER_MERID			2
+#define FD_OWNER_ICMP			3
+#define FD_OWNER_INFO_LISTENER	5
+#define FD_OWNER_INFO			6
+#define FD_OWNER_RENDV_LISTENER	7
+#define FD_OWNER_RENDV_TUNNEL	8	// Our tunnel to our rendavous node
+#define FD_OWNER_RENDV_CLIENT	9	// Tunnel from a node we are rendavous for
+#define FD_OWNER_TCP_PROBE		10
+#define FD_OWNER_DNS_PROBE		11
+#define FD_OWNER_REPLACE		12	// Finished ring replacement searches
+#define FD_OWNER_INBOX			13	// Messages from the other workers
+
+//	Types of WorkerMsg
+#define WORKER_MSG_PACKET		1	// Packet owned by the receiving worker
+#define WORKER_MSG_RING_INSERT	2	// Ring mutations, sent to worker 0
+#define WORKER_MSG_RING_ERASE	3
+#define WORKER_MSG_STOP			4
+
+//	Handed from one worker to another through the inbox of the receiver
+struct WorkerMsg {
+	int				type;
+	NodeIdent		remoteNode;		// Sender of packet, or the ring member
+	NodeIdent		rendvNode;		// Rendavous of the inserted member
+	u_int			latencyUS;		// Latency of the inserted member
+	RealPacket*		packet;			// Copy of the packet, now owned by the
+									// receiver
+};
 
 //	Contains the majority of the non-membership state of the node
 class MeridianProcess {
@@ -41,13 +97,14 @@ private:
 	u_int		g_ssGossipInterval_s;		// Steady state gossip period
 	u_int		g_replaceInterval_s;		// Ring replacement period
 	
-	fd_set		g_readSet;			// Read set for main select loop
-	fd_set 		g_writeSet;			// Write set for main select loop
-	int			g_maxFD;			// Keeps track of the largest FD in select	
+	EventSet	g_events;			// Fds watched by the main event loop
 	NodeIdent	g_rendvNode;		// Rendavous node for this node. {0,0} means
 									// this node does not need one
 									
 	RingSet*	g_rings;			// Rings for this node		
+	RingReplacer	g_replacer;		// Runs the ring replacement searches
+	vector<RingLatencyMatrix>	g_ringMatrices;	// Latencies between ring
+									// members, kept across replacements
 	uint32_t	g_localAddr;		// IP address of this node
 	int			g_stopFD;			// File descriptor used to stop the process
 	QueryTable	g_queryTable;		// Table that keeps track of all active 
@@ -83,10 +140,64 @@ private:
 	map<int, list<RealPacket*>*> 		g_rendvQueue;
 	RealPacket*							g_rendvRecvPacket; 
 	
+	//	Batched I/O on the Meridian port. The receive buffers are allocated
+	//	once in start and reused for every recvmmsg
+	u_int								g_udpBatchSize;
+	vector<char>						g_recvBufs;
+	vector<struct mmsghdr>				g_recvMsgs;
+	vector<struct iovec>				g_recvIOV;
+	vector<struct sockaddr_in>			g_recvAddrs;
+	vector<struct mmsghdr>				g_sendMsgs;
+	vector<struct iovec>				g_sendIOV;		// Two per message
+	vector<struct sockaddr_in>			g_sendAddrs;
+	vector<char>						g_pushHeaders;	// One per message
+	uint64_t							g_udpRecvCalls;
+	uint64_t							g_udpRecvPackets;
+	uint64_t							g_udpSendCalls;
+	uint64_t							g_udpSendPackets;
+	
+	//	Probes in flight, keyed on probe type and target, mapping to the qid
+	//	of the probe. Requests for a target already being probed subscribe
+	//	to the existing probe rather than starting a new one
+	map<uint64_t, uint64_t>				g_inflightProbes;
+	uint64_t							g_probesStarted;
+	uint64_t							g_probesCoalesced;
+	
+	//	Warm restart. Ring members restored from the snapshot are re-pinged
+	//	a few at a time, dropping the ones that no longer answer
+	string								g_snapshotFile;	// Empty if disabled
+	SnapshotWriter						g_snapshotWriter;	// Periodic saves
+	vector<NodeIdentRendv>				g_revalidateNodes;
+	u_int								g_revalidatePos;
+	struct timeval						g_startTime;
+	int									g_usefulRingMS;	// Time from start
+									// until the rings had a member, -1 if not
+									// yet
+	
+	//	Workers each run an event loop on their own socket bound to the
+	//	Meridian port. Worker 0, the one start was called on, owns the rings
+	//	and all node wide state: gossip, ring management, snapshots, the 
+	//	info service, rendavous tunnels, DSL and ICMP. The other workers
+	//	only run queries. Packets are passed to the worker that owns their
+	//	query id, and ring mutations are passed to worker 0
+	u_int								g_numWorkers;
+	u_int								g_workerIndex;
+	MeridianProcess*					g_owner;		// Worker 0
+	vector<MeridianProcess*>			g_workers;		// All, worker 0 only
+	vector<pthread_t>					g_workerThreads;
+	RingPublisher*						g_ringPublisher;	// Worker 0 only
+	bool								g_ringsDirty;	// Not yet published
+	pthread_mutex_t						g_inboxLock;	// Protects the inbox
+	list<WorkerMsg>						g_inbox;
+	bool								g_inboxNotified;	// Byte in the pipe
+	int									g_inboxPipe[2];
+	bool								g_sharedCache;
+	uint64_t							g_packetsForwarded;
+	
 #ifdef MERIDIAN_DSL	
-	int									g_dummySock;
-	list<uint64_t> 						g_psList;
+	DSLScheduler						g_dslScheduler;
 	uint16_t							g_max_ttl;
+	ProgramCache*						g_programCache;	// Worker 0 only
 #endif
 
 #ifdef PLANET_LAB_SUPPORT
@@ -97,9 +208,36 @@ private:
 #endif
 	
 private:
+	//	Worker in_index of in_owner. Takes the configuration of in_owner,
+	//	shares its rings and creates its own caches
+	MeridianProcess(MeridianProcess* in_owner, u_int in_index);
+	
 	//	Create a TCP listener and return the FD
 	static int createTCPListener(u_short port);
 	
+	//	Create and bind the Meridian UDP socket, and set up the buffers for
+	//	batched I/O on it
+	int openMeridSocket();
+	
+	//	Run the event loop until stopped. Returns -1 on error
+	int runEventLoop();
+	
+	//	Start and stop the workers other than worker 0
+	int startWorkers();
+	void stopWorkers();
+	static void* workerMain(void* arg);
+	int runWorker();
+	
+	//	Index of the worker that must handle a packet
+	u_int packetOwner(char queryType, uint64_t queryID) const;
+	
+	//	Queue msg for worker in_index and wake it up if needed
+	int postToWorker(u_int in_index, const WorkerMsg& msg);
+	
+	//	Handle everything queued by the other workers. Returns -1 if the
+	//	worker was asked to stop
+	int handleInbox();
+	
 	//	Performs a TCP connect on the socket to the addr:port
 	static int performConnect(int sendSock, uint32_t addr, uint16_t port);
 	
@@ -117,11 +255,24 @@ private:
 	//	performed due to the timeout
 	int evaluateTimeout();
 	
-	//	Handle all active info/TCP/DNS connections
-	int handleInfoConnections(fd_set* curReadSet, fd_set* curWriteSet);
-	int handleTCPConnections(fd_set* curReadSet, fd_set* curWriteSet);
-	int handleDNSConnections(fd_set* curReadSet, fd_set* curWriteSet);
-	int handleRendavous(fd_set* curReadSet, fd_set* curWriteSet);	
+	//	Dispatch a ready fd to its owner. Returns -1 if the main loop
+	//	should exit
+	int handleEvent(int fd, u_int owner, u_int events);
+	
+	//	Handle a ready info/TCP/DNS connection
+	int handleInfoListener();
+	int handleInfoConnection(int fd, u_int events);
+	int handleTCPConnection(int fd);
+	int handleDNSConnection(int fd);
+	void checkUsefulRing();
+	int eraseInfoConnection(
+		const list<pair<int, RealPacket*>*>::iterator& conIt);
+	
+	//	Handle the rendavous tunnel (client side), and the listener and
+	//	tunnels of nodes we are a rendavous for (server side)
+	int handleRendavousTunnel();
+	int handleRendavousListener();
+	int handleRendavousClient(int fd);	
 	
 	//	Creates an information packet	
 	int getInfoPacket(RealPacket& inPacket);
@@ -131,37 +282,34 @@ private:
 	template <class U, class T> int handleMeasureReq(
 			const NodeIdent& remoteNode, const char* buf, int numBytes) {
 		WARN_LOG("Received a REQ_PING/REQ_PING_TCP packet\n");
-		ReqGeneric* tmp = ReqGeneric::parse<U>(buf, numBytes);
-		if (tmp != NULL) {
-			const vector<NodeIdent>* tmpVect =
-				tmp->returnTargets();
-			if (tmpVect->size() == 0) {
-				// If num targets is 0, just return empty RET_PING
-				RetPing retPacket(tmp->retReqID());
-				NodeIdentRendv rNodeRendv = { 
-					remoteNode.addr, remoteNode.port, 
-					tmp->getRendvAddr(), tmp->getRendvPort() };														
-				RealPacket* inPacket = 
-					new RealPacket(rNodeRendv);
-				if (retPacket.createRealPacket(*inPacket) == -1) {
-					delete inPacket;						
-				} else {
-					addOutPacket(inPacket);
-				}									
+		ReqView tmp;
+		if (tmp.init<U>(buf, numBytes) == -1) {
+			return 0;
+		}
+		NodeIdentRendv rNodeRendv = { 
+			remoteNode.addr, remoteNode.port, 
+			tmp.getRendvAddr(), tmp.getRendvPort() };
+		if (tmp.getTargets().size() == 0) {
+			// If num targets is 0, just return empty RET_PING
+			RetPing retPacket(tmp.retReqID());
+			RealPacket* inPacket = 
+				new RealPacket(rNodeRendv);
+			inPacket->setWireVersion(
+				PeerWireVersion::get(remoteNode.addr, remoteNode.port));
+			if (retPacket.createRealPacket(*inPacket) == -1) {
+				delete inPacket;						
 			} else {
-				WARN_LOG("Parsed correctly by ReqMeasureGeneric\n");
-				NodeIdentRendv rNodeRendv = { 
-					remoteNode.addr, remoteNode.port, 
-					tmp->getRendvAddr(), tmp->getRendvPort() };
-				Query* reqQ = 
-					new T(tmp->retReqID(), rNodeRendv, *tmpVect, this);
-				if (g_queryTable.insertNewQuery(reqQ) == -1) {			
-					delete reqQ;
-				} else {
-					reqQ->init();
-				}
+				addOutPacket(inPacket);
+			}									
+		} else {
+			WARN_LOG("Parsed correctly by ReqMeasureGeneric\n");
+			Query* reqQ = 
+				new T(tmp.retReqID(), rNodeRendv, tmp.getTargets(), this);
+			if (g_queryTable.insertNewQuery(reqQ) == -1) {			
+				delete reqQ;
+			} else {
+				reqQ->init();
 			}
-			delete tmp;	// Finished with the REQ_PING packet
 		}
 		return 0;				
 	}
@@ -175,16 +323,15 @@ private:
 			g_queryTable.notifyQPacket(
 				queryID, remoteNode, buf, numBytes);						
 		} else {									
-			ReqClosestGeneric* tmp = ReqClosestGeneric::
-				parse<U>(buf, numBytes);						
-			if (tmp != NULL) {						
+			ReqView tmp;
+			if (tmp.init<U>(buf, numBytes) != -1) {						
 				//	Add remote node to ring
 				NodeIdentRendv remoteNodeRendv = { 
 					remoteNode.addr, remoteNode.port, 
-					tmp->getRendvAddr(), tmp->getRendvPort() };
-				T* newQuery	= new T(queryID, tmp->getBetaNumerator(), 
-						tmp->getBetaDenominator(), remoteNodeRendv,
-						*(tmp->returnTargets()), this);						
+					tmp.getRendvAddr(), tmp.getRendvPort() };
+				T* newQuery	= new T(queryID, tmp.getBetaNumerator(), 
+						tmp.getBetaDenominator(), remoteNodeRendv,
+						tmp.getTargets(), this);						
 				if (newQuery != NULL) {
 					if (g_queryTable.insertNewQuery(newQuery) == -1) {			
 						delete newQuery;								
@@ -192,7 +339,6 @@ private:
 						newQuery->init();
 					}
 				}
-				delete tmp;	// Finished with gossip packet						
 			}
 		}
 		return 0;		
@@ -207,16 +353,15 @@ private:
 			g_queryTable.notifyQPacket(
 				queryID, remoteNode, buf, numBytes);						
 		} else {									
-			ReqConstraintGeneric* tmp = ReqConstraintGeneric::
-				parse<U>(buf, numBytes);						
-			if (tmp != NULL) {						
+			ReqView tmp;
+			if (tmp.init<U>(buf, numBytes) != -1) {						
 				//	Add remote node to ring
 				NodeIdentRendv remoteNodeRendv = { 
 					remoteNode.addr, remoteNode.port, 
-					tmp->getRendvAddr(), tmp->getRendvPort() };
-				T* newQuery	= new T(queryID, tmp->getBetaNumerator(), 
-						tmp->getBetaDenominator(), remoteNodeRendv,
-						*(tmp->returnTargets()), this);						
+					tmp.getRendvAddr(), tmp.getRendvPort() };
+				T* newQuery	= new T(queryID, tmp.getBetaNumerator(), 
+						tmp.getBetaDenominator(), remoteNodeRendv,
+						tmp.getTargets(), this);						
 				if (newQuery != NULL) {
 					if (g_queryTable.insertNewQuery(newQuery) == -1) {			
 						delete newQuery;								
@@ -224,7 +369,6 @@ private:
 						newQuery->init();
 					}
 				}
-				delete tmp;	// Finished with gossip packet						
 			}
 		}
 		return 0;		
@@ -244,6 +388,10 @@ private:
 		
 	int createRendavousTunnel(const NodeIdent& rendvNode);
 	
+	//	Drop the tunnel, and anything received on it not yet handled, and
+	//	connect to the rendavous node again. Returns -1 if it cannot
+	int resetRendavousTunnel();
+	
 	int removeRendavousConnection(	
 		map<NodeIdent, int, ltNodeIdent>::iterator& in_it);
 		
@@ -254,16 +402,25 @@ private:
 	int addICMPOutPacket(RealPacket* in_packet);	
 	void icmpWritePending();	
 	int readICMPPacket();
+	int handleICMPPacket(char* buf, int numBytes, const NodeIdent& remoteNode);
+#endif
+
+#ifdef MERIDIAN_DSL
+	//	Runs the runnable DSL threads for up to DSL_TURN_NS. Called from the
+	//	event loop, which does not block while threads are runnable
+	void runDSLThreads();
 #endif
 	
 public:
 	
 	// Only constructor for a meridian process. Must specify meridian port,
-	// ring size, exponetial base, and file descriptor that causes the process
+	// ring size, exponetial base, number of rings, radius of the innermost
+	// ring, and file descriptor that causes the process
 	// to end. NOTE: An info_port value of 0 means that the information 
 	// service is not started.
 	MeridianProcess(u_short meridian_port, u_short info_port, u_int prim_size,
-					u_int second_size, int ring_base, int stopFD);
+					u_int second_size, int ring_base, u_int num_rings, 
+					u_int min_ring_radius_us, int stopFD);
 	
 	// Default destructor, cleans up all resources and closes all sockets
 	~MeridianProcess();
@@ -313,15 +470,42 @@ public:
 	
 	//	Sends a RealPacket using the provided socket
 	static int performSend(int sock, RealPacket* in_packet);
+	
+	//	Fills in the PUSH header and the iovecs of a packet destined to a
+	//	node behind a rendavous node. The packet itself is not copied.
+	//	Returns -1 if the PUSH packet would be too large
+	static int preparePush(const RealPacket* in_packet, char* header, 
+		struct iovec* iov, struct sockaddr_in* rendvAddr);
 #ifdef PLANET_LAB_SUPPORT	
 	static int performSendICMP(int sock, RealPacket* in_packet);
 #endif
 	
+	//	Ring mutations. Performed by worker 0 on its own copy of the rings
+	//	and published at the next turn of its event loop, other workers
+	//	pass them on to worker 0
+	int ringInsertNode(const NodeIdent& inNode, u_int latencyUS, 
+		const NodeIdent& rendvNode);
+	int ringEraseNode(const NodeIdent& inNode);
+	
+	//	Latest published copy of the rings, readable by any worker without
+	//	locking. It must be released before the worker returns to its event
+	//	loop. Worker 0 may read its own rings through getRings instead
+	const RingSet* acquireRings() {
+		return &(g_owner->g_ringPublisher->acquire(g_workerIndex)->rings);
+	}
+	void releaseRings()	{ g_owner->g_ringPublisher->release(g_workerIndex); }
+	void ringsChanged()	{ g_ringsDirty = true;	}
+	bool isRingOwner() const	{ return g_workerIndex == 0;	}
+	
 	//	Allows queries that get access to the query table and ring set if they
 	//	have access to the meridian process.
 	//	TODO: These break abstractions, need to re-factor later 					
 	QueryTable* getQueryTable() 	{ return &g_queryTable;	}	
 	RingSet* getRings() 			{ return g_rings; 		}
+	RingLatencyMatrix* getRingMatrix(int ringNum) {
+		assert(ringNum >= 0 && ringNum < (int)g_ringMatrices.size());
+		return &(g_ringMatrices[ringNum]);
+	}
 	
 	//	Add a new TCP/DNS connection that is keyed on the qid to the 
 	//	provided remoteNode
@@ -338,6 +522,21 @@ public:
 	//	Get a querid id that is not currently in use
 	uint64_t getNewQueryID();
 	
+	//	Subscribes in_subscriber to the latency of a probe to the target of
+	//	newQuery. If a probe of the same type to that target is in flight,
+	//	newQuery is deleted and the existing probe is used, otherwise newQuery
+	//	is inserted into the query table and started. Returns -1 on error
+	int startProbe(ProbeQueryGeneric* newQuery, uint64_t in_subscriber);
+	
+	//	Called by a probe once it stops accepting subscribers
+	void probeFinished(const ProbeQueryGeneric* in_probe);
+	
+	//	Fraction of probe requests served by a probe already in flight
+	double probeCoalescingRate() const {
+		uint64_t total = g_probesStarted + g_probesCoalesced;
+		return total ? (double)g_probesCoalesced / total : 0.0;
+	}
+	
 	//	Sets the gossip interval
 	void setGossipInterval(u_int initial_s,	
 			u_int initial_length, u_int steady_state_s) {
@@ -351,6 +550,40 @@ public:
 		g_replaceInterval_s = seconds; 
 	}
 	
+	//	Sets the number of event loops sharing the Meridian port
+	void setNumWorkers(u_int in_num) {
+		g_numWorkers = MAX(1, MIN(in_num, MAX_NUM_WORKERS));
+	}
+	
+	//	Worker owning a query id. Ids created by getNewQueryID carry the
+	//	index of the creating worker in their low 16 bits. Ids of requests
+	//	created by other nodes are random there, and spread evenly
+	u_int queryShard(uint64_t queryID) const {
+		return (queryID & 0xffff) % g_numWorkers;
+	}
+	
+	//	Sets the maximum number of packets read or written on the Meridian
+	//	port with a single system call
+	void setUDPBatchSize(u_int in_size) {
+		g_udpBatchSize = MAX(1, MIN(in_size, MAX_UDP_BATCH_SIZE));
+	}
+	
+	//	Share the TCP, DNS and ICMP probe caches with the other Meridian
+	//	processes on this host. Meridian ping latencies depend on the
+	//	application and stay private. Returns -1 if any cache could not
+	//	be shared, that cache then stays private
+	int useSharedLatencyCache();
+	
+	//	Average number of packets moved per recvmmsg/sendmmsg call
+	double recvPacketsPerCall() const {
+		return g_udpRecvCalls ? 
+			(double)g_udpRecvPackets / g_udpRecvCalls : 0.0;
+	}
+	double sendPacketsPerCall() const {
+		return g_udpSendCalls ? 
+			(double)g_udpSendPackets / g_udpSendCalls : 0.0;
+	}
+	
 	//	Sets the rendavous node for this node. {0,0} means no rendavous node
 	void setRendavousNode(uint32_t addr, uint16_t port) {
 		g_rendvNode.addr = addr;
@@ -374,20 +607,60 @@ public:
 	//	Start a ring management session
 	int performRingManagement();		
 	
+	//	Freeze the ring of job and run the search on a worker, or right away
+	//	if there are no workers. The job is applied to the ring (and the ring
+	//	unfrozen) once done. Takes ownership of job
+	int submitReplacement(ReplaceJob* job);
+	void applyReplacement(ReplaceJob* job);
+	
+	//	Write the rings and latency caches to the snapshot file. Only the
+	//	encoding happens here if the snapshot writer is running
+	int saveSnapshot();
+	
+	//	Re-ping the next few ring members restored from the snapshot.
+	//	Returns the number still left to re-ping
+	int performRevalidation();
+	
+	//	Rings and latency caches are restored from this file on start, and
+	//	written to it periodically and on stop
+	void setSnapshotFile(const char* path) {
+		g_snapshotFile = (path != NULL) ? path : "";
+	}
+	
 	//	Starts the meridian process. Process blocks until the stopFD is written
-	//	NOTE: Calls to addSeedNode, setReplaceInterval, and setGossipInterval 
-	//	are ignored after a call to start (this may change in the future)
+	//	NOTE: Calls to addSeedNode, setReplaceInterval, setUDPBatchSize, 
+	//	setNumWorkers, setSnapshotFile and setGossipInterval are ignored 
+	//	after a call to start (this may change in the future)
 	int start();
 #ifdef MERIDIAN_DSL
+	//	Makes the DSL thread of the query runnable
 	void addPS(uint64_t in_id) {
-		g_psList.push_back(in_id);
-		FD_SET(g_dummySock, &g_writeSet);
-		g_maxFD = MAX(g_dummySock, g_maxFD);		
+		DSLRecvQuery* thisQ = g_queryTable.getDSLRecvQ(in_id);
+		if (thisQ != NULL) {
+			g_dslScheduler.wake(in_id, thisQ->getThreadState());
+		}
 	}
 #define DEFAULT_MAX_TTL		500	
 	void setMaxTTL(uint16_t in_ttl) {
 		g_max_ttl = in_ttl;	
 	}
+	
+	//	Parsed programs of incoming DSL requests. NULL except on worker 0,
+	//	which runs all the DSL threads
+	ProgramCache* getProgramCache() {
+		return g_programCache;
+	}
+	
+	//	Memory used by parsed programs, DEFAULT_PROGRAM_CACHE_SIZE by
+	//	default. 0 disables caching. The cache lives on worker 0, so the
+	//	call goes there whichever worker it is made on. Like the other
+	//	settings, make it before start
+	void setProgramCacheSize(u_int in_bytes) {
+		ProgramCache* cache = g_owner->g_programCache;
+		if (cache != NULL) {
+			cache->setMaxSize(in_bytes);
+		}
+	}
 #endif
 
 #ifdef PLANET_LAB_SUPPORT
@@ -0,0 +1,52 @@
+/******************************************************************************
+Meridian prototype distribution
+Copyright (C) 2005 Bernard Wong
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+The copyright owner can be contacted by e-mail at bwong@cs.cornell.edu
+*******************************************************************************/
+
+using namespace std;
+
+#include "Pool.h"
+
+FreeListPool::~FreeListPool() {
+	for (u_int i = 0; i < freeList.size(); i++) {
+		free(freeList[i]);
+	}
+}
+
+SizeClassPool::SizeClassPool() : numOversize(0) {
+	for (u_int i = 0; i < POOL_MAX_OBJECT_SIZE / POOL_GRANULARITY; i++) {
+		pools[i].setObjectSize((i + 1) * POOL_GRANULARITY);
+	}
+}
+
+uint64_t SizeClassPool::getNumHits() const {
+	uint64_t total = 0;
+	for (u_int i = 0; i < POOL_MAX_OBJECT_SIZE / POOL_GRANULARITY; i++) {
+		total += pools[i].getNumHits();
+	}
+	return total;
+}
+
+uint64_t SizeClassPool::getNumMisses() const {
+	uint64_t total = numOversize;
+	for (u_int i = 0; i < POOL_MAX_OBJECT_SIZE / POOL_GRANULARITY; i++) {
+		total += pools[i].getNumMisses();
+	}
+	return total;
+}
@@ -0,0 +1,105 @@
+#ifndef CLASS_POOL
+#define CLASS_POOL
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <new>
+#include <vector>
+
+//	Objects up to this size are served from per-size free lists, rounded
+//	up to the granularity. Larger ones go straight to malloc
+#define POOL_GRANULARITY		16
+#define POOL_MAX_OBJECT_SIZE	1024
+//	Released objects beyond this many per list are freed instead of kept
+#define POOL_MAX_FREE			4096
+
+//	Free list of fixed size blocks. Not thread safe, each event loop thread
+//	uses its own
+class FreeListPool {
+private:
+	vector<void*>	freeList;
+	size_t			objSize;
+	u_int			maxFree;
+	uint64_t		numHits;	// Served from the free list
+	uint64_t		numMisses;	// Had to malloc
+
+public:
+	FreeListPool(size_t in_objSize = 0, u_int in_maxFree = POOL_MAX_FREE)
+		: objSize(in_objSize), maxFree(in_maxFree), numHits(0), numMisses(0) {}
+	~FreeListPool();
+
+	void setObjectSize(size_t in_objSize)	{ objSize = in_objSize;	}
+
+	void* alloc() {
+		if (!freeList.empty()) {
+			numHits++;
+			void* obj = freeList.back();
+			freeList.pop_back();
+			return obj;
+		}
+		numMisses++;
+		void* obj = malloc(objSize);
+		if (obj == NULL) {
+			throw std::bad_alloc();
+		}
+		return obj;
+	}
+
+	void release(void* obj) {
+		if (obj == NULL) {
+			return;
+		}
+		if (freeList.size() < maxFree) {
+			freeList.push_back(obj);
+		} else {
+			free(obj);
+		}
+	}
+
+	uint64_t getNumHits() const		{ return numHits;			}
+	uint64_t getNumMisses() const	{ return numMisses;			}
+	u_int getNumFree() const		{ return freeList.size();	}
+};
+
+//	Pools for objects of varying size, one free list per size class. Used
+//	as the backing store of class specific operator new/delete, where the
+//	size of the most derived type is passed to both
+class SizeClassPool {
+private:
+	FreeListPool	pools[POOL_MAX_OBJECT_SIZE / POOL_GRANULARITY];
+	uint64_t		numOversize;
+
+	static u_int sizeClass(size_t size) {
+		return (size - 1) / POOL_GRANULARITY;
+	}
+
+public:
+	SizeClassPool();
+
+	void* alloc(size_t size) {
+		if (size == 0 || size > POOL_MAX_OBJECT_SIZE) {
+			numOversize++;
+			void* obj = malloc(size);
+			if (obj == NULL) {
+				throw std::bad_alloc();
+			}
+			return obj;
+		}
+		return pools[sizeClass(size)].alloc();
+	}
+
+	void release(void* obj, size_t size) {
+		if (size == 0 || size > POOL_MAX_OBJECT_SIZE) {
+			free(obj);
+			return;
+		}
+		pools[sizeClass(size)].release(obj);
+	}
+
+	uint64_t getNumHits() const;
+	//	Includes allocations too large to be pooled
+	uint64_t getNumMisses() const;
+};
+
+#endif
@@ -0,0 +1,177 @@
+/******************************************************************************
+Meridian prototype distribution
+Copyright (C) 2005 Bernard Wong
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+The copyright owner can be contacted by e-mail at bwong@cs.cornell.edu
+*******************************************************************************/
+
+using namespace std;
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/evp.h>
+#include "ProgramCache.h"
+#include "MeridianDSL.h"
+
+//	Memory charged per AST node on top of the node itself, for the var
+//	table bookkeeping and the strings and vectors hanging off the nodes
+#define PROGRAM_AST_OVERHEAD	32
+
+CachedProgram::CachedProgram(const ProgramHash& in_hash) 
+	: 	hash(in_hash), parsed(NULL), compBuf(NULL), compSize(0), 
+		textSize(0), memSize(0), refCount(0), cached(false) {}
+
+CachedProgram::~CachedProgram() {
+	if (parsed) delete parsed;
+	if (compBuf) free(compBuf);
+}
+
+ASTNode* CachedProgram::getStart() {
+	return parsed->get_start();
+}
+
+ProgramCache::~ProgramCache() {
+	list<CachedProgram*>::iterator it = lru.begin();
+	for (; it != lru.end(); it++) {
+		(*it)->cached = false;
+		(*it)->release();	// Entries in use live on until released
+	}
+}
+
+int ProgramCache::hashProgram(
+		const char* in_text, u_int in_size, ProgramHash* out_hash) {
+	if (EVP_Digest(in_text, in_size, 
+			out_hash->bytes, NULL, EVP_sha256(), NULL) != 1) {
+		ERROR_LOG("hashProgram: SHA-256 digest failed\n");
+		return -1;
+	}
+	return 0;
+}
+
+CachedProgram* ProgramCache::find(const ProgramHash& in_hash) {
+	map<ProgramHash, list<CachedProgram*>::iterator, ltProgramHash>::iterator
+		it = index.find(in_hash);
+	if (it == index.end()) {
+		return NULL;
+	}
+	//	Move to the front, the iterator stays valid
+	lru.splice(lru.begin(), lru, it->second);
+	return *(it->second);
+}
+
+void ProgramCache::evict(u_int in_needed) {
+	while (!lru.empty() && memUsed + in_needed > maxMem) {
+		CachedProgram* oldest = lru.back();
+		lru.pop_back();
+		index.erase(oldest->hash);
+		memUsed -= oldest->memSize;
+		oldest->cached = false;
+		oldest->release();
+		numEvictions++;
+	}
+}
+
+CachedProgram* ProgramCache::parse(
+		ParserState* ps, const ProgramHash& in_hash) {
+	u_int textSize = ps->input_buffer.get_buf_size();
+	CachedProgram* entry = new CachedProgram(in_hash);
+	entry->parsed = new ParserState();
+	if (entry->parsed->input_buffer.create_buffer(textSize) == -1) {
+		delete entry;
+		return NULL;
+	}
+	memcpy(entry->parsed->input_buffer.get_raw_buf(), 
+		ps->input_buffer.get_raw_buf(), textSize);
+	g_parser_line = 1;	// Reset line count for parser
+	if (yyparse((void*)(entry->parsed)) == -1) {
+		delete entry;
+		return NULL;	// Parse error
+	}
+	//	Compressed once here for every RPC the program makes
+	if (compress_program(entry->parsed->input_buffer.get_raw_buf(), 
+			textSize, &(entry->compBuf), &(entry->compSize)) == -1) {
+		delete entry;
+		return NULL;
+	}
+	//	The AST holds copies of the identifiers and literals
+	entry->parsed->input_buffer.delete_buffer();
+	entry->textSize = textSize;
+	entry->memSize = textSize + entry->compSize + 
+		entry->parsed->getASTAllocationCount() * 
+			(sizeof(ASTNode) + PROGRAM_AST_OVERHEAD);
+	if (entry->memSize > maxMem) {
+		return entry;	// Run once without caching
+	}
+	evict(entry->memSize);
+	lru.push_front(entry);
+	index[in_hash] = lru.begin();
+	memUsed += entry->memSize;
+	entry->cached = true;
+	entry->addRef();	// Reference held by the cache
+	return entry;
+}
+
+int ProgramCache::attach(ParserState* ps) {
+	ProgramHash hash;
+	if (ps->by_hash()) {
+		hash = ps->get_source_hash();
+	} else {
+		if (hashProgram(ps->input_buffer.get_raw_buf(), 
+				ps->input_buffer.get_buf_size(), &hash) == -1) {
+			return -1;
+		}
+	}
+	CachedProgram* entry = find(hash);
+	if (entry != NULL) {
+		numHits++;
+	} else {
+		numMisses++;
+		if (ps->by_hash()) {
+			return -1;	// Sender has to send the text
+		}
+		if ((entry = parse(ps, hash)) == NULL) {
+			return -1;
+		}
+	}
+	ps->set_source(entry);
+	return 0;
+}
+
+void ProgramCache::setMaxSize(u_int in_max_mem) {
+	maxMem = in_max_mem;
+	evict(0);
+}
+
+void ProgramCache::setPeerProgram(
+		const NodeIdent& in_peer, const ProgramHash& in_hash) {
+	if (peerPrograms.size() >= MAX_PROGRAM_PEERS) {
+		peerPrograms.clear();
+	}
+	peerPrograms.insert(PeerProgram(in_peer, in_hash));
+}
+
+bool ProgramCache::peerHasProgram(
+		const NodeIdent& in_peer, const ProgramHash& in_hash) const {
+	return peerPrograms.find(PeerProgram(in_peer, in_hash)) 
+		!= peerPrograms.end();
+}
+
+void ProgramCache::erasePeerProgram(
+		const NodeIdent& in_peer, const ProgramHash& in_hash) {
+	peerPrograms.erase(PeerProgram(in_peer, in_hash));
+}
@@ -0,0 +1,113 @@
+#ifndef CLASS_PROGRAM_CACHE
+#define CLASS_PROGRAM_CACHE
+
+#include <string.h>
+#include <sys/types.h>
+#include <list>
+#include <map>
+#include <set>
+#include "MQLState.h"
+
+//	Memory the cache may use for parsed programs and their text
+#define DEFAULT_PROGRAM_CACHE_SIZE	(4 * 1024 * 1024)
+//	The table of programs known to be cached by each peer is cleared when
+//	full. The requests fall back to the full text until the peers confirm
+//	again
+#define MAX_PROGRAM_PEERS			65536
+
+//	A parsed DSL program shared by every ParserState running it. The AST
+//	is owned by a ParserState used only for parsing. The compressed text is
+//	kept so RPCs to other nodes do not compress it again. Entries are
+//	reference counted, an entry evicted from the cache stays alive until
+//	the last ParserState using it is deleted
+class CachedProgram {
+friend class ProgramCache;
+private:
+	ProgramHash		hash;
+	ParserState*	parsed;
+	char*			compBuf;
+	u_int			compSize;
+	u_int			textSize;
+	u_int			memSize;	// Approximate memory used by the entry
+	u_int			refCount;
+	bool			cached;		// Still in the cache
+
+	CachedProgram(const ProgramHash& in_hash);
+	~CachedProgram();
+public:
+	const ProgramHash& getHash() const		{ return hash;		}
+	bool isCached() const					{ return cached;	}
+	u_int getTextSize() const				{ return textSize;	}
+	ASTNode* getStart();
+	const char* getCompressed(u_int* out_size) const {
+		*out_size = compSize;
+		return compBuf;
+	}
+	void addRef()							{ refCount++;		}
+	void release() {
+		if (--refCount == 0) {
+			delete this;
+		}
+	}
+};
+
+//	Programs of incoming DSL_REQUEST packets, keyed by the SHA-256 of their
+//	text, in least recently used order. A request for a cached program
+//	skips decompression and parsing. Also remembers which peers confirmed
+//	having a program, so that requests to them only carry the hash
+class ProgramCache {
+private:
+	list<CachedProgram*>		lru;	// Most recently used first
+	map<ProgramHash, list<CachedProgram*>::iterator, ltProgramHash>	index;
+	typedef pair<NodeIdent, ProgramHash>	PeerProgram;
+	struct ltPeerProgram {
+		bool operator()(const PeerProgram& s1, const PeerProgram& s2) const {
+			if (s1.first.addr != s2.first.addr) {
+				return s1.first.addr < s2.first.addr;
+			}
+			if (s1.first.port != s2.first.port) {
+				return s1.first.port < s2.first.port;
+			}
+			return memcmp(s1.second.bytes,
+				s2.second.bytes, PROGRAM_HASH_SIZE) < 0;
+		}
+	};
+	set<PeerProgram, ltPeerProgram>	peerPrograms;
+	u_int						memUsed;
+	u_int						maxMem;
+	u_int						numHits;
+	u_int						numMisses;
+	u_int						numEvictions;
+
+	CachedProgram* find(const ProgramHash& in_hash);
+	CachedProgram* parse(ParserState* ps, const ProgramHash& in_hash);
+	void evict(u_int in_needed);
+public:
+	ProgramCache(u_int in_max_mem) : memUsed(0), maxMem(in_max_mem),
+		numHits(0), numMisses(0), numEvictions(0) {}
+	~ProgramCache();
+
+	//	SHA-256 of the program text. Returns -1 on failure
+	static int hashProgram(
+		const char* in_text, u_int in_size, ProgramHash* out_hash);
+
+	//	Points ps at the parsed form of its program, parsing the text in
+	//	ps->input_buffer on a miss. If ps was sent the hash only, fails
+	//	when the program is not cached. Returns -1 on failure
+	int attach(ParserState* ps);
+
+	void setMaxSize(u_int in_max_mem);
+	void setPeerProgram(const NodeIdent& in_peer, const ProgramHash& in_hash);
+	bool peerHasProgram(
+		const NodeIdent& in_peer, const ProgramHash& in_hash) const;
+	void erasePeerProgram(
+		const NodeIdent& in_peer, const ProgramHash& in_hash);
+
+	u_int getNumPrograms() const		{ return lru.size();	}
+	u_int getMemUsed() const			{ return memUsed;		}
+	u_int getNumHits() const			{ return numHits;		}
+	u_int getNumMisses() const			{ return numMisses;		}
+	u_int getNumEvictions() const		{ return numEvictions;	}
+};
+
+#endif
@@ -30,7 +30,17 @@ using namespace std;
 #include "Query.h"
 #include "RingSet.h"
 #include "MeridianProcess.h"
-#include "GramSchmidtOpt.h"
+#include "RingReplacer.h"
+
+//	One pool per thread like the payload pool. Never destroyed, queries 
+//	may still be deleted during exit
+SizeClassPool* Query::pool() {
+	static __thread SizeClassPool* queryPool = NULL;
+	if (queryPool == NULL) {
+		queryPool = new SizeClassPool();
+	}
+	return queryPool;
+}
 
 AddNodeQuery::AddNodeQuery(const NodeIdentRendv& in_remote, 
 							MeridianProcess* in_process) 
@@ -55,8 +65,7 @@ int AddNodeQuery::handleLatency(
 	u_int latencyUS = in_remoteNodes[1].latencyUS;
 	NodeIdent mainRemoteNode = {remoteNode.addr, remoteNode.port};
 	NodeIdent rendvRemoteNode = {remoteNode.addrRendv, remoteNode.portRendv};	
-	meridProcess->getRings()->insertNode(
-		mainRemoteNode, latencyUS, rendvRemoteNode);	
+	meridProcess->ringInsertNode(mainRemoteNode, latencyUS, rendvRemoteNode);	
 	NodeIdentLat outNIL = {remoteNode.addr, remoteNode.port, latencyUS};
 	vector<NodeIdentLat> subVect;
 	subVect.push_back(outNIL);
@@ -88,8 +97,7 @@ int AddNodeQuery::handleEvent(
 		+ curTime.tv_usec - startTime.tv_usec;
 	NodeIdent mainRemoteNode = {remoteNode.addr, remoteNode.port};
 	NodeIdent rendvRemoteNode = {remoteNode.addrRendv, remoteNode.portRendv};	
-	meridProcess->getRings()->insertNode(
-		mainRemoteNode, latencyUS, rendvRemoteNode);			
+	meridProcess->ringInsertNode(mainRemoteNode, latencyUS, rendvRemoteNode);			
 	//meridProcess->getRings()->insertNode(remoteNode, latencyUS);	
 	NodeIdentLat outNIL = {remoteNode.addr, remoteNode.port, latencyUS};
 	vector<NodeIdentLat> subVect;
@@ -107,7 +115,7 @@ int AddNodeQuery::handleEvent(
 int AddNodeQuery::handleTimeout() {
 	WARN_LOG("######################### QUERY TIMEOUT ###################\n");
 	NodeIdent tmpIdent = {remoteNode.addr, remoteNode.port};	
-	meridProcess->getRings()->eraseNode(tmpIdent);		
+	meridProcess->ringEraseNode(tmpIdent);		
 	finished = true;
 	return 0;
 }
@@ -234,6 +242,8 @@ int GossipQuery::handleLatency(
 	if (fillGossipPacket(gPacket, remoteNode, meridProcess) == 0) {
 		WARN_LOG("Creating gossip packet ###############\n");
 		RealPacket* inPacket = new RealPacket(remoteNode);
+		inPacket->setWireVersion(
+			PeerWireVersion::get(remoteNode.addr, remoteNode.port));
 		if (gPacket.createRealPacket(*inPacket) == -1) {
 			delete inPacket;	
 		} else {
@@ -266,7 +276,10 @@ QueryScheduler::QueryScheduler(u_int in_initInterval_MS,
 
 int QueryScheduler::handleTimeout() {
 	WARN_LOG("QueryScheduler activated\n");
-	schedObj->runOnce();
+	if (schedObj->runOnce() == SCHED_STOP) {
+		finished = true;
+		return 0;
+	}
 	computeSchedTimeout();
 	return 0;	
 }
@@ -287,6 +300,18 @@ int SchedRingManage::runOnce() {
 	return 0;	
 }
 
+int SchedRevalidate::runOnce() {
+	if (meridProcess->performRevalidation() == 0) {
+		return SCHED_STOP;	// Nothing left to revalidate
+	}
+	return 0;	
+}
+
+int SchedSnapshot::runOnce() {
+	meridProcess->saveSnapshot();
+	return 0;	
+}
+
 RingManageQuery::RingManageQuery(int in_ringNum, MeridianProcess* in_process) 
 		: 	ringNum(in_ringNum), finished(false), meridProcess(in_process) {
 	qid = meridProcess->getNewQueryID();	
@@ -302,25 +327,31 @@ int RingManageQuery::init() {
 	}
 	meridProcess->getRings()->membersDump(ringNum, remoteNodes);	
 	meridProcess->getRings()->freezeRing(ringNum);	
-	//	Create Req packets to send to each one
-	//	Only send packets to nodes that are not behind firewalls
-	set<NodeIdent, ltNodeIdent>::iterator outerIt = remoteNodes.begin();
-	for (; outerIt != remoteNodes.end(); outerIt++) {				
-		if (meridProcess->getRings()->rendvLookup(*outerIt, dummy) != -1) {			
-			continue; // Requires rendavous, don't add
+	RingLatencyMatrix* ringMatrix = meridProcess->getRingMatrix(ringNum);
+	ringMatrix->retainMembers(remoteNodes);
+	//	Only nodes that are not behind firewalls are measured
+	set<NodeIdent, ltNodeIdent> directNodes;
+	set<NodeIdent, ltNodeIdent>::iterator it = remoteNodes.begin();
+	for (; it != remoteNodes.end(); it++) {
+		if (meridProcess->getRings()->rendvLookup(*it, dummy) == -1) {
+			directNodes.insert(*it);
 		}
+	}
+	//	Create Req packets to send to each one, asking only for the pairs
+	//	that are not in the ring matrix yet or are stale. Nodes with nothing
+	//	to measure still get an empty request, which checks they are alive
+	set<NodeIdent, ltNodeIdent>::iterator outerIt = directNodes.begin();
+	for (; outerIt != directNodes.end(); outerIt++) {				
 		NodeIdent tmpRendvNode = meridProcess->returnRendv();		
 		ReqMeasurePing req(qid, tmpRendvNode.addr, tmpRendvNode.port);
-		set<NodeIdent, ltNodeIdent>::iterator innerIt = remoteNodes.begin();
-		for (; innerIt != remoteNodes.end(); innerIt++) {
-			if (((outerIt->addr == innerIt->addr) &&
-				(outerIt->port == innerIt->port)) || 
-				(meridProcess->getRings()->rendvLookup(*innerIt, dummy) != -1)){
-				continue;
-			}
-			req.addTarget(*innerIt);
+		vector<NodeIdent> targets;
+		ringMatrix->staleTargets(*outerIt, directNodes, targets);
+		for (u_int i = 0; i < targets.size(); i++) {
+			req.addTarget(targets[i]);
 		}
 		RealPacket* inPacket = new RealPacket(*outerIt);
+		inPacket->setWireVersion(
+			PeerWireVersion::get(outerIt->addr, outerIt->port));
 		if (req.createRealPacket(*inPacket) == -1) {
 			delete inPacket;			
 			continue;
@@ -332,7 +363,7 @@ int RingManageQuery::init() {
 
 int RingManageQuery::handleEvent(
 		const NodeIdent& in_remote, const char* inPacket, int packetSize) {
-	if (inPacket[0] != RET_PING_REQ) {
+	if (Packet::baseType(inPacket[0]) != RET_PING_REQ) {
 		ERROR_LOG("Expecting RET_PING_REQ, received somthing else\n");
 		return -1;	// Not RET_PING_REQ packet
 	}
@@ -345,20 +376,24 @@ int RingManageQuery::handleEvent(
 			return -1;					
 		}
 	}
-	RetPing* ret = RetPing::parse(inPacket, packetSize);
-	if (ret == NULL) {
+	RetPingView ret;
+	if (ret.init(inPacket, packetSize) == -1) {
 		ERROR_LOG("RET_PING_REQ Ill-formed\n");
 		return -1;
 	}
-	map<NodeIdent, u_int, ltNodeIdent>* newMap 
-		= new map<NodeIdent, u_int, ltNodeIdent>();	
-	const vector<NodeIdentLat>* retNodes = ret->returnNodes();
-	for (u_int i = 0; i < retNodes->size(); i++) {
-		NodeIdent tmp = {(*retNodes)[i].addr, (*retNodes)[i].port};
+	RingLatencyMatrix* ringMatrix = meridProcess->getRingMatrix(ringNum);
+	NodeListCursor cursor(ret.getNodes());
+	NodeIdentLat retNode;
+	while (cursor.next(&retNode)) {
+		NodeIdent tmp = {retNode.addr, retNode.port};
 		if (remoteNodes.find(tmp) != remoteNodes.end()) {
-			(*newMap)[tmp] = (*retNodes)[i].latencyUS;		
+			ringMatrix->update(in_remote, tmp, retNode.latencyUS);
 		}				
 	}
+	//	The new measurements along with the ones still fresh
+	map<NodeIdent, u_int, ltNodeIdent>* newMap 
+		= new map<NodeIdent, u_int, ltNodeIdent>();	
+	ringMatrix->getRow(in_remote, remoteNodes, *newMap);
 	RetNodeMap[in_remote] = newMap;
 	WARN_LOG_2("remoteNodes has %d entries, RetNodeMap has %d entries\n",
 		remoteNodes.size(), RetNodeMap.size()); 
@@ -369,7 +404,6 @@ int RingManageQuery::handleEvent(
 		performReplacement();
 		finished = true;
 	}
-	delete ret;	// Done with packet
 	return 0;
 }
 
@@ -399,215 +433,20 @@ int RingManageQuery::handleTimeout() {
 		if (RetNodeMap.find(*it) == RetNodeMap.end()) {
 			// Did not receive response back from node, delete it
 			WARN_LOG("############## REQ_PING TIMEOUT ###############\n");
-			meridProcess->getRings()->eraseNode(*it);
+			meridProcess->ringEraseNode(*it);
 			badNodes.push_back(*it);
 		}
 	}
 	for (u_int i = 0; i < badNodes.size(); i++) {
 		removeCandidateNode(badNodes[i]);
 	}	
+	meridProcess->getRingMatrix(ringNum)->retainMembers(remoteNodes);
 	performReplacement();		
 	finished = true;	
 	return 0;
 }
 
 
-double RingManageQuery::getVolume(coordT* points, int dim, int numpoints){
-	boolT ismalloc= False;	/* True if qhull should free points in qh_freeqhull() or reallocation */
-	char flags[250];		/* option flags for qhull, see qh_opt.htm */
-	FILE *outfile= NULL;	/* output from qh_produce_output() use NULL to skip qh_produce_output() */
-	FILE *errfile= NULL;	/* error messages from qhull code */
-	int curlong, totlong;	/* memory remaining after qh_memfreeshort */
-
-	/*	Write these to NULL, we don't want to keep them
-	*/
-	outfile = fopen("/dev/null", "r+");
-	errfile = fopen("/dev/null", "r+");  
-
-	/* Run 1: convex hull
-	*/
-	sprintf(flags, "qhull FA");
-	int exitcode= qh_new_qhull (dim, numpoints, points, ismalloc,
-		flags, outfile, errfile); 
-
-	double returnVolume = 0.0;
-
-	if (exitcode == 0) {
-		returnVolume = qh totvol;
-	} else {
-		ERROR_LOG("Bad exit code for qhull hypervolume computation\n");
-	}
-	fclose(outfile);
-	fclose(errfile);
-
-	qh_freeqhull(!qh_ALL);                   /* free long memory  */
-	qh_memfreeshort (&curlong, &totlong);    /* free short memory and memory allocator */
-	if (curlong || totlong) { 
-		ERROR_LOG_2("qhull internal warning (user_eg, #1): "
-			"did not free %d bytes of long memory "
-			"(%d pieces)\n", totlong, curlong);
-	}
-	return returnVolume;
-}
-
-
-
-/*	Calculates the hypervolume from the latency matrix
-*/
-double RingManageQuery::calculateHV(
-	const int N,			// Physical size of the latencyMatrix
-	const int NPrime,		// Size of the latencyMatrix in use
-	double* latencyMatrix)	// Pointer to latencyMatrix
-{
-	/*	Time to perform Gram Schmidt to reduce the dimension by 1
-	*/
-	GramSchmidtOpt gs(NPrime);
-
-	/*	tmpModMatrix is the latencyMatrix where every row subtracts
-		the last row in the matrix (and the last row is all 0)
-	*/
-	double* tmpModMatrix = 
-		(double*)malloc(sizeof(double) * NPrime * NPrime);
-
-	for (int i = 0; i < NPrime - 1; i++) {
-		// Copy from latencyMatrix to tmpModMatrix
-		cblas_dcopy(NPrime, 
-			&latencyMatrix[i * N], 1, &tmpModMatrix[i * NPrime], 1);
-
-		// Perform the subtraction
-		cblas_daxpy(NPrime, -1.0, &latencyMatrix[(NPrime-1) * N], 
-			1, &tmpModMatrix[i * NPrime] , 1);
-
-		gs.addVector(&tmpModMatrix[i * NPrime]);
-	}
-
-	/*	Zero out last row explictly
-	*/
-	for (int i = 0; i < NPrime; i++) {
-		tmpModMatrix[(NPrime-1) * NPrime + i] = 0.0;
-	}
-			
-	/*	Retrieve the orthogonal matrix that has been computed
-	*/
-	int orthSize;
-	double* orthMatrix = gs.returnOrth(&orthSize);
-
-	/*	Now re-create the latency matrix based on the dot product
-	*/
-	coordT* latencyMatrixMod = 
-		(double*) malloc(sizeof(double) * orthSize * NPrime);
-
-	cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasTrans,
-		NPrime, orthSize, NPrime, 1.0, tmpModMatrix, NPrime, 
-		orthMatrix, NPrime, 0.0, latencyMatrixMod, orthSize);
-
-	free(tmpModMatrix); // No no longer useful, can delete
-
-	/*	Let's get the hypervolume
-	*/
-	double hyperVolume = 
-		getVolume(latencyMatrixMod, orthSize, NPrime);
-
-	free(latencyMatrixMod);	// Done, free memory of intermediate structure
-	return hyperVolume;
-}
-
-
-/*	Used in diverse set formation, it reduces at set of nodes
-	by N nodes, where the remaining nodes have the approximately highest 
-	hypervolume
-*/
-double RingManageQuery::reduceSetByN(
-					vector<NodeIdent>& inVector,	// Vector of nodes
-					vector<NodeIdent>& deletedNodes,
-					int numReduction,				// How many nodes to remove
-					double* latencyMatrix)			// Pointer to latencyMatrix
-{
-	int N = inVector.size();	// Dimension of matrix
-	int colSize = N;
-	int rowSize = N;	
-	double maxHyperVolume = 0.0;
-	//	Perform reductions iteratively
-	for (int rCount = 0; rCount < numReduction; rCount++) {
-		bool maxHVNodeFound	= false;
-		NodeIdent maxHVNode = {0, 0};
-		double maxHV	= 0.0;
-		maxHyperVolume	= 0.0; // Reset		
-
-		/*	Iterate through the nodes
-		*/		
-		for (u_int k = 0; k < inVector.size(); k++) {
-			//if (anchorNodes != NULL && 
-			//		anchorNodes->find(*eIt) != anchorNodes->end()) {
-			//	continue; // We want to skip this anchor, as we can't remove it
-			//}
-			//	Swap out the current working column
-			for (int i = 0; i < rowSize; i++) {
-				double tmpValue = latencyMatrix[i * N + k];
-				latencyMatrix[i * N + k] = latencyMatrix[i * N + colSize - 1];
-				latencyMatrix[i * N + colSize - 1] = tmpValue;
-			}
-			colSize--;			
-			//	And the corresponding row information
-			cblas_dswap(colSize, 
-				&latencyMatrix[k * N], 1, &latencyMatrix[(rowSize-1) * N], 1);
-			rowSize--;
-			assert(rowSize == colSize);
-			//	Calcuate the hypervolume without this node
-			double hyperVolume = calculateHV(N, rowSize, latencyMatrix);
-			/*	See if it is the minimum so far
-				Rationale:	By removing this node, we still have the maxHV
-							comparing to removing any other node. Therefore,
-							we want to remove this node to keep a big HV
-			*/
-			if (hyperVolume >= maxHV) {
-				maxHVNodeFound 	= true;
-				maxHVNode 		= inVector[k];
-				maxHV 			= hyperVolume;
-			}
-			//	The max hypervolume at this reduction level
-			if (hyperVolume > maxHyperVolume) {
-				maxHyperVolume = hyperVolume;
-			}
-			//	Undo row and column swap
-			rowSize++;			 
-			cblas_dswap(colSize, 
-				&latencyMatrix[k * N], 1, &latencyMatrix[(rowSize-1) * N], 1);
-			colSize++;
-			for (int i = 0; i < rowSize; i++) {
-				double tmpValue = latencyMatrix[i * N + k];
-				latencyMatrix[i * N + k] = latencyMatrix[i * N + colSize - 1];
-				latencyMatrix[i * N + colSize - 1] = tmpValue;
-			}
-		}
-		if (maxHVNodeFound == false) {
-			//	Could not reduce any further, all anchors
-			assert(false); // This shouldn't really happen for any valid case 
-			return 0.0;
-		}
-		//	For the node that we have removed, remove it from the latency
-		//  matrix as well as from the vector of nodes
-		for (u_int k = 0; k < inVector.size(); k++) {
-			if ((inVector[k].addr == maxHVNode.addr) && 
-					(inVector[k].port == maxHVNode.port)) {
-				for (int i = 0; i < rowSize; i++) {
-					double tmpValue = latencyMatrix[i * N + k];
-					latencyMatrix[i * N + k] = latencyMatrix[i * N + colSize - 1];
-					latencyMatrix[i * N + colSize - 1] = tmpValue;
-				}
-				colSize--;								
-				cblas_dswap(colSize, 
-					&latencyMatrix[k * N], 1, &latencyMatrix[(rowSize-1) * N], 1);
-				rowSize--;
-				deletedNodes.push_back(inVector[k]);
-				inVector[k] = inVector.back();
-				inVector.pop_back();
-			}
-		}
-	}
-	return maxHyperVolume;
-}
-
 double* RingManageQuery::createLatencyMatrix() { 		
 	int N = remoteNodes.size();	// Dimension of matrix
 	//	Allocate the matrix here
@@ -657,6 +496,12 @@ int RingManageQuery::performReplacement() {
 		ERROR_LOG("Inconsistent data structure for ring replacement\n");
 		return -1;	
 	}
+	RingLatencyMatrix* ringMatrix = meridProcess->getRingMatrix(ringNum);
+	if (!(ringMatrix->isChanged())) {
+		//	Same members and latencies, the last selection still holds
+		WARN_LOG("Ring unchanged since the last replacement, skipping\n");
+		return 0;
+	}
 	const u_int fullPrimRingSize 
 		= meridProcess->getRings()->nodesInPrimaryRing();				
 	vector<NodeIdent> removedNodes;	
@@ -692,47 +537,41 @@ int RingManageQuery::performReplacement() {
 	}
 	double* matrix = createLatencyMatrix();	
 	if (matrix != NULL) {
-		vector<NodeIdent> newPrimNodes;
-		//vector<NodeIdent> removedNodes;
+		//	The hypervolume search is handed to a worker, the ring stays
+		//	frozen until the result is applied
+		ReplaceJob* job = new ReplaceJob(ringNum);
 		set<NodeIdent, ltNodeIdent>::iterator it = remoteNodes.begin();
 		for (; it != remoteNodes.end(); it++) {
-			newPrimNodes.push_back(*it);	
-		}
-#ifdef DEBUG			
-		double hv = reduceSetByN(newPrimNodes, removedNodes, 
-			newPrimNodes.size() - fullPrimRingSize, matrix);			
-		WARN_LOG_1("@@@@@@@@@@@ Max hypervolume is %0.2f @@@@@@@@@@@@\n", hv);
-#else		
-		reduceSetByN(newPrimNodes, removedNodes,		
-			newPrimNodes.size() - fullPrimRingSize, matrix);
-#endif
-		free(matrix);	// Matrix must be released
-		if (meridProcess->getRings()->setRingMembers(
-				ringNum, newPrimNodes, removedNodes) == -1) {
-			WARN_LOG("!!!!!!!!!!!! RING REPLACEMENT UNSUCCESSFUL !!!!!!!!\n");
-		} else {
-			WARN_LOG("************ RING REPLACEMENT SUCCESSFUL **********\n");
+			job->primNodes.push_back(*it);	
 		}
+		job->removedNodes = removedNodes;
+		job->latencyMatrix = matrix;	// Released by the job
+		job->numReduction = job->primNodes.size() - fullPrimRingSize;
+		ringMatrix->clearChanged();	// Set again if the job fails
+		meridProcess->submitReplacement(job);
 	}
 	return 0;
 }
 
 HandleReqGeneric::HandleReqGeneric(uint64_t id, 
 							const NodeIdentRendv& in_srcNode, 
-							const vector<NodeIdent>& in_remote, 
+							const NodeListView& in_remote, 
 							MeridianProcess* in_process)
-		: 	qid(id), srcNode(in_srcNode), finished(false), 
-			meridProcess(in_process) {
+		: 	qid(id), srcNode(in_srcNode), 
+			srcWireVersion(PeerWireVersion::get(srcNode.addr, srcNode.port)),
+			finished(false), meridProcess(in_process) {
 	computeTimeout(MAX_RTT_MS * MICRO_IN_MILLI, &timeoutTV);
 	//	Copy all targets over
-	for (u_int i = 0; i < in_remote.size(); i++) {
-		if (in_remote[i].addr == 0 && in_remote[i].port == 0) {
+	NodeListCursor cursor(in_remote);
+	NodeIdent curNode;
+	while (cursor.next(&curNode)) {
+		if (curNode.addr == 0 && curNode.port == 0) {
 			//	Requesting pinging of src node. The src node really
 			//	should NOT be behind a firewall
 			NodeIdent tmpIdent = {srcNode.addr, srcNode.port};
 			remoteNodes.insert(tmpIdent);
 		} else {				
-			remoteNodes.insert(in_remote[i]);
+			remoteNodes.insert(curNode);
 		}			
 	}	
 }
@@ -779,6 +618,7 @@ int HandleReqGeneric::sendReturnPacket() {
 		retPacket.addNode(it->first, it->second);
 	}
 	RealPacket* inPacket = new RealPacket(srcNode);
+	inPacket->setWireVersion(srcWireVersion);
 	if (retPacket.createRealPacket(*inPacket) == -1) {
 		delete inPacket;
 		return -1;		
@@ -805,14 +645,9 @@ int HandleReqGeneric::init() {
 */		
 		uint32_t curLatencyUS;
 		if (getLatency(curIdent, &curLatencyUS) == -1) {		
-			ProbeQueryGeneric* newQuery = 
-				createProbeQuery(curIdent, getMerid());			
-			if (getMerid()->getQueryTable()->insertNewQuery(newQuery) == -1) {			
-				delete newQuery;
-				continue;
-			}
-			newQuery->subscribeLatency(getQueryID());
-			newQuery->init();
+			ProbeQueryGeneric* newQuery =
+				createProbeQuery(curIdent, getMerid());
+			getMerid()->startProbe(newQuery, getQueryID());
 		} else {
 			remoteLatencies[curIdent] = curLatencyUS;
 		}
@@ -936,6 +771,14 @@ int ProbeQueryICMP::handleTimeout() {
 }
 #endif
 
+void ProbeQueryGeneric::setFinished(bool flag) {
+	finished = flag;
+	if (finished) {
+		//	No longer accepting subscribers
+		meridProcess->probeFinished(this);
+	}
+}
+
 int ProbeQueryGeneric::subscribeLatency(uint64_t in_qid) {
 	subscribers.push_back(in_qid);
 	return 0;		
@@ -978,23 +821,27 @@ int ProbeQueryGeneric::handleLatency(
 	}
 	//	Add to cache entry for future use
 	insertCache(remoteNode, realLatencyUS);
-	finished = true;		
+	setFinished(true);
 	return 0;
 }
 
 HandleClosestGeneric::HandleClosestGeneric(uint64_t id,
 							u_short in_betaNumer, u_short in_betaDenom,
 							const NodeIdentRendv& in_srcNode, 
-							const vector<NodeIdent>& in_remote, 
+							const NodeListView& in_remote, 
 							MeridianProcess* in_process)
 		: 	qid(id), betaNumer(in_betaNumer), betaDenom(in_betaDenom),
-			srcNode(in_srcNode), finished(false), meridProcess(in_process) {
+			srcNode(in_srcNode), 
+			srcWireVersion(PeerWireVersion::get(srcNode.addr, srcNode.port)),
+			finished(false), meridProcess(in_process) {
 	selectedMember.addr = 0;
 	selectedMember.port = 0;	
 	computeTimeout(MAX_RTT_MS * MICRO_IN_MILLI, &timeoutTV);
 	//	Copy all targets over
-	for (u_int i = 0; i < in_remote.size(); i++) {
-		remoteNodes.insert(in_remote[i]);			
+	NodeListCursor cursor(in_remote);
+	NodeIdent curNode;
+	while (cursor.next(&curNode)) {
+		remoteNodes.insert(curNode);			
 	}
 	stateMachine = HC_INIT;
 }
@@ -1007,18 +854,14 @@ int HandleClosestGeneric::init() {
 		if (getLatency(*it, &curLatencyUS) == -1) {
 			ProbeQueryGeneric* newQuery =
 				createProbeQuery(*it, meridProcess);
-			if (meridProcess->getQueryTable()->insertNewQuery(newQuery) == -1) {			
-				delete newQuery;
-				continue;
-			}
-			newQuery->subscribeLatency(qid);
-			newQuery->init();
+			meridProcess->startProbe(newQuery, qid);
 		} else {
 			remoteLatencies[*it] = curLatencyUS;
 		}
 	}
 	RetInfo curRetInfo(qid, 0, 0);	//	Send back an intermediate info packet
 	RealPacket* inPacket = new RealPacket(srcNode);
+	inPacket->setWireVersion(srcWireVersion);
 	if (curRetInfo.createRealPacket(*inPacket) == -1) {
 		delete inPacket;			
 	} else {
@@ -1052,6 +895,8 @@ int HandleClosestGeneric::handleEvent(
 			//	just received packet from in_remote, there should
 			//	be a hole in the NAT for the return
 			RealPacket* inPacket = new RealPacket(in_remote);
+			inPacket->setWireVersion(
+				PeerWireVersion::get(in_remote.addr, in_remote.port));
 			if (retPacket.createRealPacket(*inPacket) == -1) {
 				delete inPacket;			
 			} else {
@@ -1061,19 +906,18 @@ int HandleClosestGeneric::handleEvent(
 				(in_remote.port == selectedMember.port)) {
 			WARN_LOG("Received packet from selected ring member\n");			
 			if (queryType == RET_RESPONSE) {
-				RetResponse* retResp = 
-					RetResponse::parse(in_remote, inPacket, packetSize);
-				if (retResp == NULL) {
+				RetResponseView retResp;
+				if (retResp.init(in_remote, inPacket, packetSize) == -1) {
 					ERROR_LOG("Malformed packet received\n");
 					return -1;
 				}	
 				RealPacket* inPacket = new RealPacket(srcNode);
-				if (retResp->createRealPacket(*inPacket) == -1) {
+				inPacket->setWireVersion(srcWireVersion);
+				if (RetResponse::relay(retResp, *inPacket) == -1) {
 					delete inPacket;			
 				} else {
 					meridProcess->addOutPacket(inPacket);
 				}
-				delete retResp;	// Done with RetResponse
 				finished = true;		
 			} else if (queryType == RET_ERROR) {
 				RetError* retErr = RetError::parse(inPacket, packetSize);
@@ -1082,6 +926,7 @@ int HandleClosestGeneric::handleEvent(
 					return -1;
 				}
 				RealPacket* inPacket = new RealPacket(srcNode);
+				inPacket->setWireVersion(srcWireVersion);
 				if (retErr->createRealPacket(*inPacket) == -1) {
 					delete inPacket;			
 				} else {
@@ -1097,6 +942,7 @@ int HandleClosestGeneric::handleEvent(
 					return -1;					
 				}
 				RealPacket* inPacket = new RealPacket(srcNode);
+				inPacket->setWireVersion(srcWireVersion);
 				if (curRetInfo->createRealPacket(*inPacket) == -1) {
 					delete inPacket;			
 				} else {
@@ -1232,6 +1078,7 @@ int HandleClosestGeneric::handleForward() {
 			retResp = new RetResponse(qid, 0, 0, remoteLatencies);
 		}
 		RealPacket* inPacket = new RealPacket(srcNode);
+		inPacket->setWireVersion(srcWireVersion);
 		if (retResp->createRealPacket(*inPacket) == -1) {
 			delete inPacket;			
 		} else {
@@ -1265,6 +1112,8 @@ int HandleClosestGeneric::handleForward() {
 			tmpRendvOut = *setRendvIt;
 		}		
 		RealPacket* inPacket = new RealPacket(tmpRendvOut);
+		inPacket->setWireVersion(
+			PeerWireVersion::get(tmpRendvOut.addr, tmpRendvOut.port));
 		if (reqClosest->createRealPacket(*inPacket) == -1) {
 			delete inPacket;
 			finished = true;		
@@ -1310,15 +1159,19 @@ int HandleClosestGeneric::sendReqProbes() {
 	stateMachine = HC_INDIRECT_PING;			
 //			if ((meridProcess->getRings()->fillVector(averageLatUS, betaRatio, 
 //					ringMembers) == -1) || (ringMembers.size() == 0)) {
-	if ((averageLatUS == 0) ||
+	int fillRet = -1;
+	if (averageLatUS != 0) {
 		//(meridProcess->getRings()->fillVector(averageLatUS, 
 		//	averageLatUS, betaRatio, ringMembers) == -1) || 
-		(meridProcess->getRings()->fillVector(smallestLatUS, 
-			largestLatUS, betaRatio, ringMembers) == -1) || 
-		(ringMembers.size() == 0)) {									
+		fillRet = meridProcess->acquireRings()->fillVector(smallestLatUS, 
+			largestLatUS, betaRatio, ringMembers);
+		meridProcess->releaseRings();
+	}
+	if ((fillRet == -1) || (ringMembers.size() == 0)) {									
 		// 0, 0 means itself						
 		RetResponse retPacket(qid, 0, 0, remoteLatencies);	
 		RealPacket* inPacket = new RealPacket(srcNode);
+		inPacket->setWireVersion(srcWireVersion);
 		if (retPacket.createRealPacket(*inPacket) == -1) {
 			delete inPacket;			
 		} else {
@@ -1455,6 +1308,7 @@ int HandleClosestGeneric::handleTimeout() {
 			//	Can't ping every body, return a RET_ERROR			
 			RetError retPacket(qid);
 			RealPacket* inPacket = new RealPacket(srcNode);
+			inPacket->setWireVersion(srcWireVersion);
 			if (retPacket.createRealPacket(*inPacket) == -1) {
 				delete inPacket;			
 			} else {
@@ -1470,6 +1324,7 @@ int HandleClosestGeneric::handleTimeout() {
 			//	back an error packet
 			RetError retPacket(qid);
 			RealPacket* inPacket = new RealPacket(srcNode);
+			inPacket->setWireVersion(srcWireVersion);
 			if (retPacket.createRealPacket(*inPacket) == -1) {
 				delete inPacket;			
 			} else {
@@ -1523,6 +1378,7 @@ int ReqProbeTCP::init() {
 		tcpPacket.addTarget(*it);
 	}
 	RealPacket* inPacket = new RealPacket(getSrcNode());
+	inPacket->setWireVersion(getSrcWireVersion());
 	if (tcpPacket.createRealPacket(*inPacket) == -1) {
 		delete inPacket;			
 		return -1;
@@ -1542,6 +1398,7 @@ int ReqProbeDNS::init() {
 		dnsPacket.addTarget(*it);
 	}
 	RealPacket* inPacket = new RealPacket(getSrcNode());
+	inPacket->setWireVersion(getSrcWireVersion());
 	if (dnsPacket.createRealPacket(*inPacket) == -1) {
 		delete inPacket;			
 		return -1;
@@ -1562,6 +1419,7 @@ int ReqProbePing::init() {
 		pingPacket.addTarget(*it);
 	}
 	RealPacket* inPacket = new RealPacket(getSrcNode());
+	inPacket->setWireVersion(getSrcWireVersion());
 	if (pingPacket.createRealPacket(*inPacket) == -1) {
 		delete inPacket;			
 		return -1;
@@ -1582,6 +1440,7 @@ int ReqProbeICMP::init() {
 		pingPacket.addTarget(*it);
 	}
 	RealPacket* inPacket = new RealPacket(getSrcNode());
+	inPacket->setWireVersion(getSrcWireVersion());
 	if (pingPacket.createRealPacket(*inPacket) == -1) {
 		delete inPacket;			
 		return -1;
@@ -1595,7 +1454,9 @@ int ReqProbeICMP::init() {
 ReqProbeGeneric::ReqProbeGeneric(const NodeIdentRendv& in_src_node,
 								const set<NodeIdent, ltNodeIdent>& in_remote, 
 								MeridianProcess* in_process)
-		: 	srcNode(in_src_node), finished(false), meridProcess(in_process) {
+		: 	srcNode(in_src_node), 
+			srcWireVersion(PeerWireVersion::get(srcNode.addr, srcNode.port)),
+			finished(false), meridProcess(in_process) {
 	qid = meridProcess->getNewQueryID();
 	computeTimeout(2 * MAX_RTT_MS * MICRO_IN_MILLI, &timeoutTV);
 	//	Copy all targets over
@@ -1605,7 +1466,9 @@ ReqProbeGeneric::ReqProbeGeneric(const NodeIdentRendv& in_src_node,
 ReqProbeGeneric::ReqProbeGeneric(const NodeIdentRendv& in_src_node,
 						const set<NodeIdentConst, ltNodeIdentConst>& in_remote, 
 						MeridianProcess* in_process)
-		: 	srcNode(in_src_node), finished(false), meridProcess(in_process) {
+		: 	srcNode(in_src_node), 
+			srcWireVersion(PeerWireVersion::get(srcNode.addr, srcNode.port)),
+			finished(false), meridProcess(in_process) {
 	qid = meridProcess->getNewQueryID();
 	computeTimeout(2 * MAX_RTT_MS * MICRO_IN_MILLI, &timeoutTV);
 	//	Copy all targets over
@@ -1620,7 +1483,7 @@ ReqProbeGeneric::ReqProbeGeneric(const NodeIdentRendv& in_src_node,
 
 int ReqProbeGeneric::handleEvent(
 		const NodeIdent& in_remote, const char* inPacket, int packetSize) {		
-	if (inPacket[0] != RET_PING_REQ) {
+	if (Packet::baseType(inPacket[0]) != RET_PING_REQ) {
 		ERROR_LOG("Expecting RET_PING_REQ packet, received something else\n");
 		return -1;	// Not pong packet
 	}	
@@ -1629,38 +1492,38 @@ int ReqProbeGeneric::handleEvent(
 		ERROR_LOG("Received packet from unexpected node\n");
 		return -1;
 	}
-	RetPing* newRetPing = RetPing::parse(inPacket, packetSize);
-	if (newRetPing == NULL) {
+	RetPingView newRetPing;
+	if (newRetPing.init(inPacket, packetSize) == -1) {
 		ERROR_LOG("Incorrect packet received\n");
 		return -1;
 	}	
-	const vector<NodeIdentLat>* tmpVectLat = newRetPing->returnNodes();
 	//	Not all the nodes are there
-	if (tmpVectLat->size() != remoteNodes.size()) {
+	if (newRetPing.getNodes().size() != remoteNodes.size()) {
 		ERROR_LOG("Only partial list of nodes returned\n");
-		delete newRetPing;
 		return -1;
 	}
 	vector<NodeIdentLat> newTmpVect;
+	newTmpVect.reserve(remoteNodes.size() + 1);
 	//	HACK: Add srcNode to the vector before telling subscriber
 	NodeIdentLat outNIL = {srcNode.addr, srcNode.port, 0};
 	newTmpVect.push_back(outNIL);
-	for (u_int i = 0; i < tmpVectLat->size(); i++) {
-		newTmpVect.push_back((*tmpVectLat)[i]);	
+	NodeListCursor cursor(newRetPing.getNodes());
+	NodeIdentLat retNode;
+	while (cursor.next(&retNode)) {
+		newTmpVect.push_back(retNode);	
 	}
 	//	Tell subscribers
 	for (u_int i = 0; i < subscribers.size(); i++) {		
 		meridProcess->getQueryTable()->notifyQLatency(
 			subscribers[i], newTmpVect);	
 	}
-	delete newRetPing;	// 	Done with packet
 	finished = true;	//	Done with query
 	return 0;
 }
 
 int ReqProbeGeneric::handleTimeout() {
 	NodeIdent tmpIdent = {srcNode.addr, srcNode.port};
-	meridProcess->getRings()->eraseNode(tmpIdent);
+	meridProcess->ringEraseNode(tmpIdent);
 	finished = true;
 	return 0;		
 }
@@ -1674,16 +1537,20 @@ int ReqProbeGeneric::subscribeLatency(uint64_t in_qid) {
 HandleMCGeneric::HandleMCGeneric(uint64_t id,
 							u_short in_betaNumer, u_short in_betaDenom,
 							const NodeIdentRendv& in_srcNode, 
-							const vector<NodeIdentConst>& in_remote, 
+							const NodeListView& in_remote, 
 							MeridianProcess* in_process)
 		: 	qid(id), betaNumer(in_betaNumer), betaDenom(in_betaDenom),
-			srcNode(in_srcNode), finished(false), meridProcess(in_process) {
+			srcNode(in_srcNode), 
+			srcWireVersion(PeerWireVersion::get(srcNode.addr, srcNode.port)),
+			finished(false), meridProcess(in_process) {
 	selectedMember.addr = 0;
 	selectedMember.port = 0;				
 	computeTimeout(MAX_RTT_MS * MICRO_IN_MILLI, &timeoutTV);
 	//	Copy all targets over
-	for (u_int i = 0; i < in_remote.size(); i++) {
-		remoteNodes.insert(in_remote[i]);			
+	NodeListCursor cursor(in_remote);
+	NodeIdentConst curNode;
+	while (cursor.next(&curNode)) {
+		remoteNodes.insert(curNode);			
 	}
 	stateMachine = HMC_INIT;
 }
@@ -1697,18 +1564,14 @@ int HandleMCGeneric::init() {
 		if (getLatency(tmp, &curLatencyUS) == -1) {		
 			ProbeQueryGeneric* newQuery =
 				createProbeQuery(tmp, meridProcess);
-			if (meridProcess->getQueryTable()->insertNewQuery(newQuery) == -1) {			
-				delete newQuery;
-				continue;
-			}
-			newQuery->subscribeLatency(qid);
-			newQuery->init();
+			meridProcess->startProbe(newQuery, qid);
 		} else {
 			remoteLatencies[tmp] = curLatencyUS;		
 		}
 	}
 	RetInfo curRetInfo(qid, 0, 0);	//	Send back an intermediate info packet
 	RealPacket* inPacket = new RealPacket(srcNode);
+	inPacket->setWireVersion(srcWireVersion);
 	if (curRetInfo.createRealPacket(*inPacket) == -1) {
 		delete inPacket;			
 	} else {
@@ -1741,6 +1604,8 @@ int HandleMCGeneric::handleEvent(
 			//	NOTE: Don't need to use rendavous node as there should be a 
 			//	hole in the NAT to in_remote as we just received the packet
 			RealPacket* inPacket = new RealPacket(in_remote);
+			inPacket->setWireVersion(
+				PeerWireVersion::get(in_remote.addr, in_remote.port));
 			if (retPacket.createRealPacket(*inPacket) == -1) {
 				delete inPacket;			
 			} else {
@@ -1750,19 +1615,18 @@ int HandleMCGeneric::handleEvent(
 				(in_remote.port == selectedMember.port)) {
 			WARN_LOG("Received packet from selected ring member\n");			
 			if (queryType == RET_RESPONSE) {
-				RetResponse* retResp = 
-					RetResponse::parse(in_remote, inPacket, packetSize);
-				if (retResp == NULL) {
+				RetResponseView retResp;
+				if (retResp.init(in_remote, inPacket, packetSize) == -1) {
 					ERROR_LOG("Malformed packet received\n");
 					return -1;
 				}	
 				RealPacket* inPacket = new RealPacket(srcNode);
-				if (retResp->createRealPacket(*inPacket) == -1) {
+				inPacket->setWireVersion(srcWireVersion);
+				if (RetResponse::relay(retResp, *inPacket) == -1) {
 					delete inPacket;			
 				} else {
 					meridProcess->addOutPacket(inPacket);
 				}
-				delete retResp;	// Done with RetResponse
 				finished = true;		
 			} else if (queryType == RET_ERROR) {
 				RetError* retErr = RetError::parse(inPacket, packetSize);
@@ -1771,6 +1635,7 @@ int HandleMCGeneric::handleEvent(
 					return -1;
 				}
 				RealPacket* inPacket = new RealPacket(srcNode);
+				inPacket->setWireVersion(srcWireVersion);
 				if (retErr->createRealPacket(*inPacket) == -1) {
 					delete inPacket;			
 				} else {
@@ -1786,6 +1651,7 @@ int HandleMCGeneric::handleEvent(
 					return -1;					
 				}
 				RealPacket* inPacket = new RealPacket(srcNode);
+				inPacket->setWireVersion(srcWireVersion);
 				if (curRetInfo->createRealPacket(*inPacket) == -1) {
 					delete inPacket;			
 				} else {
@@ -1851,6 +1717,7 @@ int HandleMCGeneric::handleForward() {
 			retResp = new RetResponse(qid, 0, 0, remoteLatencies);
 		}
 		RealPacket* inPacket = new RealPacket(srcNode);
+		inPacket->setWireVersion(srcWireVersion);
 		if (retResp->createRealPacket(*inPacket) == -1) {
 			delete inPacket;			
 		} else {
@@ -1885,6 +1752,8 @@ int HandleMCGeneric::handleForward() {
 			tmpRendvOut = *setRendvIt;
 		}				
 		RealPacket* inPacket = new RealPacket(tmpRendvOut);					
+		inPacket->setWireVersion(
+			PeerWireVersion::get(tmpRendvOut.addr, tmpRendvOut.port));
 		//RealPacket* inPacket = new RealPacket(closestMember);
 		if (reqMC->createRealPacket(*inPacket) == -1) {
 			delete inPacket;
@@ -1937,13 +1806,17 @@ int HandleMCGeneric::sendReqProbes() {
 	//	Change to next state			
 	stateMachine = HMC_INDIRECT_PING;
 	// Have to worry about 0 latencies for multiconstraint			
-	if ((averageLatUS == 0) || 
-		(meridProcess->getRings()->fillVector(largestSubUS, 
-			largestAddUS, betaRatio, ringMembers) == -1) || 
-		(ringMembers.size() == 0)) {				
+	int fillRet = -1;
+	if (averageLatUS != 0) {
+		fillRet = meridProcess->acquireRings()->fillVector(largestSubUS, 
+			largestAddUS, betaRatio, ringMembers);
+		meridProcess->releaseRings();
+	}
+	if ((fillRet == -1) || (ringMembers.size() == 0)) {				
 		// 0, 0 means itself						
 		RetResponse retPacket(qid, 0, 0, remoteLatencies);	
 		RealPacket* inPacket = new RealPacket(srcNode);
+		inPacket->setWireVersion(srcWireVersion);
 		if (retPacket.createRealPacket(*inPacket) == -1) {
 			delete inPacket;			
 		} else {
@@ -2083,6 +1956,7 @@ int HandleMCGeneric::handleTimeout() {
 			//	Can't ping every body, return a RET_ERROR			
 			RetError retPacket(qid);
 			RealPacket* inPacket = new RealPacket(srcNode);
+			inPacket->setWireVersion(srcWireVersion);
 			if (retPacket.createRealPacket(*inPacket) == -1) {
 				delete inPacket;			
 			} else {
@@ -2098,6 +1972,7 @@ int HandleMCGeneric::handleTimeout() {
 			//	back an error packet
 			RetError retPacket(qid);
 			RealPacket* inPacket = new RealPacket(srcNode);
+			inPacket->setWireVersion(srcWireVersion);
 			if (retPacket.createRealPacket(*inPacket) == -1) {
 				delete inPacket;			
 			} else {
@@ -2147,12 +2022,28 @@ DSLReqQuery::DSLReqQuery(MeridianProcess* in_process,
 		const NodeIdentRendv& in_dest, 
 		uint64_t redirectQID)
 	: 	finished(false), timeoutTV(in_timeout), meridProcess(in_process),
-		recvQueryID(redirectQID), destNode(in_dest), ttl(in_ttl) {
+		recvQueryID(redirectQID), destNode(in_dest), ttl(in_ttl),
+		fullPacket(NULL) {
 	qid = meridProcess->getNewQueryID();		
 }
 
 int DSLReqQuery::handleEvent(
 		const NodeIdent& in_remote, const char* inPacket, int packetSize) {	
+	if (packetSize > 0 && 
+			Packet::baseType(inPacket[0]) == DSL_PROGRAM_MISS) {
+		//	Destination evicted the program, send the text once
+		ProgramCache* cache = getMerid()->getProgramCache();
+		NodeIdent destIdent = {destNode.addr, destNode.port};
+		if (cache != NULL) {
+			cache->erasePeerProgram(destIdent, programHash);
+		}
+		if (fullPacket == NULL) {
+			return -1;
+		}
+		getMerid()->addOutPacket(fullPacket);
+		fullPacket = NULL;
+		return 0;
+	}
 	return meridProcess->getQueryTable()->notifyQPacket(recvQueryID, 
 		in_remote, inPacket, packetSize);	
 }
@@ -2162,8 +2053,7 @@ int DSLReqQuery::init(
 	NodeIdent rendvInfo = getMerid()->returnRendv();
 	//	Get remaining timeout period
 	struct timeval cur_time;
-	gettimeofday(&cur_time, NULL);
-	QueryTable::normalizeTime(cur_time);	
+	getCurrentTime(&cur_time);
 	double timeout_ms = 
 		((timeoutTV.tv_sec - cur_time.tv_sec) * 1000.0) +
 			((timeoutTV.tv_usec - cur_time.tv_usec) / 1000.0);			
@@ -2186,30 +2076,48 @@ int DSLReqQuery::init(
 		delete tmpPacket;			
 		return -1;
 	}
-	if (marshal_packet(ps, *tmpPacket, func_name, param) == -1) {
+	//	Only the hash if the destination confirmed caching the program
+	CachedProgram* source = ps->get_source();
+	ProgramCache* cache = getMerid()->getProgramCache();
+	NodeIdent destIdent = {destNode.addr, destNode.port};
+	bool byHash = (source != NULL && cache != NULL && 
+		cache->peerHasProgram(destIdent, source->getHash()));
+	if (marshal_packet(ps, *tmpPacket, func_name, param, byHash) == -1) {
 		delete tmpPacket;
 		return -1;
 	}
+	if (byHash) {
+		fullPacket = new RealPacket(destNode);
+		if (tmpDSLPacket.createRealPacket(*fullPacket) == -1 ||
+				marshal_packet(ps, *fullPacket, func_name, param) == -1) {
+			delete fullPacket;
+			fullPacket = NULL;
+		}
+		programHash = source->getHash();
+	}
 	getMerid()->addOutPacket(tmpPacket);
 	return 0;
 }
 
-#define INSTRUCTIONS_PER_IT	 10000
-
 DSLRecvQuery::DSLRecvQuery(
 		ParserState* in_state, MeridianProcess* in_process,
 			const NodeIdentRendv& in_src, uint64_t in_ret_qid,
-			uint16_t timeout_ms, uint16_t in_ttl) 
+			uint16_t timeout_ms, uint16_t in_ttl, int in_priority) 
 		: 	ret_qid(in_ret_qid), finished(false), meridProcess(in_process), 
-			ps(in_state), srcNode(in_src), ttl(in_ttl) {
+			ps(in_state), srcNode(in_src), ttl(in_ttl), 
+			sliceEvals(DSL_SLICE_NS / DSL_INIT_NS_PER_EVAL), evalsUsed(0) {
 	qid = meridProcess->getNewQueryID();	
+	DSLScheduler::initThread(&threadState, in_priority);
 	computeTimeout(MIN(2 * MAX_RTT_MS * MICRO_IN_MILLI, 
 		timeout_ms * MICRO_IN_MILLI), &timeoutTV);
 }
 
 int DSLRecvQuery::handleLatency(const vector<NodeIdentLat>& in_remoteNodes) {
-	ps->allocateEvalCount(INSTRUCTIONS_PER_IT);			
-	swapcontext(&global_env_thread, ps->get_context());
+	ps->allocateEvalCount(sliceEvals);			
+	fiber_switch(&global_env_thread, ps->get_context());
+	int evalsLeft = ps->getEvalCount();
+	evalsUsed = (evalsLeft >= 0 && evalsLeft <= sliceEvals) ? 
+		sliceEvals - evalsLeft : 0;
 	switch (ps->parser_state()) {
 		case PS_RUNNING: {
 			fprintf(stderr, "Exception occurred, exiting thread\n");
@@ -2234,7 +2142,14 @@ int DSLRecvQuery::handleLatency(const vector<NodeIdentLat>& in_remoteNodes) {
 			if (marshal_ast(ps->getQueryReturn(), inPacket) == -1) {
 				delete inPacket;
 				return -1;
-			}			
+			}
+			//	Lets the source send the program by hash next time
+			CachedProgram* source = ps->get_source();
+			if (source != NULL && source->isCached() && 
+					inPacket->getPayLoadSize() + 1 + PROGRAM_HASH_SIZE 
+						<= inPacket->getPacketSize()) {
+				DSLReplyPacket::write_cached(*inPacket, source->getHash());
+			}
 			meridProcess->addOutPacket(inPacket);									
 		} break;			
 		case PS_READY: {
@@ -2254,6 +2169,11 @@ int DSLRecvQuery::handleEvent(const NodeIdent& in_remote,
 	if (tmpReplyPacket == NULL) {
 		return -1;
 	}
+	ProgramHash peerHash;
+	ProgramCache* cache = getMerid()->getProgramCache();
+	if (cache != NULL && tmpReplyPacket->peerCached(&peerHash)) {
+		cache->setPeerProgram(in_remote, peerHash);
+	}
 	delete tmpReplyPacket;
 	// retNode guaranteed to be not NULL after successful parse
 	ps->setRPCRecv(retNode);
@@ -2289,7 +2209,7 @@ ASTNode* handleRPC(ParserState* ps,
 		newQ->init(ps, func_name, paramAST);
 	}
 	ps->set_parser_state(PS_BLOCKED);
-	swapcontext(ps->get_context(), &global_env_thread);
+	fiber_switch(ps->get_context(), &global_env_thread);
 	// Get return value from ps
 	return ps->getRPCRecv();	
 }
@@ -2320,50 +2240,24 @@ ASTNode* handleRingGTE(ParserState* cur_parser, ASTNode* cur_node,
 		return cur_parser->empty_token();
 	}	
 	MeridianProcess* mp = cur_parser->getMeridProcess();
-	RingSet* rs = mp->getRings();
+	//	Read a consistent copy, ring management may replace members at any
+	//	time
+	const RingSet* rs = mp->acquireRings();
 	// Collect all satisfying members into this vector
 	vector<NodeIdentRendv> outMembers;	
-	// Input is in ms, Meridian stores everything as us
-	int ringNum 
-		= rs->getRingNumber((u_int)floor((nextNode->val.d_val * 1000.0)));				
-	const vector<NodeIdent>* ringMember = rs->returnPrimaryRing(ringNum);
-	for (u_int i = 0; i < ringMember->size(); i++) {
-		u_int latency_us;
-		if (rs->getNodeLatency((*ringMember)[i], &latency_us) != -1) {
-			bool comparisonValue;
-			if (equal) {				
-				comparisonValue = 
-					((latency_us / 1000.0) >= nextNode->val.d_val);
-			} else {
-				comparisonValue =
-					((latency_us / 1000.0) > nextNode->val.d_val);
-			}
-			if (comparisonValue) {
-				NodeIdentRendv tmpNodeIdent =
-					{ (*ringMember)[i].addr, (*ringMember)[i].port, 0, 0};
-				NodeIdent rendvNode;
-				if (rs->rendvLookup((*ringMember)[i], rendvNode) == 0) {
-					tmpNodeIdent.addrRendv = rendvNode.addr;
-					tmpNodeIdent.portRendv = rendvNode.port;					
-				}
-				outMembers.push_back(tmpNodeIdent);
-			}
+	// Input is in ms, Meridian stores everything as us. Find the smallest
+	// latency that satisfies the comparison
+	double boundUS = nextNode->val.d_val * 1000.0;
+	double lowerUS = equal ? ceil(boundUS) : (floor(boundUS) + 1.0);
+	if (lowerUS <= (double)UINT_MAX) {
+		vector<RingIndexEntry>::const_iterator first, last;
+		rs->indexRange((lowerUS > 0.0) ? (u_int)lowerUS : 0, UINT_MAX, 
+			&first, &last);
+		for (; first != last; first++) {
+			outMembers.push_back(first->node);
 		}
 	}
-	// Add the rest of the members from the higher rings
-	for (int j = ringNum + 1; j < rs->getNumberOfRings(); j++) {
-		ringMember = rs->returnPrimaryRing(j);
-		for (u_int i = 0; i < ringMember->size(); i++) {
-			NodeIdentRendv tmpNodeIdent =
-				{ (*ringMember)[i].addr, (*ringMember)[i].port, 0, 0};
-			NodeIdent rendvNode;
-			if (rs->rendvLookup((*ringMember)[i], rendvNode) == 0) {
-				tmpNodeIdent.addrRendv = rendvNode.addr;
-				tmpNodeIdent.portRendv = rendvNode.port;					
-			}
-			outMembers.push_back(tmpNodeIdent);
-		}		
-	}
+	mp->releaseRings();
 	string adtName = "Node";
 	ASTNode* newArray 
 		= ASTCreate(cur_parser, ARRAY_TYPE, &adtName, ADT_TYPE, 0);
@@ -2402,50 +2296,24 @@ ASTNode* handleRingLTE(ParserState* cur_parser, ASTNode* cur_node,
 		return cur_parser->empty_token();
 	}	
 	MeridianProcess* mp = cur_parser->getMeridProcess();
-	RingSet* rs = mp->getRings();
+	//	Read a consistent copy, ring management may replace members at any
+	//	time
+	const RingSet* rs = mp->acquireRings();
 	// Collect all satisfying members into this vector
 	vector<NodeIdentRendv> outMembers;	
-	// Input is in ms, Meridian stores everything as us
-	int ringNum 
-		= rs->getRingNumber((u_int)ceil((nextNode->val.d_val * 1000.0)));				
-	const vector<NodeIdent>* ringMember = rs->returnPrimaryRing(ringNum);
-	for (u_int i = 0; i < ringMember->size(); i++) {
-		u_int latency_us;
-		if (rs->getNodeLatency((*ringMember)[i], &latency_us) != -1) {
-			bool comparisonValue;
-			if (equal) {				
-				comparisonValue = 
-					((latency_us / 1000.0) <= nextNode->val.d_val);
-			} else {
-				comparisonValue =
-					((latency_us / 1000.0) < nextNode->val.d_val);
-			}
-			if (comparisonValue) {
-				NodeIdentRendv tmpNodeIdent =
-					{ (*ringMember)[i].addr, (*ringMember)[i].port, 0, 0};
-				NodeIdent rendvNode;
-				if (rs->rendvLookup((*ringMember)[i], rendvNode) == 0) {
-					tmpNodeIdent.addrRendv = rendvNode.addr;
-					tmpNodeIdent.portRendv = rendvNode.port;					
-				}
-				outMembers.push_back(tmpNodeIdent);
-			}
+	// Input is in ms, Meridian stores everything as us. Find the largest
+	// latency that satisfies the comparison
+	double boundUS = nextNode->val.d_val * 1000.0;
+	double upperUS = equal ? floor(boundUS) : (ceil(boundUS) - 1.0);
+	if (upperUS >= 0.0) {
+		vector<RingIndexEntry>::const_iterator first, last;
+		rs->indexRange(0, (upperUS < (double)UINT_MAX) ? 
+			(u_int)upperUS : UINT_MAX, &first, &last);
+		for (; first != last; first++) {
+			outMembers.push_back(first->node);
 		}
 	}
-	// Add the rest of the members from the higher rings
-	for (int j = 0; j < ringNum; j++) {
-		ringMember = rs->returnPrimaryRing(j);
-		for (u_int i = 0; i < ringMember->size(); i++) {
-			NodeIdentRendv tmpNodeIdent =
-				{ (*ringMember)[i].addr, (*ringMember)[i].port, 0, 0};
-			NodeIdent rendvNode;
-			if (rs->rendvLookup((*ringMember)[i], rendvNode) == 0) {
-				tmpNodeIdent.addrRendv = rendvNode.addr;
-				tmpNodeIdent.portRendv = rendvNode.port;					
-			}
-			outMembers.push_back(tmpNodeIdent);
-		}		
-	}
+	mp->releaseRings();
 	string adtName = "Node";
 	ASTNode* newArray 
 		= ASTCreate(cur_parser, ARRAY_TYPE, &adtName, ADT_TYPE, 0);
@@ -2504,13 +2372,9 @@ ReqProbeSelfGeneric::ReqProbeSelfGeneric(
 int ReqProbeSelfGeneric::init() {
 	set<NodeIdent, ltNodeIdent>::iterator it = remoteNodes.begin();
 	for (; it != remoteNodes.end(); it++) {
-		ProbeQueryGeneric* newQuery = createProbeQuery(*it, getMerid());
-		if (getMerid()->getQueryTable()->insertNewQuery(newQuery) == -1) {			
-			delete newQuery;
-			continue;
-		}
-		newQuery->subscribeLatency(getQueryID());
-		newQuery->init();
+		ProbeQueryGeneric* newQuery =
+			createProbeQuery(*it, getMerid());
+		getMerid()->startProbe(newQuery, getQueryID());
 	}
 	return 0;
 }
@@ -2758,8 +2622,7 @@ ASTNode* handleGetDistGeneric(
 	u_int timeout_ms;
 	if (nextNode_3->val.i_val < 0) {
 		struct timeval curTime;
-		gettimeofday(&curTime, NULL);
-		QueryTable::normalizeTime(curTime);
+		Query::getCurrentTime(&curTime);
 		struct timeval qTimeout = parentQuery->timeOut();
 		timeout_ms = ((qTimeout.tv_sec - curTime.tv_sec) * 1000) + (u_int)
 			(ceil((double)(qTimeout.tv_usec - curTime.tv_usec)) / 1000.0);		
@@ -2811,7 +2674,7 @@ ASTNode* handleGetDistGeneric(
 		newQ->init();
 	}
 	cur_parser->set_parser_state(PS_BLOCKED);
-	swapcontext(cur_parser->get_context(), &global_env_thread);
+	fiber_switch(cur_parser->get_context(), &global_env_thread);
 	// See if get_distance was called without a source away
 	if (nextNode_1->type == EMPTY_TYPE) {		
 		ASTNode* retSingleNode = cur_parser->getQueryReturn();
@@ -3,17 +3,13 @@
 
 #include <stdint.h>
 #include <sys/time.h>
+#include <time.h>
 #include <assert.h>
 #include <map>
 #include <set>
 #include "RingSet.h"
 #include "Marshal.h"
 
-extern "C" {
-	#include <qhull/qhull.h>
-	#include <cblas-atlas.h>
-}
-
 class MeridianProcess;
 
 #define MICRO_IN_MILLI	1000
@@ -21,6 +17,9 @@ class MeridianProcess;
 #define MICRO_IN_SECOND	1000000
 #define MAX_RTT_MS		5000
 
+//	Returned by runOnce to stop being scheduled
+#define SCHED_STOP		1
+
 class SchedObject {
 public:
 	virtual int runOnce() = 0;
@@ -45,19 +44,53 @@ public:
 	virtual ~SchedRingManage() {}
 };
 
+class SchedRevalidate : public SchedObject {
+private:	
+	MeridianProcess* meridProcess;
+public:
+	SchedRevalidate(MeridianProcess* in_process) : meridProcess(in_process) {}
+	virtual int runOnce();
+	virtual ~SchedRevalidate() {}
+};
+
+class SchedSnapshot : public SchedObject {
+private:	
+	MeridianProcess* meridProcess;
+public:
+	SchedSnapshot(MeridianProcess* in_process) : meridProcess(in_process) {}
+	virtual int runOnce();
+	virtual ~SchedSnapshot() {}
+};
+
 //	Base interface class 
 class Query {
 protected:
 	static void computeTimeout(
 			u_int periodUS, struct timeval* nextTimeOut) {
 		struct timeval curTime;
-		gettimeofday(&curTime, NULL);	
+		getCurrentTime(&curTime);
 		struct timeval offsetTV = 
 				{ periodUS / MICRO_IN_SECOND, periodUS % MICRO_IN_SECOND}; 			
 		timeradd(&curTime, &offsetTV, nextTimeOut);				
 	}
 	
 public:
+	//	Clock used for all query timeouts. Monotonic, so that timeouts are
+	//	not affected by changes to the wall clock
+	static void getCurrentTime(struct timeval* curTime) {
+		struct timespec curTS;
+		clock_gettime(CLOCK_MONOTONIC, &curTS);
+		curTime->tv_sec = curTS.tv_sec;
+		curTime->tv_usec = curTS.tv_nsec / 1000;
+	}
+	//	Queries are created and destroyed at a high rate, serve them from
+	//	free lists kept per object size. The destructor is virtual, so
+	//	delete passes the size of the most derived type
+	static void* operator new(size_t size)	{ return pool()->alloc(size);	}
+	static void operator delete(void* obj, size_t size) {
+		pool()->release(obj, size);
+	}
+	static SizeClassPool* pool();
 	virtual uint64_t getQueryID() const = 0;	
 	virtual struct timeval timeOut() const = 0;
 	virtual int init() = 0;
@@ -189,16 +222,6 @@ private:
 	int performReplacement();
 	double* createLatencyMatrix(); 		
 	int removeCandidateNode(const NodeIdent& in_node);
-	double getVolume(coordT* points, int dim, int numpoints);
-	double calculateHV(
-		const int N,					// Physical size of the latencyMatrix
-		const int NPrime,				// Size of the latencyMatrix in use
-		double* latencyMatrix);			// Pointer to latencyMatrix
-	double reduceSetByN(
-		vector<NodeIdent>& inVector,	// Vector of nodes
-		vector<NodeIdent>& deletedNodes,
-		int numReduction,				// How many nodes to remove
-		double* latencyMatrix);			// Pointer to latencyMatrix			
 public:
 	RingManageQuery(int in_ringNum,	MeridianProcess* in_process);
 	virtual ~RingManageQuery() {
@@ -223,6 +246,13 @@ public:
 };
 
 
+//	Kind of measurement performed by a probe. Concurrent probes of the same
+//	kind to the same target are coalesced by MeridianProcess::startProbe
+#define PROBE_TYPE_TCP		1
+#define PROBE_TYPE_DNS		2
+#define PROBE_TYPE_PING		3
+#define PROBE_TYPE_ICMP		4
+
 class ProbeQueryGeneric : public Query {
 private:
 	int					sockFD;
@@ -234,13 +264,12 @@ private:
 	MeridianProcess*	meridProcess;
 	vector<uint64_t>	subscribers;	
 protected:
-	NodeIdent getRemoteNode() const		{ return remoteNode;				}
 	void setSockFD(int fd)				{ sockFD = fd;						}
 	int getSockFD()	const				{ return sockFD;					}
 	struct timeval getStartTime() const	{ return startTime;					}
 	void setStartTime() 				{ gettimeofday(&startTime, NULL); 	}		
 	MeridianProcess* getMerid() 		{ return meridProcess; 				}
-	void setFinished(bool flag)			{ finished = flag;					}
+	void setFinished(bool flag);
 
 	virtual void insertCache(const NodeIdent& inNode, uint32_t latencyUS) = 0;
 	
@@ -258,6 +287,8 @@ public:
 	virtual bool isFinished() const					{ return finished;	}		
 	virtual int init() = 0;					
 	virtual int subscribeLatency(uint64_t in_qid);
+	virtual int getProbeType() const = 0;
+	NodeIdent getRemoteNode() const		{ return remoteNode;				}
 };
 
 class ProbeQueryTCP : public ProbeQueryGeneric {
@@ -267,6 +298,7 @@ public:
 	ProbeQueryTCP(const NodeIdent& in_remote, MeridianProcess* in_process)
 		: ProbeQueryGeneric(in_remote, in_process) {}				
 	virtual ~ProbeQueryTCP() {}	
+	virtual int getProbeType() const	{ return PROBE_TYPE_TCP;	}
 	virtual int handleTimeout();			
 	virtual int init();					
 };
@@ -278,6 +310,7 @@ public:
 	ProbeQueryDNS(const NodeIdent& in_remote, MeridianProcess* in_process)
 		: ProbeQueryGeneric(in_remote, in_process) {}				
 	virtual ~ProbeQueryDNS() {}	
+	virtual int getProbeType() const	{ return PROBE_TYPE_DNS;	}
 	virtual int handleTimeout();			
 	virtual int init();					
 };
@@ -289,6 +322,7 @@ public:
 	ProbeQueryPing(const NodeIdent& in_remote, MeridianProcess* in_process)
 		: ProbeQueryGeneric(in_remote, in_process) {}				
 	virtual ~ProbeQueryPing() {}	
+	virtual int getProbeType() const	{ return PROBE_TYPE_PING;	}
 	virtual int handleTimeout();			
 	virtual int init();					
 };
@@ -301,6 +335,7 @@ public:
 	ProbeQueryICMP(const NodeIdent& in_remote, MeridianProcess* in_process)
 		: ProbeQueryGeneric(in_remote, in_process) {}				
 	virtual ~ProbeQueryICMP() {}	
+	virtual int getProbeType() const	{ return PROBE_TYPE_ICMP;	}
 	virtual int handleTimeout();			
 	virtual int init();					
 };
@@ -311,6 +346,7 @@ class HandleReqGeneric : public Query {
 private:		
 	uint64_t							qid;	
 	NodeIdentRendv						srcNode;
+	int									srcWireVersion;	// Of srcNode
 	bool 								finished;
 	//struct timeval						startTime;
 	struct timeval						timeoutTV;
@@ -331,7 +367,7 @@ protected:
 		
 public:
 	HandleReqGeneric(uint64_t id, const NodeIdentRendv& in_srcNode, 
-					const vector<NodeIdent>& in_remote, 
+					const NodeListView& in_remote, 
 					MeridianProcess* in_process);
 	virtual ~HandleReqGeneric() {}	
 	virtual uint64_t getQueryID() const				{ return qid;		}
@@ -356,7 +392,7 @@ protected:
 	virtual int getLatency(const NodeIdent& inNode, uint32_t* latencyUS);
 public:
 	HandleReqPing(uint64_t id, const NodeIdentRendv& in_srcNode, 
-					const vector<NodeIdent>& in_remote, 
+					const NodeListView& in_remote, 
 					MeridianProcess* in_process) 
 		: HandleReqGeneric(id, in_srcNode, in_remote, in_process) {}
 	virtual ~HandleReqPing() {}		
@@ -372,7 +408,7 @@ protected:
 	virtual int getLatency(const NodeIdent& inNode, uint32_t* latencyUS);
 public:
 	HandleReqTCP(uint64_t id, const NodeIdentRendv& in_srcNode, 
-					const vector<NodeIdent>& in_remote, 
+					const NodeListView& in_remote, 
 					MeridianProcess* in_process)
 		: 	HandleReqGeneric(id, in_srcNode, in_remote, in_process) {}
 	virtual ~HandleReqTCP() {}
@@ -388,7 +424,7 @@ protected:
 	virtual int getLatency(const NodeIdent& inNode, uint32_t* latencyUS);
 public:
 	HandleReqDNS(uint64_t id, const NodeIdentRendv& in_srcNode, 
-					const vector<NodeIdent>& in_remote, 
+					const NodeListView& in_remote, 
 					MeridianProcess* in_process)
 		: 	HandleReqGeneric(id, in_srcNode, in_remote, in_process) {}
 	virtual ~HandleReqDNS() {}
@@ -405,7 +441,7 @@ protected:
 	virtual int getLatency(const NodeIdent& inNode, uint32_t* latencyUS);
 public:
 	HandleReqICMP(uint64_t id, const NodeIdentRendv& in_srcNode, 
-					const vector<NodeIdent>& in_remote, 
+					const NodeListView& in_remote, 
 					MeridianProcess* in_process) 
 		: HandleReqGeneric(id, in_srcNode, in_remote, in_process) {}
 	virtual ~HandleReqICMP() {}		
@@ -417,6 +453,7 @@ class ReqProbeGeneric : public Query {
 private:
 	uint64_t					qid;
 	NodeIdentRendv				srcNode;
+	int							srcWireVersion;	// Of srcNode
 	set<NodeIdent, ltNodeIdent>	remoteNodes;
 	bool 						finished;
 	struct timeval				timeoutTV;
@@ -424,6 +461,7 @@ private:
 	vector<uint64_t>			subscribers;
 protected:
 	NodeIdentRendv getSrcNode()						{ return srcNode;		}
+	int getSrcWireVersion() const				{ return srcWireVersion;	}
 	set<NodeIdent, ltNodeIdent>* getRemoteNodes() 	{ return &remoteNodes; 	}
 	MeridianProcess* getMerid() 					{ return meridProcess; 	}
 	void setFinished(bool flag)						{ finished = flag;		}
@@ -532,6 +570,7 @@ private:
 	u_short													betaDenom;
 	u_int													averageLatUS;
 	NodeIdentRendv											srcNode;
+	int														srcWireVersion;
 	bool 													finished;
 	NodeIdent												selectedMember;
 	struct timeval											timeoutTV;
@@ -574,7 +613,7 @@ public:
 	HandleClosestGeneric(uint64_t id,
 			u_short in_betaNumer, u_short in_betaDenom,
 			const NodeIdentRendv& in_srcNode, 
-			const vector<NodeIdent>& in_remote, 
+			const NodeListView& in_remote, 
 			MeridianProcess* in_process);			
 	virtual ~HandleClosestGeneric();
 	virtual uint64_t getQueryID() const				{ return qid;		}
@@ -617,7 +656,7 @@ protected:
 	
 public:				
 	HandleClosestTCP(uint64_t id, u_short in_betaNumer, u_short in_betaDenom,
-		const NodeIdentRendv& in_srcNode, const vector<NodeIdent>& in_remote, 
+		const NodeIdentRendv& in_srcNode, const NodeListView& in_remote, 
 		MeridianProcess* in_process) 
 			:	HandleClosestGeneric(id, in_betaNumer, in_betaDenom, in_srcNode, 
 				in_remote, in_process) {}
@@ -653,7 +692,7 @@ protected:
 	
 public:				
 	HandleClosestDNS(uint64_t id, u_short in_betaNumer, u_short in_betaDenom,
-		const NodeIdentRendv& in_srcNode, const vector<NodeIdent>& in_remote, 
+		const NodeIdentRendv& in_srcNode, const NodeListView& in_remote, 
 		MeridianProcess* in_process) 
 			:	HandleClosestGeneric(id, in_betaNumer, in_betaDenom, in_srcNode, 
 				in_remote, in_process) {}
@@ -690,7 +729,7 @@ protected:
 	
 public:				
 	HandleClosestPing(uint64_t id, u_short in_betaNumer, u_short in_betaDenom,
-		const NodeIdentRendv& in_srcNode, const vector<NodeIdent>& in_remote, 
+		const NodeIdentRendv& in_srcNode, const NodeListView& in_remote, 
 		MeridianProcess* in_process) 
 			:	HandleClosestGeneric(id, in_betaNumer, in_betaDenom, in_srcNode, 
 				in_remote, in_process) {}
@@ -728,7 +767,7 @@ protected:
 	
 public:				
 	HandleClosestICMP(uint64_t id, u_short in_betaNumer, u_short in_betaDenom,
-		const NodeIdentRendv& in_srcNode, const vector<NodeIdent>& in_remote, 
+		const NodeIdentRendv& in_srcNode, const NodeListView& in_remote, 
 		MeridianProcess* in_process) 
 			:	HandleClosestGeneric(id, in_betaNumer, in_betaDenom, in_srcNode, 
 				in_remote, in_process) {}
@@ -751,6 +790,7 @@ private:
 	u_short													betaDenom;
 	u_int													averageLatUS;
 	NodeIdentRendv											srcNode;
+	int														srcWireVersion;
 	bool 													finished;
 	NodeIdent												selectedMember;
 	struct timeval											timeoutTV;
@@ -848,7 +888,7 @@ public:
 	HandleMCGeneric(uint64_t id,
 			u_short in_betaNumer, u_short in_betaDenom,
 			const NodeIdentRendv& in_srcNode, 
-			const vector<NodeIdentConst>& in_remote, 
+			const NodeListView& in_remote, 
 			MeridianProcess* in_process);			
 	virtual ~HandleMCGeneric();
 	virtual uint64_t getQueryID() const				{ return qid;		}
@@ -892,7 +932,7 @@ protected:
 public:				
 	HandleMCTCP(uint64_t id, u_short in_betaNumer, u_short in_betaDenom,
 		const NodeIdentRendv& in_srcNode, 
-		const vector<NodeIdentConst>& in_remote, MeridianProcess* in_process) 
+		const NodeListView& in_remote, MeridianProcess* in_process) 
 			:	HandleMCGeneric(id, in_betaNumer, in_betaDenom, in_srcNode, 
 				in_remote, in_process) {}
 				
@@ -928,7 +968,7 @@ protected:
 public:				
 	HandleMCPing(uint64_t id, u_short in_betaNumer, u_short in_betaDenom,
 		const NodeIdentRendv& in_srcNode, 
-		const vector<NodeIdentConst>& in_remote, MeridianProcess* in_process) 
+		const NodeListView& in_remote, MeridianProcess* in_process) 
 			:	HandleMCGeneric(id, in_betaNumer, in_betaDenom, in_srcNode, 
 				in_remote, in_process) {}
 				
@@ -964,7 +1004,7 @@ protected:
 public:				
 	HandleMCDNS(uint64_t id, u_short in_betaNumer, u_short in_betaDenom,
 		const NodeIdentRendv& in_srcNode, 
-		const vector<NodeIdentConst>& in_remote, MeridianProcess* in_process) 
+		const NodeListView& in_remote, MeridianProcess* in_process) 
 			:	HandleMCGeneric(id, in_betaNumer, in_betaDenom, in_srcNode, 
 				in_remote, in_process) {}
 				
@@ -1001,7 +1041,7 @@ protected:
 public:				
 	HandleMCICMP(uint64_t id, u_short in_betaNumer, u_short in_betaDenom,
 		const NodeIdentRendv& in_srcNode, 
-		const vector<NodeIdentConst>& in_remote, MeridianProcess* in_process) 
+		const NodeListView& in_remote, MeridianProcess* in_process) 
 			:	HandleMCGeneric(id, in_betaNumer, in_betaDenom, in_srcNode, 
 				in_remote, in_process) {}
 				
@@ -1011,6 +1051,7 @@ public:
 
 #ifdef MERIDIAN_DSL
 #include "MQLState.h"
+#include "DSLScheduler.h"
 // This query redirects packets to DSLRecvQuery
 class DSLReqQuery : public Query {
 private:
@@ -1021,6 +1062,10 @@ private:
 	uint64_t					recvQueryID;
 	NodeIdentRendv				destNode;
 	uint16_t					ttl;
+	//	Set when the program was sent by hash. Sent if the destination
+	//	no longer has the program
+	RealPacket*					fullPacket;
+	ProgramHash					programHash;
 protected:
 	MeridianProcess* getMerid() 					{ return meridProcess; 	}
 	void setFinished(bool flag)						{ finished = flag;		}	
@@ -1029,7 +1074,9 @@ public:
 	DSLReqQuery(MeridianProcess* in_process, const struct timeval& in_timeout,
 		uint16_t in_ttl, const NodeIdentRendv& in_dest, uint64_t redirectQID);
 		
-	virtual ~DSLReqQuery() {}			
+	virtual ~DSLReqQuery() {
+		if (fullPacket) delete fullPacket;
+	}			
 	virtual uint64_t getQueryID() const				{ return qid;		}
 	virtual struct timeval timeOut() const			{ return timeoutTV;	} 	
 	virtual int handleEvent(
@@ -1058,6 +1105,9 @@ private:
 	ParserState*				ps;
 	NodeIdentRendv				srcNode;
 	uint16_t					ttl;
+	DSLThreadState				threadState;
+	int							sliceEvals;	// Budget of the next slice
+	int							evalsUsed;	// In the last slice
 protected:
 	NodeIdentRendv getSrcNode()						{ return srcNode;		}
 	MeridianProcess* getMerid() 					{ return meridProcess; 	}
@@ -1066,7 +1116,7 @@ protected:
 public:
 	DSLRecvQuery(ParserState* in_state, MeridianProcess* in_process,
 			const NodeIdentRendv& in_src, uint64_t in_ret_qid, 
-			uint16_t timeout_ms, uint16_t in_ttl);
+			uint16_t timeout_ms, uint16_t in_ttl, int in_priority);
 	
 	virtual ~DSLRecvQuery() {		
 		if (ps) delete ps; // Query gains ownership of ParserState
@@ -1091,6 +1141,10 @@ public:
 	uint16_t getTTL() {
 		return ttl;	
 	}	
+	DSLThreadState* getThreadState()				{ return &threadState;	}
+	//	handleLatency runs the thread for at most in_evals eval steps
+	void setSliceEvals(int in_evals)				{ sliceEvals = in_evals; }
+	int getEvalsUsed() const						{ return evalsUsed;		}
 };
 
 
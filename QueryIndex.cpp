@@ -0,0 +1,86 @@
+/******************************************************************************
+Meridian prototype distribution
+Copyright (C) 2005 Bernard Wong
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+The copyright owner can be contacted by e-mail at bwong@cs.cornell.edu
+*******************************************************************************/
+
+using namespace std;
+
+#include "QueryIndex.h"
+
+QueryIndex::QueryIndex() : numUsed(0) {
+	resize(QUERY_INDEX_INIT_SIZE);
+}
+
+void QueryIndex::resize(u_int newSize) {
+	vector<QueryIndexSlot> oldSlots;
+	oldSlots.swap(slots);
+	QueryIndexSlot emptySlot = {0, NULL, NULL};
+	slots.resize(newSize, emptySlot);
+	mask = newSize - 1;
+	shift = 64;
+	for (u_int i = newSize; i > 1; i >>= 1) {
+		shift--;
+	}
+	numUsed = 0;
+	for (u_int i = 0; i < oldSlots.size(); i++) {
+		if (oldSlots[i].query != NULL) {
+			insert(oldSlots[i].qid, oldSlots[i].query, oldSlots[i].timer);
+		}
+	}
+}
+
+int QueryIndex::insert(uint64_t qid, Query* query, TimerEntry* timer) {
+	if ((numUsed + 1) * 100 > slots.size() * QUERY_INDEX_MAX_LOAD_PCT) {
+		resize(slots.size() * 2);
+	}
+	u_int pos = homeSlot(qid);
+	for (; slots[pos].query != NULL; pos = (pos + 1) & mask) {
+		if (slots[pos].qid == qid) {
+			return -1;	// Already exists
+		}
+	}
+	slots[pos].qid = qid;
+	slots[pos].query = query;
+	slots[pos].timer = timer;
+	numUsed++;
+	return 0;
+}
+
+int QueryIndex::erase(uint64_t qid) {
+	QueryIndexSlot* curSlot = find(qid);
+	if (curSlot == NULL) {
+		return -1;
+	}
+	//	Shift following entries back into the hole instead of leaving a
+	//	tombstone, so lookups never get slower as queries come and go
+	u_int hole = curSlot - &(slots[0]);
+	for (u_int pos = (hole + 1) & mask; 
+			slots[pos].query != NULL; pos = (pos + 1) & mask) {
+		u_int home = homeSlot(slots[pos].qid);
+		//	Entry can move only if its home is not in (hole, pos]
+		if (((pos - home) & mask) >= ((pos - hole) & mask)) {
+			slots[hole] = slots[pos];
+			hole = pos;
+		}
+	}
+	slots[hole].query = NULL;
+	slots[hole].timer = NULL;
+	numUsed--;
+	return 0;
+}
@@ -0,0 +1,69 @@
+#ifndef CLASS_QUERY_INDEX
+#define CLASS_QUERY_INDEX
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <vector>
+
+class Query;
+struct TimerEntry;
+
+#define QUERY_INDEX_INIT_SIZE		1024	// Must be a power of 2
+#define QUERY_INDEX_MAX_LOAD_PCT	50
+
+//	A slot is empty when query is NULL
+struct QueryIndexSlot {
+	uint64_t	qid;
+	Query*		query;
+	TimerEntry*	timer;
+};
+
+//	Open-addressing (linear probing) hash table from query ID to the query
+//	and its timer. Slots are moved by erase and by growing the table, so
+//	pointers returned by find are only valid until the next insert or erase
+class QueryIndex {
+private:
+	vector<QueryIndexSlot>	slots;
+	u_int					mask;		// slots.size() - 1
+	u_int					shift;		// 64 - log2(slots.size())
+	u_int					numUsed;
+
+	u_int homeSlot(uint64_t qid) const {
+		//	Fibonacci hashing, query IDs share their upper bits (address
+		//	and port of the node that created them)
+		return (u_int)(((qid ^ (qid >> 29)) * 0x9E3779B97F4A7C15ULL) >> shift);
+	}
+	void resize(u_int newSize);
+
+public:
+	QueryIndex();
+
+	//	Returns NULL if qid is not in the index
+	QueryIndexSlot* find(uint64_t qid) {
+		for (u_int pos = homeSlot(qid); ; pos = (pos + 1) & mask) {
+			QueryIndexSlot* curSlot = &(slots[pos]);
+			if (curSlot->query == NULL) {
+				return NULL;
+			}
+			if (curSlot->qid == qid) {
+				return curSlot;
+			}
+		}
+	}
+
+	//	Returns -1 if qid is already in the index
+	int insert(uint64_t qid, Query* query, TimerEntry* timer);
+
+	//	Returns -1 if qid is not in the index
+	int erase(uint64_t qid);
+
+	u_int size() const				{ return numUsed;		}
+	u_int capacity() const			{ return slots.size();	}
+	//	For iterating over all queries, NULL if the slot is empty
+	QueryIndexSlot* slotAt(u_int pos) {
+		return (slots[pos].query == NULL) ? NULL : &(slots[pos]);
+	}
+};
+
+#endif
@@ -22,61 +22,6 @@ The copyright owner can be contacted by e-mail at bwong@cs.cornell.edu
 using namespace std;
 #include "QueryTable.h"
 
-int QueryTable::addTimeout(Query* inQuery) {
-	struct timeval tv = inQuery->timeOut();	
-	normalizeTime(tv);				// 	Normalized to standard form	
-	queryTimeoutMap[inQuery] = tv;	//	Insert into query timeout map
-	//	Now insert it into timeout query map (really multimap)
-	map<struct timeval, vector<Query*>*, timevalLT>::iterator findIt 
-		= timeoutQueryMap.find(tv);
-	if (findIt != timeoutQueryMap.end()) {
-		(findIt->second)->push_back(inQuery);
-	} else {
-		vector<Query*>* newVector = new vector<Query*>();
-		newVector->push_back(inQuery);
-		timeoutQueryMap[tv] = newVector;
-	}
-	return 0;				
-}
-	
-int QueryTable::removeOldTimeout(Query* inQuery) {
-	// Retrieve old timemout and remove from query-timeout map		
-	struct timeval tv = retrieveOldTimeout(inQuery);
-	queryTimeoutMap.erase(inQuery);
-	// Remove entry from timeout-query map		
-	map<struct timeval, vector<Query*>*, timevalLT>::iterator findTime
-		= timeoutQueryMap.find(tv);
-	if (findTime == timeoutQueryMap.end()) {
-		assert(false); // Not found, should not be possible		
-	}
-	vector<Query*>* tmpVect = findTime->second;
-	bool foundQuery = false;
-	for (u_int i = 0; i < tmpVect->size(); i++) {
-		if ((*tmpVect)[i] == inQuery) {
-			foundQuery = true;
-			(*tmpVect)[i] = (*tmpVect)[tmpVect->size()-1];
-			tmpVect->pop_back();
-			break;					
-		}
-	}
-	assert(foundQuery); // Logic error otherwise
-	//	If the vector is now empty
-	if (tmpVect->size() == 0) {
-		timeoutQueryMap.erase(findTime);
-		delete tmpVect;	// Vector empty, delete it
-	}
-	return 0;
-}
-	
-struct timeval QueryTable::retrieveOldTimeout(Query* inQuery) {
-	map<Query*, struct timeval, queryLT>::iterator tmpIt = 
-		queryTimeoutMap.find(inQuery);
-	if (tmpIt == queryTimeoutMap.end()) {
-		assert(false); 	// Every query should have a timeout		
-	}
-	return tmpIt->second;			
-}	
-	
 void QueryTable::normalizeTime(struct timeval& tv) {
 	if (tv.tv_usec > MICRO_IN_SECOND) {
 		u_int extraSeconds = (tv.tv_usec / MICRO_IN_SECOND);			
@@ -86,31 +31,50 @@ void QueryTable::normalizeTime(struct timeval& tv) {
 }
 	
 int QueryTable::updateTimeout(Query* inQuery) {
-	removeOldTimeout(inQuery); 		// 	Old timeout no longer valid		
+	uint64_t qid = inQuery->getQueryID();
+	QueryIndexSlot* curSlot = queryIndex.find(qid);
+	if (curSlot == NULL) {
+		assert(false); 	// Every query should have a timeout		
+	}
+	TimerEntry* entry = curSlot->timer;
 	if (inQuery->isFinished()) {
+		timerWheel.cancel(entry);
+		queryIndex.erase(qid);
+		delete entry;
 		delete inQuery; 				// 	Done with query
-	} else {			
-		addTimeout(inQuery); 			//	Set the new timeout				
+	} else {
+		struct timeval tv = inQuery->timeOut();	
+		normalizeTime(tv);
+		timerWheel.arm(entry, tv);		//	Replaces the old timeout
 	}
 	return 0;
 }
 		
 int QueryTable::insertNewQuery(Query* inQuery) {
-	if (queryTimeoutMap.find(inQuery) != queryTimeoutMap.end()) {
+	uint64_t qid = inQuery->getQueryID();
+	if (queryIndex.find(qid) != NULL) {
 		return -1;	// Query already exists
 	}
-	return addTimeout(inQuery);
+	TimerEntry* entry = new TimerEntry();
+	entry->next = NULL;
+	entry->prev = NULL;
+	entry->level = -1;
+	entry->query = inQuery;
+	queryIndex.insert(qid, inQuery, entry);
+	struct timeval tv = inQuery->timeOut();	
+	normalizeTime(tv);
+	timerWheel.arm(entry, tv);
+	return 0;
 }
 
 int QueryTable::notifyQPacket(uint64_t id, const NodeIdent& remoteNode, 
 		const char* packet, int packetSize) {
-	SearchQuery tmpQ(id);
-	map<Query*, struct timeval, queryLT>::iterator findIt 
-		= queryTimeoutMap.find(&tmpQ);
-	if (findIt == queryTimeoutMap.end()) {
+	QueryIndexSlot* curSlot = queryIndex.find(id);
+	if (curSlot == NULL) {
 		return -1;	
 	}
-	Query* curQuery = findIt->first; 	// 	Actual query
+	//	The handler may add queries, which invalidates curSlot
+	Query* curQuery = curSlot->query;
 	curQuery->handleEvent(remoteNode, packet, packetSize);
 	return updateTimeout(curQuery);
 }
@@ -119,50 +83,34 @@ int QueryTable::notifyQLatency(uint64_t id,
 	const vector<NodeIdentLat>& in_remoteNodes) {
 //	const map<NodeIdent, u_int, ltNodeIdent>& in_remoteNodes) {
 //	const NodeIdent& remoteNode, u_int latency_us) {
-	SearchQuery tmpQ(id);
-	map<Query*, struct timeval, queryLT>::iterator findIt 
-		= queryTimeoutMap.find(&tmpQ);
-	if (findIt == queryTimeoutMap.end()) {
+	QueryIndexSlot* curSlot = queryIndex.find(id);
+	if (curSlot == NULL) {
 		return -1;	
 	}
-	Query* curQuery = findIt->first; 	// 	Actual query
+	Query* curQuery = curSlot->query;
 	curQuery->handleLatency(in_remoteNodes);
 	return updateTimeout(curQuery);
 }
 
 int QueryTable::handleTimeout() {
 	struct timeval curTime;
-	gettimeofday(&curTime, NULL);
-	normalizeTime(curTime);		
-	//	Aggregate all timed out queries
-	vector<Query*> deleteQueries;
-	map<struct timeval, vector<Query*>*, timevalLT>::iterator it 
-		= timeoutQueryMap.begin();			
-	for (; it != timeoutQueryMap.end(); it++) {
-		struct timeval s1 = it->first;			
-		if ((s1.tv_sec < curTime.tv_sec) || 
-				((s1.tv_sec == curTime.tv_sec) && 
-				(s1.tv_usec <= curTime.tv_usec))) {
-			//	Push all the timed out queries in here
-			vector<Query*>* curTimeoutVect = it->second;				
-			for (u_int i = 0; i < curTimeoutVect->size(); i++) {
-				deleteQueries.push_back((*curTimeoutVect)[i]);
-			}
-		}
+	Query::getCurrentTime(&curTime);
+	expiredEntries.clear();
+	timerWheel.advance(curTime, expiredEntries);
+	vector<uint64_t> timedOutIDs;
+	for (u_int i = 0; i < expiredEntries.size(); i++) {
+		timedOutIDs.push_back(expiredEntries[i]->query->getQueryID());
 	}
-	//	Now iterate through all the queries that have timeout and either
-	//	delete them or update to new timeout value
-	for (u_int i = 0; i < deleteQueries.size(); i++) {
-		Query* curQuery = deleteQueries[i];
+	//	Handling a timeout may finish (and delete) other queries, so look
+	//	each one up again rather than holding on to the pointers
+	for (u_int i = 0; i < timedOutIDs.size(); i++) {
+		QueryIndexSlot* curSlot = queryIndex.find(timedOutIDs[i]);
+		if (curSlot == NULL || TimerWheel::isArmed(curSlot->timer)) {
+			continue;	// Gone, or given a new timeout in the meantime
+		}
+		Query* curQuery = curSlot->query;
 		curQuery->handleTimeout();
 		updateTimeout(curQuery);
-		//if (curQuery->isFinished()) {				
-		//	removeOldTimeout(curQuery);
-		//	delete curQuery;
-		//} else {
-		//	updateTimeout(curQuery);	
-		//}
 	}
 	return 0;		
 }
-
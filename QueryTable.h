@@ -8,55 +8,25 @@
 #include <map>
 #include "Common.h"
 #include "Query.h"
+#include "QueryIndex.h"
+#include "TimerWheel.h"
 
 #define DEFAULT_TIME_OUT_S	5
 
-struct queryLT {
-	bool operator()(Query* s1, Query* s2) const {
-		if (s1->getQueryID() < s2->getQueryID()) {
-			return true;
-		}
-		return false;
-	}
-};
-
-struct timevalLT {
-	bool operator()(struct timeval s1, struct timeval s2) const {
-		// Assume time is already normalized
-		if ((s1.tv_sec < s2.tv_sec) || 
-			((s1.tv_sec == s2.tv_sec) && (s1.tv_usec < s2.tv_usec))) {
-			return true;
-		}
-		return false;		
-	}
-};
-
 class QueryTable {
 private:
-	map<Query*, struct timeval, queryLT>				queryTimeoutMap; 
-	map<struct timeval, vector<Query*>*, timevalLT>		timeoutQueryMap;
-
-	int addTimeout(Query* inQuery);	
-	int removeOldTimeout(Query* inQuery);	
-	struct timeval retrieveOldTimeout(Query* inQuery);	
+	//	Every query in the table has a timer entry, armed at its timeout
+	QueryIndex				queryIndex;
+	TimerWheel				timerWheel;
+	vector<TimerEntry*>		expiredEntries;	// Reused by handleTimeout
 public:
 	QueryTable() {}
 	~QueryTable() {
-		// Since timeoutQueryMap and queryTimeoutMap both contains every
-		// query in the system, only need to delete queries from
-		// timeoutQueryMap
-		map<struct timeval, vector<Query*>*, timevalLT>	::iterator it
-			= timeoutQueryMap.begin();		
-		for (; it != timeoutQueryMap.end(); it++) {
-			if (it->second != NULL) {
-				vector<Query*>* tmpVect = it->second;
-				//	Delete all contents of the vector
-				for (u_int i = 0; i < tmpVect->size(); i++) {
-					if ((*tmpVect)[i] != NULL) {
-						delete (*tmpVect)[i];	
-					}
-				}
-				delete tmpVect;	// delete the vector itself
+		for (u_int i = 0; i < queryIndex.capacity(); i++) {
+			QueryIndexSlot* curSlot = queryIndex.slotAt(i);
+			if (curSlot != NULL) {
+				delete curSlot->query;
+				delete curSlot->timer;
 			}
 		}
 	}
@@ -71,28 +41,28 @@ public:
 		const vector<NodeIdentLat>& in_remoteNodes);
 	//const NodeIdent& remoteNode, u_int latency_us);	
 	bool isQueryInTable(uint64_t id) {
-		SearchQuery tmp(id);
-		return (queryTimeoutMap.find(&tmp) != queryTimeoutMap.end());			
+		return (queryIndex.find(id) != NULL);
+	}
+	
+	//	Returns NULL if the query is not in the table
+	Query* getQuery(uint64_t id) {
+		QueryIndexSlot* curSlot = queryIndex.find(id);
+		return (curSlot != NULL) ? curSlot->query : NULL;
 	}
 		
 	void nextTimeout(struct timeval* nextEventTime) {
-		if (timeoutQueryMap.empty()) {
-			gettimeofday(nextEventTime, NULL);
+		if (timerWheel.nextExpiry(nextEventTime) == -1) {
+			Query::getCurrentTime(nextEventTime);
 			nextEventTime->tv_sec += DEFAULT_TIME_OUT_S;	
-		} else {
-			nextEventTime->tv_sec = (timeoutQueryMap.begin())->first.tv_sec;
-			nextEventTime->tv_usec = (timeoutQueryMap.begin())->first.tv_usec;
 		}
 	}
 #ifdef MERIDIAN_DSL
 	DSLRecvQuery* getDSLRecvQ(uint64_t id) {
-		SearchQuery tmpQ(id);
-		map<Query*, struct timeval, queryLT>::iterator findIt 
-			= queryTimeoutMap.find(&tmpQ);
-		if (findIt == queryTimeoutMap.end()) {
+		QueryIndexSlot* curSlot = queryIndex.find(id);
+		if (curSlot == NULL) {
 			return NULL;	
 		}
-		return dynamic_cast<DSLRecvQuery*>(findIt->first); 			
+		return dynamic_cast<DSLRecvQuery*>(curSlot->query); 			
 	}
 #endif
 };
@@ -0,0 +1,121 @@
+/******************************************************************************
+Meridian prototype distribution
+Copyright (C) 2005 Bernard Wong
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+The copyright owner can be contacted by e-mail at bwong@cs.cornell.edu
+*******************************************************************************/
+
+using namespace std;
+
+#include "LatencyCache.h"
+#include "RingLatencyMatrix.h"
+
+void RingLatencyMatrix::retainMembers(
+		const set<NodeIdent, ltNodeIdent>& members) {
+	map<NodeIdent, LatencyRow, ltNodeIdent>::iterator rowIt = rows.begin();
+	while (rowIt != rows.end()) {
+		if (members.find(rowIt->first) == members.end()) {
+			rows.erase(rowIt++);
+			changed = true;
+			continue;
+		}
+		LatencyRow::iterator colIt = rowIt->second.begin();
+		while (colIt != rowIt->second.end()) {
+			if (members.find(colIt->first) == members.end()) {
+				rowIt->second.erase(colIt++);
+				changed = true;
+			} else {
+				colIt++;
+			}
+		}
+		rowIt++;
+	}
+	//	Compared with the previous members rather than the rows, as members
+	//	that cannot be measured never get a row
+	bool sameMembers = (members.size() == prevMembers.size());
+	set<NodeIdent, ltNodeIdent>::const_iterator it = members.begin();
+	set<NodeIdent, ltNodeIdent>::const_iterator prevIt = prevMembers.begin();
+	ltNodeIdent lessThan;
+	for (; sameMembers && it != members.end(); it++, prevIt++) {
+		if (lessThan(*it, *prevIt) || lessThan(*prevIt, *it)) {
+			sameMembers = false;
+		}
+	}
+	if (!sameMembers) {
+		prevMembers = members;
+		changed = true;
+	}
+}
+
+void RingLatencyMatrix::staleTargets(const NodeIdent& from, 
+		const set<NodeIdent, ltNodeIdent>& members, 
+		vector<NodeIdent>& targets) {
+	uint64_t curMS = LatencyCache::coarseTimeMS();
+	LatencyRow& curRow = rows[from];
+	set<NodeIdent, ltNodeIdent>::const_iterator it = members.begin();
+	for (; it != members.end(); it++) {
+		if ((it->addr == from.addr) && (it->port == from.port)) {
+			continue;
+		}
+		LatencyRow::iterator colIt = curRow.find(*it);
+		if (colIt == curRow.end() || 
+				curMS - colIt->second.measuredMS >= RING_PAIR_TTL_MS) {
+			targets.push_back(*it);
+			numRequested++;
+		} else {
+			numReused++;
+		}
+	}
+}
+
+void RingLatencyMatrix::update(
+		const NodeIdent& from, const NodeIdent& to, u_int latencyUS) {
+	PairLatency& curPair = rows[from][to];
+	uint64_t curMS = LatencyCache::coarseTimeMS();
+	//	measuredMS of 0 means the entry was just created
+	if (curPair.measuredMS == 0) {
+		changed = true;
+	} else {
+		u_int diff = (latencyUS > curPair.latencyUS) ? 
+			latencyUS - curPair.latencyUS : curPair.latencyUS - latencyUS;
+		if ((uint64_t)diff * 100 > 
+				(uint64_t)curPair.latencyUS * RING_PAIR_CHANGE_PCT) {
+			changed = true;
+		} else {
+			latencyUS = curPair.latencyUS;	// Keep what the ring was built on
+		}
+	}
+	curPair.latencyUS = latencyUS;
+	curPair.measuredMS = (curMS == 0) ? 1 : curMS;
+}
+
+void RingLatencyMatrix::getRow(const NodeIdent& from, 
+		const set<NodeIdent, ltNodeIdent>& members, 
+		map<NodeIdent, u_int, ltNodeIdent>& latencies) {
+	map<NodeIdent, LatencyRow, ltNodeIdent>::iterator rowIt = rows.find(from);
+	if (rowIt == rows.end()) {
+		return;
+	}
+	uint64_t curMS = LatencyCache::coarseTimeMS();
+	LatencyRow::iterator colIt = rowIt->second.begin();
+	for (; colIt != rowIt->second.end(); colIt++) {
+		if (members.find(colIt->first) != members.end() &&
+				curMS - colIt->second.measuredMS < RING_PAIR_TTL_MS) {
+			latencies[colIt->first] = colIt->second.latencyUS;
+		}
+	}
+}
@@ -0,0 +1,60 @@
+#ifndef CLASS_RING_LATENCY_MATRIX
+#define CLASS_RING_LATENCY_MATRIX
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <map>
+#include <set>
+#include <vector>
+#include "Marshal.h"
+
+//	A pair is measured again once its latency is this old
+#define RING_PAIR_TTL_MS		(30 * 60 * 1000)
+//	Re-measured latencies within this percentage of the stored value do
+//	not count as a change of the ring
+#define RING_PAIR_CHANGE_PCT	10
+
+//	Latencies between the members of one ring, as measured by the members
+//	themselves (row = measuring node), kept from one ring management round
+//	to the next. A round only asks for the pairs that are missing or stale,
+//	and the replacement is skipped if neither the members nor any latency
+//	changed since the previous one.
+class RingLatencyMatrix {
+private:
+	struct PairLatency {
+		u_int		latencyUS;
+		uint64_t	measuredMS;
+	};
+	typedef map<NodeIdent, PairLatency, ltNodeIdent> LatencyRow;
+	map<NodeIdent, LatencyRow, ltNodeIdent>	rows;
+	set<NodeIdent, ltNodeIdent>				prevMembers;	// Of retainMembers
+	bool		changed;		// Since the last clearChanged
+	uint64_t	numRequested;	// Stats, pairs asked for
+	uint64_t	numReused;		// Pairs served from the matrix
+
+public:
+	RingLatencyMatrix() : changed(true), numRequested(0), numReused(0) {}
+
+	//	Drop the rows and columns of nodes that are no longer members
+	void retainMembers(const set<NodeIdent, ltNodeIdent>& members);
+
+	//	Append to targets the members whose latency from "from" is missing
+	//	or stale, and so have to be measured
+	void staleTargets(const NodeIdent& from, 
+		const set<NodeIdent, ltNodeIdent>& members, vector<NodeIdent>& targets);
+
+	void update(const NodeIdent& from, const NodeIdent& to, u_int latencyUS);
+
+	//	Fresh latencies from "from" to the other members
+	void getRow(const NodeIdent& from, 
+		const set<NodeIdent, ltNodeIdent>& members, 
+		map<NodeIdent, u_int, ltNodeIdent>& latencies);
+
+	bool isChanged() const			{ return changed;		}
+	void setChanged()				{ changed = true;		}
+	void clearChanged()				{ changed = false;		}
+	uint64_t getNumRequested() const	{ return numRequested;	}
+	uint64_t getNumReused() const		{ return numReused;		}
+};
+
+#endif
@@ -0,0 +1,72 @@
+/******************************************************************************
+Meridian prototype distribution
+Copyright (C) 2005 Bernard Wong
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+The copyright owner can be contacted by e-mail at bwong@cs.cornell.edu
+*******************************************************************************/
+
+using namespace std;
+#include <string.h>
+#include "RingPublisher.h"
+
+RingPublisher::RingPublisher(const RingSet& in_rings) 
+		: globalEpoch(1), numPublished(1), numFreed(0) {
+	memset(slots, 0, sizeof(slots));
+	current = new RingSnapshot(in_rings, numPublished);
+}
+
+RingPublisher::~RingPublisher() {
+	//	No reader may be left at this point
+	for (u_int i = 0; i < retired.size(); i++) {
+		delete retired[i];
+	}
+	delete current;
+}
+
+void RingPublisher::publish(const RingSet& in_rings) {
+	RingSnapshot* newSnapshot = new RingSnapshot(in_rings, numPublished + 1);
+	RingSnapshot* oldSnapshot = 
+		__atomic_exchange_n(&current, newSnapshot, __ATOMIC_SEQ_CST);
+	numPublished++;
+	//	Readers entering from now on see the new copy, those in this or an
+	//	earlier epoch may still hold the old one
+	oldSnapshot->retireEpoch = __atomic_load_n(&globalEpoch, __ATOMIC_SEQ_CST);
+	retired.push_back(oldSnapshot);
+	__atomic_add_fetch(&globalEpoch, 1, __ATOMIC_SEQ_CST);
+	reclaim();
+}
+
+void RingPublisher::reclaim() {
+	uint64_t minEpoch = UINT64_MAX;
+	for (u_int i = 0; i < MAX_RING_READERS; i++) {
+		uint64_t readerEpoch = 
+			__atomic_load_n(&(slots[i].epoch), __ATOMIC_SEQ_CST);
+		if (readerEpoch != 0 && readerEpoch < minEpoch) {
+			minEpoch = readerEpoch;
+		}
+	}
+	u_int numKept = 0;
+	for (u_int i = 0; i < retired.size(); i++) {
+		if (retired[i]->retireEpoch < minEpoch) {
+			delete retired[i];
+			numFreed++;
+		} else {
+			retired[numKept++] = retired[i];
+		}
+	}
+	retired.resize(numKept);
+}
@@ -0,0 +1,82 @@
+#ifndef CLASS_RING_PUBLISHER
+#define CLASS_RING_PUBLISHER
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <vector>
+#include "RingSet.h"
+
+//	Threads that can read the published rings, one slot each
+#define MAX_RING_READERS	64
+
+//	Immutable copy of the rings as of one publish
+class RingSnapshot {
+public:
+	RingSet		rings;
+	uint64_t	version;		// Incremented on every publish
+	uint64_t	retireEpoch;	// Epoch in which it was replaced
+
+	RingSnapshot(const RingSet& in_rings, uint64_t in_version)
+		: rings(in_rings), version(in_version), retireEpoch(0) {}
+};
+
+//	Epoch of a reader, on its own cache line. Only written by the reader
+struct RingReaderSlot {
+	uint64_t	epoch;			// 0 while not reading
+	u_int		depth;			// Nesting of acquire calls
+	char		pad[64 - sizeof(uint64_t) - sizeof(u_int)];
+};
+
+//	Read-copy-update of the rings. The single writer mutates its own RingSet
+//	and publishes an immutable copy after each batch of changes. Readers
+//	get the latest copy without taking any lock. A replaced copy is freed
+//	once every reader that might still hold it has released it: a reader
+//	records the global epoch when it acquires, and the writer advances the
+//	epoch after every publish, so a copy retired in epoch E is only freed
+//	when no reader is in an epoch at or before E.
+class RingPublisher {
+private:
+	RingSnapshot*			current;
+	uint64_t				globalEpoch;
+	uint64_t				numPublished;
+	uint64_t				numFreed;
+	RingReaderSlot			slots[MAX_RING_READERS];
+	vector<RingSnapshot*>	retired;	// Writer only, not yet freed
+
+	//	Free the retired copies that no reader can hold anymore
+	void reclaim();
+
+public:
+	RingPublisher(const RingSet& in_rings);
+	~RingPublisher();
+
+	//	Writer side. Replace the published copy by a copy of in_rings
+	void publish(const RingSet& in_rings);
+
+	//	Reader side, reader is the slot of the calling thread. The returned
+	//	rings stay valid and unchanged until the matching release. Calls can
+	//	be nested
+	const RingSnapshot* acquire(u_int reader) {
+		RingReaderSlot* slot = &(slots[reader]);
+		if (slot->depth++ == 0) {
+			//	The epoch must be visible to the writer before the pointer 
+			//	is read, or the copy might be freed under us
+			__atomic_store_n(&(slot->epoch), 
+				__atomic_load_n(&globalEpoch, __ATOMIC_SEQ_CST), 
+				__ATOMIC_SEQ_CST);
+		}
+		return __atomic_load_n(&current, __ATOMIC_SEQ_CST);
+	}
+	void release(u_int reader) {
+		RingReaderSlot* slot = &(slots[reader]);
+		if (--(slot->depth) == 0) {
+			__atomic_store_n(&(slot->epoch), 0, __ATOMIC_RELEASE);
+		}
+	}
+
+	uint64_t getVersion() const	{ return numPublished;		}
+	uint64_t getNumFreed() const	{ return numFreed;			}
+	u_int getNumRetired() const	{ return retired.size();	}
+};
+
+#endif
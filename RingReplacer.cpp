@@ -0,0 +1,200 @@
+/******************************************************************************
+Meridian prototype distribution
+Copyright (C) 2005 Bernard Wong
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+The copyright owner can be contacted by e-mail at bwong@cs.cornell.edu
+*******************************************************************************/
+
+using namespace std;
+
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "Common.h"
+#include "HyperVolume.h"
+#include "RingReplacer.h"
+
+int ReplaceJob::run() {
+	int N = primNodes.size();	// Dimension of matrix
+	int colSize = N;
+	int rowSize = N;	
+	HyperVolume hv;		// Reused for every reduction step
+	vector<double> logVolumes(N);
+	//	Perform reductions iteratively
+	for (int rCount = 0; rCount < numReduction; rCount++) {
+		//	Calcuate the hypervolume without each of the nodes
+		if (hv.logVolumesWithout(
+				latencyMatrix, N, rowSize, &(logVolumes[0])) == -1) {
+			return -1;
+		}
+		/*	See if it is the maximum so far
+			Rationale:	By removing this node, we still have the maxHV
+						comparing to removing any other node. Therefore,
+						we want to remove this node to keep a big HV
+		*/
+		int k = -1;
+		for (int i = 0; i < rowSize; i++) {
+			if (k == -1 || logVolumes[i] >= logVolumes[k]) {
+				k = i;
+			}
+		}
+		if (k == -1) {
+			return -1;	// Could not reduce any further
+		}
+		//	The max hypervolume at this reduction level
+		hyperVolume = exp(logVolumes[k]);
+		//	For the node that we have removed, remove it from the latency
+		//  matrix as well as from the vector of nodes
+		for (int i = 0; i < rowSize; i++) {
+			double tmpValue = latencyMatrix[i * N + k];
+			latencyMatrix[i * N + k] = latencyMatrix[i * N + colSize - 1];
+			latencyMatrix[i * N + colSize - 1] = tmpValue;
+		}
+		colSize--;								
+		for (int i = 0; i < colSize; i++) {
+			double tmpValue = latencyMatrix[k * N + i];
+			latencyMatrix[k * N + i] = latencyMatrix[(rowSize - 1) * N + i];
+			latencyMatrix[(rowSize - 1) * N + i] = tmpValue;
+		}
+		rowSize--;
+		removedNodes.push_back(primNodes[k]);
+		primNodes[k] = primNodes.back();
+		primNodes.pop_back();
+	}
+	return 0;
+}
+
+RingReplacer::RingReplacer() : notified(false), stopping(false) {
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&jobReady, NULL);
+	notifyPipe[0] = -1;
+	notifyPipe[1] = -1;
+}
+
+RingReplacer::~RingReplacer() {
+	stop();
+	pthread_cond_destroy(&jobReady);
+	pthread_mutex_destroy(&lock);
+}
+
+int RingReplacer::start(u_int numThreads) {
+	if (isRunning() || numThreads == 0) {
+		return -1;
+	}
+	if (pipe(notifyPipe) == -1) {
+		perror("Cannot create replacement pipe");
+		notifyPipe[0] = -1;
+		notifyPipe[1] = -1;
+		return -1;
+	}
+	for (int i = 0; i < 2; i++) {
+		fcntl(notifyPipe[i], F_SETFL, 
+			fcntl(notifyPipe[i], F_GETFL, 0) | O_NONBLOCK);
+	}
+	stopping = false;
+	for (u_int i = 0; i < numThreads; i++) {
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, workerMain, this) != 0) {
+			ERROR_LOG("Cannot create replacement worker\n");
+			break;
+		}
+		threads.push_back(thread);
+	}
+	if (threads.empty()) {
+		stop();
+		return -1;
+	}
+	return 0;
+}
+
+void RingReplacer::stop() {
+	pthread_mutex_lock(&lock);
+	stopping = true;
+	pthread_cond_broadcast(&jobReady);
+	pthread_mutex_unlock(&lock);
+	for (u_int i = 0; i < threads.size(); i++) {
+		pthread_join(threads[i], NULL);
+	}
+	threads.clear();
+	while (!(pendingJobs.empty())) {
+		delete pendingJobs.front();
+		pendingJobs.pop_front();
+	}
+	while (!(doneJobs.empty())) {
+		delete doneJobs.front();
+		doneJobs.pop_front();
+	}
+	for (int i = 0; i < 2; i++) {
+		if (notifyPipe[i] != -1) {
+			close(notifyPipe[i]);
+			notifyPipe[i] = -1;
+		}
+	}
+	notified = false;
+}
+
+void* RingReplacer::workerMain(void* arg) {
+	RingReplacer* replacer = (RingReplacer*)arg;
+	pthread_mutex_lock(&(replacer->lock));
+	while (true) {
+		while (!(replacer->stopping) && replacer->pendingJobs.empty()) {
+			pthread_cond_wait(&(replacer->jobReady), &(replacer->lock));
+		}
+		if (replacer->stopping) {
+			break;
+		}
+		ReplaceJob* job = replacer->pendingJobs.front();
+		replacer->pendingJobs.pop_front();
+		pthread_mutex_unlock(&(replacer->lock));
+		job->status = job->run();
+		pthread_mutex_lock(&(replacer->lock));
+		replacer->doneJobs.push_back(job);
+		if (!(replacer->notified)) {
+			char signalByte = 0;
+			if (write(replacer->notifyPipe[1], &signalByte, 1) == 1) {
+				replacer->notified = true;
+			}
+		}
+	}
+	pthread_mutex_unlock(&(replacer->lock));
+	return NULL;
+}
+
+int RingReplacer::submit(ReplaceJob* job) {
+	if (!isRunning()) {
+		return -1;
+	}
+	pthread_mutex_lock(&lock);
+	pendingJobs.push_back(job);
+	pthread_cond_signal(&jobReady);
+	pthread_mutex_unlock(&lock);
+	return 0;
+}
+
+void RingReplacer::collect(vector<ReplaceJob*>& jobs) {
+	pthread_mutex_lock(&lock);
+	//	Drained under the lock, so that a byte written for a job queued
+	//	after this point is not lost
+	char drainBuf[64];
+	while (read(notifyPipe[0], drainBuf, sizeof(drainBuf)) > 0) {}
+	notified = false;
+	while (!(doneJobs.empty())) {
+		jobs.push_back(doneJobs.front());
+		doneJobs.pop_front();
+	}
+	pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,82 @@
+#ifndef CLASS_RING_REPLACER
+#define CLASS_RING_REPLACER
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <deque>
+#include <vector>
+#include "Marshal.h"
+
+//	Number of threads performing the hypervolume search of ring
+//	replacements. With 0, the search is done in the event loop
+#define DEFAULT_REPLACE_WORKERS	2
+
+//	Hypervolume search of a single ring replacement. Filled in by the event
+//	loop, run by a worker, then handed back to the event loop which applies
+//	the result with RingSet::setRingMembers. A job does not refer to any
+//	state shared with the event loop
+class ReplaceJob {
+public:
+	int					ringNum;
+	vector<NodeIdent>	primNodes;		// Candidates, the new primary ring
+										// once run
+	vector<NodeIdent>	removedNodes;	// Nodes that go to the secondary ring
+	double*				latencyMatrix;	// Row and column i are primNodes[i],
+										// malloc'ed and owned by the job
+	int					numReduction;	// Nodes to remove from primNodes
+	double				hyperVolume;	// Of the new primary ring
+	int					status;			// Return value of run
+
+	ReplaceJob(int in_ringNum)
+		: 	ringNum(in_ringNum), latencyMatrix(NULL), numReduction(0),
+			hyperVolume(0.0), status(0) {}
+	~ReplaceJob() {
+		if (latencyMatrix != NULL) {
+			free(latencyMatrix);
+		}
+	}
+
+	//	Reduce primNodes by numReduction nodes, where the remaining nodes
+	//	have approximately the highest hypervolume. Returns -1 on error
+	int run();
+};
+
+//	Pool of worker threads running ReplaceJobs. Finished jobs are queued
+//	and signalled through a pipe, which the event loop watches like any
+//	other fd, so it never waits on a worker
+class RingReplacer {
+private:
+	vector<pthread_t>	threads;
+	pthread_mutex_t		lock;			// Protects everything below
+	pthread_cond_t		jobReady;
+	deque<ReplaceJob*>	pendingJobs;
+	deque<ReplaceJob*>	doneJobs;
+	bool				notified;		// A byte is in the pipe
+	bool				stopping;
+	int					notifyPipe[2];
+
+	static void* workerMain(void* arg);
+
+public:
+	RingReplacer();
+	~RingReplacer();
+
+	//	Start the workers. Returns -1 if none could be started
+	int start(u_int numThreads);
+
+	//	Wait for the running jobs to finish and the workers to exit.
+	//	Jobs not yet collected are deleted
+	void stop();
+
+	bool isRunning() const		{ return !(threads.empty());	}
+	int getNotifyFD() const		{ return notifyPipe[0];			}
+
+	//	Queue a job, the replacer owns it until it is collected
+	int submit(ReplaceJob* job);
+
+	//	Move all finished jobs to jobs, the caller then owns them
+	void collect(vector<ReplaceJob*>& jobs);
+};
+
+#endif
@@ -26,16 +26,38 @@ using namespace std;
 #include <arpa/inet.h>
 #include "RingSet.h"
 
-int RingSet::getRingNumber(u_int latencyUS) {
-	double latencyMS = (latencyUS / 1000.0);	
-	int ringNumber = (int)ceil((log(latencyMS) / log((double)exponentBase)));
-	//	If node is really far away, put it in the maximum ring
-	if (ringNumber >= MAX_NUM_RINGS) {
-		ringNumber = MAX_NUM_RINGS - 1;				
-	} else if (ringNumber < 0) {
-		ringNumber = 0;	
-	}
-	return ringNumber;
+RingSet::RingSet(u_int prim_ring_size, u_int second_ring_size, u_int base,
+		u_int num_rings, u_int min_radius_us)
+		: 	primarySize(prim_ring_size), secondarySize(second_ring_size),
+			exponentBase(base), numRings(num_rings) {
+	if (exponentBase < 2) {
+		ERROR_LOG("Ring base must be at least 2\n");
+		exponentBase = 2;
+	}
+	if (numRings < 1 || numRings > MAX_NUM_RINGS) {
+		ERROR_LOG_1("Number of rings must be between 1 and %d\n", 
+			MAX_NUM_RINGS);
+		numRings = (numRings < 1) ? 1 : MAX_NUM_RINGS;
+	}
+	primaryRing.resize(numRings);
+	secondaryRing.resize(numRings);
+	ringFrozen.resize(numRings, false);
+	//	Radii grow geometrically until they no longer fit
+	uint64_t radiusUS = (min_radius_us > 0) ? min_radius_us : 1;
+	for (u_int i = 0; i + 1 < numRings; i++) {
+		ringBoundUS.push_back(
+			(radiusUS < UINT_MAX) ? (u_int)radiusUS : UINT_MAX);
+		if (radiusUS < UINT_MAX) {
+			radiusUS *= exponentBase;
+		}
+	}
+}
+
+int RingSet::getRingNumber(u_int latencyUS) const {
+	//	First ring whose radius covers the latency. If node is really far 
+	//	away, this is the maximum ring
+	return lower_bound(ringBoundUS.begin(), ringBoundUS.end(), latencyUS) 
+		- ringBoundUS.begin();
 }
 
 int RingSet::eraseNode(const NodeIdent& inNode) {
@@ -62,12 +84,18 @@ int RingSet::eraseNode(const NodeIdent& inNode, int ring) {
 		NodeIdent tmp = primaryRing[ring][i];
 		if ((tmp.addr == inNode.addr) && (tmp.port == inNode.port)) {
 			foundNode = true;
+			u_int latencyUS = 0;
+			getNodeLatency(tmp, &latencyUS);
+			indexErase(tmp, latencyUS);
 			primaryRing[ring][i] = primaryRing[ring].back();
 			primaryRing[ring].pop_back();
 			// Pick a random node from secondary ring to insert
 			if (secondaryRing[ring].size() > 0) {
-				primaryRing[ring].push_back(secondaryRing[ring].front());
+				NodeIdent promoted = secondaryRing[ring].front();
+				primaryRing[ring].push_back(promoted);
 				secondaryRing[ring].pop_front();
+				getNodeLatency(promoted, &latencyUS);
+				indexInsert(promoted, latencyUS);
 			}
 			break;	// Found it, exit loop
 		}					
@@ -110,6 +138,7 @@ int RingSet::insertNode(
 	//	Okay to update even if ring frozen
 	if ((rend.addr) != 0 && (rend.port) != 0) {
 		rendvMapping[inNode] = rend; 
+		indexUpdateRendv(inNode, rend);
 	}				
 	int ringNum = getRingNumber(latencyUS);	// New ring number
 	if (ringFrozen[ringNum]) {
@@ -122,7 +151,10 @@ int RingSet::insertNode(
 		int prevRingNum = getRingNumber(findIt->second);
 		if (prevRingNum == ringNum) {
 			// If old and new ring is the same, just need to update latency 
-			nodeLatencyUS[inNode] = latencyUS;		
+			if (indexErase(inNode, findIt->second) == 0) {
+				indexInsert(inNode, latencyUS);	// In the primary ring
+			}
+			findIt->second = latencyUS;		
 			return 0;
 		} else {
 			// If old ring is frozen, just return
@@ -145,10 +177,13 @@ int RingSet::insertNode(
 	//	Push new node into rings
 	if (primaryRing[ringNum].size() < primarySize) {
 		primaryRing[ringNum].push_back(inNode);
+		indexInsert(inNode, latencyUS);
 	} else {
 		if (secondaryRing[ringNum].size() >= secondarySize) {
-			// Remove oldest member of secondary ring
-			if (eraseNode(secondaryRing[ringNum].front(), ringNum) == -1) {
+			// Remove oldest member of secondary ring. Copied, as erasing
+			// it from the ring would free the reference
+			NodeIdent oldestNode = secondaryRing[ringNum].front();
+			if (eraseNode(oldestNode, ringNum) == -1) {
 				assert(false);	// Logic error	
 			}				
 		}
@@ -159,3 +194,42 @@ int RingSet::insertNode(
 	return 0;
 }	
 
+void RingSet::indexInsert(const NodeIdent& inNode, u_int latencyUS) {
+	RingIndexEntry entry = {latencyUS, {inNode.addr, inNode.port, 0, 0}};
+	map<NodeIdent, NodeIdent, ltNodeIdent>::const_iterator findRend 
+		= rendvMapping.find(inNode);
+	if (findRend != rendvMapping.end()) {
+		entry.node.addrRendv = (findRend->second).addr;
+		entry.node.portRendv = (findRend->second).port;
+	}
+	latencyIndex.insert(upper_bound(latencyIndex.begin(), 
+		latencyIndex.end(), entry, ltRingIndexEntry()), entry);
+}
+
+//	Returns -1 if the node is not in the index
+int RingSet::indexErase(const NodeIdent& inNode, u_int latencyUS) {
+	RingIndexEntry entry = {latencyUS, {inNode.addr, inNode.port, 0, 0}};
+	vector<RingIndexEntry>::iterator it = lower_bound(latencyIndex.begin(), 
+		latencyIndex.end(), entry, ltRingIndexEntry());
+	if (it == latencyIndex.end() || it->latencyUS != latencyUS ||
+			it->node.addr != inNode.addr || it->node.port != inNode.port) {
+		return -1;
+	}
+	latencyIndex.erase(it);
+	return 0;
+}
+
+void RingSet::indexUpdateRendv(const NodeIdent& inNode, const NodeIdent& rend) {
+	u_int latencyUS;
+	if (getNodeLatency(inNode, &latencyUS) == -1) {
+		return;	// New node, picked up when it is inserted
+	}
+	RingIndexEntry entry = {latencyUS, {inNode.addr, inNode.port, 0, 0}};
+	vector<RingIndexEntry>::iterator it = lower_bound(latencyIndex.begin(), 
+		latencyIndex.end(), entry, ltRingIndexEntry());
+	if (it != latencyIndex.end() && it->latencyUS == latencyUS &&
+			it->node.addr == inNode.addr && it->node.port == inNode.port) {
+		it->node.addrRendv = rend.addr;
+		it->node.portRendv = rend.port;
+	}
+}
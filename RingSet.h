@@ -2,39 +2,80 @@
 #define CLASS_RING_SET
 
 #include <math.h>
+#include <limits.h>
 #include <vector>
 #include <deque>
 #include <map>
 #include <set>
+#include <algorithm>
 #include "Marshal.h"
 
-#define MAX_NUM_RINGS	10
+//	Ring i holds the nodes within minimum radius * base^i of this node,
+//	and outside of ring i - 1. The last ring holds everything further away
+#define DEFAULT_NUM_RINGS			10
+#define MAX_NUM_RINGS				64
+#define DEFAULT_MIN_RING_RADIUS_US	1000
+
+//	Primary ring member in the latency index
+struct RingIndexEntry {
+	u_int			latencyUS;
+	NodeIdentRendv	node;
+};
+
+//	Orders the index by latency, then by address. Entries can also be
+//	compared against a bare latency for range searches
+struct ltRingIndexEntry {
+	bool operator()(const RingIndexEntry& e1, const RingIndexEntry& e2) const {
+		if (e1.latencyUS != e2.latencyUS) {
+			return e1.latencyUS < e2.latencyUS;
+		}
+		if (e1.node.addr != e2.node.addr) {
+			return e1.node.addr < e2.node.addr;
+		}
+		return e1.node.port < e2.node.port;
+	}
+	bool operator()(const RingIndexEntry& e1, u_int latencyUS) const {
+		return e1.latencyUS < latencyUS;
+	}
+	bool operator()(u_int latencyUS, const RingIndexEntry& e2) const {
+		return latencyUS < e2.latencyUS;
+	}
+};
 
 class RingSet {
 private:
-	vector<NodeIdent>		primaryRing[MAX_NUM_RINGS];	
-	deque<NodeIdent>		secondaryRing[MAX_NUM_RINGS];
-	bool 					ringFrozen[MAX_NUM_RINGS];
-	u_int					primarySize;
-	u_int					secondarySize;
-	u_int					exponentBase;
+	vector<vector<NodeIdent> >	primaryRing;	
+	vector<deque<NodeIdent> >	secondaryRing;
+	vector<bool>				ringFrozen;
+	u_int						primarySize;
+	u_int						secondarySize;
+	u_int						exponentBase;
+	u_int						numRings;
+	//	Largest latency of each ring but the last, in increasing order
+	vector<u_int>				ringBoundUS;
 	
 	map<NodeIdent, u_int, ltNodeIdent> 			nodeLatencyUS;
 	map<NodeIdent, NodeIdent, ltNodeIdent>		rendvMapping;
-		
+	
+	//	All primary ring members sorted by latency, so that a latency range
+	//	is found with two binary searches. Kept in step with the rings by
+	//	every method that moves a node in or out of a primary ring
+	vector<RingIndexEntry>						latencyIndex;
+	
+	void indexInsert(const NodeIdent& inNode, u_int latencyUS);
+	int indexErase(const NodeIdent& inNode, u_int latencyUS);
+	void indexUpdateRendv(const NodeIdent& inNode, const NodeIdent& rend);
+	
 public:
-	RingSet(u_int prim_ring_size, u_int second_ring_size, u_int base) 
-		: 	primarySize(prim_ring_size), secondarySize(second_ring_size),
-			exponentBase(base) {
-		for (u_int i = 0; i < MAX_NUM_RINGS; i++) {
-			ringFrozen[i] = false;			
-		}
-	}
-	u_int nodesInPrimaryRing() {
+	RingSet(u_int prim_ring_size, u_int second_ring_size, u_int base,
+		u_int num_rings = DEFAULT_NUM_RINGS, 
+		u_int min_radius_us = DEFAULT_MIN_RING_RADIUS_US);
+	
+	u_int nodesInPrimaryRing() const {
 		return primarySize;	
 	}
 	
-	u_int nodesInSecondaryRing() {
+	u_int nodesInSecondaryRing() const {
 		return secondarySize;	
 	}	
 			
@@ -54,25 +95,33 @@ public:
 		return 0;	
 	}
 	
-	int getNumberOfRings() const 	{ return MAX_NUM_RINGS; }
+	int getNumberOfRings() const 	{ return numRings; }
+	
+	//	Largest latency of ring ringNum, UINT_MAX for the last ring
+	u_int getRingRadiusUS(int ringNum) const {
+		if (ringNum < 0 || ringNum >= (int)ringBoundUS.size()) {
+			return UINT_MAX;
+		}
+		return ringBoundUS[ringNum];
+	}
 	
 	const vector<NodeIdent>* returnPrimaryRing(int ringNum) const {
-		if (ringNum >= MAX_NUM_RINGS) {
+		if (ringNum >= getNumberOfRings()) {
 			return NULL;
 		}
 		return &(primaryRing[ringNum]);	
 	}
 	
-	bool isPrimRingFull(int ringNum) {
-		assert(ringNum < MAX_NUM_RINGS);
+	bool isPrimRingFull(int ringNum) const {
+		assert(ringNum < getNumberOfRings());
 		if (primaryRing[ringNum].size() == primarySize) {
 			return true;	
 		}
 		return false;		
 	}
 	
-	bool isSecondRingEmpty(int ringNum) {
-		assert(ringNum < MAX_NUM_RINGS);
+	bool isSecondRingEmpty(int ringNum) const {
+		assert(ringNum < getNumberOfRings());
 		if (secondaryRing[ringNum].empty()) {
 			return true;	
 		}
@@ -80,7 +129,7 @@ public:
 	}
 	
 	const deque<NodeIdent>* returnSecondaryRing(int ringNum) const {
-		if (ringNum >= MAX_NUM_RINGS) {
+		if (ringNum >= getNumberOfRings()) {
 			return NULL;
 		}
 		return &(secondaryRing[ringNum]);	
@@ -96,8 +145,9 @@ public:
 		return 0;
 	}
 	
-	int	rendvLookup(const NodeIdent& remoteNode, NodeIdent& rendvNode) {
-		map<NodeIdent, NodeIdent, ltNodeIdent>::iterator it
+	int	rendvLookup(
+			const NodeIdent& remoteNode, NodeIdent& rendvNode) const {
+		map<NodeIdent, NodeIdent, ltNodeIdent>::const_iterator it
 			= rendvMapping.find(remoteNode);
 		if (it == rendvMapping.end()) {
 			return -1;			
@@ -111,7 +161,7 @@ public:
 			WARN_LOG("Cannot update frozen ring\n");
 			return false;	
 		}		
-		if (ringNum >= MAX_NUM_RINGS) {
+		if (ringNum >= getNumberOfRings()) {
 			return false;
 		}
 		if (isPrimRingFull(ringNum) && !isSecondRingEmpty(ringNum)) {			
@@ -150,6 +200,11 @@ public:
 							}
 							//	Swap primary and secondary
 							NodeIdent tmpIdent = secondaryRing[ringNum][j];
+							u_int primLatUS = 0, secondLatUS = 0;
+							getNodeLatency(primaryRing[ringNum][i], &primLatUS);
+							getNodeLatency(tmpIdent, &secondLatUS);
+							indexErase(primaryRing[ringNum][i], primLatUS);
+							indexInsert(tmpIdent, secondLatUS);
 							secondaryRing[ringNum][j] = primaryRing[ringNum][i];
 							primaryRing[ringNum][i] = tmpIdent;
 							j++; // Can increment one more in the loop 
@@ -162,7 +217,7 @@ public:
 		return false;
 	}
 		
-	int getRingNumber(u_int latencyUS);	
+	int getRingNumber(u_int latencyUS) const;	
 	int eraseNode(const NodeIdent& inNode);	
 	int eraseNode(const NodeIdent& inNode, int ring);	
 	int insertNode(
@@ -170,12 +225,12 @@ public:
 	// Preserves existing rendavous mapping
 	int insertNode(const NodeIdent& inNode, u_int latencyUS);
 	
-	int getRandomNodes(vector<NodeIdentRendv>& randNodes) {
-		for (int i = 0; i < MAX_NUM_RINGS; i++) {
+	int getRandomNodes(vector<NodeIdentRendv>& randNodes) const {
+		for (int i = 0; i < getNumberOfRings(); i++) {
 			if (primaryRing[i].size() > 0) {				
 				NodeIdent cur = primaryRing[i][rand() % primaryRing[i].size()];
 				NodeIdentRendv nodeToInsert = {cur.addr, cur.port, 0, 0};
-				map<NodeIdent, NodeIdent, ltNodeIdent>::iterator findRend 
+				map<NodeIdent, NodeIdent, ltNodeIdent>::const_iterator findRend 
 					= rendvMapping.find(cur);
 				if (findRend != rendvMapping.end()) {
 					nodeToInsert.addrRendv = (findRend->second).addr;
@@ -187,8 +242,9 @@ public:
 		return 0;		
 	}
 	
-	int membersDump(int ringNum, set<NodeIdent, ltNodeIdent>& ringMembers) {
-		if (ringNum >= MAX_NUM_RINGS) {
+	int membersDump(
+			int ringNum, set<NodeIdent, ltNodeIdent>& ringMembers) const {
+		if (ringNum >= getNumberOfRings()) {
 			return -1;
 		}
 		for (u_int i = 0; i < primaryRing[ringNum].size(); i++) {
@@ -237,7 +293,7 @@ public:
 */		
 	
 	int fillVector(u_int minAvgUS, u_int maxAvgUS, double betaRatio, 
-			set<NodeIdentRendv, ltNodeIdentRendv>& ringMembers) {
+			set<NodeIdentRendv, ltNodeIdentRendv>& ringMembers) const {
 		if (betaRatio <= 0.0 || betaRatio >= 1.0) {
 			ERROR_LOG("Illegal Beta Ratio\n");
 			betaRatio = 0.5;	// Set it to default beta
@@ -252,32 +308,29 @@ public:
 			upperBound = UINT_MAX;
 			lowerBound = 0;
 		}
-		int upperRing = getRingNumber(upperBound);
-		int lowerRing = getRingNumber(lowerBound);				
-		for (int i = lowerRing; i <= upperRing; i++) { 
-			for (u_int j = 0; j < primaryRing[i].size(); j++) {
-				u_int curLatencyUS;
-				if (getNodeLatency(primaryRing[i][j], &curLatencyUS) == -1) {
-					assert(false);	// This shouldn't happen
-					continue;	
-				}
-				if ((curLatencyUS <= upperBound) && 
-						(curLatencyUS >= lowerBound)) {
-					NodeIdent rendvIdent;
-					NodeIdentRendv tmpRendv = 
-						{primaryRing[i][j].addr, primaryRing[i][j].port, 0, 0};
-					if (rendvLookup(primaryRing[i][j], rendvIdent) != -1) {
-						tmpRendv.portRendv = rendvIdent.port;
-						tmpRendv.addrRendv = rendvIdent.addr;
-					}																
-					//ringMembers.insert(primaryRing[i][j]);
-					ringMembers.insert(tmpRendv);					
-				}
-			}			
+		//	Rings are ordered by latency, so the members of the rings 
+		//	between lowerBound and upperBound that are within the bounds
+		//	are exactly the index entries within the bounds
+		vector<RingIndexEntry>::const_iterator first, last;
+		indexRange(lowerBound, upperBound, &first, &last);
+		for (; first != last; first++) {
+			ringMembers.insert(first->node);
 		}
 		return 0;		
 	}	
 	
+	//	Sets first and last to the index entries with a latency in 
+	//	[lowerUS, upperUS], in increasing order of latency
+	void indexRange(u_int lowerUS, u_int upperUS, 
+			vector<RingIndexEntry>::const_iterator* first,
+			vector<RingIndexEntry>::const_iterator* last) const {
+		*first = lower_bound(latencyIndex.begin(), latencyIndex.end(), 
+			lowerUS, ltRingIndexEntry());
+		*last = upper_bound(*first, latencyIndex.end(), 
+			upperUS, ltRingIndexEntry());
+	}
+	
+	u_int numPrimaryMembers() const	{ return latencyIndex.size(); }
 	
 	int setRingMembers(int ringNum, const vector<NodeIdent>& primRing,
 			const vector<NodeIdent>& secondRing) {
@@ -315,10 +368,18 @@ public:
 			}
 		}
 		//	Clear old ring members and relocate them to new position
+		for (u_int i = 0; i < primaryRing[ringNum].size(); i++) {
+			u_int latencyUS = 0;
+			getNodeLatency(primaryRing[ringNum][i], &latencyUS);
+			indexErase(primaryRing[ringNum][i], latencyUS);
+		}
 		primaryRing[ringNum].clear();
 		secondaryRing[ringNum].clear();
 		for (u_int i = 0; i < primRing.size(); i++) {
 			primaryRing[ringNum].push_back(primRing[i]);	
+			u_int latencyUS = 0;
+			getNodeLatency(primRing[i], &latencyUS);
+			indexInsert(primRing[i], latencyUS);
 		}		
 		for (u_int i = 0; i < secondRing.size(); i++) {
 			secondaryRing[ringNum].push_back(secondRing[i]);	
@@ -0,0 +1,204 @@
+/******************************************************************************
+Meridian prototype distribution
+Copyright (C) 2005 Bernard Wong
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+The copyright owner can be contacted by e-mail at bwong@cs.cornell.edu
+*******************************************************************************/
+
+using namespace std;
+
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "SharedLatencyTable.h"
+
+SharedLatencyTable::SharedLatencyTable() 
+		: mapBase(NULL), mapSize(0), header(NULL), slots(NULL), 
+		  mask(0), shift(64) {}
+
+SharedLatencyTable::~SharedLatencyTable() {
+	if (mapBase != NULL) {
+		munmap(mapBase, mapSize);
+	}
+}
+
+int SharedLatencyTable::attach(const char* name, u_int numSlots) {
+	if (mapBase != NULL || numSlots == 0 || (numSlots & (numSlots - 1))) {
+		return -1;
+	}
+	size_t expectSize = sizeof(SharedLatencyHeader) + 
+		numSlots * sizeof(SharedLatencySlot);
+	int fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+	if (fd == -1) {
+		perror("shm_open");
+		return -1;
+	}
+	//	Whoever finds the segment empty sizes it. The kernel zero fills it,
+	//	which is a valid empty table
+	struct stat segStat;
+	if (fstat(fd, &segStat) == -1 ||
+			(segStat.st_size == 0 && ftruncate(fd, expectSize) == -1)) {
+		perror("Cannot size shared latency cache");
+		close(fd);
+		return -1;
+	}
+	if (segStat.st_size != 0 && (size_t)segStat.st_size != expectSize) {
+		ERROR_LOG_1("Shared latency cache %s has a different size\n", name);
+		close(fd);
+		return -1;
+	}
+	void* base = mmap(NULL, expectSize, 
+		PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);	// Mapping stays valid
+	if (base == MAP_FAILED) {
+		perror("mmap");
+		return -1;
+	}
+	SharedLatencyHeader* curHeader = (SharedLatencyHeader*)base;
+	if (curHeader->magic == 0) {
+		//	Racing initializers all write the same value
+		curHeader->numSlots = numSlots;
+		__sync_synchronize();
+		__sync_bool_compare_and_swap(&(curHeader->magic), 0, SHARED_CACHE_MAGIC);
+	}
+	if (curHeader->magic != SHARED_CACHE_MAGIC || 
+			curHeader->numSlots != numSlots) {
+		ERROR_LOG_1("Shared latency cache %s has an unknown layout\n", name);
+		munmap(base, expectSize);
+		return -1;
+	}
+	mapBase = base;
+	mapSize = expectSize;
+	header = curHeader;
+	slots = (SharedLatencySlot*)(curHeader + 1);
+	mask = numSlots - 1;
+	shift = 64;
+	for (u_int i = numSlots; i > 1; i >>= 1) {
+		shift--;
+	}
+	return 0;
+}
+
+int SharedLatencyTable::readSlot(
+		const SharedLatencySlot* slot, SharedLatencySlot* copy) {
+	for (u_int i = 0; i < SHARED_CACHE_READ_TRIES; i++) {
+		uint32_t startSeq = slot->seq;
+		if (startSeq & 1) {
+			continue;	// Being written
+		}
+		__sync_synchronize();
+		copy->addr = slot->addr;
+		copy->port = slot->port;
+		copy->latencyUS = slot->latencyUS;
+		copy->expireMS = slot->expireMS;
+		__sync_synchronize();
+		if (slot->seq == startSeq) {
+			return 0;
+		}
+	}
+	return -1;
+}
+
+int SharedLatencyTable::writeSlot(SharedLatencySlot* slot, 
+		const NodeIdent& inNode, uint32_t latencyUS, uint64_t expireMS) {
+	uint32_t startSeq = slot->seq;
+	if ((startSeq & 1) ||
+			!__sync_bool_compare_and_swap(&(slot->seq), startSeq, startSeq + 1)) {
+		return -1;	// Another process is writing it
+	}
+	slot->addr = inNode.addr;
+	slot->port = inNode.port;
+	slot->latencyUS = latencyUS;
+	slot->expireMS = expireMS;
+	__sync_synchronize();
+	slot->seq = startSeq + 2;
+	return 0;
+}
+
+int SharedLatencyTable::lookup(
+		const NodeIdent& inNode, uint64_t curMS, uint32_t* latencyUS) {
+	if (slots == NULL) {
+		return -1;
+	}
+	u_int home = homeSlot(inNode);
+	for (u_int i = 0; i < SHARED_CACHE_PROBE_LEN; i++) {
+		SharedLatencySlot copy;
+		if (readSlot(&(slots[(home + i) & mask]), &copy) == -1) {
+			continue;
+		}
+		if (copy.addr == inNode.addr && copy.port == inNode.port &&
+				copy.expireMS > curMS) {
+			*latencyUS = copy.latencyUS;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+int SharedLatencyTable::publish(const NodeIdent& inNode, 
+		uint32_t latencyUS, uint64_t curMS, uint64_t expireMS) {
+	if (slots == NULL) {
+		return -1;
+	}
+	//	Prefer the node's own slot, then a free or expired one, and
+	//	failing that replace the entry closest to expiring
+	u_int home = homeSlot(inNode);
+	int freeSlot = -1;
+	int oldestSlot = -1;
+	uint64_t oldestMS = 0;
+	for (u_int i = 0; i < SHARED_CACHE_PROBE_LEN; i++) {
+		u_int pos = (home + i) & mask;
+		SharedLatencySlot copy;
+		if (readSlot(&(slots[pos]), &copy) == -1) {
+			continue;
+		}
+		if (copy.addr == inNode.addr && copy.port == inNode.port) {
+			return writeSlot(&(slots[pos]), inNode, latencyUS, expireMS);
+		}
+		if (copy.expireMS <= curMS) {
+			if (freeSlot == -1) {
+				freeSlot = pos;
+			}
+		} else if (oldestSlot == -1 || copy.expireMS < oldestMS) {
+			oldestSlot = pos;
+			oldestMS = copy.expireMS;
+		}
+	}
+	int target = (freeSlot != -1) ? freeSlot : oldestSlot;
+	if (target == -1) {
+		return -1;
+	}
+	return writeSlot(&(slots[target]), inNode, latencyUS, expireMS);
+}
+
+int SharedLatencyTable::erase(const NodeIdent& inNode) {
+	if (slots == NULL) {
+		return -1;
+	}
+	u_int home = homeSlot(inNode);
+	for (u_int i = 0; i < SHARED_CACHE_PROBE_LEN; i++) {
+		u_int pos = (home + i) & mask;
+		SharedLatencySlot copy;
+		if (readSlot(&(slots[pos]), &copy) == 0 &&
+				copy.addr == inNode.addr && copy.port == inNode.port) {
+			writeSlot(&(slots[pos]), inNode, 0, 0);	// Expired
+		}
+	}
+	return 0;
+}
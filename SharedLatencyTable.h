@@ -0,0 +1,68 @@
+#ifndef CLASS_SHARED_LATENCY_TABLE
+#define CLASS_SHARED_LATENCY_TABLE
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "Marshal.h"
+
+#define SHARED_CACHE_MAGIC		0x4D4C4331	// "MLC1", bump on layout change
+#define SHARED_CACHE_PROBE_LEN	8			// Slots searched per node
+#define SHARED_CACHE_READ_TRIES	4
+
+//	Layout of a slot in the shared segment. seq is odd while a writer is
+//	updating the slot (seqlock). An all zero slot is empty
+struct SharedLatencySlot {
+	volatile uint32_t	seq;
+	uint32_t			addr;
+	uint32_t			latencyUS;
+	uint16_t			port;
+	uint16_t			pad;
+	uint64_t			expireMS;
+};
+
+struct SharedLatencyHeader {
+	volatile uint32_t	magic;
+	uint32_t			numSlots;
+};
+
+//	Latency table in a named POSIX shared memory segment, so that every
+//	Meridian process on the host sees the measurements of the others.
+//	Nodes hash to a window of SHARED_CACHE_PROBE_LEN slots. Writers claim
+//	a slot with a compare-and-swap on its sequence number and readers
+//	retry if the sequence changed under them, so no process ever blocks.
+//	Publishing gives up if the slot is busy, it is only a cache
+class SharedLatencyTable {
+private:
+	void*					mapBase;
+	size_t					mapSize;
+	SharedLatencyHeader*	header;
+	SharedLatencySlot*		slots;
+	u_int					mask;
+	u_int					shift;
+
+	u_int homeSlot(const NodeIdent& inNode) const {
+		uint64_t key = (((uint64_t)inNode.addr) << 16) | inNode.port;
+		return (u_int)((key * 0x9E3779B97F4A7C15ULL) >> shift);
+	}
+	//	Consistent copy of the slot, -1 if it could not be read
+	static int readSlot(
+		const SharedLatencySlot* slot, SharedLatencySlot* copy);
+	static int writeSlot(SharedLatencySlot* slot, const NodeIdent& inNode,
+		uint32_t latencyUS, uint64_t expireMS);
+
+public:
+	SharedLatencyTable();
+	~SharedLatencyTable();
+
+	//	Map (creating it if needed) the segment with the given name.
+	//	numSlots must be a power of 2 and match the other processes
+	int attach(const char* name, u_int numSlots);
+
+	//	Returns -1 if the node is not in the table or has expired
+	int lookup(const NodeIdent& inNode, uint64_t curMS, uint32_t* latencyUS);
+	int publish(const NodeIdent& inNode, uint32_t latencyUS, 
+		uint64_t curMS, uint64_t expireMS);
+	int erase(const NodeIdent& inNode);
+};
+
+#endif
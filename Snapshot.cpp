@@ -0,0 +1,295 @@
+/******************************************************************************
+Meridian prototype distribution
+Copyright (C) 2005 Bernard Wong
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+The copyright owner can be contacted by e-mail at bwong@cs.cornell.edu
+*******************************************************************************/
+
+using namespace std;
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <string>
+#include "Snapshot.h"
+
+template <class T>
+static void appendStruct(vector<char>& buf, const T& inStruct) {
+	const char* bytes = (const char*)&inStruct;
+	buf.insert(buf.end(), bytes, bytes + sizeof(T));
+}
+
+static int writeAll(int fd, const char* buf, size_t size) {
+	while (size > 0) {
+		ssize_t written = write(fd, buf, size);
+		if (written == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		buf += written;
+		size -= written;
+	}
+	return 0;
+}
+
+int Snapshot::save(const char* path, RingSet* rings, 
+		LatencyCache* const* caches, u_int numCaches) {
+	vector<char> buf;
+	encode(rings, caches, numCaches, &buf);
+	return write(path, buf);
+}
+
+void Snapshot::encode(RingSet* rings, LatencyCache* const* caches, 
+		u_int numCaches, vector<char>* outBuf) {
+	SnapshotHeader header;
+	memset(&header, 0, sizeof(SnapshotHeader));
+	header.magic = SNAPSHOT_MAGIC;
+	header.version = SNAPSHOT_VERSION;
+	header.savedSec = time(NULL);
+	header.primarySize = rings->nodesInPrimaryRing();
+	header.secondarySize = rings->nodesInSecondaryRing();
+	header.numCaches = numCaches;
+	vector<char> buf(sizeof(SnapshotHeader));
+	for (int i = 0; i < rings->getNumberOfRings(); i++) {
+		const vector<NodeIdent>* primRing = rings->returnPrimaryRing(i);
+		const deque<NodeIdent>* secondRing = rings->returnSecondaryRing(i);
+		u_int numNodes = primRing->size() + secondRing->size();
+		for (u_int j = 0; j < numNodes; j++) {
+			bool isPrimary = j < primRing->size();
+			NodeIdent curNode = isPrimary ? 
+				(*primRing)[j] : (*secondRing)[j - primRing->size()];
+			u_int latencyUS;
+			if (rings->getNodeLatency(curNode, &latencyUS) == -1) {
+				continue;
+			}
+			NodeIdent rendvNode = {0, 0};
+			rings->rendvLookup(curNode, rendvNode);
+			SnapshotRingNode record = {curNode.addr, rendvNode.addr, 
+				latencyUS, curNode.port, rendvNode.port, 
+				(uint8_t)i, (uint8_t)isPrimary, 0};
+			appendStruct(buf, record);
+			header.numRingNodes++;
+		}
+	}
+	for (u_int i = 0; i < numCaches; i++) {
+		vector<LatencyRecord> records;
+		if (caches[i] != NULL) {
+			caches[i]->getEntries(records);
+		}
+		uint32_t count = records.size();
+		appendStruct(buf, count);
+		for (u_int j = 0; j < records.size(); j++) {
+			SnapshotCacheEntry entry = {records[j].node.addr, 
+				records[j].latencyUS, records[j].remainingMS, 
+				records[j].node.port, 0};
+			appendStruct(buf, entry);
+		}
+	}
+	header.length = buf.size();
+	header.checksum = adler32(adler32(0L, Z_NULL, 0), 
+		(const Bytef*)&(buf[sizeof(SnapshotHeader)]), 
+		buf.size() - sizeof(SnapshotHeader));
+	memcpy(&(buf[0]), &header, sizeof(SnapshotHeader));
+	outBuf->swap(buf);
+}
+
+int Snapshot::write(const char* path, const vector<char>& buf) {
+	string tmpPath = string(path) + ".tmp";
+	int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1) {
+		perror("Cannot create snapshot");
+		return -1;
+	}
+	if (writeAll(fd, &(buf[0]), buf.size()) == -1 || fsync(fd) == -1) {
+		perror("Cannot write snapshot");
+		close(fd);
+		unlink(tmpPath.c_str());
+		return -1;
+	}
+	close(fd);
+	if (rename(tmpPath.c_str(), path) == -1) {
+		perror("Cannot rename snapshot");
+		unlink(tmpPath.c_str());
+		return -1;
+	}
+	return 0;
+}
+
+int Snapshot::load(const char* path, RingSet* rings, 
+		LatencyCache* const* caches, u_int numCaches, 
+		vector<NodeIdentRendv>* loadedNodes) {
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		return -1;	// No snapshot yet
+	}
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) == -1 || 
+			(size_t)fileStat.st_size < sizeof(SnapshotHeader)) {
+		close(fd);
+		return -1;
+	}
+	size_t fileSize = fileStat.st_size;
+	void* mapBase = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapBase == MAP_FAILED) {
+		perror("Cannot map snapshot");
+		return -1;
+	}
+	const char* base = (const char*)mapBase;
+	const char* end = base + fileSize;
+	SnapshotHeader header;
+	memcpy(&header, base, sizeof(SnapshotHeader));
+	const char* pos = base + sizeof(SnapshotHeader);
+	if (header.magic != SNAPSHOT_MAGIC || 
+			header.version != SNAPSHOT_VERSION ||
+			header.length != fileSize ||
+			header.checksum != adler32(adler32(0L, Z_NULL, 0), 
+				(const Bytef*)pos, end - pos) ||
+			(size_t)(end - pos) / sizeof(SnapshotRingNode) < 
+				header.numRingNodes) {
+		WARN_LOG("Ignoring invalid snapshot\n");
+		munmap(mapBase, fileSize);
+		return -1;
+	}
+	//	Members are inserted by latency, so a different ring configuration
+	//	sorts them properly. Primaries go first to keep them primary
+	for (int pass = 1; pass >= 0; pass--) {
+		const char* nodePos = pos;
+		for (u_int i = 0; i < header.numRingNodes; i++) {
+			SnapshotRingNode record;
+			memcpy(&record, nodePos, sizeof(SnapshotRingNode));
+			nodePos += sizeof(SnapshotRingNode);
+			if (record.primary != pass) {
+				continue;
+			}
+			NodeIdent curNode = {record.addr, record.port};
+			NodeIdent rendvNode = {record.rendvAddr, record.rendvPort};
+			rings->insertNode(curNode, record.latencyUS, rendvNode);
+			NodeIdentRendv loaded = {record.addr, record.port, 
+				record.rendvAddr, record.rendvPort};
+			loadedNodes->push_back(loaded);
+		}
+	}
+	pos += header.numRingNodes * sizeof(SnapshotRingNode);
+	//	Cache entries lose the time spent down
+	time_t curSec = time(NULL);
+	uint64_t downMS = (curSec > (time_t)header.savedSec) ? 
+		(curSec - header.savedSec) * 1000 : 0;
+	for (u_int i = 0; i < header.numCaches; i++) {
+		uint32_t count;
+		if ((size_t)(end - pos) < sizeof(uint32_t)) {
+			break;
+		}
+		memcpy(&count, pos, sizeof(uint32_t));
+		pos += sizeof(uint32_t);
+		if ((size_t)(end - pos) / sizeof(SnapshotCacheEntry) < count) {
+			break;
+		}
+		for (u_int j = 0; j < count; j++) {
+			SnapshotCacheEntry entry;
+			memcpy(&entry, pos, sizeof(SnapshotCacheEntry));
+			pos += sizeof(SnapshotCacheEntry);
+			if (i >= numCaches || caches[i] == NULL || 
+					entry.remainingMS <= downMS) {
+				continue;
+			}
+			LatencyRecord record = {{entry.addr, entry.port}, 
+				entry.latencyUS, (uint32_t)(entry.remainingMS - downMS)};
+			caches[i]->restoreEntry(record);
+		}
+	}
+	munmap(mapBase, fileSize);
+	return 0;
+}
+
+SnapshotWriter::SnapshotWriter() : running(false), stopping(false) {
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&bufReady, NULL);
+}
+
+SnapshotWriter::~SnapshotWriter() {
+	stop();
+	pthread_cond_destroy(&bufReady);
+	pthread_mutex_destroy(&lock);
+}
+
+int SnapshotWriter::start(const char* in_path) {
+	if (running) {
+		return -1;
+	}
+	path = in_path;
+	stopping = false;
+	if (pthread_create(&thread, NULL, writerMain, this) != 0) {
+		ERROR_LOG("Cannot create snapshot writer\n");
+		return -1;
+	}
+	running = true;
+	return 0;
+}
+
+void SnapshotWriter::stop() {
+	if (!running) {
+		return;
+	}
+	pthread_mutex_lock(&lock);
+	stopping = true;
+	pthread_cond_signal(&bufReady);
+	pthread_mutex_unlock(&lock);
+	pthread_join(thread, NULL);
+	pendingBuf.clear();
+	running = false;
+}
+
+void* SnapshotWriter::writerMain(void* arg) {
+	SnapshotWriter* writer = (SnapshotWriter*)arg;
+	vector<char> buf;
+	pthread_mutex_lock(&(writer->lock));
+	while (true) {
+		while (!(writer->stopping) && writer->pendingBuf.empty()) {
+			pthread_cond_wait(&(writer->bufReady), &(writer->lock));
+		}
+		if (writer->stopping) {
+			break;
+		}
+		buf.swap(writer->pendingBuf);
+		pthread_mutex_unlock(&(writer->lock));
+		Snapshot::write(writer->path.c_str(), buf);
+		buf.clear();
+		pthread_mutex_lock(&(writer->lock));
+	}
+	pthread_mutex_unlock(&(writer->lock));
+	return NULL;
+}
+
+int SnapshotWriter::submit(vector<char>& buf) {
+	if (!running) {
+		return -1;
+	}
+	pthread_mutex_lock(&lock);
+	pendingBuf.swap(buf);
+	pthread_cond_signal(&bufReady);
+	pthread_mutex_unlock(&lock);
+	buf.clear();
+	return 0;
+}
@@ -0,0 +1,108 @@
+#ifndef CLASS_SNAPSHOT
+#define CLASS_SNAPSHOT
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <string>
+#include <vector>
+#include "Marshal.h"
+#include "RingSet.h"
+#include "LatencyCache.h"
+
+#define SNAPSHOT_MAGIC		0x4D534E50	// "MSNP"
+#define SNAPSHOT_VERSION	1
+
+//	On disk layout, in host byte order (the snapshot never leaves the
+//	host). The header is followed by numRingNodes SnapshotRingNode, then
+//	for each of the numCaches caches a uint32_t count followed by that
+//	many SnapshotCacheEntry. The checksum (adler32) covers everything
+//	after the header
+struct SnapshotHeader {
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	length;			// Total file size
+	uint32_t	checksum;
+	uint64_t	savedSec;		// Wall clock time of the save
+	uint32_t	primarySize;
+	uint32_t	secondarySize;
+	uint32_t	numRingNodes;
+	uint32_t	numCaches;
+};
+
+struct SnapshotRingNode {
+	uint32_t	addr;
+	uint32_t	rendvAddr;
+	uint32_t	latencyUS;
+	uint16_t	port;
+	uint16_t	rendvPort;
+	uint8_t		ringNum;
+	uint8_t		primary;		// 1 if in the primary ring
+	uint16_t	pad;
+};
+
+struct SnapshotCacheEntry {
+	uint32_t	addr;
+	uint32_t	latencyUS;
+	uint32_t	remainingMS;
+	uint16_t	port;
+	uint16_t	pad;
+};
+
+//	Compact binary image of the rings and latency caches, used to bring a
+//	restarted Meridian process back to useful rings without waiting for
+//	gossip. Caches may be NULL, their slot in the file is then empty
+class Snapshot {
+public:
+	//	Written to a temporary file and renamed over path, so a crash never
+	//	leaves a partial snapshot behind
+	static int save(const char* path, RingSet* rings, 
+		LatencyCache* const* caches, u_int numCaches);
+
+	//	The two halves of save. Encoding only reads the rings and caches,
+	//	so writing can be left to another thread
+	static void encode(RingSet* rings, LatencyCache* const* caches, 
+		u_int numCaches, vector<char>* outBuf);
+	static int write(const char* path, const vector<char>& buf);
+
+	//	Insert the saved ring members (with their saved latencies) and the
+	//	unexpired cache entries. The ring members are appended to
+	//	loadedNodes so that the caller can revalidate them. Returns -1 if
+	//	there is no usable snapshot
+	static int load(const char* path, RingSet* rings, 
+		LatencyCache* const* caches, u_int numCaches, 
+		vector<NodeIdentRendv>* loadedNodes);
+};
+
+//	Thread writing encoded snapshots, so the event loop never waits on
+//	write, fsync and rename. Only the latest snapshot submitted is kept, 
+//	an older one not yet written is replaced
+class SnapshotWriter {
+private:
+	pthread_t			thread;
+	bool				running;
+	pthread_mutex_t		lock;			// Protects everything below
+	pthread_cond_t		bufReady;
+	string				path;
+	vector<char>		pendingBuf;		// Empty if none
+	bool				stopping;
+
+	static void* writerMain(void* arg);
+
+public:
+	SnapshotWriter();
+	~SnapshotWriter();
+
+	int start(const char* in_path);
+
+	//	Wait for the snapshot being written, if any. A snapshot not yet
+	//	started is dropped
+	void stop();
+
+	bool isRunning() const		{ return running;	}
+
+	//	Takes the content of buf, leaving it empty
+	int submit(vector<char>& buf);
+};
+
+#endif
@@ -0,0 +1,243 @@
+/******************************************************************************
+Meridian prototype distribution
+Copyright (C) 2005 Bernard Wong
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+The copyright owner can be contacted by e-mail at bwong@cs.cornell.edu
+*******************************************************************************/
+
+using namespace std;
+
+#include <string.h>
+#include "Query.h"
+#include "TimerWheel.h"
+
+TimerWheel::TimerWheel() : numArmed(0) {
+	memset(rootSlots, 0, sizeof(rootSlots));
+	memset(levelSlots, 0, sizeof(levelSlots));
+	memset(rootMap, 0, sizeof(rootMap));
+	memset(levelMap, 0, sizeof(levelMap));
+	struct timeval curTime;
+	Query::getCurrentTime(&curTime);
+	curTick = toUS(curTime) / TIMER_TICK_US;
+}
+
+void TimerWheel::link(TimerEntry* entry, int level, u_int slot) {
+	TimerEntry** head;
+	if (level == 0) {
+		head = &(rootSlots[slot]);
+		rootMap[slot / 64] |= (((uint64_t)1) << (slot % 64));
+	} else {
+		head = &(levelSlots[level - 1][slot]);
+		levelMap[level - 1] |= (((uint64_t)1) << slot);
+	}
+	entry->level = level;
+	entry->slot = slot;
+	entry->prev = NULL;
+	entry->next = *head;
+	if (*head != NULL) {
+		(*head)->prev = entry;
+	}
+	*head = entry;
+}
+
+//	Link entry into the slot matching its distance from curTick. The
+//	caller guarantees that expireTick >= curTick
+void TimerWheel::place(TimerEntry* entry) {
+	uint64_t delta = entry->expireTick - curTick;
+	if (delta < TIMER_ROOT_SIZE) {
+		link(entry, 0, entry->expireTick & (TIMER_ROOT_SIZE - 1));
+		return;
+	}
+	for (int level = 1; level < TIMER_LEVELS; level++) {
+		u_int shift = levelShift(level);
+		uint64_t expireTick = entry->expireTick;
+		if (level == TIMER_LEVELS - 1) {
+			//	Beyond the range of the wheel, park it in the last slot
+			//	within range. It is placed again when that slot cascades
+			uint64_t maxDelta =
+				(((uint64_t)TIMER_LEVEL_SIZE) << shift) - 1;
+			if (delta > maxDelta) {
+				expireTick = curTick + maxDelta;
+			}
+		} else if (delta >= (((uint64_t)TIMER_LEVEL_SIZE) << shift)) {
+			continue;	// Belongs to a higher level
+		}
+		link(entry, level, (expireTick >> shift) & (TIMER_LEVEL_SIZE - 1));
+		return;
+	}
+}
+
+void TimerWheel::cancel(TimerEntry* entry) {
+	if (!isArmed(entry)) {
+		return;
+	}
+	TimerEntry** head;
+	if (entry->level == 0) {
+		head = &(rootSlots[entry->slot]);
+	} else {
+		head = &(levelSlots[entry->level - 1][entry->slot]);
+	}
+	if (entry->prev != NULL) {
+		entry->prev->next = entry->next;
+	} else {
+		*head = entry->next;
+	}
+	if (entry->next != NULL) {
+		entry->next->prev = entry->prev;
+	}
+	//	Slot is now empty, clear its bit
+	if (*head == NULL) {
+		if (entry->level == 0) {
+			rootMap[entry->slot / 64] &= ~(((uint64_t)1) << (entry->slot % 64));
+		} else {
+			levelMap[entry->level - 1] &= ~(((uint64_t)1) << entry->slot);
+		}
+	}
+	entry->next = NULL;
+	entry->prev = NULL;
+	entry->level = -1;
+	numArmed--;
+}
+
+void TimerWheel::arm(TimerEntry* entry, const struct timeval& expireTV) {
+	cancel(entry);
+	//	Round up, a timer must never fire early
+	entry->expireTick = (toUS(expireTV) + TIMER_TICK_US - 1) / TIMER_TICK_US;
+	if (entry->expireTick <= curTick) {
+		entry->expireTick = curTick + 1;
+	}
+	place(entry);
+	numArmed++;
+}
+
+//	Move every entry of the slot one or more levels down
+void TimerWheel::cascade(int level, u_int slot) {
+	TimerEntry* entry = levelSlots[level - 1][slot];
+	levelSlots[level - 1][slot] = NULL;
+	levelMap[level - 1] &= ~(((uint64_t)1) << slot);
+	while (entry != NULL) {
+		TimerEntry* next = entry->next;
+		place(entry);
+		entry = next;
+	}
+}
+
+void TimerWheel::processTick(uint64_t tick, vector<TimerEntry*>& expired) {
+	curTick = tick;
+	//	Whenever a level wraps around, pull the timers of the current slot
+	//	of the next level down
+	for (int level = 1; level < TIMER_LEVELS; level++) {
+		u_int shift = levelShift(level);
+		if ((tick & ((((uint64_t)1) << shift) - 1)) != 0) {
+			break;
+		}
+		cascade(level, (tick >> shift) & (TIMER_LEVEL_SIZE - 1));
+	}
+	u_int slot = tick & (TIMER_ROOT_SIZE - 1);
+	TimerEntry* entry = rootSlots[slot];
+	rootSlots[slot] = NULL;
+	rootMap[slot / 64] &= ~(((uint64_t)1) << (slot % 64));
+	while (entry != NULL) {
+		TimerEntry* next = entry->next;
+		entry->next = NULL;
+		entry->prev = NULL;
+		entry->level = -1;
+		numArmed--;
+		expired.push_back(entry);
+		entry = next;
+	}
+}
+
+//	Distance from slot "from" to the first occupied root slot, searching up
+//	to the end of the root level, and continuing from slot 0 if wrap is set.
+//	Returns -1 if there is none
+int TimerWheel::nextRootSlot(u_int from, bool wrap) const {
+	u_int numWords = TIMER_ROOT_SIZE / 64;
+	u_int limit = wrap ? TIMER_ROOT_SIZE * 2 : TIMER_ROOT_SIZE;
+	for (u_int pos = from; pos < limit; ) {
+		u_int slot = pos % TIMER_ROOT_SIZE;
+		uint64_t word = rootMap[(slot / 64) % numWords] >> (slot % 64);
+		if (word != 0) {
+			u_int found = pos + __builtin_ctzll(word);
+			if (found >= limit) {
+				break;
+			}
+			return found - from;
+		}
+		pos += 64 - (slot % 64);	// Next word
+	}
+	return -1;
+}
+
+int TimerWheel::advance(
+		const struct timeval& curTime, vector<TimerEntry*>& expired) {
+	uint64_t nowTick = toUS(curTime) / TIMER_TICK_US;
+	while (curTick < nowTick) {
+		if (numArmed == 0) {
+			curTick = nowTick;	// Nothing to fire or cascade
+			break;
+		}
+		uint64_t next = curTick + 1;
+		u_int from = next & (TIMER_ROOT_SIZE - 1);
+		if (from != 0) {
+			//	Skip to the next occupied slot, or to the next wrap around
+			//	of the root level where the higher levels may cascade
+			int distance = nextRootSlot(from, false);
+			uint64_t target = (distance == -1) ?
+				((next | (TIMER_ROOT_SIZE - 1)) + 1) : (next + distance);
+			if (target > nowTick) {
+				curTick = nowTick;
+				break;
+			}
+			next = target;
+		}
+		processTick(next, expired);
+	}
+	return 0;
+}
+
+int TimerWheel::nextExpiry(struct timeval* nextTV) const {
+	if (numArmed == 0) {
+		return -1;
+	}
+	uint64_t bestTick = UINT64_MAX;
+	//	Root entries are within TIMER_ROOT_SIZE ticks of curTick
+	int distance = nextRootSlot((curTick + 1) & (TIMER_ROOT_SIZE - 1), true);
+	if (distance != -1) {
+		bestTick = curTick + 1 + distance;
+	}
+	//	Entries in a higher level need attention when their slot cascades
+	for (int level = 1; level < TIMER_LEVELS; level++) {
+		if (levelMap[level - 1] == 0) {
+			continue;
+		}
+		u_int shift = levelShift(level);
+		uint64_t base = ((curTick >> shift) + 1) << shift;
+		u_int from = (base >> shift) & (TIMER_LEVEL_SIZE - 1);
+		uint64_t word = (levelMap[level - 1] >> from) |
+			(from ? (levelMap[level - 1] << (TIMER_LEVEL_SIZE - from)) : 0);
+		uint64_t cascadeTick =
+			base + (((uint64_t)__builtin_ctzll(word)) << shift);
+		if (cascadeTick < bestTick) {
+			bestTick = cascadeTick;
+		}
+	}
+	uint64_t bestUS = bestTick * TIMER_TICK_US;
+	nextTV->tv_sec = bestUS / 1000000;
+	nextTV->tv_usec = bestUS % 1000000;
+	return 0;
+}
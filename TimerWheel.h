@@ -0,0 +1,84 @@
+#ifndef CLASS_TIMER_WHEEL
+#define CLASS_TIMER_WHEEL
+
+#include <stdint.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <vector>
+
+class Query;
+
+//	The first level covers 256 ticks, each following level covers 64 times
+//	the previous one (16.4 s, 17.5 min and 18.6 h with 1 ms ticks). Timers
+//	further out than that are parked in the last level and re-inserted
+//	every time their slot comes around
+#define TIMER_TICK_US		1000
+#define TIMER_LEVELS		4
+#define TIMER_ROOT_BITS		8
+#define TIMER_LEVEL_BITS	6
+#define TIMER_ROOT_SIZE		(1 << TIMER_ROOT_BITS)
+#define TIMER_LEVEL_SIZE	(1 << TIMER_LEVEL_BITS)
+
+//	Timeout of a single query. Allocated once per query by the query table
+//	and linked into exactly one slot of the wheel while armed
+struct TimerEntry {
+	TimerEntry*	next;
+	TimerEntry*	prev;
+	uint64_t	expireTick;
+	int			level;		// -1 when not armed
+	u_int		slot;
+	Query*		query;
+};
+
+//	Hierarchical timer wheel. Arming, re-arming and cancelling a timer are
+//	O(1). Expired timers are collected by advance, which skips empty slots
+//	using a bitmap of the occupied slots
+class TimerWheel {
+private:
+	TimerEntry*	rootSlots[TIMER_ROOT_SIZE];
+	TimerEntry*	levelSlots[TIMER_LEVELS - 1][TIMER_LEVEL_SIZE];
+	uint64_t	rootMap[TIMER_ROOT_SIZE / 64];	// Bit set if slot non-empty
+	uint64_t	levelMap[TIMER_LEVELS - 1];
+	uint64_t	curTick;	// Every timer up to and including this tick
+							// has expired
+	u_int		numArmed;
+
+	static uint64_t toUS(const struct timeval& tv) {
+		return ((uint64_t)tv.tv_sec) * 1000000 + tv.tv_usec;
+	}
+	static u_int levelShift(int level) {
+		return TIMER_ROOT_BITS + (level - 1) * TIMER_LEVEL_BITS;
+	}
+
+	void link(TimerEntry* entry, int level, u_int slot);
+	void place(TimerEntry* entry);
+	void cascade(int level, u_int slot);
+	void processTick(uint64_t tick, vector<TimerEntry*>& expired);
+	int nextRootSlot(u_int from, bool wrap) const;
+
+public:
+	TimerWheel();
+
+	//	Arm (or re-arm) entry to expire at expireTV. Times already passed
+	//	expire on the next tick
+	void arm(TimerEntry* entry, const struct timeval& expireTV);
+
+	//	Disarm entry. No-op if it is not armed
+	void cancel(TimerEntry* entry);
+
+	static bool isArmed(const TimerEntry* entry) {
+		return entry->level != -1;
+	}
+
+	//	Move the wheel forward to curTime, appending all expired entries
+	//	to expired. The expired entries are no longer armed
+	int advance(const struct timeval& curTime, vector<TimerEntry*>& expired);
+
+	//	Earliest time at which advance has work to do (an entry expires or
+	//	a higher level has to be cascaded). Returns -1 if nothing is armed
+	int nextExpiry(struct timeval* nextTV) const;
+
+	u_int size() const	{ return numArmed; }
+};
+
+#endif
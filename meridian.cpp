@@ -31,13 +31,15 @@ using namespace std;
 
 meridian::meridian(uint16_t meridian_port, uint16_t info_port, 
 			u_int nodes_per_primary_ring, u_int nodes_per_secondary_ring, 
-			int exponential_base) 
+			int exponential_base, u_int num_rings, u_int min_ring_radius_us) 
 		: 	childPID(-1), g_meridian_port(meridian_port), 
 			g_info_port(info_port), g_prim_size(nodes_per_primary_ring), 
 			g_second_size(nodes_per_secondary_ring), 
-			g_ring_base(exponential_base), g_initGossipInterval_s(0), 
+			g_ring_base(exponential_base), g_num_rings(num_rings),
+			g_min_ring_radius_us(min_ring_radius_us), g_initGossipInterval_s(0), 
 			g_numInitIntervalRemain(0), g_ssGossipInterval_s(5), 
-			g_replaceInterval_s(10), g_rendvAddr(0), g_rendvPort(0) {		
+			g_replaceInterval_s(10), g_udpBatchSize(DEFAULT_UDP_BATCH_SIZE),
+			g_numWorkers(1), g_sharedCache(false), g_rendvAddr(0), g_rendvPort(0) {		
 	pipeFD[0] = -1;
 	pipeFD[1] = -1;		
 }
@@ -57,6 +59,22 @@ void meridian::setReplaceInterval(u_int seconds) 	{
 	g_replaceInterval_s = seconds; 
 }	
 
+void meridian::setUDPBatchSize(u_int batch_size) {
+	g_udpBatchSize = batch_size;
+}
+
+void meridian::setNumWorkers(u_int num_workers) {
+	g_numWorkers = num_workers;
+}
+
+void meridian::setSharedLatencyCache(bool enable) {
+	g_sharedCache = enable;
+}
+
+void meridian::setSnapshotFile(const char* path) {
+	g_snapshotFile = (path != NULL) ? path : "";
+}
+
 void meridian::setRendavousNode(uint32_t addr, uint16_t port) {
 	g_rendvAddr = addr;
 	g_rendvPort = port;	
@@ -94,11 +112,18 @@ int meridian::start() {
 	close(pipeFD[1]);   // Child doesn't need to write to pipe
 	pipeFD[1] = -1;
 	MeridianProcess* meridInstance = new MeridianProcess(g_meridian_port, 
-			g_info_port, g_prim_size, g_second_size, g_ring_base, pipeFD[0]);
+			g_info_port, g_prim_size, g_second_size, g_ring_base, 
+			g_num_rings, g_min_ring_radius_us, pipeFD[0]);
 	meridInstance->setRendavousNode(g_rendvAddr, g_rendvPort);
 	meridInstance->setGossipInterval(g_initGossipInterval_s, 
 		g_numInitIntervalRemain, g_ssGossipInterval_s);
 	meridInstance->setReplaceInterval(g_replaceInterval_s);
+	meridInstance->setUDPBatchSize(g_udpBatchSize);
+	meridInstance->setNumWorkers(g_numWorkers);
+	if (g_sharedCache) {
+		meridInstance->useSharedLatencyCache();
+	}
+	meridInstance->setSnapshotFile(g_snapshotFile.c_str());
 	for (u_int i = 0; i < seedNodes.size(); i++) {
 		meridInstance->addSeedNode(seedNodes[i].addr, seedNodes[i].port);
 	}
@@ -4,8 +4,10 @@
 using namespace std;
 
 #include <stdint.h>
+#include <string>
 #include <vector>
 #include "Marshal.h"
+#include "RingSet.h"
 
 class meridian {
 private:
@@ -17,10 +19,16 @@ private:
 	u_int 				g_prim_size;
 	u_int 				g_second_size;
 	int 				g_ring_base;
+	u_int				g_num_rings;
+	u_int				g_min_ring_radius_us;
 	u_int				g_initGossipInterval_s;
 	u_int				g_numInitIntervalRemain;
 	u_int				g_ssGossipInterval_s;
 	u_int				g_replaceInterval_s;
+	u_int				g_udpBatchSize;
+	u_int				g_numWorkers;
+	bool				g_sharedCache;
+	string				g_snapshotFile;
 	uint32_t			g_rendvAddr;
 	uint16_t			g_rendvPort;
 	
@@ -37,13 +45,19 @@ public:
 		nodes_per_primary_ring		Number of nodes in each primary ring
 		nodes_per_secondary_ring	Number of nodes in each secondary ring
 		exponential_base			Exponetial base of ring		
+		num_rings					Number of rings (at most MAX_NUM_RINGS)
+		min_ring_radius_us			Radius of the innermost ring in 
+									microseconds. Lower it for deployments
+									where most nodes are within 1 ms
 	**************************************************************************/
 	meridian(
 		uint16_t	meridian_port,
 		uint16_t 	info_port,
 		u_int 		nodes_per_primary_ring,
 		u_int 		nodes_per_secondary_ring,
-		int 		exponential_base);
+		int 		exponential_base,
+		u_int		num_rings = DEFAULT_NUM_RINGS,
+		u_int		min_ring_radius_us = DEFAULT_MIN_RING_RADIUS_US);
 	
 		
 	/**************************************************************************
@@ -77,6 +91,55 @@ public:
 	void setReplaceInterval(u_int seconds);
 	
 	
+	/**************************************************************************
+		Sets the maximum number of packets received or sent on the Meridian
+		port with a single system call
+		
+		Description of Params:
+		----------------------
+		batch_size: 				Packets per call (1 to 1024)
+	**************************************************************************/
+	void setUDPBatchSize(u_int batch_size);
+	
+	
+	/**************************************************************************
+		Sets the number of threads running queries. Each has its own socket
+		bound to the Meridian port (SO_REUSEPORT), and handles the queries
+		whose ids map to it. The first one also performs gossip and ring
+		management
+		
+		Description of Params:
+		----------------------
+		num_workers: 				Number of threads (1 to 64, default: 1)
+	**************************************************************************/
+	void setNumWorkers(u_int num_workers);
+	
+	
+	/**************************************************************************
+		Shares the TCP, DNS and ICMP latency caches with all other Meridian
+		instances on this host through POSIX shared memory, so that a
+		target measured by one instance is not probed again by the others
+		
+		Description of Params:
+		----------------------
+		enable: 					Use the shared caches (default: false)
+	**************************************************************************/
+	void setSharedLatencyCache(bool enable);
+	
+	
+	/**************************************************************************
+		Saves the rings and latency caches to a file periodically and when 
+		the service stops, and restores them when it starts, so that a 
+		restarted node does not have to rebuild its rings from scratch. 
+		Restored ring members are pinged again in the background
+		
+		Description of Params:
+		----------------------
+		path: 						Snapshot file, NULL disables snapshots
+	**************************************************************************/
+	void setSnapshotFile(const char* path);
+	
+	
 	/**************************************************************************
 		Add initial seed nodes 
 		
@@ -102,7 +165,9 @@ public:
 	
 	/**************************************************************************
 		Starts the meridian service. Note that subsequent calls to 
-		setGossipInterval and setReplaceInterval are ignored
+		setGossipInterval, setReplaceInterval, setUDPBatchSize, 
+		setNumWorkers, setSharedLatencyCache and setSnapshotFile are 
+		ignored
 	**************************************************************************/	
 	int start();
 	